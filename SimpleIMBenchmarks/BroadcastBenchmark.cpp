@@ -0,0 +1,140 @@
+#include "ClientManager.h"
+
+#include <Log.h>
+#include <benchmark/benchmark.h>
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Broadcast fan-out through a real ClientManager and its reactors. Every
+// recipient is a logged-on connection over a socketpair, and an iteration
+// ends once each peer has read the frame, so it covers encoding, the reactor
+// hop, queueing and the writes.
+namespace {
+constexpr size_t kPayloadLength = 64;
+constexpr std::chrono::seconds kSetupTimeout(10);
+
+// Two descriptors per recipient
+void raiseFileDescriptorLimit()
+{
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+bool sendFrame(int fd, MessageType type, std::string_view payload)
+{
+    const std::vector<uint8_t> bytes = Message(type, payload).to_bytes();
+    return send(fd, bytes.data(), bytes.size(), 0) == static_cast<ssize_t>(bytes.size());
+}
+
+// Reads frames until the chat line with the given payload, skipping the
+// logon replies and presence traffic ahead of it.
+bool readUntil(int fd, std::string_view payload)
+{
+    std::string buffer;
+    while (true) {
+        char header[MessageHeader::kWireSize];
+        if (recv(fd, header, sizeof(header), MSG_WAITALL) != static_cast<ssize_t>(sizeof(header))) {
+            return false;
+        }
+        uint32_t length = 0;
+        std::memcpy(&length, &header[1], sizeof(length));
+        buffer.resize(ntohl(length));
+        if (!buffer.empty() && recv(fd, buffer.data(), buffer.size(), MSG_WAITALL) != static_cast<ssize_t>(buffer.size())) {
+            return false;
+        }
+        if (static_cast<MessageType>(header[0]) == MessageType::ChatMessageBroadcast && buffer == payload) {
+            return true;
+        }
+    }
+}
+
+struct PeerSockets
+{
+    std::vector<int> fds;
+
+    ~PeerSockets()
+    {
+        for (int fd : fds) {
+            close(fd);
+        }
+    }
+};
+
+void BM_BroadcastFanOut(benchmark::State& state)
+{
+    // Logons and logoffs by the thousand would drown the results
+    raiseFileDescriptorLimit();
+    Log::setLevel(Log::Level::Warning);
+
+    // Declared first so the peers outlive the manager; closing them under a
+    // running server would fan their logoffs out to the ones still open.
+    PeerSockets peerSockets;
+    std::vector<int>& peers = peerSockets.fds;
+
+    const size_t recipients = static_cast<size_t>(state.range(0));
+    ServerConfig config;
+    config.reactorCount = static_cast<size_t>(state.range(1));
+    config.presenceInterval = std::chrono::milliseconds(0);
+    ClientManager manager(config);
+
+    for (size_t i = 0; i < recipients; ++i) {
+        int sockets[2] = {-1, -1};
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+            state.SkipWithError("socketpair failed");
+            break;
+        }
+        timeval timeout{5, 0};
+        setsockopt(sockets[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        sendFrame(sockets[1], MessageType::UserLogon, "user" + std::to_string(i));
+        manager.addConnectedClient(sockets[0]);
+        peers.push_back(sockets[1]);
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + kSetupTimeout;
+    while (manager.getConnectedUsernames().size() < peers.size() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // Everything queued before this marker is logon and presence traffic
+    manager.broadcastMessage(MessageType::ChatMessageBroadcast, "ready");
+    for (int fd : peers) {
+        if (!readUntil(fd, "ready")) {
+            state.SkipWithError("recipients did not log on");
+            break;
+        }
+    }
+
+    const std::string payload(kPayloadLength, 'x');
+    std::vector<char> frame(MessageHeader::kWireSize + kPayloadLength);
+    for (auto _ : state) {
+        manager.broadcastMessage(MessageType::ChatMessageBroadcast, payload);
+        for (int fd : peers) {
+            if (recv(fd, frame.data(), frame.size(), MSG_WAITALL) != static_cast<ssize_t>(frame.size())) {
+                state.SkipWithError("recipient missed a broadcast");
+                break;
+            }
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * peers.size()));
+}
+}
+
+BENCHMARK(BM_BroadcastFanOut)
+    ->ArgNames({"recipients", "reactors"})
+    ->Args({16, 1})
+    ->Args({128, 1})
+    ->Args({1024, 1})
+    ->Args({1024, 4})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
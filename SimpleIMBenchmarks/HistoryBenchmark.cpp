@@ -0,0 +1,49 @@
+#include "HistoryLog.h"
+
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+// Sustained history write rate: a burst of chat lines appended the way the
+// broadcast path does, timed until the writer has synced all of it. The
+// directory is under the system temp path, so the disk there is what is measured.
+namespace {
+constexpr size_t kBurstLength = 1000;
+
+void BM_HistoryAppendUntilDurable(benchmark::State& state)
+{
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("simpleim-history-bench-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+
+    HistoryConfig config;
+    config.directory = directory.string();
+    {
+        std::unique_ptr<HistoryLog> history = HistoryLog::open(config);
+        if (!history) {
+            state.SkipWithError("could not open the history directory");
+            return;
+        }
+
+        const SharedFrame frame = Message::encode_shared(MessageType::ChatMessageBroadcast,
+            {"sender", ": ", std::string(static_cast<size_t>(state.range(0)), 'x')});
+        for (auto _ : state) {
+            const uint64_t target = history->durableSequence() + kBurstLength;
+            for (size_t i = 0; i < kBurstLength; ++i) {
+                history->append(HistoryKind::Broadcast, "sender", {}, frame);
+            }
+            while (history->durableSequence() < target && history->droppedRecords() == 0) {
+                std::this_thread::yield();
+            }
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kBurstLength));
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kBurstLength * frame->size()));
+    }
+    std::filesystem::remove_all(directory);
+}
+}
+
+BENCHMARK(BM_HistoryAppendUntilDurable)->Arg(64)->Arg(1024)->UseRealTime()->Unit(benchmark::kMicrosecond);
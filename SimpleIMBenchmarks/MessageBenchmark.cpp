@@ -0,0 +1,98 @@
+#include <FrameDecoder.h>
+#include <Message.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Wire encoding and decoding. Payload sizes straddle Message::kInlineCapacity.
+namespace {
+constexpr size_t kFramesPerStream = 1000;
+// A typical TCP segment's worth, so frames regularly straddle two reads
+constexpr size_t kReadChunkSize = 1448;
+
+std::vector<char> buildStream(size_t payloadLength)
+{
+    const Message message(MessageType::ChatMessageBroadcast, std::string(payloadLength, 'x'));
+    std::vector<char> stream(kFramesPerStream * message.encoded_size());
+    for (size_t i = 0; i < kFramesPerStream; ++i) {
+        message.encode_into(stream.data() + i * message.encoded_size(), message.encoded_size());
+    }
+    return stream;
+}
+
+void BM_MessageToBytes(benchmark::State& state)
+{
+    const Message message(MessageType::ChatMessageBroadcast, std::string(static_cast<size_t>(state.range(0)), 'x'));
+    for (auto _ : state) {
+        std::vector<uint8_t> bytes = message.to_bytes();
+        benchmark::DoNotOptimize(bytes.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * message.encoded_size()));
+}
+
+void BM_MessageFromBytes(benchmark::State& state)
+{
+    const std::vector<uint8_t> bytes =
+        Message(MessageType::ChatMessageBroadcast, std::string(static_cast<size_t>(state.range(0)), 'x')).to_bytes();
+    for (auto _ : state) {
+        Message message = Message::from_bytes(bytes);
+        benchmark::DoNotOptimize(message);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes.size()));
+}
+
+void BM_EncodeShared(benchmark::State& state)
+{
+    const std::string payload(static_cast<size_t>(state.range(0)), 'x');
+    for (auto _ : state) {
+        SharedFrame frame = Message::encode_shared(MessageType::ChatMessageBroadcast, {"sender", ": ", payload});
+        benchmark::DoNotOptimize(frame.get());
+    }
+}
+
+// Whole reads of complete frames, decoded in place.
+void BM_FrameDecoderInPlace(benchmark::State& state)
+{
+    const std::vector<char> stream = buildStream(static_cast<size_t>(state.range(0)));
+    FrameDecoder decoder;
+    Frame frame;
+    for (auto _ : state) {
+        decoder.feed(stream.data(), stream.size());
+        while (decoder.next(frame) == FrameDecoder::Result::Frame) {
+            benchmark::DoNotOptimize(frame.payload.data());
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kFramesPerStream));
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * stream.size()));
+}
+
+// Segment-sized reads into the decoder's buffer, reassembling split frames.
+void BM_FrameDecoderChunked(benchmark::State& state)
+{
+    const std::vector<char> stream = buildStream(static_cast<size_t>(state.range(0)));
+    FrameDecoder decoder;
+    Frame frame;
+    for (auto _ : state) {
+        for (size_t offset = 0; offset < stream.size(); offset += kReadChunkSize) {
+            const size_t length = std::min(kReadChunkSize, stream.size() - offset);
+            std::memcpy(decoder.prepare(length), stream.data() + offset, length);
+            decoder.commit(length);
+            while (decoder.next(frame) == FrameDecoder::Result::Frame) {
+                benchmark::DoNotOptimize(frame.payload.data());
+            }
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kFramesPerStream));
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * stream.size()));
+}
+}
+
+BENCHMARK(BM_MessageToBytes)->Arg(16)->Arg(200)->Arg(4096);
+BENCHMARK(BM_MessageFromBytes)->Arg(16)->Arg(200)->Arg(4096);
+BENCHMARK(BM_EncodeShared)->Arg(16)->Arg(200)->Arg(4096);
+BENCHMARK(BM_FrameDecoderInPlace)->Arg(16)->Arg(200)->Arg(4096);
+BENCHMARK(BM_FrameDecoderChunked)->Arg(16)->Arg(200)->Arg(4096);
@@ -0,0 +1,50 @@
+#include "Presence.h"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+// What a logon costs in presence at 1k, 10k and 100k users: the snapshot as
+// first requested after a change, which rebuilds and encodes every page, and
+// as shared by the logons that follow until the next change.
+namespace {
+void fill(Presence& presence, int64_t users)
+{
+    for (int64_t i = 0; i < users; ++i) {
+        presence.join("user" + std::to_string(i));
+    }
+    presence.flush();
+}
+
+void BM_PresenceSnapshotRebuild(benchmark::State& state)
+{
+    Presence presence;
+    fill(presence, state.range(0));
+
+    bool present = true;
+    for (auto _ : state) {
+        // One user toggling makes every snapshot stale; the flush is O(1)
+        if (present) {
+            presence.leave("user0");
+        } else {
+            presence.join("user0");
+        }
+        present = !present;
+        presence.flush();
+        benchmark::DoNotOptimize(presence.snapshot().get());
+    }
+}
+
+void BM_PresenceSnapshotCached(benchmark::State& state)
+{
+    Presence presence;
+    fill(presence, state.range(0));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(presence.snapshot().get());
+    }
+}
+}
+
+BENCHMARK(BM_PresenceSnapshotRebuild)->Arg(1000)->Arg(10000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_PresenceSnapshotCached)->Arg(1000)->Arg(10000)->Arg(100000);
@@ -0,0 +1,28 @@
+#include <MessageQueue.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <thread>
+
+// MessageQueue under contention: every thread pushes a message and pops one,
+// so the queue never runs dry and a pop never waits, and all the time goes to
+// the lock and the ring.
+namespace {
+MessageQueue g_queue;
+
+void BM_MessageQueuePushPop(benchmark::State& state)
+{
+    Message message;
+    for (auto _ : state) {
+        g_queue.emplace(MessageType::ChatMessageBroadcast, "queued chat line");
+        g_queue.tryPop(message);
+        benchmark::DoNotOptimize(message);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+}
+
+BENCHMARK(BM_MessageQueuePushPop)
+    ->ThreadRange(1, static_cast<int>(std::max(2u, std::thread::hardware_concurrency())))
+    ->UseRealTime();
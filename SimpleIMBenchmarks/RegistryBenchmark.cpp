@@ -0,0 +1,64 @@
+#include "UserDirectory.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The registry lookups on the DM path, target name to handle and handle to
+// owning reactor, once with every name behind one lock and once sharded, from
+// one thread up to one per core. Every 100th operation is a logoff and logon,
+// so readers also meet writers.
+namespace {
+constexpr size_t kUsers = 10000;
+constexpr uint64_t kChurnEvery = 100;
+
+// Built by thread 0; the others only touch them inside the timed loop
+std::unique_ptr<UserDirectory> g_users;
+std::vector<std::string> g_names;
+
+void BM_DirectMessageLookup(benchmark::State& state)
+{
+    if (state.thread_index() == 0) {
+        g_users = std::make_unique<UserDirectory>(static_cast<size_t>(state.range(0)));
+        g_names.clear();
+        for (size_t i = 0; i < kUsers; ++i) {
+            g_names.push_back("user" + std::to_string(i));
+            g_users->claim(g_names.back(), i % 4);
+        }
+    }
+
+    std::mt19937 random(static_cast<unsigned>(state.thread_index()) + 1);
+    std::uniform_int_distribution<size_t> pick(0, kUsers - 1);
+    uint64_t operations = 0;
+    size_t reactorShard = 0;
+
+    for (auto _ : state) {
+        const std::string& name = g_names[pick(random)];
+        const UserHandle handle = g_users->find(name);
+        if (++operations % kChurnEvery == 0 && handle != kInvalidUserHandle) {
+            g_users->release(handle);
+            g_users->claim(name, reactorShard);
+        }
+        else if (handle != kInvalidUserHandle) {
+            g_users->shardOf(handle, reactorShard);
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+
+    if (state.thread_index() == 0) {
+        g_users.reset();
+    }
+}
+}
+
+BENCHMARK(BM_DirectMessageLookup)
+    ->ArgName("shards")
+    ->Arg(1)
+    ->Arg(UserDirectory::kDefaultShardCount)
+    ->ThreadRange(1, static_cast<int>(std::max(1u, std::thread::hardware_concurrency())))
+    ->UseRealTime();
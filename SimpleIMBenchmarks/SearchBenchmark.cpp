@@ -0,0 +1,117 @@
+#include "HistoryLog.h"
+#include "SearchIndex.h"
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Search latency over a history of a few million chat lines. Words are drawn
+// from a Zipf-like vocabulary, so a query's words range from ones in most
+// lines to ones in a handful. The history and its index are built once, under
+// the system temp path, and shared by every benchmark here.
+namespace {
+constexpr size_t kRecords = 2 * 1000 * 1000;
+constexpr size_t kVocabulary = 20000;
+constexpr size_t kWordsPerLine = 8;
+
+std::string word(size_t rank)
+{
+    return "w" + std::to_string(rank);
+}
+
+class SearchCorpus
+{
+public:
+    SearchCorpus()
+        : m_directory(std::filesystem::temp_directory_path() / ("simpleim-search-bench-" + std::to_string(getpid())))
+    {
+        std::filesystem::remove_all(m_directory);
+        HistoryConfig config;
+        config.directory = m_directory.string();
+        m_history = HistoryLog::open(config);
+        if (!m_history) {
+            return;
+        }
+
+        std::vector<double> weights(kVocabulary);
+        for (size_t rank = 0; rank < kVocabulary; ++rank) {
+            weights[rank] = 1.0 / static_cast<double>(rank + 1);
+        }
+        std::mt19937 random(42);
+        std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+
+        for (size_t i = 0; i < kRecords; ++i) {
+            std::string line;
+            for (size_t w = 0; w < kWordsPerLine; ++w) {
+                line += word(pick(random));
+                line += ' ';
+            }
+            m_history->append(HistoryKind::Broadcast, "sender", {},
+                              Message::encode_shared(MessageType::ChatMessageBroadcast, {"sender: ", line}));
+            // Keep within the history's queue
+            while (i + 1 - m_history->durableSequence() - m_history->droppedRecords() > 16 * 1024) {
+                std::this_thread::yield();
+            }
+        }
+
+        m_index = SearchIndex::open(*m_history, (m_directory / "index").string(), 64 * 1024);
+        while (m_index && m_index->indexedSequence() < m_history->durableSequence()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    ~SearchCorpus()
+    {
+        m_index.reset();
+        m_history.reset();
+        std::filesystem::remove_all(m_directory);
+    }
+
+    const SearchIndex* index() const { return m_index.get(); }
+
+private:
+    std::filesystem::path m_directory;
+    std::unique_ptr<HistoryLog> m_history;
+    std::unique_ptr<SearchIndex> m_index;
+};
+
+const SearchCorpus& corpus()
+{
+    static SearchCorpus instance;
+    return instance;
+}
+
+// Two words of the given ranks; rank 0 is in about a third of the lines.
+void BM_SearchTwoWords(benchmark::State& state)
+{
+    const SearchIndex* index = corpus().index();
+    if (!index) {
+        state.SkipWithError("could not build the search corpus");
+        return;
+    }
+
+    const std::string query = word(static_cast<size_t>(state.range(0))) + " " + word(static_cast<size_t>(state.range(1)));
+    size_t found = 0;
+    for (auto _ : state) {
+        const std::vector<uint64_t> results = index->find(query, "reader", 20);
+        found = results.size();
+        benchmark::DoNotOptimize(results.data());
+    }
+    state.counters["found"] = static_cast<double>(found);
+    state.counters["segments"] = static_cast<double>(index->segmentCount());
+}
+}
+
+BENCHMARK(BM_SearchTwoWords)
+    ->Args({0, 1})       // two of the commonest
+    ->Args({0, 500})     // common and mid
+    ->Args({50, 5000})   // mid and rare
+    ->Args({10000, 15000})
+    ->Unit(benchmark::kMicrosecond);
@@ -54,7 +54,7 @@ void ClientInterface::interfaceLoop()
     std::cout << "Type 'help' for available commands" << std::endl;
     
     std::string input;
-    while(!m_terminate && m_client && m_client->connected()) {
+    while(!m_terminate && m_client && (m_reconnecting || m_client->connected())) {
         std::cout << "SimpleIM> ";
         
         if(!std::getline(std::cin, input)) {
@@ -83,6 +83,11 @@ void ClientInterface::printHelp()
     std::cout << "  msg <message>        - Send a chat message" << std::endl;
     std::cout << "  say <message>        - Send a chat message (alias for msg)" << std::endl;
     std::cout << "  dm <user> <message>  - Send direct message to specific user" << std::endl;
+    std::cout << "  join <room>          - Join a room, creating it if needed" << std::endl;
+    std::cout << "  leave <room>         - Leave a room" << std::endl;
+    std::cout << "  rooms                - List the open rooms" << std::endl;
+    std::cout << "  room <room> <message> - Send a message to a room you are in" << std::endl;
+    std::cout << "  search <words>       - Find the latest messages mentioning all the words" << std::endl;
     std::cout << "  status               - Show connection status" << std::endl;
     std::cout << "  quit, exit, bye      - Disconnect and exit" << std::endl;
     std::cout << "  clear                - Clear the screen" << std::endl;
@@ -138,6 +143,51 @@ void ClientInterface::handleCommand(const std::string& command)
             std::cout << "Direct message sent to " << username << ": " << message << std::endl;
         }
     }
+    else if(cmd == "join" || cmd == "leave") {
+        std::string room;
+        iss >> room;
+
+        if(room.empty()) {
+            std::cout << "Usage: " << cmd << " <room>" << std::endl;
+        } else if(cmd == "join") {
+            m_client->joinRoom(room);
+        } else {
+            m_client->leaveRoom(room);
+        }
+    }
+    else if(cmd == "rooms") {
+        m_client->listRooms();
+    }
+    else if(cmd == "room") {
+        std::string room, message;
+        iss >> room;
+        std::getline(iss, message);
+        // Remove leading space
+        if(!message.empty() && message[0] == ' ') {
+            message = message.substr(1);
+        }
+
+        if(room.empty() || message.empty()) {
+            std::cout << "Usage: room <room> <message>" << std::endl;
+        } else {
+            m_client->sendRoomMessage(room, message);
+            std::cout << "Message sent to room " << room << ": " << message << std::endl;
+        }
+    }
+    else if(cmd == "search") {
+        std::string query;
+        std::getline(iss, query);
+        // Remove leading space
+        if(!query.empty() && query[0] == ' ') {
+            query = query.substr(1);
+        }
+
+        if(query.empty()) {
+            std::cout << "Usage: search <words>" << std::endl;
+        } else {
+            m_client->search(query);
+        }
+    }
     else if(cmd == "status") {
         if(m_client->connected()) {
             std::cout << "Status: Connected to SimpleIM Server" << std::endl;
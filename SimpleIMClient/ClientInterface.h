@@ -25,9 +25,14 @@ public:
     // Callback for when the interface should exit
     void setExitCallback(std::function<void()> callback);
 
+    // While set, a dropped connection is being logged on again and the
+    // interface carries on; otherwise it ends with the connection.
+    void setReconnecting(bool reconnecting) { m_reconnecting = reconnecting; }
+
 private:
     std::unique_ptr<std::thread> m_clientInterfaceThread;
     std::atomic<bool> m_terminate = false;
+    std::atomic<bool> m_reconnecting = false;
     
     SimpleIMClient* m_client = nullptr;
     std::function<void()> m_exitCallback;
@@ -1,11 +1,21 @@
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <thread>
 #include <chrono>
+#include <ctime>
 
 #include <SimpleIMClient.h>
 #include "ClientInterface.h"
 
+namespace {
+// Reconnecting waits this long after the first failed attempt, doubling up
+// to the most, and gives up after so many attempts in a row.
+constexpr std::chrono::milliseconds kFirstRetryDelay{1000};
+constexpr std::chrono::milliseconds kMaxRetryDelay{30000};
+constexpr int kMaxReconnectAttempts = 8;
+}
+
 int main(int argc, char *argv[]) {
 
     SimpleIMClient client;
@@ -40,6 +50,21 @@ int main(int argc, char *argv[]) {
     interface.setExitCallback([&client]() {
         client.disconnectFromServer();
     });
+    client.setRoomMessageCallback([](const std::string& room, const std::string& user, const std::string& message) {
+        std::cout << "[" << room << "] " << user << ": " << message << std::endl;
+    });
+    client.setHistoryEndCallback([](uint64_t sequence) {
+        std::cout << "--- history up to #" << sequence << " ---" << std::endl;
+    });
+    client.setSearchResultCallback([](int64_t timestamp, const std::string& user, const std::string& message) {
+        const std::time_t seconds = static_cast<std::time_t>(timestamp / 1000);
+        char when[32];
+        std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M", std::localtime(&seconds));
+        std::cout << "[" << when << "] " << user << ": " << message << std::endl;
+    });
+    client.setSearchEndCallback([](size_t count) {
+        std::cout << "--- " << count << " match(es) ---" << std::endl;
+    });
 
     // Start the interactive interface
     if (!interface.run()) {
@@ -49,10 +74,44 @@ int main(int argc, char *argv[]) {
     }
 
     // Wait for the interface to finish naturally (when user quits)
-    // The interface will stop itself when the user types quit/exit
-    while (interface.isRunning() && client.connected()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    // The interface will stop itself when the user types quit/exit.
+    // A dropped connection logs on again, picking up where it left off,
+    // waiting twice as long after each failed attempt. A rejected logon, or
+    // running out of attempts, ends the session.
+    interface.setReconnecting(true);
+    int attempts = 0;
+    std::chrono::milliseconds retryDelay = kFirstRetryDelay;
+    while (interface.isRunning()) {
+        if (client.connected()) {
+            if (client.logonState() == SimpleIMClient::LogonState::Accepted) {
+                attempts = 0;
+                retryDelay = kFirstRetryDelay;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        if (client.logonState() == SimpleIMClient::LogonState::Rejected) {
+            std::cout << "The server turned the logon down. Press Enter to exit." << std::endl;
+            break;
+        }
+        if (attempts == kMaxReconnectAttempts) {
+            std::cout << "Could not reconnect. Press Enter to exit." << std::endl;
+            break;
+        }
+
+        ++attempts;
+        std::cout << "Connection lost. Reconnecting (attempt " << attempts << " of " << kMaxReconnectAttempts
+                  << "; type 'quit' to give up)..." << std::endl;
+        client.logon(username);
+        const auto retryAt = std::chrono::steady_clock::now() + retryDelay;
+        while (interface.isRunning() && client.logonState() != SimpleIMClient::LogonState::Accepted
+               && std::chrono::steady_clock::now() < retryAt) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        retryDelay = std::min(retryDelay * 2, kMaxRetryDelay);
     }
+    interface.setReconnecting(false);
 
     // Clean shutdown
     interface.stop();
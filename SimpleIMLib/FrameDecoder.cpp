@@ -0,0 +1,155 @@
+#include "FrameDecoder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <arpa/inet.h>
+
+namespace {
+// A connection keeps at most this much buffer once it has nothing pending, so
+// a single large frame does not pin memory on an otherwise idle connection.
+constexpr size_t kRetainedBufferSize = 16 * 1024;
+}
+
+FrameDecoder::FrameDecoder(uint32_t maxPayloadLength)
+    : m_begin(0)
+    , m_end(0)
+    , m_external(nullptr)
+    , m_externalLength(0)
+    , m_maxPayloadLength(maxPayloadLength)
+{}
+
+char* FrameDecoder::prepare(size_t minimum)
+{
+    // Bytes lent through feed() have to be kept before new ones land after them
+    if (m_external) {
+        const char* data = m_external;
+        const size_t length = m_externalLength;
+        m_external = nullptr;
+        m_externalLength = 0;
+        append(data, length);
+    }
+
+    reserve(minimum);
+    return m_buffer.data() + m_end;
+}
+
+void FrameDecoder::commit(size_t bytes)
+{
+    m_end += bytes;
+}
+
+void FrameDecoder::feed(const char* data, size_t length)
+{
+    if (m_begin == m_end && !m_external) {
+        m_external = data;
+        m_externalLength = length;
+        return;
+    }
+
+    prepare(length);
+    std::memcpy(m_buffer.data() + m_end, data, length);
+    commit(length);
+}
+
+void FrameDecoder::clear()
+{
+    m_begin = 0;
+    m_end = 0;
+    m_external = nullptr;
+    m_externalLength = 0;
+}
+
+FrameDecoder::Result FrameDecoder::next(Frame& frame)
+{
+    size_t frameSize = 0;
+
+    if (m_external) {
+        const Result result = decode(m_external, m_externalLength, m_maxPayloadLength, frame, frameSize);
+        if (result == Result::Frame) {
+            m_external += frameSize;
+            m_externalLength -= frameSize;
+            return result;
+        }
+
+        if (result == Result::Incomplete) {
+            const char* data = m_external;
+            const size_t length = m_externalLength;
+            m_external = nullptr;
+            m_externalLength = 0;
+            append(data, length);
+        }
+        return result;
+    }
+
+    const Result result = decode(m_buffer.data() + m_begin, m_end - m_begin, m_maxPayloadLength, frame, frameSize);
+    if (result == Result::Frame) {
+        m_begin += frameSize;
+        return result;
+    }
+
+    if (result == Result::Incomplete && m_begin == m_end) {
+        m_begin = 0;
+        m_end = 0;
+        if (m_buffer.size() > kRetainedBufferSize) {
+            std::vector<char>().swap(m_buffer);
+        }
+    }
+    return result;
+}
+
+FrameDecoder::Result FrameDecoder::decode(const char* data, size_t length, uint32_t maxPayloadLength,
+                                          Frame& frame, size_t& frameSize)
+{
+    if (length < MessageHeader::kWireSize) {
+        return Result::Incomplete;
+    }
+
+    const MessageType type = static_cast<MessageType>(data[0]);
+    if (!isValidMessageType(type)) {
+        return Result::InvalidType;
+    }
+
+    uint32_t payloadLength = 0;
+    std::memcpy(&payloadLength, &data[1], sizeof(payloadLength));
+    payloadLength = ntohl(payloadLength);
+    if (payloadLength > maxPayloadLength) {
+        return Result::PayloadTooLarge;
+    }
+
+    if (length - MessageHeader::kWireSize < payloadLength) {
+        return Result::Incomplete;
+    }
+
+    frame.type = type;
+    frame.payload = std::string_view(data + MessageHeader::kWireSize, payloadLength);
+    frameSize = MessageHeader::kWireSize + payloadLength;
+    return Result::Frame;
+}
+
+void FrameDecoder::append(const char* data, size_t length)
+{
+    if (length == 0) {
+        return; // the buffer may not exist yet, and memcpy takes no null
+    }
+    reserve(length);
+    std::memcpy(m_buffer.data() + m_end, data, length);
+    m_end += length;
+}
+
+void FrameDecoder::reserve(size_t bytes)
+{
+    if (m_buffer.size() - m_end >= bytes) {
+        return;
+    }
+
+    // Slide the pending partial frame to the front before growing
+    if (m_begin > 0) {
+        std::memmove(m_buffer.data(), m_buffer.data() + m_begin, m_end - m_begin);
+        m_end -= m_begin;
+        m_begin = 0;
+    }
+
+    if (m_buffer.size() - m_end < bytes) {
+        m_buffer.resize(std::max(m_end + bytes, m_buffer.size() * 2));
+    }
+}
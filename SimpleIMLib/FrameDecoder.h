@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "MessageHeader.h"
+
+// One decoded frame. The payload points into the decoder or into the bytes
+// handed to feed(), and is only valid until the decoder is next used.
+struct Frame
+{
+    MessageType type;
+    std::string_view payload;
+};
+
+// Incremental decoder for the 5-byte header wire format. Bytes go in as they
+// arrive, in chunks of any size, and next() yields every complete frame without
+// copying or allocating per frame; only a frame split across chunks is copied,
+// into a buffer that compacts instead of wrapping so payloads stay contiguous.
+class FrameDecoder
+{
+public:
+    enum class Result
+    {
+        Frame,
+        Incomplete,     // wait for more bytes
+        InvalidType,
+        PayloadTooLarge
+    };
+
+    static constexpr uint32_t kDefaultMaxPayloadLength = 1024 * 1024;
+
+    explicit FrameDecoder(uint32_t maxPayloadLength = kDefaultMaxPayloadLength);
+
+    FrameDecoder(const FrameDecoder&) = delete;
+    FrameDecoder& operator=(const FrameDecoder&) = delete;
+
+    // Applies to frames not yet returned, so a protocol can tighten or relax it
+    // between frames.
+    void setMaxPayloadLength(uint32_t maxPayloadLength) { m_maxPayloadLength = maxPayloadLength; }
+
+    // Receive straight into the decoder: prepare returns room for at least
+    // minimum bytes and commit adds the ones actually received.
+    char* prepare(size_t minimum);
+    void commit(size_t bytes);
+
+    // Decodes the caller's bytes in place. They must stay valid until next()
+    // returns something other than Frame; any trailing partial frame is copied.
+    void feed(const char* data, size_t length);
+
+    Result next(Frame& frame);
+
+    // Drops whatever is buffered, for bytes from a new connection.
+    void clear();
+
+    // Bytes received but not yet returned as frames.
+    size_t buffered() const { return m_end - m_begin + m_externalLength; }
+
+    // Parses the frame at the front of data; frameSize is header plus payload.
+    static Result decode(const char* data, size_t length, uint32_t maxPayloadLength,
+                         Frame& frame, size_t& frameSize);
+
+private:
+    std::vector<char> m_buffer;
+    size_t m_begin;
+    size_t m_end;
+    const char* m_external;
+    size_t m_externalLength;
+    uint32_t m_maxPayloadLength;
+
+    void append(const char* data, size_t length);
+    void reserve(size_t bytes);
+};
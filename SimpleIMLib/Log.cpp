@@ -0,0 +1,210 @@
+#include "Log.h"
+
+#include "MpscQueue.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <poll.h>
+#include <thread>
+
+namespace Log {
+
+namespace {
+constexpr size_t kSinkCapacity = 4096;
+constexpr std::string_view kTruncated = "...";
+
+std::atomic<Level> g_level{kCompiledLevel};
+
+// Writes records out on its own thread, so logging costs a caller one copy
+// into the ring and no I/O. Info and Debug go to stdout, the rest to stderr,
+// as the iostream calls this replaced did.
+class Sink
+{
+public:
+    Sink()
+        : m_queue(kSinkCapacity)
+        , m_thread([this]() { run(); })
+    {}
+
+    ~Sink()
+    {
+        m_queue.wakeUp();
+        m_thread.join();
+    }
+
+    void submit(Record&& record)
+    {
+        if (!m_queue.push(std::move(record))) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        m_submitted.fetch_add(1, std::memory_order_release);
+    }
+
+    void flush()
+    {
+        const uint64_t target = m_submitted.load(std::memory_order_acquire);
+        std::unique_lock<std::mutex> lock(m_flushMutex);
+        m_flushed.wait(lock, [this, target]() {
+            return m_written.load(std::memory_order_acquire) >= target || m_queue.terminating();
+        });
+    }
+
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    MpscQueue<Record> m_queue;
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<uint64_t> m_reportedDrops{0};
+    std::atomic<uint64_t> m_submitted{0};
+    std::atomic<uint64_t> m_written{0};
+    std::mutex m_flushMutex;
+    std::condition_variable m_flushed;
+    std::thread m_thread;
+
+    void run()
+    {
+        Record record;
+        while (true) {
+            // One flush per batch rather than per line
+            bool wroteOut = false;
+            bool wroteErr = false;
+            uint64_t written = 0;
+            while (m_queue.tryPop(record)) {
+                std::FILE* stream = record.level >= Level::Warning ? stderr : stdout;
+                std::fwrite(record.text, 1, record.length, stream);
+                std::fputc('\n', stream);
+                (stream == stderr ? wroteErr : wroteOut) = true;
+                ++written;
+            }
+
+            const uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+            const uint64_t reported = m_reportedDrops.exchange(dropped, std::memory_order_relaxed);
+            if (dropped != reported) {
+                std::fprintf(stderr, "Log: dropped %llu lines, the sink could not keep up.\n",
+                             static_cast<unsigned long long>(dropped - reported));
+                wroteErr = true;
+            }
+
+            if (wroteOut) {
+                std::fflush(stdout);
+            }
+            if (wroteErr) {
+                std::fflush(stderr);
+            }
+            if (written > 0) {
+                std::lock_guard<std::mutex> lock(m_flushMutex);
+                m_written.fetch_add(written, std::memory_order_release);
+                m_flushed.notify_all();
+            }
+
+            if (m_queue.prepareWait()) {
+                pollfd wake{m_queue.wakeFd(), POLLIN, 0};
+                while (poll(&wake, 1, -1) == -1 && errno == EINTR) {}
+                m_queue.consumeWakeup();
+            }
+            else if (m_queue.terminating() && m_queue.empty()) {
+                break;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_flushMutex);
+        m_flushed.notify_all();
+    }
+};
+
+Sink& sink()
+{
+    static Sink instance;
+    return instance;
+}
+}
+
+void setLevel(Level level)
+{
+    g_level.store(level, std::memory_order_relaxed);
+}
+
+bool enabled(Level level)
+{
+    return compiledIn(level) && level >= g_level.load(std::memory_order_relaxed);
+}
+
+void submit(Record&& record)
+{
+    sink().submit(std::move(record));
+}
+
+void flush()
+{
+    sink().flush();
+}
+
+uint64_t droppedLines()
+{
+    return sink().dropped();
+}
+
+Line::Line(Level level, uint64_t suppressed)
+    : m_suppressed(suppressed)
+{
+    m_record.level = level;
+}
+
+Line::~Line()
+{
+    if (m_suppressed > 0) {
+        *this << " (" << m_suppressed << " similar lines suppressed)";
+    }
+    submit(std::move(m_record));
+}
+
+Line& Line::operator<<(std::string_view text)
+{
+    const size_t room = kMaxLineLength - m_record.length;
+    if (text.size() <= room) {
+        std::memcpy(m_record.text + m_record.length, text.data(), text.size());
+        m_record.length += static_cast<uint16_t>(text.size());
+        return *this;
+    }
+
+    // Keep what fits and mark the cut
+    if (room > 0) {
+        const size_t kept = room > kTruncated.size() ? room - kTruncated.size() : 0;
+        std::memcpy(m_record.text + m_record.length, text.data(), kept);
+        std::memcpy(m_record.text + m_record.length + kept, kTruncated.data(), room - kept);
+        m_record.length = static_cast<uint16_t>(kMaxLineLength);
+    }
+    return *this;
+}
+
+Line& Line::operator<<(double value)
+{
+    char digits[32];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    return *this << std::string_view(digits, static_cast<size_t>(result.ptr - digits));
+}
+
+bool RateLimiter::allow()
+{
+    const int64_t second = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    // A new second opens a new budget; racing threads may both reset it,
+    // which at worst lets a few extra lines through.
+    int64_t current = m_second.load(std::memory_order_relaxed);
+    if (current != second && m_second.compare_exchange_strong(current, second, std::memory_order_relaxed)) {
+        m_count.store(0, std::memory_order_relaxed);
+    }
+
+    if (m_count.fetch_add(1, std::memory_order_relaxed) < kLinesPerSecond) {
+        return true;
+    }
+    m_suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Levels a build can keep; anything below SIMPLEIM_LOG_LEVEL is compiled out,
+// arguments and all. Set it with -DSIMPLEIM_LOG_LEVEL=DEBUG (etc.) in CMake.
+#define SIMPLEIM_LOG_LEVEL_DEBUG 0
+#define SIMPLEIM_LOG_LEVEL_INFO 1
+#define SIMPLEIM_LOG_LEVEL_WARNING 2
+#define SIMPLEIM_LOG_LEVEL_ERROR 3
+#define SIMPLEIM_LOG_LEVEL_OFF 4
+
+#ifndef SIMPLEIM_LOG_LEVEL
+#define SIMPLEIM_LOG_LEVEL SIMPLEIM_LOG_LEVEL_INFO
+#endif
+
+namespace Log {
+
+enum class Level : uint8_t
+{
+    Debug = SIMPLEIM_LOG_LEVEL_DEBUG,
+    Info = SIMPLEIM_LOG_LEVEL_INFO,
+    Warning = SIMPLEIM_LOG_LEVEL_WARNING,
+    Error = SIMPLEIM_LOG_LEVEL_ERROR,
+    Off = SIMPLEIM_LOG_LEVEL_OFF
+};
+
+constexpr Level kCompiledLevel = static_cast<Level>(SIMPLEIM_LOG_LEVEL);
+
+constexpr bool compiledIn(Level level)
+{
+    return level >= kCompiledLevel && level != Level::Off;
+}
+
+// Longer lines are truncated; a record is a fixed-size slot in the sink's ring.
+constexpr size_t kMaxLineLength = 240;
+
+struct Record
+{
+    Level level = Level::Info;
+    uint16_t length = 0;
+    char text[kMaxLineLength];
+};
+
+// Raise the threshold at runtime on top of the compiled one.
+void setLevel(Level level);
+bool enabled(Level level);
+
+// Hands a record to the sink thread. Never blocks: when the ring is full the
+// record is counted and dropped, and the sink reports the count later.
+void submit(Record&& record);
+
+// Waits until everything submitted so far has been written out.
+void flush();
+
+// Lines logged since the sink started that did not fit in the ring.
+uint64_t droppedLines();
+
+// Formats one line into a record on the stack and submits it when destroyed.
+class Line
+{
+public:
+    explicit Line(Level level, uint64_t suppressed = 0);
+    ~Line();
+
+    Line(const Line&) = delete;
+    Line& operator=(const Line&) = delete;
+
+    Line& operator<<(std::string_view text);
+    Line& operator<<(const char* text) { return *this << std::string_view(text ? text : "(null)"); }
+    Line& operator<<(const std::string& text) { return *this << std::string_view(text); }
+    Line& operator<<(char c) { return *this << std::string_view(&c, 1); }
+    Line& operator<<(bool value) { return *this << (value ? "1" : "0"); }
+    Line& operator<<(double value);
+
+    template<typename Integer, typename = std::enable_if_t<std::is_integral_v<Integer>>>
+    Line& operator<<(Integer value)
+    {
+        char digits[24];
+        const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        return *this << std::string_view(digits, static_cast<size_t>(result.ptr - digits));
+    }
+
+    // Enums such as MessageType print as their number.
+    template<typename Enum, typename = std::enable_if_t<std::is_enum_v<Enum>>, typename = void>
+    Line& operator<<(Enum value)
+    {
+        return *this << static_cast<std::underlying_type_t<Enum>>(value);
+    }
+
+private:
+    Record m_record;
+    uint64_t m_suppressed;
+};
+
+// Lets a call site through at most kLinesPerSecond times a second, so a
+// failure repeating per message cannot flood the log; the next line that gets
+// through says how many were held back.
+class RateLimiter
+{
+public:
+    static constexpr uint32_t kLinesPerSecond = 10;
+
+    bool allow();
+    uint64_t takeSuppressed() { return m_suppressed.exchange(0, std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> m_second{-1};
+    std::atomic<uint32_t> m_count{0};
+    std::atomic<uint64_t> m_suppressed{0};
+};
+
+}
+
+// Usage: SIMPLEIM_LOG_INFO << "Client '" << userId << "' connected.";
+// Below the compiled level the statement is discarded at compile time.
+#define SIMPLEIM_LOG(level) \
+    if constexpr (!Log::compiledIn(level)) {} \
+    else if (!Log::enabled(level)) {} \
+    else Log::Line(level)
+
+#define SIMPLEIM_LOG_DEBUG SIMPLEIM_LOG(Log::Level::Debug)
+#define SIMPLEIM_LOG_INFO SIMPLEIM_LOG(Log::Level::Info)
+#define SIMPLEIM_LOG_WARNING SIMPLEIM_LOG(Log::Level::Warning)
+
+// Errors are rate limited per call site.
+#define SIMPLEIM_LOG_ERROR \
+    if constexpr (!Log::compiledIn(Log::Level::Error)) {} \
+    else if (static Log::RateLimiter simpleimLogLimiter; !simpleimLogLimiter.allow()) {} \
+    else Log::Line(Log::Level::Error, simpleimLogLimiter.takeSuppressed())
@@ -1,39 +1,147 @@
 #include "Message.h"
+#include "FrameDecoder.h"
+#include "Log.h"
 
 #include <arpa/inet.h>
 
 
-Message::Message(MessageType messageType, const std::string& data)
+namespace {
+void encodeHeader(char* buffer, MessageType type, uint32_t length)
+{
+    buffer[0] = static_cast<char>(type);
+    const uint32_t networkLength = htonl(length);
+    std::memcpy(&buffer[1], &networkLength, sizeof(networkLength));
+}
+}
+
+Message::Message()
+    : m_header(static_cast<MessageType>(0), 0)
+{}
+
+Message::Message(MessageType messageType, std::string_view data)
     : m_header(messageType, data.size())
-    , m_messageData(data)
+{
+    if (isInline()) {
+        std::memcpy(m_inline, data.data(), data.size());
+    }
+    else {
+        m_heapData.assign(data);
+    }
+}
+
+Message::Message(MessageType messageType, const char* data)
+    : Message(messageType, std::string_view(data))
 {}
 
-std::vector<uint8_t> Message::to_bytes() const
+Message::Message(MessageType messageType, std::string&& data)
+    : m_header(messageType, data.size())
+{
+    if (isInline()) {
+        std::memcpy(m_inline, data.data(), data.size());
+    }
+    else {
+        m_heapData = std::move(data);
+    }
+}
+
+Message::Message(MessageType messageType, std::initializer_list<std::string_view> parts)
+    : m_header(messageType, 0)
+{
+    for (std::string_view part : parts) {
+        m_header.length += part.size();
+    }
+
+    char* out = m_inline;
+    if (!isInline()) {
+        m_heapData.resize(m_header.length);
+        out = m_heapData.data();
+    }
+
+    for (std::string_view part : parts) {
+        std::memcpy(out, part.data(), part.size());
+        out += part.size();
+    }
+}
+
+Message::Message(Message&& other) noexcept
+    : m_header(other.m_header)
+    , m_heapData(std::move(other.m_heapData))
 {
-    std::vector<uint8_t> bytes(1 + 4 + m_messageData.size());
+    if (isInline()) {
+        std::memcpy(m_inline, other.m_inline, m_header.length);
+    }
+    other.m_header.length = 0;
+}
+
+Message& Message::operator=(Message&& other) noexcept
+{
+    if (this != &other) {
+        m_header = other.m_header;
+        m_heapData = std::move(other.m_heapData);
+        if (isInline()) {
+            std::memcpy(m_inline, other.m_inline, m_header.length);
+        }
+        other.m_header.length = 0;
+    }
+    return *this;
+}
+
+std::string_view Message::data() const
+{
+    return std::string_view(isInline() ? m_inline : m_heapData.data(), m_header.length);
+}
 
-    bytes[0] = static_cast<uint8_t>(m_header.type);
-    const uint32_t networkLength = htonl(m_header.length);
-    std::memcpy(&bytes[1], &networkLength, sizeof(networkLength));
+size_t Message::encode_into(char* buffer, size_t capacity) const
+{
+    if (capacity < encoded_size()) {
+        return 0;
+    }
+
+    encodeHeader(buffer, m_header.type, m_header.length);
+    std::memcpy(buffer + MessageHeader::kWireSize, data().data(), m_header.length);
+    return encoded_size();
+}
 
-    // The message
-    std::memcpy(&bytes[5], m_messageData.data(), m_messageData.size());
+std::vector<uint8_t> Message::to_bytes() const
+{
+    std::vector<uint8_t> bytes(encoded_size());
+    encode_into(reinterpret_cast<char*>(bytes.data()), bytes.size());
     return bytes;
 }
 
-Message Message::from_bytes(const std::vector<uint8_t>& data)
+SharedFrame Message::encode_shared(MessageType messageType, std::string_view data)
 {
-    if (data.size() < sizeof(MessageHeader)) 
-        std::cout << "Invalid message format received!" << std::endl;
+    return encode_shared(messageType, {data});
+}
 
-    MessageType type = static_cast<MessageType>(data[0]);
+SharedFrame Message::encode_shared(MessageType messageType, std::initializer_list<std::string_view> parts)
+{
+    size_t length = 0;
+    for (std::string_view part : parts) {
+        length += part.size();
+    }
 
-    uint32_t length = 0;
-    std::memcpy(&length, &data[1], 4);
-    length = ntohl(length);
+    auto frame = std::make_shared<std::string>(MessageHeader::kWireSize + length, '\0');
+    encodeHeader(frame->data(), messageType, static_cast<uint32_t>(length));
 
-    std::string payload(data.begin() + sizeof(MessageHeader), 
-                        data.begin() + sizeof(MessageHeader) + length);
+    char* out = frame->data() + MessageHeader::kWireSize;
+    for (std::string_view part : parts) {
+        std::memcpy(out, part.data(), part.size());
+        out += part.size();
+    }
+    return frame;
+}
+
+Message Message::from_bytes(const std::vector<uint8_t>& data)
+{
+    Frame frame{};
+    size_t frameSize = 0;
+    const FrameDecoder::Result result = FrameDecoder::decode(reinterpret_cast<const char*>(data.data()), data.size(),
+                                                             FrameDecoder::kDefaultMaxPayloadLength, frame, frameSize);
+    if (result != FrameDecoder::Result::Frame) {
+        SIMPLEIM_LOG_WARNING << "Invalid message format received!";
+        return Message();
+    }
 
-    return Message(type, payload);
+    return Message(frame.type, frame.payload);
 }
\ No newline at end of file
@@ -1,22 +1,63 @@
 #pragma once
 
 #include <cstring>
+#include <initializer_list>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 
 #include "MessageHeader.h"
 
+// An encoded frame, header and payload in one buffer, shared read-only by
+// every connection it is queued on.
+using SharedFrame = std::shared_ptr<const std::string>;
+
+// A message waiting to be encoded. Payloads up to kInlineCapacity bytes live
+// inside the Message itself, so typical chat lines are queued and sent without
+// touching the heap; longer ones keep the std::string they were moved from.
 class Message {
 public:
-    explicit Message(MessageType messageType, const std::string& data);
+    static constexpr size_t kInlineCapacity = 200;
+
+    Message();
+    explicit Message(MessageType messageType, std::string_view data);
+    explicit Message(MessageType messageType, const char* data);
+    explicit Message(MessageType messageType, std::string&& data);
+    // Concatenates the parts straight into the payload, "target" ":" "text" for a DM.
+    explicit Message(MessageType messageType, std::initializer_list<std::string_view> parts);
+
+    Message(const Message& other) = default;
+    Message& operator=(const Message& other) = default;
+    Message(Message&& other) noexcept;
+    Message& operator=(Message&& other) noexcept;
+
+    MessageType type() const { return m_header.type; }
+    std::string_view data() const;
+
+    // Header plus payload, as written by encode_into.
+    size_t encoded_size() const { return MessageHeader::kWireSize + m_header.length; }
+
+    // Encodes into the caller's buffer; returns the bytes written, or 0 when
+    // capacity is smaller than encoded_size().
+    size_t encode_into(char* buffer, size_t capacity) const;
 
     std::vector<uint8_t> to_bytes() const;
 
     static Message from_bytes(const std::vector<uint8_t>& data);
 
+    // Encodes once for any number of recipients.
+    static SharedFrame encode_shared(MessageType messageType, std::string_view data);
+    // Concatenates the parts into the frame, "sender" ": " "text" for a chat line.
+    static SharedFrame encode_shared(MessageType messageType, std::initializer_list<std::string_view> parts);
+
 private:
     MessageHeader m_header;
-    std::string m_messageData;
+    // Holds the payload once it outgrows m_inline.
+    std::string m_heapData;
+    char m_inline[kInlineCapacity];
+
+    bool isInline() const { return m_header.length <= kInlineCapacity; }
 };
\ No newline at end of file
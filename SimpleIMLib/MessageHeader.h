@@ -1,9 +1,14 @@
 #pragma once
 
+#include <cstddef>
+
 #include "MessageType.h"
 
 struct MessageHeader 
 {
+    // On the wire: the type byte, then the payload length as a network-order uint32.
+    static constexpr size_t kWireSize = 5;
+
     MessageType type;
     uint32_t length;
 
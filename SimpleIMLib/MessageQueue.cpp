@@ -1,7 +1,12 @@
 #include "MessageQueue.h"
 
+namespace {
+constexpr size_t kInitialSlots = 64;
+}
+
 MessageQueue::MessageQueue()
-    : m_terminate(false)
+    : m_slots(kInitialSlots)
+    , m_terminate(false)
 {
 }
 
@@ -11,13 +16,18 @@ MessageQueue::~MessageQueue()
 }
 
 void MessageQueue::push(const Message& message)
+{
+    push(Message(message));
+}
+
+void MessageQueue::push(Message&& message)
 {
     {
         std::lock_guard<std::mutex> lock(m_mutex);
         if (m_terminate) {
             return; // Don't add messages if terminating
         }
-        m_queue.push(message);
+        pushLocked(std::move(message));
     }
     m_condition.notify_one();
 }
@@ -25,26 +35,23 @@ void MessageQueue::push(const Message& message)
 Message MessageQueue::pop()
 {
     std::unique_lock<std::mutex> lock(m_mutex);
-    m_condition.wait(lock, [this] { return !m_queue.empty() || m_terminate; });
+    m_condition.wait(lock, [this] { return m_count > 0 || m_terminate; });
     
-    if (m_terminate && m_queue.empty()) {
+    if (m_terminate && m_count == 0) {
         // Return empty message if terminating and no messages left
-        return Message(static_cast<MessageType>(0), "");
+        return Message();
     }
     
-    Message message = m_queue.front();
-    m_queue.pop();
-    return message;
+    return popLocked();
 }
 
 bool MessageQueue::tryPop(Message& message, std::chrono::milliseconds timeout)
 {
     std::unique_lock<std::mutex> lock(m_mutex);
     
-    if (m_condition.wait_for(lock, timeout, [this] { return !m_queue.empty() || m_terminate; })) {
-        if (!m_queue.empty()) {
-            message = m_queue.front();
-            m_queue.pop();
+    if (m_condition.wait_for(lock, timeout, [this] { return m_count > 0 || m_terminate; })) {
+        if (m_count > 0) {
+            message = popLocked();
             return true;
         }
     }
@@ -55,20 +62,22 @@ bool MessageQueue::tryPop(Message& message, std::chrono::milliseconds timeout)
 bool MessageQueue::empty() const
 {
     std::lock_guard<std::mutex> lock(m_mutex);
-    return m_queue.empty();
+    return m_count == 0;
 }
 
 size_t MessageQueue::size() const
 {
     std::lock_guard<std::mutex> lock(m_mutex);
-    return m_queue.size();
+    return m_count;
 }
 
 void MessageQueue::clear()
 {
     std::lock_guard<std::mutex> lock(m_mutex);
-    std::queue<Message> empty;
-    m_queue.swap(empty);
+    while (m_count > 0) {
+        popLocked();
+    }
+    m_head = 0;
 }
 
 void MessageQueue::wakeUp()
@@ -79,3 +88,28 @@ void MessageQueue::wakeUp()
     }
     m_condition.notify_all();
 }
+
+void MessageQueue::pushLocked(Message&& message)
+{
+    if (m_count == m_slots.size()) {
+        // Unroll the ring into a larger one, oldest first
+        std::vector<Message> slots(m_slots.size() * 2);
+        for (size_t i = 0; i < m_count; ++i) {
+            slots[i] = std::move(m_slots[(m_head + i) % m_slots.size()]);
+        }
+        m_slots.swap(slots);
+        m_head = 0;
+    }
+
+    m_slots[(m_head + m_count) % m_slots.size()] = std::move(message);
+    ++m_count;
+}
+
+Message MessageQueue::popLocked()
+{
+    // Moving out leaves the slot empty, releasing any large payload it held
+    Message message = std::move(m_slots[m_head]);
+    m_head = (m_head + 1) % m_slots.size();
+    --m_count;
+    return message;
+}
@@ -1,11 +1,13 @@
 #pragma once
 
 #include <Message.h>
-#include <queue>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
 
+// Messages live in a ring of slots that only ever grows, so once it has
+// reached the depth a sender needs, pushing and popping no longer allocate.
 class MessageQueue
 {
 public:
@@ -13,6 +15,15 @@ public:
     ~MessageQueue();
     
     void push(const Message& message);
+    void push(Message&& message);
+
+    // Builds the message in place from Message constructor arguments.
+    template<typename... Args>
+    void emplace(Args&&... args)
+    {
+        push(Message(std::forward<Args>(args)...));
+    }
+
     Message pop();
     bool tryPop(Message& message, std::chrono::milliseconds timeout = std::chrono::milliseconds(10));
     bool empty() const;
@@ -24,6 +35,11 @@ public:
 private:
     mutable std::mutex m_mutex;
     std::condition_variable m_condition;
-    std::queue<Message> m_queue;
+    std::vector<Message> m_slots;
+    size_t m_head = 0;
+    size_t m_count = 0;
     bool m_terminate = false;
+
+    void pushLocked(Message&& message);
+    Message popLocked();
 };
@@ -10,7 +10,49 @@ enum class MessageType : uint8_t
     ChatMessageDM,
     LoginSuccess,
     LoginFailure,
-    ConnectedClientsList,
-    ClientConnected,
-    ClientDisconnected
-};
\ No newline at end of file
+    // Presence. Every join and leave takes the next sequence number. After
+    // LoginSuccess the server sends the users logged on as snapshot pages,
+    // "seq:page:pages:name,name,...", seq being the last change they include,
+    // then deltas "seq:+name,-name,..." whose changes are numbered from seq up.
+    PresenceSnapshot,
+    PresenceDelta,
+    // Rooms. Join, leave and list are echoed back to the sender as the reply:
+    // "room" for join and leave, "room,room,..." for list. A room message goes
+    // up as "room:text" and reaches the members as "room:sender: text".
+    RoomJoin,
+    RoomLeave,
+    RoomList,
+    RoomMessage,
+    // History. A server keeping history replays it after the presence
+    // snapshot: the frames the user was sent, as they were sent, then
+    // HistoryEnd "seq" naming the last record the replay covered. A logon
+    // asks for the last records, or for all after seq when HistoryResume
+    // "seq" (below) goes just ahead of its UserLogon.
+    HistoryEnd,
+    // Search. SearchRequest "words" asks for the newest history records
+    // holding every word. Each match comes back as SearchResult
+    // "timestamp:sender: text", newest first, the timestamp in milliseconds
+    // since the epoch, then SearchEnd "count".
+    SearchRequest,
+    SearchResult,
+    SearchEnd,
+    // Resume. A server keeping chat streams numbers the chat frames it sends
+    // a user (broadcast, direct and room messages, replayed history included)
+    // 1, 2, 3... in the order they go out. StreamSync "stream:seq" says the
+    // next chat frame is number seq of that stream; the client acknowledges
+    // with StreamAck "seq", everything up to seq received. StreamResume
+    // "stream:seq" (below), sent just ahead of the UserLogon, resumes the
+    // stream after seq: the server resends the frames numbered past it instead
+    // of replaying history, or starts a new stream, and replays history as
+    // usual, when it no longer holds them.
+    StreamSync,
+    StreamAck,
+    HistoryResume,
+    StreamResume
+};
+
+// Keep in step with the last enumerator when types are added.
+inline bool isValidMessageType(MessageType type)
+{
+    return type >= MessageType::UserLogon && type <= MessageType::StreamResume;
+}
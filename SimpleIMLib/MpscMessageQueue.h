@@ -0,0 +1,8 @@
+#pragma once
+
+#include <Message.h>
+#include <MpscQueue.h>
+
+// Lock-free alternative to MessageQueue for any number of producers and a
+// single consumer; see MpscQueue.
+using MpscMessageQueue = MpscQueue<Message>;
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Bounded lock-free queue for any number of producers and a single consumer.
+// Producers claim slots with one CAS on the tail and publish them through a
+// per-slot sequence number; the consumer owns the head. Instead of a condition
+// variable the consumer sleeps on wakeFd(), which producers only signal when it
+// announced a sleep with prepareWait(), so a busy queue costs no syscalls.
+template<typename T>
+class MpscQueue
+{
+public:
+    static constexpr size_t kDefaultCapacity = 1024;
+
+    // Capacity is rounded up to a power of two.
+    explicit MpscQueue(size_t capacity = kDefaultCapacity)
+        : m_mask(roundUpToPowerOfTwo(capacity < 2 ? 2 : capacity) - 1)
+        , m_wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+        , m_tail(0)
+        , m_head(0)
+        , m_consumerWaiting(false)
+        , m_terminate(false)
+    {
+        // Written directly: the log sink is built on this queue
+        if (m_wakeFd == -1) {
+            std::fprintf(stderr, "%sError: eventfd failed. errno=%d\n", __PRETTY_FUNCTION__, errno);
+        }
+
+        // Slot i is free for the producer claiming position i
+        m_slots.reset(new Slot[m_mask + 1]);
+        for (size_t i = 0; i <= m_mask; ++i) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~MpscQueue()
+    {
+        if (m_wakeFd > -1) {
+            close(m_wakeFd);
+            m_wakeFd = -1;
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // Any thread. False when the queue is full or shutting down; the value is
+    // left untouched then.
+    bool push(T&& value)
+    {
+        if (m_terminate.load(std::memory_order_relaxed)) {
+            return false;
+        }
+
+        size_t position = m_tail.load(std::memory_order_relaxed);
+        Slot* slot = nullptr;
+
+        while (true) {
+            slot = &m_slots[position & m_mask];
+            const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const intptr_t lag = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+            if (lag == 0) {
+                if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (lag < 0) {
+                return false; // the consumer has not freed this slot yet: full
+            }
+            else {
+                position = m_tail.load(std::memory_order_relaxed); // another producer took it
+            }
+        }
+
+        slot->value = std::move(value);
+        slot->sequence.store(position + 1, std::memory_order_release);
+
+        // Pairs with the fence in prepareWait: either the consumer sees this
+        // value before sleeping, or we see it waiting and wake it.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_consumerWaiting.load(std::memory_order_relaxed)
+            && m_consumerWaiting.exchange(false, std::memory_order_relaxed)) {
+            signal();
+        }
+        return true;
+    }
+
+    bool push(const T& value) { return push(T(value)); }
+
+    template<typename... Args>
+    bool emplace(Args&&... args)
+    {
+        return push(T(std::forward<Args>(args)...));
+    }
+
+    // Consumer thread only.
+    bool tryPop(T& value)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        Slot& slot = m_slots[head & m_mask];
+        if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+            return false;
+        }
+
+        value = std::move(slot.value);
+        // Hand the slot to the producer that will claim it one lap later
+        slot.sequence.store(head + m_mask + 1, std::memory_order_release);
+        m_head.store(head + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool empty() const
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        return m_slots[head & m_mask].sequence.load(std::memory_order_acquire) != head + 1;
+    }
+
+    // Consumer thread only. Returns true when the queue is still empty and the
+    // consumer may block on wakeFd(); any push from then on signals it. Call
+    // consumeWakeup() once wakeFd() is readable.
+    bool prepareWait()
+    {
+        m_consumerWaiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!empty() || m_terminate.load(std::memory_order_relaxed)) {
+            m_consumerWaiting.store(false, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void consumeWakeup()
+    {
+        uint64_t count = 0;
+        (void)!read(m_wakeFd, &count, sizeof(count));
+    }
+
+    int wakeFd() const { return m_wakeFd; }
+
+    // Any thread; a snapshot that may be stale by the time it returns.
+    size_t size() const
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // Refuses further pushes and wakes the consumer for good.
+    void wakeUp()
+    {
+        m_terminate.store(true, std::memory_order_relaxed);
+        signal();
+    }
+
+    // Takes pushes again after wakeUp, for the next consumer. Only while no
+    // consumer is running.
+    void reopen()
+    {
+        consumeWakeup();
+        m_consumerWaiting.store(false, std::memory_order_relaxed);
+        m_terminate.store(false, std::memory_order_relaxed);
+    }
+
+    bool terminating() const { return m_terminate.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t kCacheLineSize = 64;
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> m_slots;
+    size_t m_mask;
+    int m_wakeFd;
+
+    // Producers and the consumer each get a cache line, so claiming a slot
+    // does not invalidate the line the consumer is polling.
+    alignas(kCacheLineSize) std::atomic<size_t> m_tail;
+    alignas(kCacheLineSize) std::atomic<size_t> m_head;
+    alignas(kCacheLineSize) std::atomic<bool> m_consumerWaiting;
+    std::atomic<bool> m_terminate;
+
+    static size_t roundUpToPowerOfTwo(size_t value)
+    {
+        size_t result = 1;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    void signal()
+    {
+        const uint64_t one = 1;
+        (void)!write(m_wakeFd, &one, sizeof(one));
+    }
+};
@@ -1,4 +1,4 @@
-#include <iostream>
+#include <Log.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -6,20 +6,53 @@
 #include <cstring>
 #include <string>
 #include <vector>
-#include <optional>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include <charconv>
+#include <climits>
 #include <errno.h>
+#include <fcntl.h>
+#include <iostream>
 
 #include "SimpleIMClient.h"
 
+namespace {
+constexpr size_t kMaxFramesPerWrite = IOV_MAX;
+constexpr size_t kReadChunkSize = 16 * 1024;
+constexpr size_t kInitialSendBufferSize = 4 * 1024;
+constexpr int kMaxEventsPerWait = 4;
+// Received chat frames are acknowledged at most this often, or once this many
+// are waiting.
+constexpr std::chrono::seconds kStreamAckInterval{1};
+constexpr uint64_t kStreamAckFrames = 256;
+
+// The frames a server numbers in its chat streams.
+bool isChatMessage(MessageType type)
+{
+    return type == MessageType::ChatMessageBroadcast || type == MessageType::ChatMessageDM
+        || type == MessageType::RoomMessage;
+}
+
+bool setNonBlocking(int socket)
+{
+    const int flags = fcntl(socket, F_GETFL, 0);
+    if (flags == -1) {
+        return false;
+    }
+
+    return fcntl(socket, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+}
 
 SimpleIMClient::SimpleIMClient()
     : m_clientUsername("")
+    , m_sendBuffer(kInitialSendBufferSize)
 {}
 
 SimpleIMClient::~SimpleIMClient()
 {
-    disconnectFromServer();
+    // Also joins a network thread left behind by a rejected logon
+    closeConnection();
 }
 
 bool SimpleIMClient::connected()
@@ -29,15 +62,37 @@ bool SimpleIMClient::connected()
 
 void SimpleIMClient::logon(const std::string &username)
 {
+    // Whatever a dropped connection left behind; the logon has to go first
+    closeConnection();
+    m_terminate = false;
+    m_decoder.clear();
+    m_sendOffset = 0;
+    m_sendLength = 0;
+    m_writeBlocked = false;
+    Message stale;
+    while (m_outgoingMessages.tryPop(stale)) {}
+    m_outgoingMessages.reopen();
+    m_logonState = LogonState::Pending;
+
     if(!connectToServer()) {
-        std::cout << __FUNCTION__ << "Unable to connect to SimpleIM Server. Exiting." << std::endl;
+        SIMPLEIM_LOG_INFO << __FUNCTION__ << "Unable to connect to SimpleIM Server. Exiting.";
         return;
     }
     
     m_clientUsername = username;
+    m_presenceSequence = 0;
+    m_presenceSynced = false;
     startNetworkThread();
     
-    // Send login message
+    // Send login message, asking for the history missed since the last replay
+    // and the rest of the chat stream, when there was one
+    if (m_historySequence > 0) {
+        queueMessage(Message(MessageType::HistoryResume, std::to_string(m_historySequence)));
+    }
+    if (m_streamId != 0) {
+        queueMessage(Message(MessageType::StreamResume,
+                             std::to_string(m_streamId) + ":" + std::to_string(m_streamReceived)));
+    }
     queueMessage(Message(MessageType::UserLogon, username));
 }
 
@@ -48,31 +103,63 @@ void SimpleIMClient::sendChatMessage(const std::string &message)
 
 void SimpleIMClient::sendDirectMessage(const std::string &targetUsername, const std::string &message)
 {
-    // Format: "targetUser:message"
-    std::string dmData = targetUsername + ":" + message;
-    queueMessage(Message(MessageType::ChatMessageDM, dmData));
+    // Format: "targetUser:message", assembled in the message itself
+    queueMessage(Message(MessageType::ChatMessageDM, {targetUsername, ":", message}));
+}
+
+void SimpleIMClient::joinRoom(const std::string &room)
+{
+    queueMessage(Message(MessageType::RoomJoin, room));
+}
+
+void SimpleIMClient::leaveRoom(const std::string &room)
+{
+    queueMessage(Message(MessageType::RoomLeave, room));
+}
+
+void SimpleIMClient::listRooms()
+{
+    queueMessage(Message(MessageType::RoomList, std::string()));
+}
+
+void SimpleIMClient::sendRoomMessage(const std::string &room, const std::string &message)
+{
+    // Format: "room:message", as for direct messages
+    queueMessage(Message(MessageType::RoomMessage, {room, ":", message}));
+}
+
+void SimpleIMClient::search(const std::string &query)
+{
+    queueMessage(Message(MessageType::SearchRequest, query));
 }
 
 bool SimpleIMClient::connectToServer()
 {
     m_clientSocket = socket(AF_INET, SOCK_STREAM, 0);
     if (m_clientSocket == -1) {
-        std::cerr << __FUNCTION__ << "SimpleIMClient::connectToServer() Error: Could not create socket\n";
+        SIMPLEIM_LOG_ERROR << __FUNCTION__ << "SimpleIMClient::connectToServer() Error: Could not create socket";
         return false;
     }
 
     sockaddr_in serverAddr;
     serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(8989);
-    serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    serverAddr.sin_port = htons(m_serverPort);
+    serverAddr.sin_addr.s_addr = inet_addr(m_serverHost.c_str());
 
     if (connect(m_clientSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1) {
-        std::cerr << __FUNCTION__ << "SimpleIMClient::connectToServer() Error: Could not connect to server\n";
+        SIMPLEIM_LOG_ERROR << __FUNCTION__ << "SimpleIMClient::connectToServer() Error: Could not connect to server";
         close(m_clientSocket);
         return false;
     }
 
-    std::cout << __FUNCTION__ << "connection successful" << std::endl;
+    // From here on the network thread drives the socket through epoll
+    if (!setNonBlocking(m_clientSocket)) {
+        SIMPLEIM_LOG_ERROR << __FUNCTION__ << "Error: Could not make socket non-blocking";
+        close(m_clientSocket);
+        return false;
+    }
+
+    SIMPLEIM_LOG_INFO << __FUNCTION__ << "connection successful";
     m_connected = true;
     return m_connected;
 }
@@ -80,51 +167,108 @@ bool SimpleIMClient::connectToServer()
 void SimpleIMClient::disconnectFromServer()
 {
     if(m_connected) {
-        m_terminate = true;
-        
-        // Wake up the network thread
-        m_outgoingMessages.wakeUp();
-        
-        // Close socket first to interrupt any blocking recv calls
-        if (m_clientSocket > -1) {
-            close(m_clientSocket);
-            m_clientSocket = -1;
-        }
-        
-        // Then join the network thread if it exists
-        if(m_networkThread && m_networkThread->joinable()) {
+        closeConnection();
+        SIMPLEIM_LOG_INFO << "Disconnected from server.";
+    }
+}
+
+void SimpleIMClient::closeConnection()
+{
+    m_terminate = true;
+
+    // Wake up the network thread
+    m_outgoingMessages.wakeUp();
+
+    // Close socket first to interrupt any blocking recv calls
+    if (m_clientSocket > -1) {
+        close(m_clientSocket);
+        m_clientSocket = -1;
+    }
+
+    // Then join the network thread if it exists; it may have ended already
+    // with a lost connection. Closing from the network thread itself, after a
+    // failed logon, leaves it to end and be joined by the next logon.
+    if(m_networkThread && m_networkThread->get_id() != std::this_thread::get_id()) {
+        if (m_networkThread->joinable()) {
             m_networkThread->join();
-            m_networkThread.reset();
         }
-        
-        m_connected = false;
-        std::cout << "Disconnected from server." << std::endl;
+        m_networkThread.reset();
     }
+
+    m_connected = false;
 }
 
-void SimpleIMClient::queueMessage(const Message& message)
+void SimpleIMClient::queueMessage(Message&& message)
 {
     if(!m_connected) {
-        std::cerr << __FUNCTION__ << "Warning: not connected. Cannot queue message." << std::endl;
+        SIMPLEIM_LOG_WARNING << __FUNCTION__ << "Warning: not connected. Cannot queue message.";
         return;
     } 
-    m_outgoingMessages.push(message);
+
+    // The queue is bounded; a full one pushes back on the caller until the
+    // network thread catches up.
+    while (!m_outgoingMessages.push(std::move(message))) {
+        if (!m_connected || m_terminate) {
+            SIMPLEIM_LOG_WARNING << __FUNCTION__ << "Warning: disconnecting. Message dropped.";
+            return;
+        }
+        std::this_thread::yield();
+    }
 }
 
-void SimpleIMClient::sendQueuedMessage(const Message& message)
+bool SimpleIMClient::sendQueuedMessages()
 {
     if(!m_connected) {
-        std::cerr << __FUNCTION__ << "Warning: not connected. Cannot send." << std::endl;
-        return;
+        SIMPLEIM_LOG_WARNING << __FUNCTION__ << "Warning: not connected. Cannot send.";
+        return false;
     }
 
-    std::vector<uint8_t> data = message.to_bytes();
-    if (send(m_clientSocket, data.data(), data.size(), 0) == -1) {
-        std::cerr << __FUNCTION__ << "Could not send to server." << std::endl;
-        m_connected = false;
-        close(m_clientSocket);
-        return;
+    // A batch the socket only partly took goes out before the next one
+    if (m_sendOffset == m_sendLength) {
+        if (m_outgoingMessages.empty()) {
+            return true;
+        }
+
+        // Let the rest of a burst catch up with the first message
+        if (m_flushDelay.count() > 0) {
+            std::this_thread::sleep_for(m_flushDelay);
+        }
+
+        // Encode the batch back to back into the reused send buffer; it only
+        // grows when a batch is larger than any before it.
+        size_t batchSize = 0;
+        size_t frames = 0;
+        Message msg;
+        while (frames < kMaxFramesPerWrite && m_outgoingMessages.tryPop(msg)) {
+            if (m_sendBuffer.size() - batchSize < msg.encoded_size()) {
+                m_sendBuffer.resize(std::max(m_sendBuffer.size() * 2, batchSize + msg.encoded_size()));
+            }
+            batchSize += msg.encode_into(m_sendBuffer.data() + batchSize, m_sendBuffer.size() - batchSize);
+            ++frames;
+        }
+        m_sendOffset = 0;
+        m_sendLength = batchSize;
     }
+
+    // One send for the whole batch; a full socket waits for EPOLLOUT
+    while (m_sendOffset < m_sendLength) {
+        const ssize_t bytesSent = send(m_clientSocket, m_sendBuffer.data() + m_sendOffset,
+                                       m_sendLength - m_sendOffset, MSG_NOSIGNAL);
+        if (bytesSent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytesSent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            m_writeBlocked = true;
+            return true;
+        }
+        if (bytesSent == -1) {
+            SIMPLEIM_LOG_ERROR << __FUNCTION__ << "Could not send to server.";
+            m_connected = false;
+            return false;
+        }
+        m_sendOffset += static_cast<size_t>(bytesSent);
+    }
+    return true;
 }
 
 void SimpleIMClient::startNetworkThread()
@@ -136,175 +280,163 @@ void SimpleIMClient::startNetworkThread()
 
 void SimpleIMClient::networkLoop()
 {
-    std::cout << __FUNCTION__ << "Network thread started" << std::endl;
-    
-    while (!m_terminate && m_connected && m_clientSocket > -1) {
-        fd_set readfds, writefds;
-        FD_ZERO(&readfds);
-        FD_ZERO(&writefds);
-        FD_SET(m_clientSocket, &readfds);
-        
-        // Only set write fd if we have messages to send
-        bool hasOutgoingMessages = !m_outgoingMessages.empty();
-        if (hasOutgoingMessages) {
-            FD_SET(m_clientSocket, &writefds);
+    SIMPLEIM_LOG_INFO << __FUNCTION__ << "Network thread started";
+
+    const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd == -1) {
+        SIMPLEIM_LOG_ERROR << __FUNCTION__ << "Error: epoll_create1 failed: " << strerror(errno);
+        m_connected = false;
+        return;
+    }
+
+    // Edge-triggered like the server's reactor: reads drain to EAGAIN and an
+    // EPOLLOUT edge only matters while a send is blocked.
+    const int socket = m_clientSocket;
+    epoll_event socketEvent{};
+    socketEvent.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    socketEvent.data.fd = socket;
+    epoll_event wakeEvent{};
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.fd = m_outgoingMessages.wakeFd();
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, socket, &socketEvent) == -1
+        || epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeEvent.data.fd, &wakeEvent) == -1) {
+        SIMPLEIM_LOG_ERROR << __FUNCTION__ << "Error: epoll_ctl ADD failed: " << strerror(errno);
+        close(epollFd);
+        m_connected = false;
+        return;
+    }
+
+    epoll_event events[kMaxEventsPerWait];
+
+    while (!m_terminate && m_connected) {
+        // Send whatever is queued before going to sleep
+        if (!m_writeBlocked && !sendQueuedMessages()) {
+            break;
         }
-        
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = hasOutgoingMessages ? 1000 : 100000; // 1ms if sending, 100ms if idle
-        
-        int result = select(m_clientSocket + 1, &readfds, hasOutgoingMessages ? &writefds : nullptr, nullptr, &timeout);
-        
-        if (result < 0) {
+
+        // Block until the server sends something, the socket drains or a push
+        // signals the queue; only poll when a batch is still waiting to go out.
+        const bool moreToSend = !m_writeBlocked && !m_outgoingMessages.prepareWait();
+        const int ready = epoll_wait(epollFd, events, kMaxEventsPerWait, moreToSend ? 0 : acknowledgeTimeoutMs());
+        if (ready == -1) {
             if (errno == EINTR) continue; // Interrupted system call, retry
-            std::cerr << __FUNCTION__ << "Error in select(): " << strerror(errno) << std::endl;
+            SIMPLEIM_LOG_ERROR << __FUNCTION__ << "Error in epoll_wait(): " << strerror(errno);
             break;
         }
-        
-        // Process all pending outgoing messages when socket is writable
-        if (result > 0 && hasOutgoingMessages && FD_ISSET(m_clientSocket, &writefds)) {
-            // Send multiple messages if available to reduce system calls
-            int messagesSent = 0;
-            Message msg(static_cast<MessageType>(0), "");
-            while (messagesSent < 10 && m_outgoingMessages.tryPop(msg, std::chrono::milliseconds(0))) {
-                std::cout << __FUNCTION__ << "Sending queued message (batch " << messagesSent + 1 << ")..." << std::endl;
-                sendQueuedMessage(msg);
-                if (!m_connected) break; // Stop if send failed
-                messagesSent++;
+
+        for (int i = 0; i < ready; ++i) {
+            if (events[i].data.fd == wakeEvent.data.fd) {
+                m_outgoingMessages.consumeWakeup();
+                continue;
             }
-        }
-        
-        // Handle incoming messages
-        if (result > 0 && FD_ISSET(m_clientSocket, &readfds)) {
-            std::cout << "Data available to read..." << std::endl;
-            if (!processIncomingMessage()) {
-                std::cout << "Failed to process incoming message, connection lost" << std::endl;
-                break;
+
+            if (events[i].events & EPOLLOUT) {
+                m_writeBlocked = false;
+            }
+
+            // Handle incoming messages, including the hangup that ends them
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                SIMPLEIM_LOG_DEBUG << "Data available to read...";
+                if (!processIncomingMessages()) {
+                    SIMPLEIM_LOG_INFO << "Failed to process incoming message, connection lost";
+                    m_connected = false;
+                }
             }
         }
+
+        acknowledgeStream();
         
         // Check termination condition
         if (m_terminate || !m_connected) {
-            std::cout << "Breaking from network loop: terminate=" << m_terminate << ", connected=" << m_connected << std::endl;
+            SIMPLEIM_LOG_INFO << "Breaking from network loop: terminate=" << m_terminate.load() << ", connected=" << m_connected.load();
             break;
         }
     }
-    
-    std::cout << "Network thread ending." << std::endl;
+
+    close(epollFd);
+    SIMPLEIM_LOG_INFO << "Network thread ending.";
 }
 
-std::optional<MessageHeader> SimpleIMClient::readMessageHeader()
+bool SimpleIMClient::processIncomingMessages()
 {
     if (m_clientSocket <= -1) {
-        return std::nullopt;
+        return false;
     }
 
-    char headerBuffer[5];
-    size_t totalReceived = 0;
-    
-    // Since select() confirmed data is available, use blocking recv
-    while (totalReceived < sizeof(headerBuffer) && !m_terminate) {
-        int bytesReceived = recv(m_clientSocket, headerBuffer + totalReceived, 
-                               sizeof(headerBuffer) - totalReceived, 0);
-        
-        if (bytesReceived > 0) {
-            totalReceived += bytesReceived;
-        } else if (bytesReceived == 0) {
-            std::cout << "Server disconnected." << std::endl;
+    // The socket is edge-triggered, so read until it runs dry; each read can
+    // carry any number of frames.
+    while (!m_terminate) {
+        char* space = m_decoder.prepare(kReadChunkSize);
+        const ssize_t bytesReceived = recv(m_clientSocket, space, kReadChunkSize, 0);
+        if (bytesReceived == 0) {
+            SIMPLEIM_LOG_INFO << "Server disconnected.";
             m_connected = false;
-            return std::nullopt;
-        } else {
-            std::cerr << __FUNCTION__ << "Error: Could not receive data from server: " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (bytesReceived < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            SIMPLEIM_LOG_ERROR << __FUNCTION__ << "Error: Could not receive data from server: " << strerror(errno);
             m_connected = false;
-            return std::nullopt;
+            return false;
         }
-    }
+        m_decoder.commit(static_cast<size_t>(bytesReceived));
 
-    if (totalReceived != sizeof(headerBuffer)) {
-        std::cerr << __FUNCTION__ << "Error: Incomplete header received" << std::endl;
-        m_connected = false;
-        return std::nullopt;
-    }
+        Frame frame;
+        FrameDecoder::Result result = FrameDecoder::Result::Incomplete;
+        while (!m_terminate && (result = m_decoder.next(frame)) == FrameDecoder::Result::Frame) {
+            handleReceivedMessage(frame.type, frame.payload);
+        }
 
-    MessageType type = static_cast<MessageType>(headerBuffer[0]);
-    uint32_t payloadLength = 0;
-    std::memcpy(&payloadLength, &headerBuffer[1], sizeof(uint32_t));
-    payloadLength = ntohl(payloadLength);
+        if (!m_terminate && result != FrameDecoder::Result::Incomplete) {
+            SIMPLEIM_LOG_ERROR << __FUNCTION__ << "Error: Malformed frame received from server";
+            m_connected = false;
+            return false;
+        }
+    }
 
-    return MessageHeader(type, payloadLength);
+    return !m_terminate;
 }
 
-std::string SimpleIMClient::readMessageData(uint32_t dataLen)
+void SimpleIMClient::acknowledgeStream()
 {
-    if (dataLen < 1) {
-        return std::string();
+    const auto now = std::chrono::steady_clock::now();
+    if (m_streamReceived == m_streamAcked
+        || (m_streamReceived - m_streamAcked < kStreamAckFrames && now < m_streamAckedAt + kStreamAckInterval)) {
+        return;
     }
 
-    if (m_clientSocket <= -1) {
-        return std::string();
-    }
-
-    std::vector<char> payloadBuffer(dataLen);
-    size_t totalReceived = 0;
-    
-    // Since select() confirmed data is available, use blocking recv
-    while (totalReceived < dataLen && !m_terminate) {
-        size_t bytesReceived = recv(m_clientSocket, payloadBuffer.data() + totalReceived, 
-                                  dataLen - totalReceived, 0);
-
-        if (bytesReceived > 0) {
-            totalReceived += bytesReceived;
-        } else if (bytesReceived == 0) {
-            std::cout << "Server disconnected during payload read." << std::endl;
-            m_connected = false;
-            return std::string();
-        } else {
-            std::cerr << __FUNCTION__ << "Error: Could not receive payload from server: " << strerror(errno) << std::endl;
-            m_connected = false;
-            return std::string();
-        }
+    // Never waits on the queue from the thread that drains it; a full one
+    // gets the ack on a later pass
+    if (m_outgoingMessages.push(Message(MessageType::StreamAck, std::to_string(m_streamReceived)))) {
+        m_streamAcked = m_streamReceived;
+        m_streamAckedAt = now;
     }
+}
 
-    if (totalReceived != dataLen) {
-        std::cerr << __FUNCTION__ << "Error: Incomplete payload received (" << totalReceived << "/" << dataLen << ")" << std::endl;
-        m_connected = false;
-        return std::string();
+int SimpleIMClient::acknowledgeTimeoutMs() const
+{
+    if (m_streamReceived == m_streamAcked) {
+        return -1;
     }
 
-    return std::string(payloadBuffer.begin(), payloadBuffer.end());
+    const auto remaining = m_streamAckedAt + kStreamAckInterval - std::chrono::steady_clock::now();
+    return std::max<int>(0, std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
 }
 
-bool SimpleIMClient::processIncomingMessage()
+void SimpleIMClient::handleReceivedMessage(MessageType type, std::string_view data)
 {
-    std::optional<MessageHeader> header = readMessageHeader();
-    if (!header.has_value()) {
-        return false; // Connection lost or error
-    }
-    
-    if (m_terminate) {
-        return false;
-    }
-    
-    if (header->length > 0) {
-        std::cout << "Reading message data of length: " << header->length << std::endl;
-        std::string data = readMessageData(header->length);
-        if (data.empty()) {
-            return false; // Failed to read data
-        }
-        handleReceivedMessage(header->type, data);
-    } else {
-        // Handle messages with no payload
-        std::cout << "Handling message with no payload..." << std::endl;
-        handleReceivedMessage(header->type, "");
+    SIMPLEIM_LOG_DEBUG << __FUNCTION__ << " user name: " << m_clientUsername;
+
+    // The server numbers these in the order it sent them
+    if (m_streamId != 0 && isChatMessage(type)) {
+        ++m_streamReceived;
     }
-    
-    return true;
-}
 
-void SimpleIMClient::handleReceivedMessage(MessageType type, const std::string& data)
-{
-    std::cout << __FUNCTION__ << " user name: " << m_clientUsername << std::endl;
     switch (type) {
         case MessageType::LoginSuccess:
             handleLoginSuccess(data);
@@ -312,14 +444,11 @@ void SimpleIMClient::handleReceivedMessage(MessageType type, const std::string&
         case MessageType::LoginFailure:
             handleLoginFailure(data);
             break;
-        case MessageType::ConnectedClientsList:
-            handleConnectedClientsList(data);
-            break;
-        case MessageType::ClientConnected:
-            handleClientConnected(data);
+        case MessageType::PresenceSnapshot:
+            handlePresenceSnapshot(data);
             break;
-        case MessageType::ClientDisconnected:
-            handleClientDisconnected(data);
+        case MessageType::PresenceDelta:
+            handlePresenceDelta(data);
             break;
         case MessageType::ChatMessageBroadcast:
             handleChatMessageBroadcast(data);
@@ -327,24 +456,143 @@ void SimpleIMClient::handleReceivedMessage(MessageType type, const std::string&
         case MessageType::ChatMessageDM:
             handleChatMessageDm(data);
             break;
+        case MessageType::RoomJoin:
+            handleRoomJoin(data);
+            break;
+        case MessageType::RoomLeave:
+            handleRoomLeave(data);
+            break;
+        case MessageType::RoomList:
+            handleRoomList(data);
+            break;
+        case MessageType::RoomMessage:
+            handleRoomMessage(data);
+            break;
+        case MessageType::HistoryEnd:
+            handleHistoryEnd(data);
+            break;
+        case MessageType::SearchResult:
+            handleSearchResult(data);
+            break;
+        case MessageType::SearchEnd:
+            handleSearchEnd(data);
+            break;
+        case MessageType::StreamSync:
+            handleStreamSync(data);
+            break;
         default:
-            std::cout << "Received unknown message type." << std::endl;
+            SIMPLEIM_LOG_INFO << "Received unknown message type.";
             break;
     }
 }
 
-void SimpleIMClient::handleLoginSuccess(const std::string& data)
+void SimpleIMClient::handleLoginSuccess(std::string_view data)
 {
     std::cout << "✓ Login successful! " << data << std::endl;
+    m_logonState = LogonState::Accepted;
 }
 
-void SimpleIMClient::handleLoginFailure(const std::string& data)
+void SimpleIMClient::handleLoginFailure(std::string_view data)
 {
     std::cout << "✗ Login failed: " << data << std::endl;
+    m_logonState = LogonState::Rejected;
     disconnectFromServer();
 }
 
-void SimpleIMClient::handleConnectedClientsList(const std::string& data)
+void SimpleIMClient::handlePresenceSnapshot(std::string_view data)
+{
+    // "seq:page:pages:name,name,..."
+    uint64_t fields[3] = {0, 0, 0};
+    const char* cursor = data.data();
+    const char* end = data.data() + data.size();
+    for (uint64_t& field : fields) {
+        const auto result = std::from_chars(cursor, end, field);
+        if (result.ec != std::errc() || result.ptr == end || *result.ptr != ':') {
+            SIMPLEIM_LOG_WARNING << "Malformed presence snapshot: " << data;
+            return;
+        }
+        cursor = result.ptr + 1;
+    }
+
+    const std::string_view names(cursor, static_cast<size_t>(end - cursor));
+    if (fields[1] == 0) {
+        m_snapshotNames.clear();
+    }
+    if (!names.empty()) {
+        if (!m_snapshotNames.empty()) {
+            m_snapshotNames += ',';
+        }
+        m_snapshotNames += names;
+    }
+    if (fields[1] + 1 < fields[2]) {
+        return; // more pages to come
+    }
+
+    m_presenceSequence = fields[0];
+    m_presenceSynced = true;
+
+    // The snapshot counts ourselves; the list shown is of the others
+    std::string others;
+    std::string_view remaining = m_snapshotNames;
+    while (!remaining.empty()) {
+        const size_t comma = remaining.find(',');
+        const std::string_view name = remaining.substr(0, comma);
+        if (name != m_clientUsername) {
+            if (!others.empty()) {
+                others += ',';
+            }
+            others += name;
+        }
+        remaining = comma == std::string_view::npos ? std::string_view() : remaining.substr(comma + 1);
+    }
+    m_snapshotNames.clear();
+    m_snapshotNames.shrink_to_fit();
+
+    handleConnectedClientsList(others);
+}
+
+void SimpleIMClient::handlePresenceDelta(std::string_view data)
+{
+    // "seq:+name,-name,...", the changes numbered from seq up
+    uint64_t sequence = 0;
+    const auto result = std::from_chars(data.data(), data.data() + data.size(), sequence);
+    if (result.ec != std::errc() || result.ptr == data.data() + data.size() || *result.ptr != ':') {
+        SIMPLEIM_LOG_WARNING << "Malformed presence delta: " << data;
+        return;
+    }
+
+    if (!m_presenceSynced) {
+        return; // the snapshot still to come includes it
+    }
+
+    std::string_view remaining = data.substr(static_cast<size_t>(result.ptr - data.data()) + 1);
+    for (; !remaining.empty(); ++sequence) {
+        const size_t comma = remaining.find(',');
+        const std::string_view change = remaining.substr(0, comma);
+        remaining = comma == std::string_view::npos ? std::string_view() : remaining.substr(comma + 1);
+
+        // Changes the snapshot already had
+        if (sequence <= m_presenceSequence) {
+            continue;
+        }
+        if (sequence != m_presenceSequence + 1) {
+            SIMPLEIM_LOG_WARNING << "Presence changes " << m_presenceSequence + 1 << " to " << sequence - 1
+                                 << " were missed.";
+        }
+        m_presenceSequence = sequence;
+
+        if (change.size() < 2 || change.substr(1) == m_clientUsername) {
+            continue;
+        }
+        if (change[0] == '+') {
+            handleClientConnected(change.substr(1));
+        } else if (change[0] == '-') {
+            handleClientDisconnected(change.substr(1));
+        }
+    }
+}
+
+void SimpleIMClient::handleConnectedClientsList(std::string_view data)
 {
     if (data.empty()) {
         std::cout << "Connected users: (none)" << std::endl;
@@ -354,60 +602,174 @@ void SimpleIMClient::handleConnectedClientsList(const std::string& data)
     
     // Invoke callback if set
     if (m_connectedUsersListCallback) {
-        m_connectedUsersListCallback(data);
+        m_connectedUsersListCallback(std::string(data));
     }
 }
 
-void SimpleIMClient::handleClientConnected(const std::string& data)
+void SimpleIMClient::handleClientConnected(std::string_view data)
 {
     std::cout << "User '" << data << "' joined the chat." << std::endl;
     
     // Invoke callback if set
     if (m_userConnectedCallback) {
-        m_userConnectedCallback(data);
+        m_userConnectedCallback(std::string(data));
     }
 }
 
-void SimpleIMClient::handleClientDisconnected(const std::string& data)
+void SimpleIMClient::handleClientDisconnected(std::string_view data)
 {
     std::cout << "User '" << data << "' left the chat." << std::endl;
     
     // Invoke callback if set
     if (m_userDisconnectedCallback) {
-        m_userDisconnectedCallback(data);
+        m_userDisconnectedCallback(std::string(data));
     }
 }
 
-void SimpleIMClient::handleChatMessageBroadcast(const std::string &data)
+void SimpleIMClient::handleChatMessageBroadcast(std::string_view data)
 {
-    std::cout << __FUNCTION__ << std::endl;
+    SIMPLEIM_LOG_DEBUG << __FUNCTION__;
 
     if (m_chatMessageCallback) {
         // Parse username from message format "username: message"
         size_t colonPos = data.find(": ");
-        if (colonPos != std::string::npos) {
-            std::string username = data.substr(0, colonPos);
-            std::string message = data.substr(colonPos + 2);
+        if (colonPos != std::string_view::npos) {
+            std::string username(data.substr(0, colonPos));
+            std::string message(data.substr(colonPos + 2));
             m_chatMessageCallback(username, message);
         } else {
-            m_chatMessageCallback("Unknown", data);
+            m_chatMessageCallback("Unknown", std::string(data));
         }
     }
 }
 
-void SimpleIMClient::handleChatMessageDm(const std::string &data)
+void SimpleIMClient::handleChatMessageDm(std::string_view data)
 {
-    std::cout << __FUNCTION__ << std::endl;
+    SIMPLEIM_LOG_DEBUG << __FUNCTION__;
     // Invoke callback if set
     if (m_chatMessageCallback) {
         // Parse DM format "from_user: message"
         size_t colonPos = data.find(": ");
-        if (colonPos != std::string::npos) {
-            std::string username = data.substr(0, colonPos);
-            std::string message = data.substr(colonPos + 2);
+        if (colonPos != std::string_view::npos) {
+            std::string username(data.substr(0, colonPos));
+            std::string message(data.substr(colonPos + 2));
             m_chatMessageCallback(username, message);
         } else {
-            m_chatMessageCallback("Unknown", data);
+            m_chatMessageCallback("Unknown", std::string(data));
         }
     }
 }
+
+void SimpleIMClient::handleRoomJoin(std::string_view data)
+{
+    std::cout << "Joined room '" << data << "'." << std::endl;
+}
+
+void SimpleIMClient::handleRoomLeave(std::string_view data)
+{
+    std::cout << "Left room '" << data << "'." << std::endl;
+}
+
+void SimpleIMClient::handleRoomList(std::string_view data)
+{
+    if (data.empty()) {
+        std::cout << "Rooms: (none)" << std::endl;
+    } else {
+        std::cout << "Rooms: " << data << std::endl;
+    }
+}
+
+void SimpleIMClient::handleRoomMessage(std::string_view data)
+{
+    SIMPLEIM_LOG_DEBUG << __FUNCTION__;
+    // Parse room format "room:from_user: message"
+    size_t roomEnd = data.find(':');
+    size_t colonPos = roomEnd == std::string_view::npos ? roomEnd : data.find(": ", roomEnd + 1);
+    if (colonPos == std::string_view::npos) {
+        SIMPLEIM_LOG_WARNING << "Malformed room message: " << data;
+        return;
+    }
+
+    if (m_roomMessageCallback) {
+        std::string room(data.substr(0, roomEnd));
+        std::string username(data.substr(roomEnd + 1, colonPos - roomEnd - 1));
+        std::string message(data.substr(colonPos + 2));
+        m_roomMessageCallback(room, username, message);
+    }
+}
+
+void SimpleIMClient::handleHistoryEnd(std::string_view data)
+{
+    uint64_t sequence = 0;
+    const auto result = std::from_chars(data.data(), data.data() + data.size(), sequence);
+    if (result.ec != std::errc()) {
+        SIMPLEIM_LOG_WARNING << "Malformed history end: " << data;
+        return;
+    }
+
+    m_historySequence = sequence;
+    if (m_historyEndCallback) {
+        m_historyEndCallback(sequence);
+    }
+}
+
+void SimpleIMClient::handleSearchResult(std::string_view data)
+{
+    // Parse "timestamp:from_user: message"
+    int64_t timestamp = 0;
+    const auto result = std::from_chars(data.data(), data.data() + data.size(), timestamp);
+    const size_t userStart = static_cast<size_t>(result.ptr - data.data()) + 1;
+    const bool separated = result.ec == std::errc() && userStart <= data.size() && data[userStart - 1] == ':';
+    const size_t colonPos = separated ? data.find(": ", userStart) : std::string_view::npos;
+    if (colonPos == std::string_view::npos) {
+        SIMPLEIM_LOG_WARNING << "Malformed search result: " << data;
+        return;
+    }
+
+    std::string username(data.substr(userStart, colonPos - userStart));
+    std::string message(data.substr(colonPos + 2));
+    if (m_searchResultCallback) {
+        m_searchResultCallback(timestamp, username, message);
+    } else {
+        std::cout << "Found: " << username << ": " << message << std::endl;
+    }
+}
+
+void SimpleIMClient::handleSearchEnd(std::string_view data)
+{
+    size_t count = 0;
+    const auto result = std::from_chars(data.data(), data.data() + data.size(), count);
+    if (result.ec != std::errc()) {
+        SIMPLEIM_LOG_WARNING << "Malformed search end: " << data;
+        return;
+    }
+
+    if (m_searchEndCallback) {
+        m_searchEndCallback(count);
+    } else {
+        std::cout << "Search found " << count << " message(s)." << std::endl;
+    }
+}
+
+void SimpleIMClient::handleStreamSync(std::string_view data)
+{
+    // "stream:seq", seq numbering the next chat frame
+    uint64_t stream = 0;
+    uint64_t next = 0;
+    const char* end = data.data() + data.size();
+    const auto streamResult = std::from_chars(data.data(), end, stream);
+    const bool separated = streamResult.ec == std::errc() && streamResult.ptr != end && *streamResult.ptr == ':';
+    const auto nextResult = separated ? std::from_chars(streamResult.ptr + 1, end, next) : streamResult;
+    if (!separated || nextResult.ec != std::errc() || next == 0) {
+        SIMPLEIM_LOG_WARNING << "Malformed stream sync: " << data;
+        return;
+    }
+
+    if (m_streamId != 0 && stream != m_streamId) {
+        SIMPLEIM_LOG_INFO << "Chat stream could not be resumed; starting over from history.";
+    }
+    m_streamId = stream;
+    m_streamReceived = next - 1;
+    m_streamAcked = m_streamReceived;
+    m_streamAckedAt = std::chrono::steady_clock::now();
+}
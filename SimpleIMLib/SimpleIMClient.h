@@ -1,11 +1,17 @@
 #pragma once
 
+#include <FrameDecoder.h>
 #include <Message.h>
-#include <MessageQueue.h>
+#include <MpscMessageQueue.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <thread>
 #include <memory>
 #include <functional>
-#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 class SimpleIMClient
 {
@@ -15,61 +21,159 @@ public:
     using UserDisconnectedCallback = std::function<void(const std::string& username)>;
     using ConnectedUsersListCallback = std::function<void(const std::string& userList)>;
     using ChatMessageCallback = std::function<void(const std::string& username, const std::string& message)>;
+    using RoomMessageCallback = std::function<void(const std::string& room, const std::string& username, const std::string& message)>;
+    using HistoryEndCallback = std::function<void(uint64_t sequence)>;
+    using SearchResultCallback = std::function<void(int64_t timestamp, const std::string& username, const std::string& message)>;
+    using SearchEndCallback = std::function<void(size_t count)>;
     
+    // How the server answered the last logon.
+    enum class LogonState
+    {
+        Pending,
+        Accepted,
+        Rejected
+    };
+
     SimpleIMClient();
     ~SimpleIMClient();
 
     bool connected();
+    // A rejected logon, a name already taken say, fails again if retried.
+    LogonState logonState() const { return m_logonState; }
 
+    // Logging on again, after the connection dropped or was closed, resumes
+    // the chat stream after the last frame this client got, or when the server
+    // cannot, history after the last replay it saw. Messages still queued for
+    // the old connection are dropped.
     void logon(const std::string &username);
 
     void sendChatMessage(const std::string &message);
     void sendDirectMessage(const std::string &targetUsername, const std::string &message);
 
+    // Rooms: only members receive a room's messages, and only members may send them.
+    void joinRoom(const std::string &room);
+    void leaveRoom(const std::string &room);
+    void listRooms();
+    void sendRoomMessage(const std::string &room, const std::string &message);
+
+    // Asks for the newest messages in the history mentioning every word.
+    // The matches arrive through the search callbacks, newest first.
+    void search(const std::string &query);
+
     void disconnectFromServer();
+
+    // Where logon connects to; 127.0.0.1:8989 unless set.
+    void setServerAddress(const std::string& host, uint16_t port)
+    {
+        m_serverHost = host;
+        m_serverPort = port;
+    }
+
+    // Hold outgoing messages this long once one is ready, so a burst leaves
+    // in a single write. 0 (the default) sends as soon as the socket allows.
+    void setFlushDelay(std::chrono::microseconds delay) { m_flushDelay = delay; }
     
     // Callback setters
     void setUserConnectedCallback(UserConnectedCallback callback) { m_userConnectedCallback = callback; }
     void setUserDisconnectedCallback(UserDisconnectedCallback callback) { m_userDisconnectedCallback = callback; }
     void setConnectedUsersListCallback(ConnectedUsersListCallback callback) { m_connectedUsersListCallback = callback; }
     void setChatMessageCallback(ChatMessageCallback callback) { m_chatMessageCallback = callback; }
+    void setRoomMessageCallback(RoomMessageCallback callback) { m_roomMessageCallback = callback; }
+    void setHistoryEndCallback(HistoryEndCallback callback) { m_historyEndCallback = callback; }
+    void setSearchResultCallback(SearchResultCallback callback) { m_searchResultCallback = callback; }
+    void setSearchEndCallback(SearchEndCallback callback) { m_searchEndCallback = callback; }
+
+    // The last history record replayed to this client; 0 before any replay.
+    uint64_t historySequence() const { return m_historySequence; }
+
+    // The chat stream the server numbers this client's chat frames in, and
+    // the last frame of it received; 0 until a server keeping streams starts one.
+    uint64_t streamId() const { return m_streamId; }
+    uint64_t streamSequence() const { return m_streamReceived; }
 
 private:
     int m_clientSocket = -1;
-    bool m_connected = false;
-    bool m_terminate = false;
+    std::atomic<bool> m_connected{false};
+    std::atomic<bool> m_terminate{false};
+    std::atomic<LogonState> m_logonState{LogonState::Pending};
     std::string m_clientUsername;
+    std::string m_serverHost = "127.0.0.1";
+    uint16_t m_serverPort = 8989;
     std::unique_ptr<std::thread> m_networkThread;
+    std::chrono::microseconds m_flushDelay{0};
     
-    // Message queue for outgoing messages
-    MessageQueue m_outgoingMessages;
+    // Outgoing messages; the UI and any other thread push, the network thread pops
+    MpscMessageQueue m_outgoingMessages;
+
+    // Encoded frames of the batch being sent, reused between batches
+    std::vector<char> m_sendBuffer;
+    size_t m_sendOffset = 0;
+    size_t m_sendLength = 0;
+    bool m_writeBlocked = false;     // socket full; wait for EPOLLOUT
+
+    // Received bytes, split into frames
+    FrameDecoder m_decoder;
+
+    // Presence: the last change applied, and the snapshot pages gathered so far.
+    // Deltas are ignored until the snapshot is complete.
+    uint64_t m_presenceSequence = 0;
+    bool m_presenceSynced = false;
+    std::string m_snapshotNames;
+
+    // Where the last history replay ended.
+    uint64_t m_historySequence = 0;
+
+    // Chat frames are counted from StreamSync on and acknowledged now and
+    // then, so the server can let go of them.
+    uint64_t m_streamId = 0;
+    uint64_t m_streamReceived = 0;
+    uint64_t m_streamAcked = 0;
+    std::chrono::steady_clock::time_point m_streamAckedAt;
     
     // UI callback functions
     UserConnectedCallback m_userConnectedCallback;
     UserDisconnectedCallback m_userDisconnectedCallback;
     ConnectedUsersListCallback m_connectedUsersListCallback;
     ChatMessageCallback m_chatMessageCallback;
+    RoomMessageCallback m_roomMessageCallback;
+    HistoryEndCallback m_historyEndCallback;
+    SearchResultCallback m_searchResultCallback;
+    SearchEndCallback m_searchEndCallback;
 
     bool connectToServer();
-    void queueMessage(const Message& message);
-    void sendQueuedMessage(const Message& message);
+    void closeConnection();
+    void queueMessage(Message&& message);
+    bool sendQueuedMessages();
     
     // Network thread functionality
     void startNetworkThread();
     void networkLoop();
     
     // Message receiving functionality
-    std::optional<MessageHeader> readMessageHeader();
-    std::string readMessageData(uint32_t dataLen);
-    bool processIncomingMessage();
-    void handleReceivedMessage(MessageType type, const std::string& data);
+    bool processIncomingMessages();
+    void handleReceivedMessage(MessageType type, std::string_view data);
+
+    // Acknowledges the chat frames received once enough have come in or
+    // enough time has passed, and says how long epoll may wait until then.
+    void acknowledgeStream();
+    int acknowledgeTimeoutMs() const;
     
     // Message handlers
-    void handleLoginSuccess(const std::string& data);
-    void handleLoginFailure(const std::string& data);
-    void handleConnectedClientsList(const std::string& data);
-    void handleClientConnected(const std::string& data);
-    void handleClientDisconnected(const std::string& data);
-    void handleChatMessageBroadcast(const std::string& data);
-    void handleChatMessageDm(const std::string& data);
+    void handleLoginSuccess(std::string_view data);
+    void handleLoginFailure(std::string_view data);
+    void handlePresenceSnapshot(std::string_view data);
+    void handlePresenceDelta(std::string_view data);
+    void handleConnectedClientsList(std::string_view data);
+    void handleClientConnected(std::string_view data);
+    void handleClientDisconnected(std::string_view data);
+    void handleChatMessageBroadcast(std::string_view data);
+    void handleChatMessageDm(std::string_view data);
+    void handleRoomJoin(std::string_view data);
+    void handleRoomLeave(std::string_view data);
+    void handleRoomList(std::string_view data);
+    void handleRoomMessage(std::string_view data);
+    void handleHistoryEnd(std::string_view data);
+    void handleSearchResult(std::string_view data);
+    void handleSearchEnd(std::string_view data);
+    void handleStreamSync(std::string_view data);
 };
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct LoadGenConfig
+{
+    std::string host = "127.0.0.1";
+    uint16_t port = 8989;
+
+    // Simulated clients, all driven from one epoll loop.
+    size_t connections = 1000;
+
+    // Connection attempts started per second; 0 starts them all at once.
+    size_t connectRate = 0;
+
+    // How long the clients get to connect and log on before the load starts.
+    std::chrono::seconds loginTimeout{30};
+
+    // How long the message load runs once everyone is logged on.
+    std::chrono::seconds duration{10};
+
+    // Messages per second across all clients, each from a random client. A
+    // broadcast reaches every client; a DM goes to another random one.
+    double broadcastRate = 10;
+    double directRate = 100;
+
+    // Chat payload size, send timestamp included.
+    size_t payloadBytes = 64;
+
+    // Usernames are the prefix and the client's index.
+    std::string userPrefix;
+
+    // Also write the results here as CSV when set.
+    std::string csvPath;
+};
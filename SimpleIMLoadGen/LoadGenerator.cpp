@@ -0,0 +1,390 @@
+#include "LoadGenerator.h"
+
+#include <Log.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+constexpr size_t kReadChunkSize = 16 * 1024;
+constexpr int kMaxEvents = 256;
+// Pacing resolution of the message load
+constexpr int kTickMs = 1;
+// Time left for messages still in flight once the load stops
+constexpr std::chrono::seconds kDrainTime(1);
+
+// Chat payloads are "<kind><send time in ns>|<padding>"
+constexpr char kBroadcastTag = 'B';
+constexpr char kDirectTag = 'D';
+
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+}
+
+LoadGenerator::LoadGenerator(const LoadGenConfig& config)
+    : m_config(config)
+    , m_epollFd(epoll_create1(EPOLL_CLOEXEC))
+    , m_started(0)
+    , m_settled(0)
+    , m_random(std::random_device()())
+{
+    m_report.connections = config.connections;
+    m_connections.reserve(config.connections);
+    for (size_t i = 0; i < config.connections; ++i) {
+        m_connections.push_back(std::make_unique<Connection>());
+        m_connections.back()->index = i;
+        m_connections.back()->name = config.userPrefix + std::to_string(i);
+    }
+
+    // The timestamp and separator take up to 22 bytes of the payload
+    m_padding.assign(config.payloadBytes > 22 ? config.payloadBytes - 22 : 0, 'x');
+}
+
+LoadGenerator::~LoadGenerator()
+{
+    for (auto& connection : m_connections) {
+        if (connection->fd > -1) {
+            ::close(connection->fd);
+        }
+    }
+    if (m_epollFd > -1) {
+        ::close(m_epollFd);
+    }
+}
+
+bool LoadGenerator::run()
+{
+    if (m_epollFd == -1) {
+        SIMPLEIM_LOG_ERROR << "epoll_create1 failed. errno=" << errno;
+        return false;
+    }
+
+    // Connect and log on, at the configured rate
+    SIMPLEIM_LOG_INFO << "Connecting " << m_connections.size() << " clients to " << m_config.host << ":"
+                      << m_config.port << ".";
+    const Clock::time_point connectBegin = Clock::now();
+    const Clock::time_point loginDeadline = connectBegin + m_config.loginTimeout;
+    while (m_settled < m_connections.size() && Clock::now() < loginDeadline) {
+        startDueConnections(connectBegin);
+        poll(m_started < m_connections.size() ? kTickMs : 100);
+    }
+
+    for (auto& connection : m_connections) {
+        if (connection->state == State::Connecting || connection->state == State::LoggingOn) {
+            close(*connection, true);
+        }
+    }
+    m_report.loggedOn = m_report.login.count();
+    SIMPLEIM_LOG_INFO << m_report.loggedOn << " clients logged on in "
+                      << std::chrono::duration<double>(Clock::now() - connectBegin).count() << " s.";
+    if (m_ready.empty()) {
+        return false;
+    }
+
+    // Message load, paced against the start so a slow iteration catches up
+    const Clock::time_point loadBegin = Clock::now();
+    const Clock::time_point loadEnd = loadBegin + m_config.duration;
+    for (Clock::time_point now = loadBegin; now < loadEnd && !m_ready.empty(); now = Clock::now()) {
+        const double elapsed = std::chrono::duration<double>(now - loadBegin).count();
+        while (m_report.broadcastsSent < static_cast<uint64_t>(elapsed * m_config.broadcastRate) && !m_ready.empty()) {
+            sendBroadcast();
+        }
+        while (m_report.directSent < static_cast<uint64_t>(elapsed * m_config.directRate) && m_ready.size() > 1) {
+            sendDirectMessage();
+        }
+        poll(kTickMs);
+    }
+    m_report.loadSeconds = std::chrono::duration<double>(Clock::now() - loadBegin).count();
+
+    const Clock::time_point drainEnd = Clock::now() + kDrainTime;
+    while (Clock::now() < drainEnd) {
+        poll(10);
+    }
+    return true;
+}
+
+bool LoadGenerator::startConnection(size_t index)
+{
+    Connection& connection = *m_connections[index];
+    connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (connection.fd == -1) {
+        SIMPLEIM_LOG_ERROR << "Could not create socket. errno=" << errno;
+        return false;
+    }
+
+    sockaddr_in serverAddr{};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(m_config.port);
+    serverAddr.sin_addr.s_addr = inet_addr(m_config.host.c_str());
+
+    connection.connectStarted = Clock::now();
+    if (connect(connection.fd, reinterpret_cast<sockaddr*>(&serverAddr), sizeof(serverAddr)) == -1
+        && errno != EINPROGRESS) {
+        SIMPLEIM_LOG_ERROR << "Could not connect to server. errno=" << errno;
+        return false;
+    }
+
+    // Writable once the connection is up, and on every later edge
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = index;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, connection.fd, &event) == -1) {
+        SIMPLEIM_LOG_ERROR << "epoll_ctl failed. errno=" << errno;
+        return false;
+    }
+    return true;
+}
+
+void LoadGenerator::startDueConnections(Clock::time_point begin)
+{
+    size_t due = m_connections.size();
+    if (m_config.connectRate > 0) {
+        const double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+        due = std::min(due, static_cast<size_t>(elapsed * m_config.connectRate) + 1);
+    }
+
+    for (; m_started < due; ++m_started) {
+        if (!startConnection(m_started)) {
+            close(*m_connections[m_started], true);
+        }
+    }
+}
+
+void LoadGenerator::poll(int timeoutMs)
+{
+    epoll_event events[kMaxEvents];
+    const int count = epoll_wait(m_epollFd, events, kMaxEvents, timeoutMs);
+    for (int i = 0; i < count; ++i) {
+        handleEvents(*m_connections[events[i].data.u64], events[i].events);
+    }
+}
+
+void LoadGenerator::handleEvents(Connection& connection, uint32_t events)
+{
+    if (connection.state == State::Closed) {
+        return;
+    }
+
+    if (connection.state == State::Connecting) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if ((events & (EPOLLERR | EPOLLHUP))
+            || getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0) {
+            close(connection, true);
+            return;
+        }
+        if (!(events & EPOLLOUT)) {
+            return;
+        }
+        onConnected(connection);
+    }
+    else if ((events & EPOLLOUT) && connection.writeBlocked) {
+        connection.writeBlocked = false;
+        if (!flush(connection)) {
+            close(connection, connection.state != State::Ready);
+            return;
+        }
+    }
+
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !readFrames(connection)) {
+        close(connection, connection.state != State::Ready);
+    }
+}
+
+void LoadGenerator::onConnected(Connection& connection)
+{
+    connection.connected = Clock::now();
+    m_report.connect.record(connection.connected - connection.connectStarted);
+    connection.state = State::LoggingOn;
+    sendFrame(connection, Message(MessageType::UserLogon, connection.name));
+}
+
+bool LoadGenerator::readFrames(Connection& connection)
+{
+    while (true) {
+        char* buffer = connection.decoder.prepare(kReadChunkSize);
+        const ssize_t received = recv(connection.fd, buffer, kReadChunkSize, 0);
+        if (received > 0) {
+            connection.decoder.commit(static_cast<size_t>(received));
+            m_report.bytesReceived += static_cast<uint64_t>(received);
+            continue;
+        }
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return false; // closed or failed; the frames already here are dropped with it
+        }
+        break;
+    }
+
+    Frame frame;
+    FrameDecoder::Result result;
+    while ((result = connection.decoder.next(frame)) == FrameDecoder::Result::Frame) {
+        handleFrame(connection, frame.type, frame.payload);
+        if (connection.state == State::Closed) {
+            return true;
+        }
+    }
+    return result == FrameDecoder::Result::Incomplete;
+}
+
+void LoadGenerator::handleFrame(Connection& connection, MessageType type, std::string_view payload)
+{
+    switch (type) {
+        case MessageType::LoginSuccess:
+            m_report.login.record(Clock::now() - connection.connected);
+            connection.state = State::Ready;
+            connection.readyIndex = m_ready.size();
+            m_ready.push_back(connection.index);
+            ++m_settled;
+            break;
+        case MessageType::LoginFailure:
+            SIMPLEIM_LOG_WARNING << "Logon of '" << connection.name << "' refused: " << payload;
+            close(connection, true);
+            break;
+        case MessageType::ChatMessageBroadcast:
+            recordLatency(payload);
+            break;
+        default:
+            break; // presence and rooms are not part of the load
+    }
+}
+
+void LoadGenerator::recordLatency(std::string_view payload)
+{
+    // "sender: <tag><ns>|..."; DM confirmations and other system lines have no tag
+    const size_t separator = payload.find(": ");
+    if (separator == std::string_view::npos || separator + 3 > payload.size()) {
+        return;
+    }
+
+    const char tag = payload[separator + 2];
+    if (tag != kBroadcastTag && tag != kDirectTag) {
+        return;
+    }
+
+    int64_t sentNs = 0;
+    const char* digits = payload.data() + separator + 3;
+    const auto result = std::from_chars(digits, payload.data() + payload.size(), sentNs);
+    if (result.ec != std::errc()) {
+        return;
+    }
+
+    const std::chrono::nanoseconds latency(nowNs() - sentNs);
+    (tag == kBroadcastTag ? m_report.broadcast : m_report.direct).record(latency);
+}
+
+void LoadGenerator::sendFrame(Connection& connection, const Message& message)
+{
+    const size_t offset = connection.outbound.size();
+    connection.outbound.resize(offset + message.encoded_size());
+    message.encode_into(connection.outbound.data() + offset, message.encoded_size());
+    m_report.bytesSent += message.encoded_size();
+
+    if (!connection.writeBlocked && !flush(connection)) {
+        close(connection, connection.state != State::Ready);
+    }
+}
+
+bool LoadGenerator::flush(Connection& connection)
+{
+    while (connection.outboundOffset < connection.outbound.size()) {
+        const ssize_t sent = send(connection.fd, connection.outbound.data() + connection.outboundOffset,
+                                  connection.outbound.size() - connection.outboundOffset, MSG_NOSIGNAL);
+        if (sent > 0) {
+            connection.outboundOffset += static_cast<size_t>(sent);
+            continue;
+        }
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            connection.writeBlocked = true; // EPOLLOUT resumes it
+            return true;
+        }
+        return false;
+    }
+
+    connection.outbound.clear();
+    connection.outboundOffset = 0;
+    return true;
+}
+
+void LoadGenerator::close(Connection& connection, bool failed)
+{
+    if (connection.state == State::Closed) {
+        return;
+    }
+
+    if (connection.state == State::Ready) {
+        // Swap out of the ready list
+        const size_t last = m_ready.back();
+        m_ready[connection.readyIndex] = last;
+        m_connections[last]->readyIndex = connection.readyIndex;
+        m_ready.pop_back();
+        ++m_report.disconnected;
+    }
+    else {
+        ++m_settled;
+    }
+    if (failed) {
+        ++m_report.failed;
+    }
+
+    connection.state = State::Closed;
+    if (connection.fd > -1) {
+        ::close(connection.fd); // also drops it from the epoll set
+        connection.fd = -1;
+    }
+    connection.outbound.clear();
+    connection.outboundOffset = 0;
+}
+
+void LoadGenerator::sendBroadcast()
+{
+    Connection* sender = randomReady();
+    char digits[24];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), nowNs());
+
+    // Everyone logged on now should get it, the sender included
+    m_report.expectedDeliveries += m_ready.size();
+    ++m_report.broadcastsSent;
+    sendFrame(*sender, Message(MessageType::ChatMessageBroadcast,
+        {std::string_view(&kBroadcastTag, 1), std::string_view(digits, result.ptr - digits), "|", m_padding}));
+}
+
+void LoadGenerator::sendDirectMessage()
+{
+    Connection* sender = randomReady();
+    Connection* target = sender;
+    while (target == sender) {
+        target = randomReady();
+    }
+
+    char digits[24];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), nowNs());
+
+    ++m_report.expectedDeliveries;
+    ++m_report.directSent;
+    sendFrame(*sender, Message(MessageType::ChatMessageDM,
+        {target->name, ":", std::string_view(&kDirectTag, 1), std::string_view(digits, result.ptr - digits), "|",
+         m_padding}));
+}
+
+LoadGenerator::Connection* LoadGenerator::randomReady()
+{
+    std::uniform_int_distribution<size_t> pick(0, m_ready.size() - 1);
+    return m_connections[m_ready[pick(m_random)]].get();
+}
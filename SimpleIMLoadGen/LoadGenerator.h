@@ -0,0 +1,97 @@
+#pragma once
+
+#include "LoadGenConfig.h"
+#include "LoadReport.h"
+
+#include <FrameDecoder.h>
+#include <Message.h>
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Simulates many SimpleIM clients from one thread. Every connection is a
+// non-blocking socket on a single epoll instance, so thousands cost a
+// descriptor and a buffer each rather than a SimpleIMClient and its thread.
+// Chat payloads carry their send time, which the receiving side turns into an
+// end-to-end latency sample.
+class LoadGenerator
+{
+public:
+    explicit LoadGenerator(const LoadGenConfig& config);
+    ~LoadGenerator();
+
+    LoadGenerator(const LoadGenerator&) = delete;
+    LoadGenerator& operator=(const LoadGenerator&) = delete;
+
+    // Connects and logs every client on, drives the message load for the
+    // configured duration, then waits briefly for messages still in flight.
+    // False if nothing could be started.
+    bool run();
+
+    LoadReport& report() { return m_report; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    enum class State
+    {
+        Connecting,
+        LoggingOn,
+        Ready,
+        Closed
+    };
+
+    struct Connection
+    {
+        size_t index = 0;
+        int fd = -1;
+        std::string name;
+        State state = State::Connecting;
+        Clock::time_point connectStarted;
+        Clock::time_point connected;
+
+        std::string outbound;
+        size_t outboundOffset = 0;
+        bool writeBlocked = false;
+
+        FrameDecoder decoder;
+        // Position in m_ready while Ready.
+        size_t readyIndex = 0;
+    };
+
+    LoadGenConfig m_config;
+    LoadReport m_report;
+    int m_epollFd;
+
+    std::vector<std::unique_ptr<Connection>> m_connections;
+    size_t m_started;
+    size_t m_settled; // logged on or failed
+    std::vector<size_t> m_ready;
+
+    std::mt19937 m_random;
+    std::string m_padding;
+
+    bool startConnection(size_t index);
+    void startDueConnections(Clock::time_point begin);
+
+    // Waits up to timeoutMs for events and handles them.
+    void poll(int timeoutMs);
+    void handleEvents(Connection& connection, uint32_t events);
+    void onConnected(Connection& connection);
+    bool readFrames(Connection& connection);
+    void handleFrame(Connection& connection, MessageType type, std::string_view payload);
+    void recordLatency(std::string_view payload);
+
+    void sendFrame(Connection& connection, const Message& message);
+    bool flush(Connection& connection);
+    void close(Connection& connection, bool failed);
+
+    void sendBroadcast();
+    void sendDirectMessage();
+    Connection* randomReady();
+};
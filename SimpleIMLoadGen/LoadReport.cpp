@@ -0,0 +1,100 @@
+#include "LoadReport.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+constexpr double kNanosecondsPerMicrosecond = 1000.0;
+
+struct Row
+{
+    const char* metric;
+    size_t count;
+    double rate;            // per second of load; negative when not a rate
+    LatencyRecorder* latency;
+};
+
+std::vector<Row> latencyRows(LoadReport& report)
+{
+    const double seconds = report.loadSeconds > 0 ? report.loadSeconds : 1;
+    return {
+        {"connect", report.connect.count(), -1, &report.connect},
+        {"login", report.login.count(), -1, &report.login},
+        {"broadcast", report.broadcast.count(), report.broadcast.count() / seconds, &report.broadcast},
+        {"dm", report.direct.count(), report.direct.count() / seconds, &report.direct},
+    };
+}
+}
+
+double LatencyRecorder::percentileUs(double quantile)
+{
+    if (m_samples.empty()) {
+        return 0;
+    }
+    if (!m_sorted) {
+        std::sort(m_samples.begin(), m_samples.end());
+        m_sorted = true;
+    }
+
+    // Nearest rank
+    const size_t rank = static_cast<size_t>(quantile * static_cast<double>(m_samples.size() - 1) + 0.5);
+    return static_cast<double>(m_samples[std::min(rank, m_samples.size() - 1)]) / kNanosecondsPerMicrosecond;
+}
+
+double LatencyRecorder::maxUs()
+{
+    return percentileUs(1.0);
+}
+
+void LoadReport::print()
+{
+    const uint64_t delivered = broadcast.count() + direct.count();
+
+    std::printf("\n%zu of %zu clients logged on (%zu failed, %zu disconnected during the run)\n",
+                loggedOn, connections, failed, disconnected);
+    std::printf("Load: %.1f s, %llu broadcasts and %llu DMs sent, %.1f MB out, %.1f MB in\n\n", loadSeconds,
+                static_cast<unsigned long long>(broadcastsSent), static_cast<unsigned long long>(directSent),
+                bytesSent / 1e6, bytesReceived / 1e6);
+
+    std::printf("%-10s %10s %12s %10s %10s %10s %10s\n", "metric", "count", "per second", "p50 us", "p99 us",
+                "p99.9 us", "max us");
+    for (const Row& row : latencyRows(*this)) {
+        char rate[32] = "-";
+        if (row.rate >= 0) {
+            std::snprintf(rate, sizeof(rate), "%.1f", row.rate);
+        }
+        std::printf("%-10s %10zu %12s %10.1f %10.1f %10.1f %10.1f\n", row.metric, row.count, rate,
+                    row.latency->percentileUs(0.5), row.latency->percentileUs(0.99),
+                    row.latency->percentileUs(0.999), row.latency->maxUs());
+    }
+
+    std::printf("\nDelivered %llu of %llu expected chat messages (%.2f%%)\n",
+                static_cast<unsigned long long>(delivered), static_cast<unsigned long long>(expectedDeliveries),
+                expectedDeliveries > 0 ? 100.0 * delivered / expectedDeliveries : 100.0);
+}
+
+bool LoadReport::writeCsv(const std::string& path)
+{
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+
+    const double seconds = loadSeconds > 0 ? loadSeconds : 1;
+    std::fprintf(file, "metric,count,per_second,p50_us,p99_us,p999_us,max_us\n");
+    for (const Row& row : latencyRows(*this)) {
+        char rate[32] = "";
+        if (row.rate >= 0) {
+            std::snprintf(rate, sizeof(rate), "%.3f", row.rate);
+        }
+        std::fprintf(file, "%s,%zu,%s,%.3f,%.3f,%.3f,%.3f\n", row.metric, row.count, rate,
+                     row.latency->percentileUs(0.5), row.latency->percentileUs(0.99),
+                     row.latency->percentileUs(0.999), row.latency->maxUs());
+    }
+    std::fprintf(file, "sent,%llu,%.3f,,,,\n", static_cast<unsigned long long>(broadcastsSent + directSent),
+                 (broadcastsSent + directSent) / seconds);
+    std::fprintf(file, "expected_deliveries,%llu,%.3f,,,,\n", static_cast<unsigned long long>(expectedDeliveries),
+                 expectedDeliveries / seconds);
+
+    return std::fclose(file) == 0;
+}
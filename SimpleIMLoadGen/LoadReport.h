@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Latency samples; percentiles sort them on first use after a change.
+class LatencyRecorder
+{
+public:
+    void record(std::chrono::nanoseconds latency) { m_samples.push_back(latency.count()); m_sorted = false; }
+
+    size_t count() const { return m_samples.size(); }
+
+    // quantile in [0, 1]; 0 when there are no samples.
+    double percentileUs(double quantile);
+    double maxUs();
+
+private:
+    std::vector<int64_t> m_samples;
+    bool m_sorted = true;
+};
+
+struct LoadReport
+{
+    size_t connections = 0;
+    size_t loggedOn = 0;
+    size_t failed = 0;        // refused, rejected at logon or timed out
+    size_t disconnected = 0;  // dropped by the server after logging on
+
+    double loadSeconds = 0;
+    uint64_t broadcastsSent = 0;
+    uint64_t directSent = 0;
+    uint64_t bytesSent = 0;
+    uint64_t bytesReceived = 0;
+    // Deliveries the sends called for, each broadcast counting every client
+    // logged on when it was sent.
+    uint64_t expectedDeliveries = 0;
+
+    LatencyRecorder connect;   // connect() to the connection being writable
+    LatencyRecorder login;     // connected to LoginSuccess
+    LatencyRecorder broadcast; // send to receipt, once per receiving client
+    LatencyRecorder direct;
+
+    void print();
+    bool writeCsv(const std::string& path);
+};
@@ -0,0 +1,122 @@
+#include "LoadGenConfig.h"
+#include "LoadGenerator.h"
+
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <Log.h>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace {
+// Each simulated client holds a descriptor, so lift the soft limit as far as allowed.
+void raiseFileDescriptorLimit() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            SIMPLEIM_LOG_WARNING << "Could not raise open file limit.";
+        }
+    }
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --host <address>     Server IPv4 address (default 127.0.0.1)\n"
+              << "  --port <port>        Server port (default 8989)\n"
+              << "  --connections <count>\n"
+              << "                       Simulated clients (default 1000)\n"
+              << "  --connect-rate <per second>\n"
+              << "                       Connection attempts started per second (default 0, all at once)\n"
+              << "  --login-timeout-s <s>  Time allowed for connecting and logging on (default 30)\n"
+              << "  --duration-s <s>     Length of the message load (default 10)\n"
+              << "  --broadcast-rate <per second>\n"
+              << "                       Broadcasts sent per second across all clients (default 10)\n"
+              << "  --dm-rate <per second>\n"
+              << "                       Direct messages sent per second across all clients (default 100)\n"
+              << "  --payload-bytes <bytes>\n"
+              << "                       Chat payload size (default 64)\n"
+              << "  --user-prefix <name> Usernames are this and the client's index (default load<pid>_)\n"
+              << "  --csv <path>         Also write the results to this CSV file\n";
+}
+
+bool parseArguments(int argc, char *argv[], LoadGenConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string option = argv[i];
+        if (option == "--help" || option == "-h" || i + 1 >= argc) {
+            return false;
+        }
+
+        const std::string argument = argv[++i];
+        const unsigned long value = std::strtoul(argument.c_str(), nullptr, 10);
+        if (option == "--host") {
+            config.host = argument;
+        }
+        else if (option == "--port" && value > 0 && value <= 65535) {
+            config.port = static_cast<uint16_t>(value);
+        }
+        else if (option == "--connections" && value > 0) {
+            config.connections = value;
+        }
+        else if (option == "--connect-rate") {
+            config.connectRate = value;
+        }
+        else if (option == "--login-timeout-s" && value > 0) {
+            config.loginTimeout = std::chrono::seconds(value);
+        }
+        else if (option == "--duration-s" && value > 0) {
+            config.duration = std::chrono::seconds(value);
+        }
+        else if (option == "--broadcast-rate") {
+            config.broadcastRate = std::strtod(argument.c_str(), nullptr);
+        }
+        else if (option == "--dm-rate") {
+            config.directRate = std::strtod(argument.c_str(), nullptr);
+        }
+        else if (option == "--payload-bytes") {
+            config.payloadBytes = value;
+        }
+        else if (option == "--user-prefix" && !argument.empty()) {
+            config.userPrefix = argument;
+        }
+        else if (option == "--csv") {
+            config.csvPath = argument;
+        }
+        else {
+            std::cerr << "Invalid option: " << option << " " << argv[i] << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::signal(SIGPIPE, SIG_IGN);
+    raiseFileDescriptorLimit();
+
+    LoadGenConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (config.userPrefix.empty()) {
+        // Unique per run, so two generators can share a server
+        config.userPrefix = "load" + std::to_string(getpid()) + "_";
+    }
+
+    LoadGenerator generator(config);
+    const bool ran = generator.run();
+    Log::flush();
+
+    LoadReport& report = generator.report();
+    report.print();
+    if (!config.csvPath.empty() && !report.writeCsv(config.csvPath)) {
+        std::cerr << "Could not write " << config.csvPath << std::endl;
+        return 1;
+    }
+
+    return ran ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+#include "ChatStream.h"
+
+#include <FrameDecoder.h>
+
+#include <climits>
+
+ChatStream::ChatStream(uint64_t id, size_t retainedBytes)
+    : m_id(id)
+    , m_retainedBytes(retainedBytes)
+    , m_nextSequence(1)
+    , m_heldBytes(0)
+    , m_parked(false)
+{}
+
+uint64_t ChatStream::nextSequence() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nextSequence;
+}
+
+void ChatStream::record(const std::shared_ptr<const void>& owner, std::string_view frames)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    recordLocked(owner, frames);
+}
+
+void ChatStream::recordLocked(const std::shared_ptr<const void>& owner, std::string_view frames)
+{
+    ::Frame decoded;
+    size_t frameSize = 0;
+    while (FrameDecoder::decode(frames.data(), frames.size(), UINT32_MAX, decoded, frameSize)
+           == FrameDecoder::Result::Frame) {
+        if (isChat(decoded.type)) {
+            m_held.push_back(Frame{owner, frames.substr(0, frameSize)});
+            m_heldBytes += frameSize;
+            ++m_nextSequence;
+        }
+        frames.remove_prefix(frameSize);
+    }
+
+    while (m_heldBytes > m_retainedBytes) {
+        m_heldBytes -= m_held.front().bytes.size();
+        m_held.pop_front();
+    }
+}
+
+void ChatStream::acknowledge(uint64_t sequence)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t firstHeld = m_nextSequence - m_held.size();
+    while (!m_held.empty() && firstHeld <= sequence) {
+        m_heldBytes -= m_held.front().bytes.size();
+        m_held.pop_front();
+        ++firstHeld;
+    }
+}
+
+void ChatStream::park(std::chrono::steady_clock::time_point until)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_parked = true;
+    m_parkedUntil = until;
+}
+
+bool ChatStream::expired(std::chrono::steady_clock::time_point now) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_parked && m_parkedUntil <= now;
+}
+
+bool ChatStream::resume(uint64_t received, std::chrono::steady_clock::time_point now, std::vector<Frame>& frames)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const uint64_t firstHeld = m_nextSequence - m_held.size();
+    if (!m_parked || m_parkedUntil <= now || received >= m_nextSequence || received + 1 < firstHeld) {
+        return false;
+    }
+
+    // What the client has is acknowledged by asking; the rest goes out again
+    const size_t missed = static_cast<size_t>(m_nextSequence - 1 - received);
+    frames.assign(m_held.end() - static_cast<std::ptrdiff_t>(missed), m_held.end());
+    m_held.clear();
+    m_heldBytes = 0;
+    m_nextSequence = received + 1;
+    m_parked = false;
+    return true;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Message.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+// The chat frames one user has been sent, numbered in the order they went out,
+// with the newest of them held for resending. A client whose connection drops
+// logs on again naming the last number it got, and the stream hands back what
+// came after, so a network blip costs the frames it lost rather than a history
+// replay.
+//
+// A stream whose connection is gone is parked for the resume window. The
+// broadcasts its user would have been sent meanwhile are not recorded into
+// it; the manager adds them from the reactor's recent ones on resume.
+// Thread-safe.
+class ChatStream
+{
+public:
+    // A frame held for resending and what keeps its bytes alive.
+    struct Frame
+    {
+        std::shared_ptr<const void> owner;
+        std::string_view bytes;
+    };
+
+    // Where a client asks to resume: the stream, and the last frame it got.
+    struct Position
+    {
+        uint64_t stream;
+        uint64_t received;
+    };
+
+    // Held frames past retainedBytes go, oldest first, acknowledged or not.
+    ChatStream(uint64_t id, size_t retainedBytes);
+
+    ChatStream(const ChatStream&) = delete;
+    ChatStream& operator=(const ChatStream&) = delete;
+
+    // The frames a stream numbers; anything else passes through unnumbered.
+    static bool isChat(MessageType type)
+    {
+        return type == MessageType::ChatMessageBroadcast || type == MessageType::ChatMessageDM
+            || type == MessageType::RoomMessage;
+    }
+
+    uint64_t id() const { return m_id; }
+    // The number the next chat frame recorded takes.
+    uint64_t nextSequence() const;
+
+    // Numbers the chat frames among frames, which may hold several back to
+    // back, and holds on to them.
+    void record(const std::shared_ptr<const void>& owner, std::string_view frames);
+
+    // The client has every frame up to sequence; they need not be held.
+    void acknowledge(uint64_t sequence);
+
+    void park(std::chrono::steady_clock::time_point until);
+    bool expired(std::chrono::steady_clock::time_point now) const;
+
+    // Takes a parked stream back for a client that got every frame up to
+    // received. The frames past it are handed back oldest first, and the
+    // stream rewinds so they take the same numbers as they go out again.
+    // False, and the stream is left as it was, if it is not parked, or
+    // received is ahead of it, or any frame past it is no longer held.
+    bool resume(uint64_t received, std::chrono::steady_clock::time_point now, std::vector<Frame>& frames);
+
+private:
+    const uint64_t m_id;
+    const size_t m_retainedBytes;
+
+    mutable std::mutex m_mutex;
+    uint64_t m_nextSequence;
+    // Numbered m_nextSequence - m_held.size() on, without gaps.
+    std::deque<Frame> m_held;
+    size_t m_heldBytes;
+    bool m_parked;
+    std::chrono::steady_clock::time_point m_parkedUntil;
+
+    // Caller holds m_mutex.
+    void recordLocked(const std::shared_ptr<const void>& owner, std::string_view frames);
+};
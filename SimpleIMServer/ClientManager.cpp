@@ -1,231 +1,611 @@
 #include "ClientManager.h"
 
 #include <functional>
-#include <iostream>
+#include <Log.h>
 #include <unistd.h>
 #include <algorithm>
-#include <sstream>
+#include <iterator>
+#include <string>
+
+namespace {
+// Replayed history is queued on a connection about this much at a time.
+constexpr size_t kReplayBatchBytes = 256 * 1024;
+}
 
 
-ClientManager::ClientManager()
+ClientManager::ClientManager(const ServerConfig& config)
+    : m_presenceInterval(config.presenceInterval)
+    , m_presencePending(false)
+    , m_presenceStop(false)
+    , m_nextShard(0)
+    , m_outboundLimits(config.outboundLimits)
+    , m_replayCount(config.history.replayCount)
+    , m_searchResults(config.history.searchResults)
+    , m_historyStop(false)
+    , m_resume(config.resume)
+    // From the clock, so a stream from before a restart never matches a new one
+    , m_nextStreamId(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count()))
+    , m_lastBroadcast(0)
 {
+    if (!config.history.directory.empty()) {
+        m_history = HistoryLog::open(config.history);
+        if (!m_history) {
+            SIMPLEIM_LOG_WARNING << "Running without history.";
+        }
+        else {
+            if (config.history.searchSegmentRecords > 0) {
+                m_search = SearchIndex::open(*m_history, config.history.directory + "/index",
+                                             config.history.searchSegmentRecords);
+            }
+            m_historyThread = std::thread([this]() { runHistory(); });
+        }
+    }
+
+    if (!config.offline.directory.empty()) {
+        m_offline = OfflineStore::open(config.offline);
+        if (!m_offline) {
+            SIMPLEIM_LOG_WARNING << "Running without offline messages.";
+        }
+    }
+
+    const size_t reactorCount = std::max<size_t>(1, config.reactorCount);
+    m_reactors.reserve(reactorCount);
+    for (size_t i = 0; i < reactorCount; ++i) {
+        m_reactors.push_back(Reactor::create(this, config.handshakeTimeout, config.flushDelay,
+                                             m_resume.window.count() > 0 ? m_resume.retainedBytes : 0));
+        m_reactors.back()->start();
+    }
+    SIMPLEIM_LOG_INFO << "Started " << reactorCount << " " << m_reactors.front()->backendName()
+                      << " reactor(s).";
+
+    if (m_presenceInterval.count() > 0) {
+        m_presenceThread = std::thread([this]() { runPresence(); });
+    }
 }
 
 ClientManager::~ClientManager()
 {
+    {
+        std::lock_guard<std::mutex> lock(m_historyMutex);
+        m_historyStop = true;
+    }
+    m_historyWake.notify_one();
+    if (m_historyThread.joinable()) {
+        m_historyThread.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_presenceMutex);
+        m_presenceStop = true;
+    }
+    m_presenceWake.notify_one();
+    if (m_presenceThread.joinable()) {
+        m_presenceThread.join();
+    }
+
+    for (auto& reactor : m_reactors) {
+        reactor->stop();
+    }
+
+    // The writer's last whenDurable callbacks still queue replays here
+    m_search.reset();
+    m_history.reset();
 }
 
 void ClientManager::addConnectedClient(int clientSock)
 {
-    ServerClient *client = new ServerClient(clientSock, std::bind(&ClientManager::onClientDisconnected, this, std::placeholders::_1));
-    
-    bool loginSuccessful = client->handleLogon(this);
-    
-    if(loginSuccessful && !client->getUserId().empty()) {
-        client->run(this);
-        
-        // Register the client and notify others
-        {
-            std::lock_guard<std::mutex> lock(m_clientsMutex);
-            m_connectedClients.emplace(client->getUserId(), std::unique_ptr<ServerClient>(client));
-        }
-        
-        // Broadcast to other clients that a new user connected
-        broadcastToOthers(client->getUserId(), MessageType::ClientConnected, client->getUserId());
-        
-        std::cout << "Client '" << client->getUserId() << "' connected successfully." << std::endl;
-    }
-    else {
-        std::cout << "Client connection failed during login." << std::endl;
-        close(clientSock);
-        delete client;
-        client = nullptr;
+    addConnectedClient(clientSock, m_nextShard.fetch_add(1, std::memory_order_relaxed) % m_reactors.size());
+}
+
+void ClientManager::addConnectedClient(int clientSock, size_t shard)
+{
+    auto client = std::make_unique<ServerClient>(clientSock,
+        std::bind(&ClientManager::onClientDisconnected, this, std::placeholders::_1), shard,
+        m_outboundLimits);
+    m_reactors[shard]->addClient(std::move(client));
+}
+
+void ClientManager::onClientLogon(std::string_view userId)
+{
+    // Announced with the next presence batch
+    m_presence.join(userId);
+    presenceChanged();
+
+    SIMPLEIM_LOG_INFO << "Client '" << userId << "' connected successfully.";
+}
+
+void ClientManager::replayHistory(UserHandle user, std::string_view userId, std::optional<uint64_t> afterSequence)
+{
+    if (!m_history) {
+        return;
     }
+
+    // Up to everything appended before now, once it is synced. A broadcast
+    // that missed the user live was appended before it was sent, so it is
+    // covered; what follows reaches them live. A message sent as they log on
+    // may turn up both ways.
+    m_history->whenDurable([this, user, userId = std::string(userId), afterSequence](uint64_t lastSequence) mutable {
+        uint64_t nextSequence = 1;
+        if (afterSequence) {
+            nextSequence = *afterSequence + 1;
+        }
+        else if (lastSequence > m_replayCount) {
+            nextSequence = lastSequence - m_replayCount + 1;
+        }
+        queueReplay(ReplayRequest{user, std::move(userId), nextSequence, lastSequence});
+    });
 }
 
-bool ClientManager::isUsernameAvailable(const std::string& username)
+void ClientManager::queueReplay(ReplayRequest request)
 {
-    std::lock_guard<std::mutex> lock(m_clientsMutex);
-    return m_connectedClients.find(username) == m_connectedClients.end();
+    {
+        std::lock_guard<std::mutex> lock(m_historyMutex);
+        m_replayRequests.push_back(std::move(request));
+    }
+    m_historyWake.notify_one();
 }
 
-void ClientManager::registerClient(const std::string& userId, std::unique_ptr<ServerClient> client)
+void ClientManager::replayBatch(ReplayRequest& request)
 {
-    std::lock_guard<std::mutex> lock(m_clientsMutex);
-    m_connectedClients.emplace(userId, std::move(client));
+    size_t shard = 0;
+    if (!m_users.shardOf(request.user, shard)) {
+        return; // logged off mid-replay
+    }
+
+    auto batch = std::make_shared<HistoryLog::Batch>();
+    m_history->collect(request.userId, request.nextSequence, request.lastSequence, kReplayBatchBytes, *batch);
+
+    // The next batch is read once this one has mostly gone out
+    std::function<void()> next;
+    if (batch->nextSequence <= request.lastSequence) {
+        request.nextSequence = batch->nextSequence;
+        next = [this, request]() { queueReplay(request); };
+    }
+    else {
+        SharedFrame end = Message::encode_shared(MessageType::HistoryEnd, std::to_string(request.lastSequence));
+        batch->frames.push_back(*end);
+        batch->owners.push_back(std::move(end));
+    }
+    m_reactors[shard]->sendHistory(request.user, std::move(batch), std::move(next));
 }
 
-void ClientManager::broadcastMessage(MessageType type, const std::string& data)
+void ClientManager::search(UserHandle user, std::string_view userId, std::string_view query)
 {
-    std::vector<ServerClient*> recipients;
+    if (!m_search) {
+        sendToUser(user, MessageType::ChatMessageBroadcast, "System: Search is not available");
+        sendToUser(user, MessageType::SearchEnd, "0");
+        return;
+    }
+
     {
-        std::lock_guard<std::mutex> lock(m_clientsMutex);
-        recipients.reserve(m_connectedClients.size());
-        for (auto& clientPair : m_connectedClients) {
-            recipients.push_back(clientPair.second.get());
+        std::lock_guard<std::mutex> lock(m_historyMutex);
+        m_searchRequests.push_back(SearchRequest{user, std::string(userId), std::string(query)});
+    }
+    m_historyWake.notify_one();
+}
+
+void ClientManager::answerSearch(const SearchRequest& request)
+{
+    std::vector<Message> replies;
+    size_t replyBytes = 0;
+    for (uint64_t sequence : m_search->find(request.query, request.userId, m_searchResults)) {
+        const std::vector<HistoryLog::Entry> entries = m_history->read(sequence, 1);
+        if (entries.empty() || entries.front().sequence != sequence) {
+            continue;
         }
+
+        // "timestamp:" then the frame's own payload, "from: text"
+        const HistoryLog::Entry& entry = entries.front();
+        const std::string timestamp = std::to_string(entry.timestamp);
+        const std::string_view payload = std::string_view(entry.frame).substr(MessageHeader::kWireSize);
+        replies.emplace_back(MessageType::SearchResult, std::initializer_list<std::string_view>{timestamp, ":", payload});
+        replyBytes += replies.back().encoded_size();
     }
+    replies.emplace_back(MessageType::SearchEnd, std::to_string(replies.size()));
+    replyBytes += replies.back().encoded_size();
 
-    for (auto* recipient : recipients) {
-        recipient->sendMessage(type, data);
+    // One buffer, so the answer goes out in one write
+    auto frames = std::make_shared<std::string>(replyBytes, '\0');
+    char* out = frames->data();
+    for (const Message& reply : replies) {
+        out += reply.encode_into(out, frames->data() + frames->size() - out);
     }
+    sendFrameToUser(request.user, std::move(frames));
 }
 
-void ClientManager::broadcastToOthers(const std::string& excludeUserId, MessageType type, const std::string& data)
+void ClientManager::runHistory()
 {
-    std::vector<ServerClient*> recipients;
-    {
-        std::lock_guard<std::mutex> lock(m_clientsMutex);
-        recipients.reserve(m_connectedClients.size());
-        for (auto& clientPair : m_connectedClients) {
-            if (clientPair.first != excludeUserId) {
-                recipients.push_back(clientPair.second.get());
-            }
+    std::unique_lock<std::mutex> lock(m_historyMutex);
+    while (true) {
+        m_historyWake.wait(lock, [this]() {
+            return !m_replayRequests.empty() || !m_searchRequests.empty() || m_historyStop;
+        });
+        if (m_historyStop) {
+            break;
+        }
+
+        // Searches first; a replay batch can wait for the next turn
+        if (!m_searchRequests.empty()) {
+            SearchRequest request = std::move(m_searchRequests.front());
+            m_searchRequests.pop_front();
+            lock.unlock();
+            answerSearch(request);
+        }
+        else {
+            ReplayRequest request = std::move(m_replayRequests.front());
+            m_replayRequests.pop_front();
+            lock.unlock();
+            replayBatch(request);
         }
+        lock.lock();
     }
+}
 
-    for (auto* recipient : recipients) {
-        recipient->sendMessage(type, data);
+SharedFrame ClientManager::takeOfflineMessages(std::string_view userId)
+{
+    return m_offline ? m_offline->take(userId) : nullptr;
+}
+
+std::shared_ptr<ChatStream> ClientManager::openStream(UserHandle user, size_t shard, std::string_view userId,
+                                                      const std::optional<ChatStream::Position>& resume,
+                                                      std::vector<ChatStream::Frame>& missed,
+                                                      uint64_t& resentBroadcasts)
+{
+    if (m_resume.window.count() == 0) {
+        return nullptr;
     }
+
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(m_streamsMutex);
+    dropExpiredStreams(now);
+
+    // The stream holds what went out before it was parked, and this reactor
+    // the broadcasts since; one that has queued fewer than the old one had
+    // must not send the rest again
+    auto streamIt = m_streams.find(userId);
+    std::vector<ChatStream::Frame> broadcasts;
+    if (resume && streamIt != m_streams.end() && streamIt->second.user == kInvalidUserHandle
+        && streamIt->second.stream->id() == resume->stream
+        && m_reactors[shard]->recentBroadcasts(streamIt->second.parkedAfter, streamIt->second.parkedUser, broadcasts)
+        && streamIt->second.stream->resume(resume->received, now, missed)) {
+        StreamEntry& entry = streamIt->second;
+        entry.user = user;
+        missed.insert(missed.end(), std::make_move_iterator(broadcasts.begin()),
+                      std::make_move_iterator(broadcasts.end()));
+        resentBroadcasts = std::max(entry.parkedAfter, m_reactors[shard]->lastBroadcast());
+        SIMPLEIM_LOG_INFO << "Resuming chat stream " << resume->stream << " for '" << userId << "' after "
+                          << resume->received << " with " << missed.size() << " frame(s) missed.";
+        return entry.stream;
+    }
+
+    // A stream that cannot be resumed is dropped, with what it holds
+    auto stream = std::make_shared<ChatStream>(m_nextStreamId.fetch_add(1, std::memory_order_relaxed),
+                                               m_resume.retainedBytes);
+    m_streams.insert_or_assign(std::string(userId), StreamEntry{user, stream, kInvalidUserHandle, 0});
+    return stream;
 }
 
-std::vector<std::string> ClientManager::getConnectedUsernames()
+void ClientManager::parkStream(UserHandle user, size_t shard, const std::string& userId)
 {
-    std::lock_guard<std::mutex> lock(m_clientsMutex);
-    std::vector<std::string> usernames;
-    usernames.reserve(m_connectedClients.size());
-    
-    for(const auto& clientPair : m_connectedClients) {
-        usernames.push_back(clientPair.first);
+    // Everything up to here was queued on the connection, and is in its stream
+    const uint64_t delivered = m_reactors[shard]->lastBroadcast();
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(m_streamsMutex);
+    dropExpiredStreams(now);
+
+    // Not if a newer logon replaced it already
+    auto streamIt = m_streams.find(userId);
+    if (streamIt == m_streams.end() || streamIt->second.user != user) {
+        return;
     }
-    
-    return usernames;
+
+    StreamEntry& entry = streamIt->second;
+    entry.user = kInvalidUserHandle;
+    entry.parkedUser = user;
+    entry.parkedAfter = delivered;
+    entry.stream->park(now + m_resume.window);
+    m_parkedNames.emplace_back(now + m_resume.window, userId);
 }
 
-std::string ClientManager::serializeUserList()
+void ClientManager::dropExpiredStreams(std::chrono::steady_clock::time_point now)
 {
-    std::vector<std::string> usernames = getConnectedUsernames();
-    std::ostringstream oss;
-    
-    for(size_t i = 0; i < usernames.size(); ++i) {
-        if(i > 0) oss << ",";
-        oss << usernames[i];
+    while (!m_parkedNames.empty() && m_parkedNames.front().first <= now) {
+        // Unless it was resumed, or resumed and parked again since
+        auto streamIt = m_streams.find(m_parkedNames.front().second);
+        if (streamIt != m_streams.end() && streamIt->second.user == kInvalidUserHandle
+            && streamIt->second.stream->expired(now)) {
+            m_streams.erase(streamIt);
+        }
+        m_parkedNames.pop_front();
     }
-    
-    return oss.str();
 }
 
-void ClientManager::onClientDisconnected(std::string userId)
+void ClientManager::storeOfflineMessage(UserHandle fromUser, std::string_view fromUserId, std::string_view toUserId,
+                                        std::string_view message)
 {
-    std::cout << __PRETTY_FUNCTION__ << "User id: " << userId << std::endl;
+    switch (m_offline->store(toUserId, fromUserId, message)) {
+    case OfflineStore::Result::Stored:
+        break;
+    case OfflineStore::Result::RecipientFull:
+        sendFrameToUser(fromUser, Message::encode_shared(MessageType::ChatMessageBroadcast,
+                                                         {"System: Too many messages are waiting for '", toUserId,
+                                                          "'; not sent"}));
+        return;
+    case OfflineStore::Result::SenderFull:
+        sendToUser(fromUser, MessageType::ChatMessageBroadcast,
+                   "System: You have too many messages waiting for offline users; not sent");
+        return;
+    case OfflineStore::Result::StoreFull:
+        sendToUser(fromUser, MessageType::ChatMessageBroadcast, "System: Offline messages are full; not sent");
+        return;
+    case OfflineStore::Result::Failed:
+        sendFrameToUser(fromUser, Message::encode_shared(MessageType::ChatMessageBroadcast,
+                                                         {"System: User '", toUserId, "' not found or not online"}));
+        return;
+    }
 
-    std::unique_ptr<ServerClient> disconnectedClient;
-    {
-        std::lock_guard<std::mutex> lock(m_clientsMutex);
-        auto clientIt = m_connectedClients.find(userId);
-        if (clientIt != m_connectedClients.end()) {
-            disconnectedClient = std::move(clientIt->second);
-            m_connectedClients.erase(clientIt);
+    sendFrameToUser(fromUser, Message::encode_shared(MessageType::ChatMessageBroadcast,
+                                                     {"System: '", toUserId, "' is offline; the message will be "
+                                                      "delivered when they log on"}));
+
+    // They may have logged on, and collected their queue, since we looked
+    const UserHandle toUser = m_users.find(toUserId);
+    if (toUser != kInvalidUserHandle) {
+        if (SharedFrame frames = m_offline->take(toUserId)) {
+            sendFrameToUser(toUser, std::move(frames));
         }
     }
+}
+
+bool ClientManager::isUsernameAvailable(std::string_view username)
+{
+    return m_users.find(username) == kInvalidUserHandle;
+}
+
+UserHandle ClientManager::registerClient(std::string_view userId, size_t shard)
+{
+    return m_users.claim(userId, shard);
+}
+
+void ClientManager::broadcastMessage(MessageType type, std::string_view data)
+{
+    // Encoded once; each reactor queues the same frame on its own connections
+    fanOut(Message::encode_shared(type, data));
+}
+
+void ClientManager::broadcastToOthers(UserHandle excludeUser, MessageType type, std::string_view data)
+{
+    fanOut(Message::encode_shared(type, data), excludeUser);
+}
+
+void ClientManager::fanOut(SharedFrame frame, UserHandle excludeUser)
+{
+    // Every reactor gets every number and queues them in order, whichever
+    // sender's post reaches it first
+    uint64_t number = 0;
+    if (m_resume.window.count() > 0 && ChatStream::isChat(static_cast<MessageType>((*frame)[0]))) {
+        number = m_lastBroadcast.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    for (auto& reactor : m_reactors) {
+        reactor->broadcast(frame, excludeUser, number);
+    }
+}
+
+std::vector<std::string> ClientManager::getConnectedUsernames()
+{
+    return m_users.names();
+}
+
+void ClientManager::onClientDisconnected(UserHandle user)
+{
+    // The reactor owning the connection releases it once this returns
+    m_rooms.leaveAll(user);
+    size_t shard = 0;
+    const bool loggedOn = m_users.shardOf(user, shard);
+    const std::string userId = m_users.release(user);
+    SIMPLEIM_LOG_INFO << __PRETTY_FUNCTION__ << "User id: " << userId;
+
+    if (!loggedOn || userId.empty()) {
+        return; // dropped before logon completed, nobody was told about it
+    }
 
-    // Broadcast to all remaining clients that someone disconnected
-    broadcastMessage(MessageType::ClientDisconnected, userId);
+    if (m_resume.window.count() > 0) {
+        parkStream(user, shard, userId);
+    }
+
+    // Announced to the remaining clients with the next presence batch
+    m_presence.leave(userId);
+    presenceChanged();
 
-    std::cout << "Client '" << userId << "' disconnected and removed." << std::endl;
+    SIMPLEIM_LOG_INFO << "Client '" << userId << "' disconnected and removed.";
 }
 
-bool ClientManager::sendDirectMessage(const std::string& fromUserId, const std::string& toUserId, const std::string& message)
+void ClientManager::presenceChanged()
 {
-    ServerClient* recipient = nullptr;
-    {
-        std::lock_guard<std::mutex> lock(m_clientsMutex);
-        auto it = m_connectedClients.find(toUserId);
-        if (it != m_connectedClients.end()) {
-            recipient = it->second.get();
+    if (m_presenceInterval.count() == 0) {
+        publishPresence();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_presenceMutex);
+    if (!m_presencePending) {
+        m_presencePending = true;
+        m_presenceWake.notify_one();
+    }
+}
+
+void ClientManager::publishPresence()
+{
+    // Every user gets the batch, the ones it announces included; clients skip
+    // their own changes and any their snapshot already had
+    for (SharedFrame& delta : m_presence.flush()) {
+        fanOut(std::move(delta));
+    }
+}
+
+void ClientManager::runPresence()
+{
+    std::unique_lock<std::mutex> lock(m_presenceMutex);
+    while (true) {
+        m_presenceWake.wait(lock, [this]() { return m_presencePending || m_presenceStop; });
+        // Let the rest of the window's changes join this batch
+        m_presenceWake.wait_for(lock, m_presenceInterval, [this]() { return m_presenceStop; });
+        if (m_presenceStop) {
+            break;
         }
+
+        m_presencePending = false;
+        lock.unlock();
+        publishPresence();
+        lock.lock();
     }
+}
 
-    if (recipient != nullptr) {
-        std::string formattedMessage = fromUserId + ": " + message;
-        recipient->sendMessage(MessageType::ChatMessageBroadcast, formattedMessage);
-        return true;
+bool ClientManager::sendToUser(UserHandle user, MessageType type, std::string_view data)
+{
+    return sendFrameToUser(user, Message::encode_shared(type, data));
+}
+
+bool ClientManager::sendFrameToUser(UserHandle user, SharedFrame frame)
+{
+    size_t shard = 0;
+    if (!m_users.shardOf(user, shard)) {
+        return false;
     }
 
-    return false;
+    m_reactors[shard]->sendTo(user, std::move(frame));
+    return true;
 }
 
-void ClientManager::broadcastChatMessage(const std::string& fromUserId, const std::string& message)
+bool ClientManager::sendDirectMessage(std::string_view fromUserId, UserHandle toUser, std::string_view toUserId,
+                                      std::string_view message)
 {
-    // Broadcast to all users (public message)
-    std::string formattedMessage = fromUserId + ": " + message;
-    broadcastMessage(MessageType::ChatMessageBroadcast, formattedMessage);
+    SharedFrame frame = Message::encode_shared(MessageType::ChatMessageBroadcast, {fromUserId, ": ", message});
+    if (!sendFrameToUser(toUser, frame)) {
+        return false;
+    }
+    if (m_history) {
+        m_history->append(HistoryKind::Direct, fromUserId, toUserId, std::move(frame));
+    }
+    return true;
 }
 
-void ClientManager::handleDirectMessage(const std::string& fromUserId, const std::string& messageData)
+void ClientManager::broadcastChatMessage(std::string_view fromUserId, std::string_view message)
+{
+    // Broadcast to all users (public message). Logged first, so a user whose
+    // logon the broadcast misses gets it replayed; see replayHistory.
+    SharedFrame frame = Message::encode_shared(MessageType::ChatMessageBroadcast, {fromUserId, ": ", message});
+    if (m_history) {
+        m_history->append(HistoryKind::Broadcast, fromUserId, {}, frame);
+    }
+    fanOut(std::move(frame));
+}
+
+void ClientManager::handleDirectMessage(UserHandle fromUser, std::string_view fromUserId, std::string_view messageData)
 {
     // Parse the direct message format: "targetUser:message"
     size_t colonPos = messageData.find(':');
-    if (colonPos == std::string::npos || colonPos == 0 || colonPos == messageData.length() - 1) {
+    if (colonPos == std::string_view::npos || colonPos == 0 || colonPos == messageData.length() - 1) {
         // Send error back to sender - invalid format
-        ServerClient* sender = nullptr;
-        {
-            std::lock_guard<std::mutex> lock(m_clientsMutex);
-            auto it = m_connectedClients.find(fromUserId);
-            if (it != m_connectedClients.end()) {
-                sender = it->second.get();
-            }
-        }
-        if (sender != nullptr) {
-            sender->sendMessage(MessageType::ChatMessageBroadcast, "System: Invalid direct message format. Expected 'username:message'");
-        }
+        sendToUser(fromUser, MessageType::ChatMessageBroadcast, "System: Invalid direct message format. Expected 'username:message'");
         return;
     }
     
-    std::string toUserId = messageData.substr(0, colonPos);
-    std::string actualMessage = messageData.substr(colonPos + 1);
+    std::string_view toUserId = messageData.substr(0, colonPos);
+    std::string_view actualMessage = messageData.substr(colonPos + 1);
     
     if (toUserId.empty() || actualMessage.empty()) {
         // Send error back to sender
-        ServerClient* sender = nullptr;
-        {
-            std::lock_guard<std::mutex> lock(m_clientsMutex);
-            auto it = m_connectedClients.find(fromUserId);
-            if (it != m_connectedClients.end()) {
-                sender = it->second.get();
-            }
-        }
-        if (sender != nullptr) {
-            sender->sendMessage(MessageType::ChatMessageBroadcast, "System: Username and message cannot be empty");
-        }
+        sendToUser(fromUser, MessageType::ChatMessageBroadcast, "System: Username and message cannot be empty");
         return;
     }
     
-    if (sendDirectMessage(fromUserId, toUserId, actualMessage)) {
+    // The one name lookup on this path: the client addresses the target by name
+    const UserHandle toUser = m_users.find(toUserId);
+    if (toUser != kInvalidUserHandle && sendDirectMessage(fromUserId, toUser, toUserId, actualMessage)) {
         // Confirm to sender
-        ServerClient* sender = nullptr;
-        {
-            std::lock_guard<std::mutex> lock(m_clientsMutex);
-            auto it = m_connectedClients.find(fromUserId);
-            if (it != m_connectedClients.end()) {
-                sender = it->second.get();
-            }
-        }
-        if (sender != nullptr) {
-            sender->sendMessage(MessageType::ChatMessageBroadcast, "System: Message sent to " + toUserId);
-        }
+        sendFrameToUser(fromUser, Message::encode_shared(MessageType::ChatMessageBroadcast,
+                                                         {"System: Message sent to ", toUserId}));
+    } else if (m_offline) {
+        storeOfflineMessage(fromUser, fromUserId, toUserId, actualMessage);
     } else {
         // User not found
-        ServerClient* sender = nullptr;
-        {
-            std::lock_guard<std::mutex> lock(m_clientsMutex);
-            auto it = m_connectedClients.find(fromUserId);
-            if (it != m_connectedClients.end()) {
-                sender = it->second.get();
-            }
+        sendFrameToUser(fromUser, Message::encode_shared(MessageType::ChatMessageBroadcast,
+                                                         {"System: User '", toUserId, "' not found or not online"}));
+    }
+}
+
+void ClientManager::joinRoom(UserHandle user, std::string_view room)
+{
+    size_t shard = 0;
+    if (!RoomDirectory::isValidName(room)) {
+        sendToUser(user, MessageType::ChatMessageBroadcast, "System: Invalid room name");
+        return;
+    }
+    if (!m_users.shardOf(user, shard)) {
+        return;
+    }
+
+    // Rejoining is not an error; the reply is the same
+    m_rooms.join(room, user, shard);
+    sendToUser(user, MessageType::RoomJoin, room);
+}
+
+void ClientManager::leaveRoom(UserHandle user, std::string_view room)
+{
+    if (!m_rooms.leave(room, user)) {
+        sendFrameToUser(user, Message::encode_shared(MessageType::ChatMessageBroadcast,
+                                                     {"System: You are not in room '", room, "'"}));
+        return;
+    }
+    sendToUser(user, MessageType::RoomLeave, room);
+}
+
+void ClientManager::listRooms(UserHandle user)
+{
+    std::vector<std::string> rooms = m_rooms.names();
+    std::sort(rooms.begin(), rooms.end());
+
+    std::string list;
+    for (const auto& room : rooms) {
+        if (!list.empty()) {
+            list += ',';
         }
-        if (sender != nullptr) {
-            sender->sendMessage(MessageType::ChatMessageBroadcast, "System: User '" + toUserId + "' not found or not online");
+        list += room;
+    }
+    sendToUser(user, MessageType::RoomList, list);
+}
+
+void ClientManager::handleRoomMessage(UserHandle fromUser, std::string_view fromUserId, std::string_view messageData)
+{
+    // Same "room:message" shape as a direct message
+    size_t colonPos = messageData.find(':');
+    if (colonPos == std::string_view::npos || colonPos == 0 || colonPos == messageData.length() - 1) {
+        sendToUser(fromUser, MessageType::ChatMessageBroadcast, "System: Invalid room message format. Expected 'room:message'");
+        return;
+    }
+
+    std::string_view room = messageData.substr(0, colonPos);
+    std::string_view message = messageData.substr(colonPos + 1);
+
+    std::shared_ptr<const RoomDirectory::Members> members = m_rooms.members(room);
+    if (!members || !m_rooms.isMember(room, fromUser)) {
+        sendFrameToUser(fromUser, Message::encode_shared(MessageType::ChatMessageBroadcast,
+                                                         {"System: You are not in room '", room, "'"}));
+        return;
+    }
+
+    // Group the members by reactor so each gets one task, whatever the room size
+    std::vector<std::vector<UserHandle>> usersByShard(m_reactors.size());
+    for (const RoomDirectory::Member& member : *members) {
+        usersByShard[member.shard].push_back(member.user);
+    }
+
+    SharedFrame frame = Message::encode_shared(MessageType::RoomMessage, {room, ":", fromUserId, ": ", message});
+    for (size_t shard = 0; shard < usersByShard.size(); ++shard) {
+        if (!usersByShard[shard].empty()) {
+            m_reactors[shard]->sendTo(std::move(usersByShard[shard]), frame);
         }
     }
 }
@@ -1,35 +1,197 @@
 #pragma once
 
+#include "ChatStream.h"
+#include "HistoryLog.h"
+#include "OfflineStore.h"
 #include "ServerClient.h"
+#include "ServerConfig.h"
+#include "Presence.h"
+#include "Reactor.h"
+#include "RoomDirectory.h"
+#include "SearchIndex.h"
+#include "UserDirectory.h"
 
-#include <unordered_map>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <optional>
 #include <mutex>
+#include <thread>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 class ClientManager
 {
 public:
-    ClientManager();
+    explicit ClientManager(const ServerConfig& config = ServerConfig());
     ~ClientManager();
 
+    size_t reactorCount() const { return m_reactors.size(); }
+    Reactor& reactor(size_t shard) { return *m_reactors[shard]; }
+
+    // Hands a freshly accepted connection to a reactor, round-robin or the given
+    // shard. The logon then completes asynchronously on that reactor.
     void addConnectedClient(int clientSock);
-    bool isUsernameAvailable(const std::string& username);
-    void registerClient(const std::string& userId, std::unique_ptr<ServerClient> client);
+    void addConnectedClient(int clientSock, size_t shard);
+    bool isUsernameAvailable(std::string_view username);
+
+    // Claims the username for a connection owned by the given shard and
+    // returns the user's handle, or kInvalidUserHandle if the name is taken.
+    UserHandle registerClient(std::string_view userId, size_t shard);
+    void onClientLogon(std::string_view userId);
+
+    // Streams history to a user who just logged on: everything after
+    // afterSequence, or the last few records without one. Batches are read
+    // on the history thread and queued as the previous one goes out, so a long
+    // replay neither holds up a reactor nor piles up in memory.
+    void replayHistory(UserHandle user, std::string_view userId, std::optional<uint64_t> afterSequence);
+
+    // Answers with the newest records holding every word of the query, as
+    // SearchResult frames followed by SearchEnd. Looked up on the history thread.
+    void search(UserHandle user, std::string_view userId, std::string_view query);
+
+    // Direct messages that waited for the user while they were away, as one
+    // buffer of frames; null when there are none.
+    SharedFrame takeOfflineMessages(std::string_view userId);
+
+    // The chat stream for a user who just logged on, on the reactor of the
+    // given shard. The one they ask to resume, with the frames they missed in
+    // missed, when it is parked and those are all still held, by it or by the
+    // reactor; a new one otherwise. Null when the server keeps no streams.
+    // Broadcasts numbered up to resentBroadcasts are among the frames missed,
+    // and must not reach the new connection live as well.
+    std::shared_ptr<ChatStream> openStream(UserHandle user, size_t shard, std::string_view userId,
+                                           const std::optional<ChatStream::Position>& resume,
+                                           std::vector<ChatStream::Frame>& missed, uint64_t& resentBroadcasts);
     
-    void broadcastMessage(MessageType type, const std::string& data = "");
-    void broadcastToOthers(const std::string& excludeUserId, MessageType type, const std::string& data = "");
+    void broadcastMessage(MessageType type, std::string_view data = "");
+    void broadcastToOthers(UserHandle excludeUser, MessageType type, std::string_view data = "");
     
-    // Chat messaging functionality
-    void broadcastChatMessage(const std::string& fromUserId, const std::string& message);
-    void handleDirectMessage(const std::string& fromUserId, const std::string& messageData);
-    bool sendDirectMessage(const std::string& fromUserId, const std::string& toUserId, const std::string& message);
+    // Chat messaging functionality. Senders pass their own handle and name, so
+    // neither path looks the sender up. Delivered chat and direct messages are
+    // kept in the history, when there is one. A direct message to a user who is
+    // not logged on waits in the offline store, when there is one.
+    void broadcastChatMessage(std::string_view fromUserId, std::string_view message);
+    void handleDirectMessage(UserHandle fromUser, std::string_view fromUserId, std::string_view messageData);
+    bool sendDirectMessage(std::string_view fromUserId, UserHandle toUser, std::string_view toUserId,
+                           std::string_view message);
     
+    // Rooms. Each replies to the user; a room message reaches the room's
+    // members only, whatever the number of users logged on.
+    void joinRoom(UserHandle user, std::string_view room);
+    void leaveRoom(UserHandle user, std::string_view room);
+    void listRooms(UserHandle user);
+    void handleRoomMessage(UserHandle fromUser, std::string_view fromUserId, std::string_view messageData);
+
     std::vector<std::string> getConnectedUsernames();
-    std::string serializeUserList();
+    // The users logged on, as cached PresenceSnapshot frames.
+    std::shared_ptr<const Presence::Snapshot> presenceSnapshot() { return m_presence.snapshot(); }
+    // Null when the server keeps no history.
+    HistoryLog* history() { return m_history.get(); }
+    SearchIndex* searchIndex() { return m_search.get(); }
 
-    void onClientDisconnected(std::string userId);
+    void onClientDisconnected(UserHandle user);
 
 private:
-    std::unordered_map<std::string, std::unique_ptr<ServerClient>> m_connectedClients;
-    std::mutex m_clientsMutex;
+    // Queues the message on the reactor owning the user's connection.
+    bool sendToUser(UserHandle user, MessageType type, std::string_view data);
+    bool sendFrameToUser(UserHandle user, SharedFrame frame);
+
+    // Presence batching. A change wakes the presence thread, which waits out
+    // the interval so the rest of the burst joins the batch, then publishes.
+    void presenceChanged();
+    void publishPresence();
+    void runPresence();
+
+    struct ReplayRequest
+    {
+        UserHandle user;
+        std::string userId;
+        uint64_t nextSequence;
+        uint64_t lastSequence;
+    };
+
+    struct SearchRequest
+    {
+        UserHandle user;
+        std::string userId;
+        std::string query;
+    };
+
+    // The history thread reads replay batches and answers searches, so
+    // neither touches the disk on a reactor.
+    void queueReplay(ReplayRequest request);
+    void replayBatch(ReplayRequest& request);
+    void answerSearch(const SearchRequest& request);
+    void runHistory();
+
+    // Queues the frame on every reactor. Chat is numbered first, so whichever
+    // reactor a user resumes on, each broadcast either is in what they are
+    // resent or reaches them live, never both; see openStream.
+    void fanOut(SharedFrame frame, UserHandle excludeUser = kInvalidUserHandle);
+
+    // Parks the stream of a user whose connection just closed, for the resume
+    // window. From the disconnect, on the reactor that owned the connection.
+    void parkStream(UserHandle user, size_t shard, const std::string& userId);
+    void dropExpiredStreams(std::chrono::steady_clock::time_point now);
+
+    // Replies to the sender of a direct message the target was not there for.
+    void storeOfflineMessage(UserHandle fromUser, std::string_view fromUserId, std::string_view toUserId,
+                             std::string_view message);
+
+    // Logged-on users and the shard of the reactor owning each connection.
+    // Broadcasts fan out per reactor without touching it.
+    UserDirectory m_users;
+    RoomDirectory m_rooms;
+    Presence m_presence;
+    std::chrono::milliseconds m_presenceInterval;
+    std::mutex m_presenceMutex;
+    std::condition_variable m_presenceWake;
+    bool m_presencePending;
+    bool m_presenceStop;
+    std::thread m_presenceThread;
+
+    std::atomic<size_t> m_nextShard;
+    OutboundQueueLimits m_outboundLimits;
+
+    // Null when the server keeps no history.
+    std::unique_ptr<HistoryLog> m_history;
+    // Null without history, or when it is kept unindexed.
+    std::unique_ptr<SearchIndex> m_search;
+    size_t m_replayCount;
+    size_t m_searchResults;
+    std::mutex m_historyMutex;
+    std::condition_variable m_historyWake;
+    std::deque<ReplayRequest> m_replayRequests;
+    std::deque<SearchRequest> m_searchRequests;
+    bool m_historyStop;
+    std::thread m_historyThread;
+
+    // Null when direct messages to absent users are turned away.
+    std::unique_ptr<OfflineStore> m_offline;
+
+    // Every user's chat stream by name, kept from logon until its resume
+    // window runs out. A parked stream has no user; it remembers the one it
+    // had and the last broadcast their reactor queued, as the broadcasts
+    // after it are taken from the reactor the stream resumes on.
+    struct StreamEntry
+    {
+        UserHandle user;
+        std::shared_ptr<ChatStream> stream;
+        UserHandle parkedUser = kInvalidUserHandle;
+        uint64_t parkedAfter = 0;
+    };
+    ResumeConfig m_resume;
+    std::atomic<uint64_t> m_nextStreamId;
+    std::mutex m_streamsMutex;
+    std::unordered_map<std::string, StreamEntry, NameHash, std::equal_to<>> m_streams;
+    // Names parked, in the order their windows end.
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> m_parkedNames;
+    // The number of the last chat broadcast.
+    std::atomic<uint64_t> m_lastBroadcast;
+
+    // Declared last so they are stopped before the registry goes away.
+    std::vector<std::unique_ptr<Reactor>> m_reactors;
 };
\ No newline at end of file
@@ -0,0 +1,193 @@
+#include "EpollReactor.h"
+
+#include <Log.h>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+namespace {
+constexpr int kMaxEventsPerWait = 256;
+}
+
+EpollReactor::EpollReactor(ClientManager* manager, std::chrono::milliseconds handshakeTimeout,
+                           std::chrono::microseconds flushDelay, size_t recentBroadcastBytes)
+    : Reactor(manager, handshakeTimeout, flushDelay, recentBroadcastBytes)
+    , m_epollFd(-1)
+{}
+
+EpollReactor::~EpollReactor()
+{
+    stop();
+}
+
+bool EpollReactor::openBackend()
+{
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd == -1) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: epoll_create1 failed. errno=" << errno;
+        return false;
+    }
+
+    epoll_event wakeEvent{};
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.fd = m_wakeFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &wakeEvent);
+
+    if (m_flushTimerFd > -1) {
+        epoll_event timerEvent{};
+        timerEvent.events = EPOLLIN;
+        timerEvent.data.fd = m_flushTimerFd;
+        epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_flushTimerFd, &timerEvent);
+    }
+    return true;
+}
+
+void EpollReactor::closeBackend()
+{
+    close(m_epollFd);
+    m_epollFd = -1;
+}
+
+void EpollReactor::run()
+{
+    epoll_event events[kMaxEventsPerWait];
+
+    while (!m_terminate) {
+        const int ready = epoll_wait(m_epollFd, events, kMaxEventsPerWait, nextTimeoutMs());
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: epoll_wait failed. errno=" << errno;
+            break;
+        }
+
+        for (int i = 0; i < ready && !m_terminate; ++i) {
+            if (events[i].data.fd == m_wakeFd) {
+                uint64_t count = 0;
+                (void)!read(m_wakeFd, &count, sizeof(count));
+                runPendingTasks();
+            }
+            else if (events[i].data.fd == m_flushTimerFd) {
+                onFlushTimer();
+            }
+            else if (isListener(events[i].data.fd)) {
+                acceptConnections(events[i].data.fd);
+            }
+            else {
+                handleClientEvent(events[i].data.fd, events[i].events);
+            }
+        }
+
+        for (int listenSocket : dueStalledListeners()) {
+            acceptConnections(listenSocket);
+        }
+        expirePendingLogons();
+        flushPending();
+    }
+}
+
+bool EpollReactor::watchListener(int listenSocket)
+{
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = listenSocket;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, listenSocket, &event) == -1) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: epoll_ctl ADD failed for listener. errno=" << errno;
+        return false;
+    }
+
+    // Connections may have queued before registration; edge-triggered mode won't report them.
+    acceptConnections(listenSocket);
+    return true;
+}
+
+void EpollReactor::unwatchListener(int listenSocket)
+{
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, listenSocket, nullptr);
+}
+
+bool EpollReactor::watchClient(ServerClient* client)
+{
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = client->getSocket();
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, client->getSocket(), &event) == -1) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: epoll_ctl ADD failed. errno=" << errno;
+        return false;
+    }
+
+    const int fd = client->getSocket();
+    client->setWriteScheduler([this, fd]() { scheduleFlush(fd); });
+    return true;
+}
+
+void EpollReactor::releaseClient(std::unique_ptr<ServerClient> client)
+{
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, client->getSocket(), nullptr);
+
+    // Best effort for whatever is still queued (a LoginFailure, say); the
+    // destructor then closes the socket.
+    client->onWritable();
+}
+
+void EpollReactor::flushClient(int fd)
+{
+    ServerClient* client = findClient(fd);
+    if (client && !client->onWritable()) {
+        closeClient(fd);
+    }
+}
+
+void EpollReactor::acceptConnections(int listenSocket)
+{
+    while (!m_terminate && isListener(listenSocket)) {
+        const int clientSocket = accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (clientSocket == -1) {
+            const int error = errno;
+            if (error == EINTR || error == ECONNABORTED) {
+                continue;
+            }
+            if ((error == EMFILE || error == ENFILE) && shedConnections(listenSocket)) {
+                return;
+            }
+            if (error != EWOULDBLOCK && error != EAGAIN) {
+                SIMPLEIM_LOG_ERROR << "Error: Could not accept incoming connection. errno=" << error;
+                // Edge-triggered, so connections left queued would never be reported again
+                stallListener(listenSocket);
+            }
+            return;
+        }
+
+        acceptConnection(listenSocket, clientSocket);
+    }
+}
+
+void EpollReactor::handleClientEvent(int fd, uint32_t events)
+{
+    ServerClient* client = findClient(fd);
+    if (!client) {
+        return;
+    }
+
+    const bool wasPreAuth = client->getState() == ServerClient::ConnectionState::PreAuth;
+    bool alive = true;
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        alive = client->onReadable(m_manager);
+    }
+
+    if (alive) {
+        trackLogon(client, wasPreAuth);
+    }
+
+    if (alive && (events & EPOLLOUT)) {
+        alive = client->onWritable();
+    }
+
+    if (!alive) {
+        closeClient(fd);
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Reactor.h"
+
+#include <cstdint>
+
+// Edge-triggered epoll backend: ServerClients do their own non-blocking
+// recv/send whenever their socket reports readiness. Frames queued during an
+// iteration are written once it is done, one sendmsg per connection.
+class EpollReactor : public Reactor
+{
+public:
+    EpollReactor(ClientManager* manager, std::chrono::milliseconds handshakeTimeout,
+                 std::chrono::microseconds flushDelay, size_t recentBroadcastBytes);
+    ~EpollReactor() override;
+
+    const char* backendName() const override { return "epoll"; }
+
+protected:
+    bool openBackend() override;
+    void closeBackend() override;
+    void run() override;
+    bool watchListener(int listenSocket) override;
+    void unwatchListener(int listenSocket) override;
+    bool watchClient(ServerClient* client) override;
+    void releaseClient(std::unique_ptr<ServerClient> client) override;
+    void flushClient(int fd) override;
+
+private:
+    int m_epollFd;
+
+    void acceptConnections(int listenSocket);
+    void handleClientEvent(int fd, uint32_t events);
+};
@@ -0,0 +1,620 @@
+#include "HistoryLog.h"
+
+#include <Log.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+constexpr size_t kQueueCapacity = 32 * 1024;
+// Queued records are gathered up to this much per write and sync
+constexpr size_t kMaxBatchBytes = 1024 * 1024;
+// Roughly how far apart the index entries of a segment are
+constexpr uint64_t kIndexIntervalBytes = 4096;
+constexpr uint64_t kFirstSequence = 1;
+
+// Host byte order; the files are not meant to move between machines.
+struct RecordHeader
+{
+    uint32_t length;    // of the names and the frame after the header
+    uint32_t checksum;  // FNV-1a of the rest of the header and everything after it
+    uint64_t sequence;
+    int64_t timestamp;
+    uint8_t kind;
+    uint8_t reserved;
+    uint16_t fromLength;
+    uint16_t toLength;
+    uint16_t reserved2;
+};
+static_assert(sizeof(RecordHeader) == 32);
+
+constexpr size_t kChecksumStart = offsetof(RecordHeader, sequence);
+
+uint32_t checksum(const char* data, size_t length, uint32_t hash = 2166136261u)
+{
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool writeAll(int fd, const char* data, size_t length)
+{
+    while (length > 0) {
+        const ssize_t written = write(fd, data, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+// Makes a new segment's directory entry as durable as its contents.
+void syncDirectory(const std::string& directory)
+{
+    const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+int64_t nowMilliseconds()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+}
+
+// Read-only mapping of the first length bytes of a file.
+class HistoryLog::Mapping
+{
+public:
+    Mapping(const std::string& path, size_t length)
+        : m_data(nullptr)
+        , m_length(length)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || length == 0) {
+            if (fd != -1) {
+                close(fd);
+            }
+            return;
+        }
+
+        void* data = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data != MAP_FAILED) {
+            m_data = static_cast<const char*>(data);
+        }
+    }
+
+    ~Mapping()
+    {
+        if (m_data) {
+            munmap(const_cast<char*>(m_data), m_length);
+        }
+    }
+
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+
+    const char* data() const { return m_data; }
+
+private:
+    const char* m_data;
+    size_t m_length;
+};
+
+std::unique_ptr<HistoryLog> HistoryLog::open(const HistoryConfig& config)
+{
+    std::unique_ptr<HistoryLog> history(new HistoryLog(config));
+    if (!history->recover()) {
+        return nullptr;
+    }
+
+    history->m_writer = std::thread([log = history.get()]() { log->run(); });
+    SIMPLEIM_LOG_INFO << "History: " << history->segmentCount() << " segment(s) in '" << config.directory
+                      << "', next sequence " << history->m_nextSequence << ".";
+    return history;
+}
+
+HistoryLog::HistoryLog(const HistoryConfig& config)
+    : m_directory(config.directory)
+    , m_segmentBytes(config.segmentBytes)
+    , m_queue(kQueueCapacity)
+    , m_dropped(0)
+    , m_durableSequence(0)
+    , m_logFd(-1)
+    , m_indexFd(-1)
+    , m_nextSequence(kFirstSequence)
+    , m_writeOffset(0)
+    , m_lastIndexedOffset(0)
+{}
+
+HistoryLog::~HistoryLog()
+{
+    m_queue.wakeUp();
+    if (m_writer.joinable()) {
+        m_writer.join();
+    }
+    closeSegment();
+}
+
+void HistoryLog::append(HistoryKind kind, std::string_view from, std::string_view to, SharedFrame frame)
+{
+    Pending pending;
+    pending.kind = kind;
+    pending.timestamp = nowMilliseconds();
+    pending.from.assign(from);
+    pending.to.assign(to);
+    pending.frame = std::move(frame);
+
+    if (!m_queue.push(std::move(pending))) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        SIMPLEIM_LOG_ERROR << "History: the writer is behind, dropped a record.";
+    }
+}
+
+void HistoryLog::whenDurable(std::function<void(uint64_t)> callback)
+{
+    // Queued behind every record appended so far, so the writer reaches it
+    // only once they are all in its batch
+    Pending marker;
+    marker.onDurable = std::move(callback);
+    if (!m_queue.push(std::move(marker)) && !m_queue.terminating()) {
+        marker.onDurable(durableSequence());
+    }
+}
+
+std::vector<HistoryLog::Entry> HistoryLog::read(uint64_t fromSequence, size_t limit) const
+{
+    std::vector<Entry> entries;
+    if (limit == 0) {
+        return entries;
+    }
+
+    scan(fromSequence, [&](const RecordView& record, const std::shared_ptr<const Mapping>&) {
+        entries.push_back(Entry{record.sequence, record.timestamp, record.kind, std::string(record.from),
+                                std::string(record.to), std::string(record.frame)});
+        return entries.size() < limit;
+    });
+    return entries;
+}
+
+void HistoryLog::collect(std::string_view user, uint64_t fromSequence, uint64_t toSequence, size_t maxBytes,
+                         Batch& batch) const
+{
+    // Past the range unless the batch fills up first
+    batch.nextSequence = toSequence + 1;
+    if (fromSequence > toSequence) {
+        return;
+    }
+
+    size_t bytes = 0;
+    scan(fromSequence, [&](const RecordView& record, const std::shared_ptr<const Mapping>& mapping) {
+        if (record.sequence > toSequence) {
+            return false;
+        }
+
+        if (record.kind == HistoryKind::Broadcast || record.to == user) {
+            if (batch.owners.empty() || batch.owners.back() != mapping) {
+                batch.owners.push_back(mapping);
+            }
+            batch.frames.push_back(record.frame);
+            bytes += record.frame.size();
+        }
+
+        if (bytes >= maxBytes && record.sequence < toSequence) {
+            batch.nextSequence = record.sequence + 1;
+            return false;
+        }
+        return true;
+    });
+}
+
+size_t HistoryLog::parseRecord(const char* data, size_t available, RecordView& record)
+{
+    RecordHeader header;
+    if (available < sizeof(header)) {
+        return 0;
+    }
+    std::memcpy(&header, data, sizeof(header));
+
+    const size_t namesLength = static_cast<size_t>(header.fromLength) + header.toLength;
+    if (header.length > available - sizeof(header)
+        || namesLength + MessageHeader::kWireSize > header.length
+        || header.kind > static_cast<uint8_t>(HistoryKind::Direct)) {
+        return 0;
+    }
+
+    const char* body = data + sizeof(header);
+    const uint32_t headerHash = checksum(data + kChecksumStart, sizeof(header) - kChecksumStart);
+    if (checksum(body, header.length, headerHash) != header.checksum) {
+        return 0;
+    }
+
+    record.sequence = header.sequence;
+    record.timestamp = header.timestamp;
+    record.kind = static_cast<HistoryKind>(header.kind);
+    record.from = std::string_view(body, header.fromLength);
+    record.to = std::string_view(body + header.fromLength, header.toLength);
+    record.frame = std::string_view(body + namesLength, header.length - namesLength);
+    return sizeof(header) + header.length;
+}
+
+void HistoryLog::scan(uint64_t fromSequence,
+    const std::function<bool(const RecordView&, const std::shared_ptr<const Mapping>&)>& visit) const
+{
+    struct Span
+    {
+        uint64_t firstSequence;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // From the segment that may hold fromSequence on; in it, from the closest
+    // index entry at or before it
+    std::vector<Span> spans;
+    {
+        std::lock_guard<std::mutex> lock(m_segmentsMutex);
+        auto segment = std::upper_bound(m_segments.begin(), m_segments.end(), fromSequence,
+            [](uint64_t sequence, const Segment& candidate) { return sequence < candidate.firstSequence; });
+        if (segment != m_segments.begin()) {
+            --segment;
+        }
+
+        for (; segment != m_segments.end(); ++segment) {
+            uint64_t offset = 0;
+            if (spans.empty()) {
+                auto entry = std::upper_bound(segment->index.begin(), segment->index.end(), fromSequence,
+                    [](uint64_t sequence, const IndexEntry& candidate) { return sequence < candidate.sequence; });
+                if (entry != segment->index.begin()) {
+                    offset = std::prev(entry)->offset;
+                }
+            }
+            spans.push_back(Span{segment->firstSequence, offset, segment->size});
+        }
+    }
+
+    for (const Span& span : spans) {
+        if (span.offset >= span.size) {
+            continue;
+        }
+
+        const auto mapping = std::make_shared<const Mapping>(segmentPath(span.firstSequence, ".log"), span.size);
+        if (!mapping->data()) {
+            SIMPLEIM_LOG_ERROR << "History: could not map segment " << span.firstSequence << ". errno=" << errno;
+            return;
+        }
+
+        uint64_t offset = span.offset;
+        RecordView record;
+        while (offset < span.size) {
+            const size_t size = parseRecord(mapping->data() + offset, span.size - offset, record);
+            if (size == 0) {
+                break;
+            }
+            offset += size;
+
+            if (record.sequence >= fromSequence && !visit(record, mapping)) {
+                return;
+            }
+        }
+    }
+}
+
+size_t HistoryLog::segmentCount() const
+{
+    std::lock_guard<std::mutex> lock(m_segmentsMutex);
+    return m_segments.size();
+}
+
+bool HistoryLog::recover()
+{
+    std::error_code error;
+    std::filesystem::create_directories(m_directory, error);
+
+    std::vector<uint64_t> firstSequences;
+    if (!error) {
+        for (const auto& file : std::filesystem::directory_iterator(m_directory, error)) {
+            const std::string stem = file.path().stem().string();
+            uint64_t firstSequence = 0;
+            const auto result = std::from_chars(stem.data(), stem.data() + stem.size(), firstSequence);
+            if (file.path().extension() == ".log" && result.ec == std::errc()
+                && result.ptr == stem.data() + stem.size() && firstSequence >= kFirstSequence) {
+                firstSequences.push_back(firstSequence);
+            }
+        }
+    }
+    if (error) {
+        SIMPLEIM_LOG_ERROR << "History: cannot use '" << m_directory << "': " << error.message();
+        return false;
+    }
+    std::sort(firstSequences.begin(), firstSequences.end());
+
+    for (size_t i = 0; i < firstSequences.size(); ++i) {
+        Segment segment;
+        segment.firstSequence = firstSequences[i];
+        const bool sealed = i + 1 < firstSequences.size();
+
+        const std::string logPath = segmentPath(segment.firstSequence, ".log");
+        struct stat info{};
+        if (stat(logPath.c_str(), &info) != 0) {
+            SIMPLEIM_LOG_ERROR << "History: cannot stat '" << logPath << "'. errno=" << errno;
+            return false;
+        }
+        const size_t fileSize = static_cast<size_t>(info.st_size);
+
+        // A sealed segment's index was synced when it was sealed
+        const std::string indexPath = segmentPath(segment.firstSequence, ".idx");
+        struct stat indexInfo{};
+        if (sealed && stat(indexPath.c_str(), &indexInfo) == 0 && indexInfo.st_size > 0
+            && indexInfo.st_size % sizeof(IndexEntry) == 0) {
+            const Mapping index(indexPath, static_cast<size_t>(indexInfo.st_size));
+            if (index.data()) {
+                segment.index.resize(static_cast<size_t>(indexInfo.st_size) / sizeof(IndexEntry));
+                std::memcpy(segment.index.data(), index.data(), static_cast<size_t>(indexInfo.st_size));
+            }
+        }
+
+        if (!segment.index.empty() && segment.index.front().sequence == segment.firstSequence
+            && segment.index.front().offset == 0) {
+            segment.size = fileSize;
+            m_nextSequence = firstSequences[i + 1];
+            m_segments.push_back(std::move(segment));
+            continue;
+        }
+
+        // Otherwise walk the records, rebuilding the index, up to the first
+        // that is torn or out of sequence
+        segment.index.clear();
+        const Mapping file(logPath, fileSize);
+        if (fileSize > 0 && !file.data()) {
+            SIMPLEIM_LOG_ERROR << "History: cannot map '" << logPath << "'. errno=" << errno;
+            return false;
+        }
+
+        uint64_t offset = 0;
+        uint64_t lastIndexed = 0;
+        uint64_t sequence = segment.firstSequence;
+        RecordView record;
+        while (offset < fileSize) {
+            const size_t size = parseRecord(file.data() + offset, fileSize - offset, record);
+            if (size == 0 || record.sequence != sequence) {
+                break;
+            }
+            if (segment.index.empty() || offset - lastIndexed >= kIndexIntervalBytes) {
+                segment.index.push_back(IndexEntry{sequence, offset});
+                lastIndexed = offset;
+            }
+            offset += size;
+            ++sequence;
+        }
+        segment.size = offset;
+        m_nextSequence = sealed ? firstSequences[i + 1] : sequence;
+
+        if (!sealed && offset < fileSize) {
+            SIMPLEIM_LOG_WARNING << "History: cutting " << (fileSize - offset) << " bytes of torn records from '"
+                                 << logPath << "'.";
+            if (truncate(logPath.c_str(), static_cast<off_t>(offset)) != 0) {
+                SIMPLEIM_LOG_ERROR << "History: cannot truncate '" << logPath << "'. errno=" << errno;
+                return false;
+            }
+        }
+        m_segments.push_back(std::move(segment));
+    }
+
+    // Carry on appending to the last segment, or start the first
+    const bool create = m_segments.empty();
+    if (create) {
+        m_segments.push_back(Segment{kFirstSequence, 0, {}});
+    }
+    if (!openSegment(m_segments.back().firstSequence, create)) {
+        return false;
+    }
+
+    const Segment& active = m_segments.back();
+    if (!active.index.empty()
+        && !writeAll(m_indexFd, reinterpret_cast<const char*>(active.index.data()),
+                     active.index.size() * sizeof(IndexEntry))) {
+        SIMPLEIM_LOG_WARNING << "History: could not rewrite the index of segment " << active.firstSequence << ".";
+    }
+    m_writeOffset = active.size;
+    m_lastIndexedOffset = active.index.empty() ? 0 : active.index.back().offset;
+    m_durableSequence.store(m_nextSequence - 1, std::memory_order_release);
+    return true;
+}
+
+bool HistoryLog::openSegment(uint64_t firstSequence, bool create)
+{
+    const std::string logPath = segmentPath(firstSequence, ".log");
+    const std::string indexPath = segmentPath(firstSequence, ".idx");
+
+    // The index of the active segment is rewritten from memory; a crash
+    // leaves it to be rebuilt from the records
+    m_logFd = ::open(logPath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    m_indexFd = ::open(indexPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_logFd == -1 || m_indexFd == -1) {
+        SIMPLEIM_LOG_ERROR << "History: cannot open segment " << firstSequence << ". errno=" << errno;
+        closeSegment();
+        return false;
+    }
+
+    if (create) {
+        syncDirectory(m_directory);
+    }
+    return true;
+}
+
+void HistoryLog::closeSegment()
+{
+    if (m_indexFd != -1) {
+        fdatasync(m_indexFd);
+        close(m_indexFd);
+        m_indexFd = -1;
+    }
+    if (m_logFd != -1) {
+        close(m_logFd);
+        m_logFd = -1;
+    }
+}
+
+std::string HistoryLog::segmentPath(uint64_t firstSequence, const char* extension) const
+{
+    // Zero padded so the names sort in sequence order
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020" PRIu64 "%s", firstSequence, extension);
+    return m_directory + "/" + name;
+}
+
+void HistoryLog::run()
+{
+    Pending pending;
+    while (true) {
+        // Everything queued since the last pass goes out with one sync
+        while (m_batch.size() < kMaxBatchBytes && m_queue.tryPop(pending)) {
+            if (pending.onDurable) {
+                m_durableCallbacks.push_back(std::move(pending.onDurable));
+                pending.onDurable = nullptr;
+                continue;
+            }
+            appendRecord(pending);
+        }
+        commit();
+        pending.frame.reset();
+
+        if (!m_durableCallbacks.empty()) {
+            const uint64_t durable = m_durableSequence.load(std::memory_order_relaxed);
+            for (const auto& callback : m_durableCallbacks) {
+                if (!m_queue.terminating()) {
+                    callback(durable);
+                }
+            }
+            m_durableCallbacks.clear();
+        }
+
+        if (m_queue.prepareWait()) {
+            pollfd wake{m_queue.wakeFd(), POLLIN, 0};
+            while (poll(&wake, 1, -1) == -1 && errno == EINTR) {}
+            m_queue.consumeWakeup();
+        }
+        else if (m_queue.terminating() && m_queue.empty()) {
+            break;
+        }
+    }
+}
+
+void HistoryLog::appendRecord(const Pending& pending)
+{
+    const std::string_view from(pending.from.data(), std::min<size_t>(pending.from.size(), UINT16_MAX));
+    const std::string_view to(pending.to.data(), std::min<size_t>(pending.to.size(), UINT16_MAX));
+    const std::string& frame = *pending.frame;
+    const size_t recordSize = sizeof(RecordHeader) + from.size() + to.size() + frame.size();
+
+    // A record never straddles two segments
+    if (m_writeOffset > 0 && m_writeOffset + recordSize > m_segmentBytes) {
+        commit();
+        roll();
+    }
+
+    if (m_writeOffset == 0 || m_writeOffset - m_lastIndexedOffset >= kIndexIntervalBytes) {
+        m_batchIndex.push_back(IndexEntry{m_nextSequence, m_writeOffset});
+        m_lastIndexedOffset = m_writeOffset;
+    }
+
+    RecordHeader header{};
+    header.length = static_cast<uint32_t>(recordSize - sizeof(header));
+    header.sequence = m_nextSequence;
+    header.timestamp = pending.timestamp;
+    header.kind = static_cast<uint8_t>(pending.kind);
+    header.fromLength = static_cast<uint16_t>(from.size());
+    header.toLength = static_cast<uint16_t>(to.size());
+
+    uint32_t hash = checksum(reinterpret_cast<const char*>(&header) + kChecksumStart, sizeof(header) - kChecksumStart);
+    hash = checksum(from.data(), from.size(), hash);
+    hash = checksum(to.data(), to.size(), hash);
+    header.checksum = checksum(frame.data(), frame.size(), hash);
+
+    m_batch.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    m_batch.append(from);
+    m_batch.append(to);
+    m_batch.append(frame);
+    m_writeOffset += recordSize;
+    ++m_nextSequence;
+}
+
+void HistoryLog::commit()
+{
+    if (m_batch.empty()) {
+        return;
+    }
+
+    const uint64_t durable = m_durableSequence.load(std::memory_order_relaxed);
+    const uint64_t syncedOffset = m_writeOffset - m_batch.size();
+    if (m_logFd == -1 || !writeAll(m_logFd, m_batch.data(), m_batch.size()) || fdatasync(m_logFd) != 0) {
+        SIMPLEIM_LOG_ERROR << "History: could not write " << (m_nextSequence - 1 - durable)
+                           << " record(s). errno=" << errno;
+        m_dropped.fetch_add(m_nextSequence - 1 - durable, std::memory_order_relaxed);
+
+        // Forget the batch, so the segment still ends with its last synced record
+        if (m_logFd != -1) {
+            (void)!ftruncate(m_logFd, static_cast<off_t>(syncedOffset));
+        }
+        const Segment& active = m_segments.back();
+        m_nextSequence = durable + 1;
+        m_writeOffset = syncedOffset;
+        m_lastIndexedOffset = active.index.empty() ? 0 : active.index.back().offset;
+        m_batch.clear();
+        m_batchIndex.clear();
+        return;
+    }
+
+    // Not synced: the active segment's index is rebuilt after a crash anyway
+    if (!m_batchIndex.empty()
+        && !writeAll(m_indexFd, reinterpret_cast<const char*>(m_batchIndex.data()),
+                     m_batchIndex.size() * sizeof(IndexEntry))) {
+        SIMPLEIM_LOG_ERROR << "History: could not write the index. errno=" << errno;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_segmentsMutex);
+        Segment& active = m_segments.back();
+        active.size = m_writeOffset;
+        active.index.insert(active.index.end(), m_batchIndex.begin(), m_batchIndex.end());
+    }
+    m_durableSequence.store(m_nextSequence - 1, std::memory_order_release);
+    m_batch.clear();
+    m_batchIndex.clear();
+}
+
+void HistoryLog::roll()
+{
+    closeSegment();
+    if (!openSegment(m_nextSequence, true)) {
+        return; // commits fail and drop their records until a later roll succeeds
+    }
+
+    std::lock_guard<std::mutex> lock(m_segmentsMutex);
+    m_segments.push_back(Segment{m_nextSequence, 0, {}});
+    m_writeOffset = 0;
+    m_lastIndexedOffset = 0;
+}
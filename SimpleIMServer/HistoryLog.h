@@ -0,0 +1,177 @@
+#pragma once
+
+#include "ServerConfig.h"
+
+#include <Message.h>
+#include <MpscQueue.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+enum class HistoryKind : uint8_t
+{
+    Broadcast,
+    Direct      // replayed to its recipient only
+};
+
+// Append-only record of the chat and direct messages the server delivered,
+// kept as a run of segment files named after the first sequence number in each.
+// A record is a small header, the sender and recipient names and the frame
+// exactly as it went out on the wire.
+//
+// append() only queues the frame it is handed. A writer thread numbers the
+// records, writes everything queued since its last pass in one go and syncs it
+// with one fdatasync, so delivery never waits on the disk and a burst costs a
+// sync per batch rather than per message. Each segment keeps a sparse index of
+// sequence numbers to offsets in a file beside it. Readers see synced records
+// only. On open a torn tail left by a crash is cut off. Thread-safe.
+class HistoryLog
+{
+public:
+    // A record read back.
+    struct Entry
+    {
+        uint64_t sequence = 0;
+        int64_t timestamp = 0; // milliseconds since the epoch
+        HistoryKind kind = HistoryKind::Broadcast;
+        std::string from;
+        std::string to;
+        std::string frame;
+    };
+
+    // Frames to replay to one user. They point straight into the mapped
+    // segments, which the batch keeps mapped for as long as it is held.
+    struct Batch
+    {
+        std::vector<std::string_view> frames;
+        // Mappings and encoded frames the views point into.
+        std::vector<std::shared_ptr<const void>> owners;
+        // Where the next batch starts.
+        uint64_t nextSequence = 0;
+    };
+
+    // Creates the directory if needed and recovers what is in it. Null if the
+    // directory cannot be used.
+    static std::unique_ptr<HistoryLog> open(const HistoryConfig& config);
+
+    // Drains and syncs whatever is still queued.
+    ~HistoryLog();
+
+    HistoryLog(const HistoryLog&) = delete;
+    HistoryLog& operator=(const HistoryLog&) = delete;
+
+    // Any thread; never blocks. The record is dropped, and counted, when the
+    // writer has fallen a whole queue behind.
+    void append(HistoryKind kind, std::string_view from, std::string_view to, SharedFrame frame);
+
+    // Any thread. Calls back on the writer thread, with the last synced
+    // sequence, once every record appended before this call is synced or has
+    // failed to be. Straight away, with what is synced now, if the queue is
+    // full; not at all if the log closes first.
+    void whenDurable(std::function<void(uint64_t)> callback);
+
+    // Up to limit synced records numbered fromSequence or later, oldest first.
+    std::vector<Entry> read(uint64_t fromSequence, size_t limit) const;
+
+    // Adds the frames user was sent among records fromSequence to
+    // toSequence, every broadcast and the direct messages to them, until the
+    // batch holds about maxBytes. Reading them faults the pages in here, so a
+    // reactor later writing from the batch does not wait on the disk.
+    void collect(std::string_view user, uint64_t fromSequence, uint64_t toSequence, size_t maxBytes,
+                 Batch& batch) const;
+
+    // The last record synced to disk; 0 while there are none.
+    uint64_t durableSequence() const { return m_durableSequence.load(std::memory_order_acquire); }
+    size_t segmentCount() const;
+    uint64_t droppedRecords() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    struct Pending
+    {
+        HistoryKind kind = HistoryKind::Broadcast;
+        int64_t timestamp = 0;
+        std::string from;
+        std::string to;
+        SharedFrame frame;
+        // Set instead of a frame on the marker whenDurable queues.
+        std::function<void(uint64_t)> onDurable;
+    };
+
+    struct IndexEntry
+    {
+        uint64_t sequence;
+        uint64_t offset;
+    };
+
+    class Mapping;
+
+    struct RecordView
+    {
+        uint64_t sequence;
+        int64_t timestamp;
+        HistoryKind kind;
+        std::string_view from;
+        std::string_view to;
+        std::string_view frame;
+    };
+
+    struct Segment
+    {
+        uint64_t firstSequence = 0;
+        // Synced bytes; the writer may be past this.
+        uint64_t size = 0;
+        std::vector<IndexEntry> index;
+    };
+
+    explicit HistoryLog(const HistoryConfig& config);
+
+    std::string m_directory;
+    size_t m_segmentBytes;
+    MpscQueue<Pending> m_queue;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<uint64_t> m_durableSequence;
+
+    // The writer adds segments and publishes synced bytes; readers look.
+    mutable std::mutex m_segmentsMutex;
+    std::vector<Segment> m_segments;
+
+    // Writer thread only, once open() has returned.
+    int m_logFd;
+    int m_indexFd;
+    uint64_t m_nextSequence;
+    uint64_t m_writeOffset;
+    uint64_t m_lastIndexedOffset;
+    std::string m_batch;
+    std::vector<IndexEntry> m_batchIndex;
+    // whenDurable callbacks reached in the queue, run once the batch is synced.
+    std::vector<std::function<void(uint64_t)>> m_durableCallbacks;
+
+    std::thread m_writer;
+
+    // The size of the record at the front of data, or 0 if there is no whole,
+    // intact record there.
+    static size_t parseRecord(const char* data, size_t available, RecordView& record);
+
+    // Visits synced records from fromSequence on, in order, until visit
+    // returns false. The views stay valid while the mapping is held.
+    void scan(uint64_t fromSequence,
+              const std::function<bool(const RecordView&, const std::shared_ptr<const Mapping>&)>& visit) const;
+
+    bool recover();
+    bool openSegment(uint64_t firstSequence, bool create);
+    void closeSegment();
+    std::string segmentPath(uint64_t firstSequence, const char* extension) const;
+
+    void run();
+    void appendRecord(const Pending& pending);
+    void commit();
+    void roll();
+};
@@ -1,15 +1,59 @@
 #include "IncomingConnHandler.h"
 
-#include <iostream>
+#include <Log.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
-#include <sys/select.h>
 #include <errno.h>
 
-IncomingConnHandler::IncomingConnHandler()
-    : m_terminate(false)
+namespace {
+int createListenSocket(uint16_t port)
+{
+    int serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (serverSocket == -1) {
+        SIMPLEIM_LOG_ERROR << "Error: Could not create socket. errno=" << errno;
+        return -1;
+    }
+
+    int reuseAddr = 1;
+    if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuseAddr, sizeof(reuseAddr)) == -1) {
+        SIMPLEIM_LOG_ERROR << "Error: Could not set SO_REUSEADDR on server socket. errno=" << errno;
+        close(serverSocket);
+        return -1;
+    }
+
+    int reusePort = 1;
+    if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &reusePort, sizeof(reusePort)) == -1) {
+        SIMPLEIM_LOG_ERROR << "Error: Could not set SO_REUSEPORT on server socket. errno=" << errno;
+        close(serverSocket);
+        return -1;
+    }
+
+    sockaddr_in serverAddr;
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(port);
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(serverSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1) {
+        SIMPLEIM_LOG_ERROR << "Error: Could not bind socket to address. errno=" << errno;
+        close(serverSocket);
+        return -1;
+    }
+
+    if (listen(serverSocket, SOMAXCONN) == -1) {
+        SIMPLEIM_LOG_ERROR << "Error: Could not listen on socket. errno=" << errno;
+        close(serverSocket);
+        return -1;
+    }
+
+    return serverSocket;
+}
+}
+
+IncomingConnHandler::IncomingConnHandler(const ServerConfig& config)
+    : m_config(config)
+    , m_clientManager(config)
 {}
 
 IncomingConnHandler::~IncomingConnHandler()
@@ -19,97 +63,36 @@ IncomingConnHandler::~IncomingConnHandler()
 
 void IncomingConnHandler::stop()
 {
-    m_terminate = true;
-    if(m_acceptorThread && m_acceptorThread->joinable()) {
-        m_acceptorThread->join();
-        m_acceptorThread.reset();
+    for (size_t shard = 0; shard < m_listenSockets.size(); ++shard) {
+        m_clientManager.reactor(shard).removeListener(m_listenSockets[shard]);
+    }
+
+    if (!m_listenSockets.empty()) {
+        m_listenSockets.clear();
+        SIMPLEIM_LOG_INFO << "IncomingConnHandler exiting.";
     }
 }
 
 void IncomingConnHandler::start()
 {
-    if(!m_acceptorThread) {
-        std::cout << "IncomingConnHandler starting..." << std::endl;
-
-        m_acceptorThread.reset(new std::thread([this]()->void {
-
-            int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-            if (serverSocket == -1) {
-                std::cerr << "Error: Could not create socket. errno=" << errno << "\n";
-                return;
-            }
-
-            int reuseAddr = 1;
-            if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuseAddr, sizeof(reuseAddr)) == -1) {
-                std::cerr << "Error: Could not set SO_REUSEADDR on server socket. errno=" << errno << "\n";
-                close(serverSocket);
-                return;
-            }
-
-            sockaddr_in serverAddr;
-            serverAddr.sin_family = AF_INET;
-            serverAddr.sin_port = htons(8989);
-            serverAddr.sin_addr.s_addr = INADDR_ANY;
-
-            if (bind(serverSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1) {
-                std::cerr << "Error: Could not bind socket to address. errno=" << errno << "\n";
-                close(serverSocket);
-                return;
-            }
-
-            if (listen(serverSocket, 10) == -1) {
-                std::cerr << "Error: Could not listen on socket. errno=" << errno << "\n";
-                close(serverSocket);
-                return;
-            }
-
-            std::cout << "Server listening on port 8989...\n";
-
-            while (!m_terminate) {
-
-                fd_set readfds;
-                struct timeval timeout;
-                
-                FD_ZERO(&readfds);
-                FD_SET(serverSocket, &readfds);
-                
-                timeout.tv_sec = 0;
-                timeout.tv_usec = 10000;
-                
-                int selectResult = select(serverSocket + 1, &readfds, NULL, NULL, &timeout);
-                
-                if (selectResult == -1) {
-                    if (errno != EINTR) {
-                        std::cerr << "Error: select() failed on server socket. errno=" << errno << "\n";
-                        break;
-                    }
-                    // signal interrupt
-                    continue;
-                }
-                else if (selectResult == 0) {
-                    // timeout
-                    continue;
-                }
-                else if (FD_ISSET(serverSocket, &readfds)) {
-                    // Socket is ready for accept
-                    sockaddr_in clientAddr;
-                    socklen_t clientAddrSize = sizeof(clientAddr);
-                    int clientSocket = accept(serverSocket, (struct sockaddr *)&clientAddr, &clientAddrSize);
-                    
-                    if (clientSocket == -1) {
-                        if (errno != EWOULDBLOCK && errno != EAGAIN) {
-                            std::cerr << "Error: Could not accept incoming connection. errno=" << errno << "\n";
-                        }
-                        continue;
-                    }
-
-                    std::cout << "Connection accepted from " << inet_ntoa(clientAddr.sin_addr) << ":" << ntohs(clientAddr.sin_port) << std::endl;
-                    m_clientManager.addConnectedClient(clientSocket);
-                }
-            }
-
-            close(serverSocket);
-            std::cout << "IncomingConnHandler exiting." << std::endl;
-        }));       
+    if(!m_listenSockets.empty()) {
+        return;
     }
+
+    SIMPLEIM_LOG_INFO << "IncomingConnHandler starting...";
+
+    for (size_t shard = 0; shard < m_clientManager.reactorCount(); ++shard) {
+        const int serverSocket = createListenSocket(m_config.port);
+        if (serverSocket == -1) {
+            break;
+        }
+
+        m_listenSockets.push_back(serverSocket);
+        m_clientManager.reactor(shard).addListener(serverSocket, [this, shard](int clientSocket) {
+            m_clientManager.addConnectedClient(clientSocket, shard);
+        });
+    }
+
+    SIMPLEIM_LOG_INFO << "Server listening on port " << m_config.port << " with "
+                      << m_listenSockets.size() << " reactor(s)...";
 }
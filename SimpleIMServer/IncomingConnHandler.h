@@ -1,23 +1,24 @@
 #pragma once
 #include "ClientManager.h"
+#include "ServerConfig.h"
 
-#include <thread>
-#include <memory>
+#include <vector>
 
 
 class IncomingConnHandler 
 {
 
 public:
-    IncomingConnHandler();
+    explicit IncomingConnHandler(const ServerConfig& config = ServerConfig());
     ~IncomingConnHandler();
 
     void start();
     void stop();
 
 private:
+    ServerConfig m_config;
     ClientManager m_clientManager;
 
-    bool m_terminate;
-    std::unique_ptr<std::thread> m_acceptorThread;
-};
\ No newline at end of file
+    // One SO_REUSEPORT listen socket per reactor; the kernel spreads accepts across them.
+    std::vector<int> m_listenSockets;
+};
@@ -0,0 +1,221 @@
+#include "IoUring.h"
+
+#include <algorithm>
+#include <Log.h>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace {
+// Multishot receives can complete many times per submission, so the
+// completion queue gets more room than the submission queue.
+constexpr unsigned kCompletionQueueFactor = 4;
+}
+
+IoUring::IoUring()
+    : m_ringFd(-1)
+    , m_ringPtr(MAP_FAILED)
+    , m_ringSize(0)
+    , m_sqes(nullptr)
+    , m_sqesSize(0)
+    , m_sqHead(nullptr)
+    , m_sqTail(nullptr)
+    , m_sqMask(0)
+    , m_sqEntries(0)
+    , m_sqeTail(0)
+    , m_cqHead(nullptr)
+    , m_cqTail(nullptr)
+    , m_cqMask(0)
+    , m_cqes(nullptr)
+    , m_bufRing(nullptr)
+    , m_bufRingSize(0)
+    , m_bufGroup(0)
+    , m_bufCount(0)
+    , m_bufTail(0)
+    , m_bufferSize(0)
+{}
+
+IoUring::~IoUring()
+{
+    destroy();
+}
+
+bool IoUring::init(unsigned entries)
+{
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * kCompletionQueueFactor;
+
+    m_ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (m_ringFd < 0) {
+        m_ringFd = -1;
+        return false;
+    }
+
+    // One mapping for both rings, overflowed completions kept rather than
+    // dropped, and timeouts passed to io_uring_enter directly
+    const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Kernel lacks required io_uring features.";
+        destroy();
+        return false;
+    }
+
+    const size_t sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    const size_t cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    m_ringSize = std::max(sqRingSize, cqRingSize);
+    m_ringPtr = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     m_ringFd, IORING_OFF_SQ_RING);
+    if (m_ringPtr == MAP_FAILED) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: mmap of the rings failed. errno=" << errno;
+        destroy();
+        return false;
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: mmap of the SQEs failed. errno=" << errno;
+        destroy();
+        return false;
+    }
+    m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+    char* ring = static_cast<char*>(m_ringPtr);
+    m_sqHead = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+    m_sqEntries = params.sq_entries;
+    m_sqeTail = *m_sqTail;
+
+    // SQE slots are used in ring order, so the index array is the identity
+    unsigned* sqArray = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+    for (unsigned i = 0; i < m_sqEntries; ++i) {
+        sqArray[i] = i;
+    }
+
+    m_cqHead = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+    return true;
+}
+
+void IoUring::destroy()
+{
+    // Closing the ring cancels whatever is still in flight
+    if (m_ringFd > -1) {
+        close(m_ringFd);
+        m_ringFd = -1;
+    }
+
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+        m_sqes = nullptr;
+    }
+    if (m_ringPtr != MAP_FAILED) {
+        munmap(m_ringPtr, m_ringSize);
+        m_ringPtr = MAP_FAILED;
+    }
+    if (m_bufRing) {
+        munmap(m_bufRing, m_bufRingSize);
+        m_bufRing = nullptr;
+    }
+    m_buffers.reset();
+}
+
+io_uring_sqe* IoUring::getSqe()
+{
+    if (m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries) {
+        if (submit() < 0 || m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries) {
+            return nullptr;
+        }
+    }
+
+    io_uring_sqe* sqe = &m_sqes[m_sqeTail & m_sqMask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    ++m_sqeTail;
+    return sqe;
+}
+
+int IoUring::submit()
+{
+    return enter(flushSqes(), 0, 0, nullptr, 0);
+}
+
+int IoUring::submitAndWait(int timeoutMs)
+{
+    const unsigned toSubmit = flushSqes();
+
+    if (timeoutMs < 0) {
+        return enter(toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    }
+
+    __kernel_timespec timeout{};
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+
+    io_uring_getevents_arg arg{};
+    arg.ts = reinterpret_cast<uint64_t>(&timeout);
+    return enter(toSubmit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+bool IoUring::setupBufferRing(uint16_t groupId, uint16_t count, uint32_t bufferSize)
+{
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    m_bufRingSize = (count * sizeof(io_uring_buf) + pageSize - 1) / pageSize * pageSize;
+    void* ring = mmap(nullptr, m_bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: mmap of the buffer ring failed. errno=" << errno;
+        return false;
+    }
+    m_bufRing = static_cast<io_uring_buf_ring*>(ring);
+
+    io_uring_buf_reg registration{};
+    registration.ring_addr = reinterpret_cast<uint64_t>(m_bufRing);
+    registration.ring_entries = count;
+    registration.bgid = groupId;
+    if (syscall(__NR_io_uring_register, m_ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+        munmap(m_bufRing, m_bufRingSize);
+        m_bufRing = nullptr;
+        return false;
+    }
+
+    m_bufGroup = groupId;
+    m_bufCount = count;
+    m_bufferSize = bufferSize;
+    m_buffers.reset(new char[size_t(count) * bufferSize]);
+    for (uint16_t id = 0; id < count; ++id) {
+        recycleBuffer(id);
+    }
+    return true;
+}
+
+void IoUring::recycleBuffer(uint16_t bufferId)
+{
+    // Index the slots by hand: in C++ the header's flexible bufs[] member lands
+    // past an empty placeholder struct instead of at offset 0.
+    io_uring_buf& slot = reinterpret_cast<io_uring_buf*>(m_bufRing)[m_bufTail & (m_bufCount - 1)];
+    slot.addr = reinterpret_cast<uint64_t>(buffer(bufferId));
+    slot.len = m_bufferSize;
+    slot.bid = bufferId;
+    ++m_bufTail;
+
+    // Publish the slot before the kernel can see the new tail
+    __atomic_store_n(&m_bufRing->tail, m_bufTail, __ATOMIC_RELEASE);
+}
+
+unsigned IoUring::flushSqes()
+{
+    __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+    return m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+int IoUring::enter(unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize)
+{
+    const long result = syscall(__NR_io_uring_enter, m_ringFd, toSubmit, minComplete, flags, arg, argSize);
+    return result < 0 ? -errno : static_cast<int>(result);
+}
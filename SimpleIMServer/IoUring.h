@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <linux/io_uring.h>
+
+// Thin wrapper over the io_uring system calls: ring setup and mapping, SQE
+// acquisition, submit-and-wait with a timeout, completion draining, and one
+// provided-buffer ring for multishot receives. Not thread-safe; only the
+// owning reactor thread touches it.
+class IoUring
+{
+public:
+    IoUring();
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    bool init(unsigned entries);
+    void destroy();
+
+    // Returns a zeroed SQE, submitting queued ones first if the ring is full;
+    // null only when that submit fails.
+    io_uring_sqe* getSqe();
+
+    // Submits queued SQEs without waiting. Returns the count or -errno.
+    int submit();
+
+    // Submits queued SQEs and waits for at least one completion, or until
+    // timeoutMs passes when it is not negative. Returns -errno on failure,
+    // -ETIME included.
+    int submitAndWait(int timeoutMs);
+
+    // Calls handler for every available completion, then releases them.
+    template<typename Handler>
+    unsigned drainCompletions(Handler&& handler)
+    {
+        unsigned head = *m_cqHead;
+        const unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        const unsigned count = tail - head;
+
+        for (; head != tail; ++head) {
+            const io_uring_cqe cqe = m_cqes[head & m_cqMask];
+            handler(cqe);
+        }
+
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    // Registers count buffers of bufferSize bytes as buffer group groupId.
+    // count must be a power of two.
+    bool setupBufferRing(uint16_t groupId, uint16_t count, uint32_t bufferSize);
+    char* buffer(uint16_t bufferId) { return m_buffers.get() + size_t(bufferId) * m_bufferSize; }
+    uint16_t bufferGroup() const { return m_bufGroup; }
+    // Hands a buffer consumed from a completion back to the kernel.
+    void recycleBuffer(uint16_t bufferId);
+
+private:
+    int m_ringFd;
+
+    void* m_ringPtr;
+    size_t m_ringSize;
+    io_uring_sqe* m_sqes;
+    size_t m_sqesSize;
+
+    unsigned* m_sqHead;
+    unsigned* m_sqTail;
+    unsigned m_sqMask;
+    unsigned m_sqEntries;
+    unsigned m_sqeTail;
+
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned m_cqMask;
+    io_uring_cqe* m_cqes;
+
+    io_uring_buf_ring* m_bufRing;
+    size_t m_bufRingSize;
+    uint16_t m_bufGroup;
+    uint16_t m_bufCount;
+    uint16_t m_bufTail;
+    uint32_t m_bufferSize;
+    std::unique_ptr<char[]> m_buffers;
+
+    unsigned flushSqes();
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize);
+};
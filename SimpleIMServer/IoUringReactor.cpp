@@ -0,0 +1,416 @@
+#include "IoUringReactor.h"
+
+#include <Log.h>
+#include <cerrno>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+constexpr unsigned kRingEntries = 1024;
+constexpr uint16_t kBufferGroup = 0;
+constexpr uint16_t kBufferCount = 256;
+constexpr uint32_t kBufferSize = 8 * 1024;
+
+// user_data carries the operation in the high word and the socket in the low one
+template<typename Operation>
+uint64_t packUserData(Operation operation, int fd)
+{
+    return (static_cast<uint64_t>(operation) << 32) | static_cast<uint32_t>(fd);
+}
+}
+
+bool IoUringReactor::isSupported()
+{
+    // Probed on a throwaway thread: tearing a ring down queues task work that
+    // would otherwise interrupt the caller's next blocking call with EINTR.
+    static const bool supported = []() {
+        bool usable = false;
+        std::thread probeThread([&usable]() {
+            IoUring probe;
+            usable = probe.init(8) && probe.setupBufferRing(kBufferGroup, 1, 64);
+        });
+        probeThread.join();
+        return usable;
+    }();
+    return supported;
+}
+
+IoUringReactor::IoUringReactor(ClientManager* manager, std::chrono::milliseconds handshakeTimeout,
+                               std::chrono::microseconds flushDelay, size_t recentBroadcastBytes)
+    : Reactor(manager, handshakeTimeout, flushDelay, recentBroadcastBytes)
+{}
+
+IoUringReactor::~IoUringReactor()
+{
+    stop();
+}
+
+bool IoUringReactor::openBackend()
+{
+    if (!m_ring.init(kRingEntries)) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: io_uring_setup failed.";
+        return false;
+    }
+
+    if (!m_ring.setupBufferRing(kBufferGroup, kBufferCount, kBufferSize)) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: could not register the receive buffer ring.";
+        m_ring.destroy();
+        return false;
+    }
+
+    armPoll(m_wakeFd, Operation::Wake);
+    if (m_flushTimerFd > -1) {
+        armPoll(m_flushTimerFd, Operation::FlushTimer);
+    }
+    return true;
+}
+
+void IoUringReactor::closeBackend()
+{
+    m_ring.destroy();
+    m_connections.clear();
+}
+
+void IoUringReactor::run()
+{
+    while (!m_terminate) {
+        flushPending();
+
+        const int result = m_ring.submitAndWait(nextTimeoutMs());
+        if (result < 0 && result != -ETIME && result != -EINTR && result != -EAGAIN && result != -EBUSY) {
+            SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: io_uring_enter failed. errno=" << -result;
+            break;
+        }
+
+        m_ring.drainCompletions([this](const io_uring_cqe& cqe) { handleCompletion(cqe); });
+        for (int listenSocket : dueStalledListeners()) {
+            if (isListener(listenSocket)) {
+                armAccept(listenSocket);
+            }
+        }
+        expirePendingLogons();
+    }
+}
+
+bool IoUringReactor::watchListener(int listenSocket)
+{
+    armAccept(listenSocket);
+    return true;
+}
+
+void IoUringReactor::unwatchListener(int listenSocket)
+{
+    io_uring_sqe* sqe = m_ring.getSqe();
+    if (!sqe) {
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = packUserData(Operation::Accept, listenSocket);
+    sqe->user_data = packUserData(Operation::Cancel, listenSocket);
+
+    // Cancel before the caller closes the socket and its number can be reused
+    m_ring.submit();
+}
+
+bool IoUringReactor::watchClient(ServerClient* client)
+{
+    const int fd = client->getSocket();
+    Connection& connection = m_connections[fd];
+    connection = Connection();
+    connection.client = client;
+
+    client->setWriteScheduler([this, fd]() { scheduleFlush(fd); });
+    armReceive(fd, connection);
+    return true;
+}
+
+void IoUringReactor::releaseClient(std::unique_ptr<ServerClient> client)
+{
+    const int fd = client->getSocket();
+    auto connectionIt = m_connections.find(fd);
+    if (connectionIt == m_connections.end()) {
+        return;
+    }
+
+    Connection& connection = connectionIt->second;
+    connection.client = nullptr;
+    connection.released = std::move(client);
+
+    // Flush what is still queued (a LoginFailure, say) without waiting on a slow
+    // peer, hard-linked to the shutdown so the socket goes down either way.
+    io_uring_sqe* sqe = nullptr;
+    if (!connection.sending && submitSend(fd, connection, IOSQE_IO_HARDLINK, MSG_DONTWAIT)) {
+        sqe = m_ring.getSqe();
+    }
+
+    if (sqe) {
+        sqe->opcode = IORING_OP_SHUTDOWN;
+        sqe->fd = fd;
+        sqe->len = SHUT_RDWR;
+        sqe->user_data = packUserData(Operation::Shutdown, fd);
+        connection.shuttingDown = true;
+    }
+    else {
+        shutdown(fd, SHUT_RDWR);
+    }
+
+    finishIfIdle(fd);
+}
+
+void IoUringReactor::armPoll(int fd, Operation operation)
+{
+    io_uring_sqe* sqe = m_ring.getSqe();
+    if (!sqe) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: submission queue full.";
+        return;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = packUserData(operation, fd);
+}
+
+void IoUringReactor::armAccept(int listenSocket)
+{
+    io_uring_sqe* sqe = m_ring.getSqe();
+    if (!sqe) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: submission queue full.";
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenSocket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = packUserData(Operation::Accept, listenSocket);
+}
+
+void IoUringReactor::armReceive(int fd, Connection& connection)
+{
+    io_uring_sqe* sqe = m_ring.getSqe();
+    if (!sqe) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: submission queue full.";
+        return;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = m_ring.bufferGroup();
+    sqe->user_data = packUserData(Operation::Receive, fd);
+    connection.receiving = true;
+}
+
+void IoUringReactor::flushClient(int fd)
+{
+    auto connectionIt = m_connections.find(fd);
+    if (connectionIt == m_connections.end()) {
+        return;
+    }
+
+    // One send in flight per connection keeps its frames in order; the rest
+    // go out when it completes.
+    Connection& connection = connectionIt->second;
+    if (connection.client && !connection.sending) {
+        submitSend(fd, connection, 0, 0);
+    }
+}
+
+bool IoUringReactor::submitSend(int fd, Connection& connection, uint8_t sqeFlags, int messageFlags)
+{
+    ServerClient* client = connection.client ? connection.client : connection.released.get();
+    if (!client->prepareWrite(connection.chunks)) {
+        return false;
+    }
+
+    io_uring_sqe* sqe = m_ring.getSqe();
+    if (!sqe) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: submission queue full.";
+        return false;
+    }
+
+    connection.message = msghdr();
+    connection.message.msg_iov = connection.chunks.data();
+    connection.message.msg_iovlen = connection.chunks.size();
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&connection.message);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | messageFlags;
+    sqe->flags = sqeFlags;
+    sqe->user_data = packUserData(Operation::Send, fd);
+    connection.sending = true;
+    return true;
+}
+
+void IoUringReactor::handleCompletion(const io_uring_cqe& cqe)
+{
+    const Operation operation = static_cast<Operation>(cqe.user_data >> 32);
+    const int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+
+    switch (operation)
+    {
+        case Operation::Wake:
+        {
+            uint64_t count = 0;
+            (void)!read(m_wakeFd, &count, sizeof(count));
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                armPoll(m_wakeFd, Operation::Wake);
+            }
+            runPendingTasks();
+        }
+        break;
+        case Operation::FlushTimer:
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                armPoll(m_flushTimerFd, Operation::FlushTimer);
+            }
+            onFlushTimer();
+        break;
+        case Operation::Accept:
+            handleAccept(fd, cqe);
+        break;
+        case Operation::Receive:
+            handleReceive(fd, cqe);
+        break;
+        case Operation::Send:
+            handleSend(fd, cqe);
+        break;
+        case Operation::Shutdown:
+        {
+            auto connectionIt = m_connections.find(fd);
+            if (connectionIt != m_connections.end()) {
+                connectionIt->second.shuttingDown = false;
+                finishIfIdle(fd);
+            }
+        }
+        break;
+        case Operation::Cancel:
+        break;
+    }
+}
+
+void IoUringReactor::handleAccept(int listenSocket, const io_uring_cqe& cqe)
+{
+    if (cqe.res >= 0) {
+        // Also closes sockets accepted just before their listener was removed
+        acceptConnection(listenSocket, cqe.res);
+    }
+    else if (cqe.res != -ECANCELED) {
+        if ((cqe.res != -EMFILE && cqe.res != -ENFILE) || !shedConnections(listenSocket)) {
+            SIMPLEIM_LOG_ERROR << "Error: Could not accept incoming connection. errno=" << -cqe.res;
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE) && isListener(listenSocket)) {
+            // An accept armed now would fail straight away, backlog or not
+            stallListener(listenSocket);
+            return;
+        }
+    }
+
+    if (!(cqe.flags & IORING_CQE_F_MORE) && isListener(listenSocket)) {
+        armAccept(listenSocket);
+    }
+}
+
+void IoUringReactor::handleReceive(int fd, const io_uring_cqe& cqe)
+{
+    const bool hasBuffer = cqe.flags & IORING_CQE_F_BUFFER;
+    const uint16_t bufferId = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+
+    auto connectionIt = m_connections.find(fd);
+    if (connectionIt == m_connections.end()) {
+        if (hasBuffer) {
+            m_ring.recycleBuffer(bufferId);
+        }
+        return;
+    }
+
+    Connection& connection = connectionIt->second;
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        connection.receiving = false;
+    }
+
+    ServerClient* client = connection.client;
+    if (cqe.res > 0 && hasBuffer && client) {
+        const bool wasPreAuth = client->getState() == ServerClient::ConnectionState::PreAuth;
+        const bool alive = client->onReceived(m_manager, m_ring.buffer(bufferId), static_cast<size_t>(cqe.res));
+        m_ring.recycleBuffer(bufferId);
+
+        if (!alive) {
+            closeClient(fd);
+            return;
+        }
+
+        trackLogon(client, wasPreAuth);
+        if (!connection.receiving) {
+            armReceive(fd, connection);
+        }
+        return;
+    }
+
+    if (hasBuffer) {
+        m_ring.recycleBuffer(bufferId);
+    }
+
+    // Released connections just wait for their receive to end
+    if (!client) {
+        finishIfIdle(fd);
+        return;
+    }
+
+    // The buffer ring ran dry; the buffers recycled above are available again
+    if (cqe.res == -ENOBUFS) {
+        if (!connection.receiving) {
+            armReceive(fd, connection);
+        }
+        return;
+    }
+
+    client->onReadFailed(-cqe.res);
+    closeClient(fd);
+}
+
+void IoUringReactor::handleSend(int fd, const io_uring_cqe& cqe)
+{
+    auto connectionIt = m_connections.find(fd);
+    if (connectionIt == m_connections.end()) {
+        return;
+    }
+
+    Connection& connection = connectionIt->second;
+    connection.sending = false;
+
+    if (!connection.client) {
+        finishIfIdle(fd);
+        return;
+    }
+
+    if (!connection.client->completeWrite(cqe.res)) {
+        closeClient(fd);
+        return;
+    }
+
+    // The rest of a short send, or frames queued while this one was in flight
+    submitSend(fd, connection, 0, 0);
+}
+
+void IoUringReactor::finishIfIdle(int fd)
+{
+    auto connectionIt = m_connections.find(fd);
+    if (connectionIt == m_connections.end()) {
+        return;
+    }
+
+    const Connection& connection = connectionIt->second;
+    if (connection.client || connection.receiving || connection.sending || connection.shuttingDown) {
+        return;
+    }
+
+    // Destroying the released ServerClient closes its socket
+    m_connections.erase(connectionIt);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Reactor.h"
+#include "IoUring.h"
+
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// io_uring backend (Linux 6.0+). Listeners use a multishot accept and clients
+// a multishot receive into a shared provided-buffer ring, so steady-state
+// reads cost no syscalls of their own. Each connection has at most one
+// SENDMSG in flight carrying every frame queued when it was submitted, sends
+// queued while handling one batch of completions go out together in the next
+// io_uring_enter, and a closing connection's final flush is hard-linked to
+// its shutdown.
+class IoUringReactor : public Reactor
+{
+public:
+    // Probes once whether the running kernel has everything this backend uses.
+    static bool isSupported();
+
+    IoUringReactor(ClientManager* manager, std::chrono::milliseconds handshakeTimeout,
+                   std::chrono::microseconds flushDelay, size_t recentBroadcastBytes);
+    ~IoUringReactor() override;
+
+    const char* backendName() const override { return "io_uring"; }
+
+protected:
+    bool openBackend() override;
+    void closeBackend() override;
+    void run() override;
+    bool watchListener(int listenSocket) override;
+    void unwatchListener(int listenSocket) override;
+    bool watchClient(ServerClient* client) override;
+    void releaseClient(std::unique_ptr<ServerClient> client) override;
+    void flushClient(int fd) override;
+
+private:
+    enum class Operation : uint8_t
+    {
+        Wake,
+        FlushTimer,
+        Accept,
+        Receive,
+        Send,
+        Shutdown,
+        Cancel
+    };
+
+    // Per-socket state. A connection the reactor has dropped stays here,
+    // owned through released, until its last operation completes.
+    struct Connection
+    {
+        ServerClient* client = nullptr;
+        std::unique_ptr<ServerClient> released;
+        bool receiving = false;
+        bool sending = false;
+        bool shuttingDown = false;
+        std::vector<iovec> chunks;
+        msghdr message{};
+    };
+
+    IoUring m_ring;
+    std::unordered_map<int, Connection> m_connections;
+
+    void armPoll(int fd, Operation operation);
+    void armAccept(int listenSocket);
+    void armReceive(int fd, Connection& connection);
+    bool submitSend(int fd, Connection& connection, uint8_t sqeFlags, int messageFlags);
+
+    void handleCompletion(const io_uring_cqe& cqe);
+    void handleAccept(int listenSocket, const io_uring_cqe& cqe);
+    void handleReceive(int fd, const io_uring_cqe& cqe);
+    void handleSend(int fd, const io_uring_cqe& cqe);
+    void finishIfIdle(int fd);
+};
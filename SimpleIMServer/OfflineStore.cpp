@@ -0,0 +1,317 @@
+#include "OfflineStore.h"
+
+#include <Log.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <limits.h>
+#include <optional>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+constexpr const char* kQueueExtension = ".queue";
+
+// Host byte order, like the history.
+struct RecordHeader
+{
+    uint16_t fromLength;
+    uint16_t reserved;
+    uint32_t messageLength;
+};
+static_assert(sizeof(RecordHeader) == 8);
+static_assert(2 * kMaxUsernameLength + sizeof(".queue") - 1 <= NAME_MAX, "a queue must be nameable for any user");
+
+bool readAll(int fd, char* data, size_t length)
+{
+    while (length > 0) {
+        const ssize_t received = read(fd, data, length);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        length -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+// Cuts a record torn by a crash off the end of a queue, so what is appended
+// next starts on a record boundary. The size of what is left, or empty if the
+// queue could not be checked; a queue left empty is removed.
+std::optional<uint64_t> repairQueue(const std::filesystem::path& path)
+{
+    const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        return std::nullopt;
+    }
+
+    struct stat info{};
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return std::nullopt;
+    }
+    const uint64_t size = static_cast<uint64_t>(info.st_size);
+    uint64_t whole = 0;
+    while (size - whole >= sizeof(RecordHeader)) {
+        RecordHeader header{};
+        if (pread(fd, &header, sizeof(header), static_cast<off_t>(whole)) != static_cast<ssize_t>(sizeof(header))) {
+            close(fd);
+            return std::nullopt;
+        }
+        const uint64_t recordSize = sizeof(header) + header.fromLength + header.messageLength;
+        if (size - whole < recordSize) {
+            break;
+        }
+        whole += recordSize;
+    }
+
+    bool repaired = true;
+    if (whole != size) {
+        SIMPLEIM_LOG_WARNING << "Offline messages: cutting a torn record off " << path << ".";
+        repaired = ftruncate(fd, static_cast<off_t>(whole)) == 0;
+    }
+    close(fd);
+    if (!repaired) {
+        return std::nullopt;
+    }
+    if (whole == 0) {
+        unlink(path.c_str());
+    }
+    return whole;
+}
+}
+
+std::unique_ptr<OfflineStore> OfflineStore::open(const OfflineConfig& config)
+{
+    std::unique_ptr<OfflineStore> store(new OfflineStore(config));
+
+    std::error_code error;
+    std::filesystem::create_directories(store->m_directory, error);
+    uint64_t totalBytes = 0;
+    size_t queueCount = 0;
+    if (!error) {
+        for (const auto& file : std::filesystem::directory_iterator(store->m_directory, error)) {
+            if (file.path().extension() != kQueueExtension) {
+                continue;
+            }
+            std::optional<uint64_t> size = repairQueue(file.path());
+            if (!size) {
+                // Still counted as it stands; take() reads no further than its last whole record
+                SIMPLEIM_LOG_ERROR << "Offline messages: cannot check " << file.path() << ": " << std::strerror(errno);
+                std::error_code sizeError;
+                size = file.file_size(sizeError);
+                if (sizeError) {
+                    continue;
+                }
+            }
+            if (*size > 0) {
+                totalBytes += *size;
+                ++queueCount;
+            }
+        }
+    }
+    if (error) {
+        SIMPLEIM_LOG_ERROR << "Offline messages: cannot use '" << config.directory << "': " << error.message();
+        return nullptr;
+    }
+
+    store->m_totalBytes.store(totalBytes, std::memory_order_relaxed);
+    SIMPLEIM_LOG_INFO << "Offline messages: " << queueCount << " queue(s), " << totalBytes << " bytes in '"
+                      << config.directory << "'.";
+    return store;
+}
+
+OfflineStore::OfflineStore(const OfflineConfig& config)
+    : m_directory(config.directory)
+    , m_maxBytesPerUser(config.maxBytesPerUser)
+    , m_maxBytesPerSender(config.maxBytesPerSender)
+    , m_maxTotalBytes(config.maxTotalBytes)
+    , m_totalBytes(0)
+{}
+
+OfflineStore::Result OfflineStore::store(std::string_view to, std::string_view from, std::string_view message)
+{
+    if (to.size() > kMaxUsernameLength || from.size() > UINT16_MAX || message.size() > UINT32_MAX) {
+        return Result::Failed;
+    }
+
+    RecordHeader header{};
+    header.fromLength = static_cast<uint16_t>(from.size());
+    header.messageLength = static_cast<uint32_t>(message.size());
+    const size_t recordSize = sizeof(header) + from.size() + message.size();
+
+    Stripe& stripe = stripeFor(to);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+
+    const std::string path = queuePath(to);
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        SIMPLEIM_LOG_ERROR << "Offline messages: cannot open '" << path << "': " << std::strerror(errno);
+        return Result::Failed;
+    }
+
+    struct stat info{};
+    Result result = Result::Stored;
+    if (fstat(fd, &info) != 0) {
+        result = Result::Failed;
+    }
+    else if (static_cast<size_t>(info.st_size) + recordSize > m_maxBytesPerUser) {
+        result = Result::RecipientFull;
+    }
+    else if (!reserveSenderBytes(from, recordSize)) {
+        result = Result::SenderFull;
+    }
+    else if (m_totalBytes.fetch_add(recordSize, std::memory_order_relaxed) + recordSize > m_maxTotalBytes) {
+        m_totalBytes.fetch_sub(recordSize, std::memory_order_relaxed);
+        releaseSenderBytes(from, recordSize);
+        result = Result::StoreFull;
+    }
+    else {
+        // One write, so a crash leaves at most a torn last record, which open() cuts off
+        iovec parts[3] = {
+            {&header, sizeof(header)},
+            {const_cast<char*>(from.data()), from.size()},
+            {const_cast<char*>(message.data()), message.size()},
+        };
+        ssize_t written = -1;
+        do {
+            written = writev(fd, parts, 3);
+        } while (written == -1 && errno == EINTR);
+
+        if (written != static_cast<ssize_t>(recordSize)) {
+            SIMPLEIM_LOG_ERROR << "Offline messages: cannot append to '" << path << "'.";
+            m_totalBytes.fetch_sub(recordSize, std::memory_order_relaxed);
+            releaseSenderBytes(from, recordSize);
+            if (written > 0 && ftruncate(fd, info.st_size) != 0) {
+                SIMPLEIM_LOG_ERROR << "Offline messages: '" << path << "' now ends in a torn record.";
+            }
+            result = Result::Failed;
+        }
+    }
+
+    if (info.st_size == 0 && result != Result::Stored) {
+        unlink(path.c_str()); // do not leave an empty queue behind
+    }
+    close(fd);
+    return result;
+}
+
+SharedFrame OfflineStore::take(std::string_view user)
+{
+    std::string records;
+    {
+        Stripe& stripe = stripeFor(user);
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+
+        const std::string path = queuePath(user);
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return nullptr;
+        }
+
+        struct stat info{};
+        bool read = fstat(fd, &info) == 0;
+        if (read) {
+            records.resize(static_cast<size_t>(info.st_size));
+            read = readAll(fd, records.data(), records.size());
+        }
+        close(fd);
+        if (!read) {
+            // Kept, so the messages are not lost to a passing error
+            SIMPLEIM_LOG_ERROR << "Offline messages: cannot read '" << path << "'; leaving it for next time.";
+            return nullptr;
+        }
+        unlink(path.c_str());
+        m_totalBytes.fetch_sub(static_cast<uint64_t>(info.st_size), std::memory_order_relaxed);
+    }
+
+    // Each record becomes "from: message", a little longer than it was on disk
+    std::vector<Message> messages;
+    size_t frameBytes = 0;
+    size_t offset = 0;
+    while (records.size() - offset >= sizeof(RecordHeader)) {
+        RecordHeader header{};
+        std::memcpy(&header, records.data() + offset, sizeof(header));
+        const size_t recordSize = sizeof(header) + header.fromLength + header.messageLength;
+        if (records.size() - offset < recordSize) {
+            break; // torn, and open() could not cut it off
+        }
+
+        const std::string_view from(records.data() + offset + sizeof(header), header.fromLength);
+        const std::string_view message(from.data() + from.size(), header.messageLength);
+        messages.emplace_back(MessageType::ChatMessageBroadcast, std::initializer_list<std::string_view>{from, ": ", message});
+        frameBytes += messages.back().encoded_size();
+        releaseSenderBytes(from, recordSize);
+        offset += recordSize;
+    }
+    if (messages.empty()) {
+        return nullptr;
+    }
+
+    auto frames = std::make_shared<std::string>(frameBytes, '\0');
+    char* out = frames->data();
+    for (const Message& message : messages) {
+        out += message.encode_into(out, frames->data() + frames->size() - out);
+    }
+    return frames;
+}
+
+std::string OfflineStore::queuePath(std::string_view user) const
+{
+    // Hex keeps any name a valid file name
+    static constexpr char kDigits[] = "0123456789abcdef";
+    std::string path = m_directory;
+    path += '/';
+    for (char c : user) {
+        path += kDigits[static_cast<uint8_t>(c) >> 4];
+        path += kDigits[static_cast<uint8_t>(c) & 0x0f];
+    }
+    path += kQueueExtension;
+    return path;
+}
+
+OfflineStore::Stripe& OfflineStore::stripeFor(std::string_view user)
+{
+    return m_stripes[std::hash<std::string_view>()(user) % kStripeCount];
+}
+
+bool OfflineStore::reserveSenderBytes(std::string_view from, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_sendersMutex);
+    auto senderIt = m_senderBytes.find(from);
+    const uint64_t queued = senderIt == m_senderBytes.end() ? 0 : senderIt->second;
+    if (queued + bytes > m_maxBytesPerSender) {
+        return false;
+    }
+    if (senderIt == m_senderBytes.end()) {
+        m_senderBytes.emplace(std::string(from), bytes);
+    }
+    else {
+        senderIt->second += bytes;
+    }
+    return true;
+}
+
+void OfflineStore::releaseSenderBytes(std::string_view from, size_t bytes)
+{
+    // Messages queued before the store opened were never counted
+    std::lock_guard<std::mutex> lock(m_sendersMutex);
+    auto senderIt = m_senderBytes.find(from);
+    if (senderIt == m_senderBytes.end()) {
+        return;
+    }
+    if (senderIt->second <= bytes) {
+        m_senderBytes.erase(senderIt);
+    }
+    else {
+        senderIt->second -= bytes;
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "ServerConfig.h"
+
+#include <Message.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "UserDirectory.h"
+
+// Direct messages waiting for users who are not logged on. Each recipient has
+// one queue file, named after their name in hex, so delivering it opens that
+// file and no other. A record is the sender's and the message's lengths
+// followed by both; the frame is rebuilt when it goes out.
+//
+// Records are written straight through to the file without a sync: they
+// survive the server restarting, not the machine going down. A queue stops
+// taking messages at its size limit, a sender at theirs and the store as a
+// whole at its own. What each sender has waiting is counted from when the
+// store opens. Thread-safe.
+class OfflineStore
+{
+public:
+    enum class Result
+    {
+        Stored,
+        RecipientFull,
+        SenderFull,
+        StoreFull,
+        Failed
+    };
+
+    // Creates the directory if needed and totals the queues already in it,
+    // first cutting off any record a crash left torn at the end of one.
+    // Null if the directory cannot be used.
+    static std::unique_ptr<OfflineStore> open(const OfflineConfig& config);
+
+    OfflineStore(const OfflineStore&) = delete;
+    OfflineStore& operator=(const OfflineStore&) = delete;
+
+    Result store(std::string_view to, std::string_view from, std::string_view message);
+
+    // Removes the user's queue and hands back its messages as chat frames,
+    // oldest first, back to back in one buffer. Null when nothing was waiting,
+    // or when the queue could not be read; it is left for the next logon then.
+    SharedFrame take(std::string_view user);
+
+    uint64_t totalBytes() const { return m_totalBytes.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t kStripeCount = 16;
+    static constexpr size_t kCacheLineSize = 64;
+
+    // Serialises the appends and the take of the queues hashed to it.
+    struct alignas(kCacheLineSize) Stripe
+    {
+        std::mutex mutex;
+    };
+
+    explicit OfflineStore(const OfflineConfig& config);
+
+    std::string queuePath(std::string_view user) const;
+    Stripe& stripeFor(std::string_view user);
+    bool reserveSenderBytes(std::string_view from, size_t bytes);
+    void releaseSenderBytes(std::string_view from, size_t bytes);
+
+    std::string m_directory;
+    size_t m_maxBytesPerUser;
+    size_t m_maxBytesPerSender;
+    size_t m_maxTotalBytes;
+    std::atomic<uint64_t> m_totalBytes;
+    Stripe m_stripes[kStripeCount];
+
+    std::mutex m_sendersMutex;
+    std::unordered_map<std::string, uint64_t, NameHash, std::equal_to<>> m_senderBytes;
+};
@@ -0,0 +1,170 @@
+#include "Presence.h"
+
+#include <charconv>
+
+namespace {
+// Decimal digits of a uint64_t
+constexpr size_t kMaxSequenceDigits = 20;
+
+std::string_view formatSequence(char (&digits)[kMaxSequenceDigits], uint64_t value)
+{
+    const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    return std::string_view(digits, static_cast<size_t>(result.ptr - digits));
+}
+}
+
+Presence::Presence(size_t pageBytes)
+    : m_pageBytes(pageBytes)
+    , m_sequence(0)
+{
+}
+
+void Presence::join(std::string_view name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    queue(name, '+');
+}
+
+void Presence::leave(std::string_view name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    queue(name, '-');
+}
+
+std::vector<SharedFrame> Presence::flush()
+{
+    std::vector<SharedFrame> frames;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pending.empty()) {
+        return frames;
+    }
+
+    // Consecutive changes share a frame, numbered from the sequence in its header
+    char digits[kMaxSequenceDigits];
+    std::string body;
+    uint64_t first = 0;
+    auto emit = [&]() {
+        frames.push_back(Message::encode_shared(MessageType::PresenceDelta,
+                                                {formatSequence(digits, first), ":", body}));
+        body.clear();
+    };
+
+    for (const Change& change : m_pending) {
+        if (change.op == 0) {
+            continue;
+        }
+        if (!body.empty() && body.size() + 2 + change.name.size() > m_pageBytes) {
+            emit();
+        }
+        if (body.empty()) {
+            first = m_sequence + 1;
+        } else {
+            body += ',';
+        }
+        body += change.op;
+        body += change.name;
+
+        apply(change);
+        ++m_sequence;
+    }
+    if (!body.empty()) {
+        emit();
+    }
+
+    m_pending.clear();
+    m_pendingByName.clear();
+    if (!frames.empty()) {
+        m_snapshot.reset();
+    }
+    return frames;
+}
+
+std::shared_ptr<const Presence::Snapshot> Presence::snapshot()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_snapshot) {
+        m_snapshot = buildSnapshot();
+    }
+    return m_snapshot;
+}
+
+uint64_t Presence::sequence() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_sequence;
+}
+
+size_t Presence::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_names.size();
+}
+
+void Presence::queue(std::string_view name, char op)
+{
+    auto pendingIt = m_pendingByName.find(name);
+    if (pendingIt != m_pendingByName.end()) {
+        Change& queued = m_pending[pendingIt->second];
+        if (queued.op != op) {
+            // Joined and left (or left and rejoined) within one batch
+            queued.op = 0;
+            m_pendingByName.erase(pendingIt);
+            return;
+        }
+    }
+
+    m_pendingByName[std::string(name)] = m_pending.size();
+    m_pending.push_back(Change{std::string(name), op});
+}
+
+void Presence::apply(const Change& change)
+{
+    if (change.op == '+') {
+        m_indexByName.emplace(change.name, m_names.size());
+        m_names.push_back(change.name);
+        return;
+    }
+
+    auto nameIt = m_indexByName.find(change.name);
+    if (nameIt == m_indexByName.end()) {
+        return;
+    }
+    const size_t index = nameIt->second;
+    m_indexByName.erase(nameIt);
+    if (index != m_names.size() - 1) {
+        m_names[index] = std::move(m_names.back());
+        m_indexByName.find(m_names[index])->second = index;
+    }
+    m_names.pop_back();
+}
+
+std::shared_ptr<const Presence::Snapshot> Presence::buildSnapshot() const
+{
+    // Split the names first; each page's header carries the page count
+    std::vector<std::string> bodies(1);
+    for (const std::string& name : m_names) {
+        std::string* body = &bodies.back();
+        if (!body->empty() && body->size() + 1 + name.size() > m_pageBytes) {
+            body = &bodies.emplace_back();
+        }
+        if (!body->empty()) {
+            *body += ',';
+        }
+        *body += name;
+    }
+
+    auto snapshot = std::make_shared<Snapshot>();
+    snapshot->sequence = m_sequence;
+    snapshot->pages.reserve(bodies.size());
+
+    char sequenceDigits[kMaxSequenceDigits];
+    char countDigits[kMaxSequenceDigits];
+    const std::string_view sequence = formatSequence(sequenceDigits, m_sequence);
+    const std::string_view count = formatSequence(countDigits, bodies.size());
+    for (size_t page = 0; page < bodies.size(); ++page) {
+        char pageDigits[kMaxSequenceDigits];
+        snapshot->pages.push_back(Message::encode_shared(MessageType::PresenceSnapshot,
+            {sequence, ":", formatSequence(pageDigits, page), ":", count, ":", bodies[page]}));
+    }
+    return snapshot;
+}
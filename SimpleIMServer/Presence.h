@@ -0,0 +1,79 @@
+#pragma once
+
+#include "UserDirectory.h"
+
+#include <Message.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Who is logged on, kept as a versioned log. Joins and leaves are queued and
+// published in batches by flush(), which numbers each change with the next
+// sequence number and returns the PresenceDelta frames announcing them. A user
+// logging on gets a snapshot of what has been published instead, split into
+// pages and tagged with the sequence it reflects, and applies only the deltas
+// numbered after it. The snapshot frames are cached, so logons between two
+// flushes share them. Thread-safe.
+class Presence
+{
+public:
+    static constexpr size_t kDefaultPageBytes = 16 * 1024;
+
+    struct Snapshot
+    {
+        uint64_t sequence = 0;
+        std::vector<SharedFrame> pages;
+    };
+
+    // Snapshot pages and delta frames hold about pageBytes of names each, at
+    // least one name.
+    explicit Presence(size_t pageBytes = kDefaultPageBytes);
+
+    // Queue the change for the next flush. A join and a leave of the same name
+    // between two flushes cancel out, so a user bouncing during a reconnect
+    // storm is never announced.
+    void join(std::string_view name);
+    void leave(std::string_view name);
+
+    // Publishes the changes queued since the last flush; empty if there were none.
+    std::vector<SharedFrame> flush();
+
+    // Rebuilt on first use after a flush that changed something.
+    std::shared_ptr<const Snapshot> snapshot();
+
+    uint64_t sequence() const;
+    // Published users, not counting queued changes.
+    size_t size() const;
+
+private:
+    struct Change
+    {
+        std::string name;
+        char op; // '+' or '-', 0 once cancelled
+    };
+
+    size_t m_pageBytes;
+
+    mutable std::mutex m_mutex;
+    uint64_t m_sequence;
+    // Unordered; a leave moves the last name into the gap.
+    std::vector<std::string> m_names;
+    std::unordered_map<std::string, size_t, NameHash, std::equal_to<>> m_indexByName;
+    // Null once a flush made it stale.
+    std::shared_ptr<const Snapshot> m_snapshot;
+
+    // Queued changes in arrival order, and where each name's live one sits.
+    std::vector<Change> m_pending;
+    std::unordered_map<std::string, size_t, NameHash, std::equal_to<>> m_pendingByName;
+
+    // Caller holds the mutex.
+    void queue(std::string_view name, char op);
+    void apply(const Change& change);
+    std::shared_ptr<const Snapshot> buildSnapshot() const;
+};
@@ -0,0 +1,554 @@
+#include "Reactor.h"
+#include "ClientManager.h"
+#include "EpollReactor.h"
+#ifdef SIMPLEIM_IO_URING
+#include "IoUringReactor.h"
+#endif
+
+#include <Log.h>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <optional>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace {
+// How long a listener rests after an accept failure that shedding can't fix.
+constexpr std::chrono::milliseconds kAcceptRetryDelay(100);
+
+// Chat sent to many may be shed from a slow consumer's queue; presence and
+// anything meant for one user may not.
+bool isFannedOutChat(const SharedFrame& frame)
+{
+    return ChatStream::isChat(static_cast<MessageType>((*frame)[0]));
+}
+
+bool setNonBlocking(int socket)
+{
+    const int flags = fcntl(socket, F_GETFL, 0);
+    if (flags == -1) {
+        return false;
+    }
+
+    return fcntl(socket, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+}
+
+std::unique_ptr<Reactor> Reactor::create(ClientManager* manager,
+                                         std::chrono::milliseconds handshakeTimeout,
+                                         std::chrono::microseconds flushDelay,
+                                         size_t recentBroadcastBytes)
+{
+#ifdef SIMPLEIM_IO_URING
+    if (IoUringReactor::isSupported()) {
+        return std::make_unique<IoUringReactor>(manager, handshakeTimeout, flushDelay, recentBroadcastBytes);
+    }
+    SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "io_uring is not usable on this kernel, falling back to epoll.";
+#endif
+    return std::make_unique<EpollReactor>(manager, handshakeTimeout, flushDelay, recentBroadcastBytes);
+}
+
+Reactor::Reactor(ClientManager* manager, std::chrono::milliseconds handshakeTimeout,
+                 std::chrono::microseconds flushDelay, size_t recentBroadcastBytes)
+    : m_manager(manager)
+    , m_wakeFd(-1)
+    , m_flushTimerFd(-1)
+    , m_terminate(false)
+    , m_handshakeTimeout(handshakeTimeout)
+    , m_flushDelay(flushDelay)
+    , m_recipientsStale(false)
+    , m_spareFd(-1)
+    , m_shedConnections(0)
+    , m_lastBroadcast(0)
+    , m_recentBroadcastBytes(0)
+    , m_maxRecentBroadcastBytes(recentBroadcastBytes)
+    , m_clientCount(0)
+    , m_flushWindowOpen(false)
+{}
+
+Reactor::~Reactor() = default;
+
+void Reactor::start()
+{
+    if (m_thread) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Reactor already running.";
+        return;
+    }
+
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeFd == -1) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: eventfd failed. errno=" << errno;
+        return;
+    }
+
+    m_spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (m_spareFd == -1) {
+        SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Error: could not open a spare descriptor. errno=" << errno;
+    }
+
+    if (m_flushDelay.count() > 0) {
+        m_flushTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (m_flushTimerFd == -1) {
+            SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Error: timerfd_create failed, flushing without delay. errno="
+                                 << errno;
+        }
+    }
+
+    m_terminate = false;
+    m_thread.reset(new std::thread([this]()->void {
+        if (!openBackend()) {
+            SIMPLEIM_LOG_ERROR << "Reactor: could not open the " << backendName() << " backend.";
+            return;
+        }
+        run();
+        // Before stop() drops the connections, so the kernel is done with their buffers
+        closeBackend();
+    }));
+}
+
+void Reactor::stop()
+{
+    if (!m_thread) {
+        return;
+    }
+
+    m_terminate = true;
+    const uint64_t one = 1;
+    (void)!write(m_wakeFd, &one, sizeof(one));
+
+    if (m_thread->joinable()) {
+        m_thread->join();
+    }
+    m_thread.reset();
+
+    // Connections still open at shutdown are dropped without disconnect notifications.
+    m_clientsByUser.clear();
+    m_recipients.clear();
+    m_recipientsStale = false;
+    m_recentBroadcasts.clear();
+    m_recentBroadcastBytes = 0;
+    m_earlyBroadcasts.clear();
+    m_pendingLogons.clear();
+    m_clients.clear();
+    for (auto& listener : m_listeners) {
+        close(listener.first);
+    }
+    m_listeners.clear();
+    m_stalledListeners.clear();
+    m_clientCount = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_tasksMutex);
+        m_pendingTasks.clear();
+    }
+
+    m_pendingFlushes.clear();
+    m_flushWindowOpen = false;
+    if (m_flushTimerFd > -1) {
+        close(m_flushTimerFd);
+        m_flushTimerFd = -1;
+    }
+
+    if (m_spareFd > -1) {
+        close(m_spareFd);
+        m_spareFd = -1;
+    }
+
+    close(m_wakeFd);
+    m_wakeFd = -1;
+}
+
+void Reactor::addClient(std::unique_ptr<ServerClient> client)
+{
+    // std::function needs a copyable callable, so the client travels as a shared_ptr
+    // holding the unique_ptr until the reactor thread takes it.
+    auto pending = std::make_shared<std::unique_ptr<ServerClient>>(std::move(client));
+    post([this, pending]() {
+        registerClient(std::move(*pending));
+    });
+}
+
+void Reactor::post(std::function<void()> task)
+{
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(m_tasksMutex);
+        wake = m_pendingTasks.empty();
+        m_pendingTasks.push_back(std::move(task));
+    }
+
+    if (wake && m_wakeFd > -1) {
+        const uint64_t one = 1;
+        (void)!write(m_wakeFd, &one, sizeof(one));
+    }
+}
+
+void Reactor::addListener(int listenSocket, std::function<void(int)> onAccept)
+{
+    post([this, listenSocket, onAccept]() {
+        m_listeners[listenSocket] = onAccept;
+        if (!watchListener(listenSocket)) {
+            m_listeners.erase(listenSocket);
+            close(listenSocket);
+        }
+    });
+}
+
+void Reactor::removeListener(int listenSocket)
+{
+    post([this, listenSocket]() {
+        if (m_listeners.erase(listenSocket) > 0) {
+            m_stalledListeners.erase(std::remove(m_stalledListeners.begin(), m_stalledListeners.end(), listenSocket),
+                                     m_stalledListeners.end());
+            unwatchListener(listenSocket);
+            close(listenSocket);
+        }
+    });
+}
+
+void Reactor::broadcast(SharedFrame frame, UserHandle excludeUser, uint64_t number)
+{
+    post([this, frame = std::move(frame), excludeUser, number]() mutable {
+        // Numbers are taken before posting, so a later one can get here first
+        if (number != 0 && number != m_lastBroadcast + 1) {
+            m_earlyBroadcasts.emplace(number, NumberedBroadcast{excludeUser, std::move(frame)});
+            return;
+        }
+
+        deliverBroadcast(frame, excludeUser, number);
+        auto earlyIt = m_earlyBroadcasts.begin();
+        while (number != 0 && earlyIt != m_earlyBroadcasts.end() && earlyIt->first == m_lastBroadcast + 1) {
+            deliverBroadcast(earlyIt->second.frame, earlyIt->second.excludeUser, earlyIt->first);
+            earlyIt = m_earlyBroadcasts.erase(earlyIt);
+        }
+    });
+}
+
+void Reactor::deliverBroadcast(const SharedFrame& frame, UserHandle excludeUser, uint64_t number)
+{
+    if (number != 0) {
+        m_lastBroadcast = number;
+        if (m_maxRecentBroadcastBytes > 0) {
+            m_recentBroadcasts.push_back(NumberedBroadcast{excludeUser, frame});
+            m_recentBroadcastBytes += frame->size();
+            while (m_recentBroadcastBytes > m_maxRecentBroadcastBytes) {
+                m_recentBroadcastBytes -= m_recentBroadcasts.front().frame->size();
+                m_recentBroadcasts.pop_front();
+            }
+        }
+    }
+
+    // Queuing a frame may fail a connection but never removes it, so the
+    // list holds still while it is walked; failed ones are closed after.
+    const bool droppable = isFannedOutChat(frame);
+    std::vector<int> dropped;
+    for (ServerClient* client : recipients()) {
+        if (client->getState() == ServerClient::ConnectionState::Authenticated
+            && client->getUserHandle() != excludeUser
+            && (number == 0 || number > client->resentBroadcasts())
+            && !client->sendFrame(frame, droppable)) {
+            dropped.push_back(client->getSocket());
+        }
+    }
+
+    // Slow consumers cut off by their queue limit, closed once the loop is done
+    for (const int fd : dropped) {
+        closeClient(fd);
+    }
+}
+
+bool Reactor::recentBroadcasts(uint64_t after, UserHandle excludeUser, std::vector<ChatStream::Frame>& frames) const
+{
+    if (after >= m_lastBroadcast) {
+        return true;
+    }
+    const uint64_t firstKept = m_lastBroadcast - m_recentBroadcasts.size() + 1;
+    if (after + 1 < firstKept) {
+        return false;
+    }
+
+    for (auto broadcastIt = m_recentBroadcasts.begin() + static_cast<std::ptrdiff_t>(after + 1 - firstKept);
+         broadcastIt != m_recentBroadcasts.end(); ++broadcastIt) {
+        if (broadcastIt->excludeUser != excludeUser) {
+            frames.push_back(ChatStream::Frame{broadcastIt->frame, *broadcastIt->frame});
+        }
+    }
+    return true;
+}
+
+void Reactor::sendTo(UserHandle user, SharedFrame frame)
+{
+    post([this, user, frame = std::move(frame)]() {
+        auto userIt = m_clientsByUser.find(user);
+        if (userIt != m_clientsByUser.end() && !userIt->second->sendFrame(frame)) {
+            closeClient(userIt->second->getSocket());
+        }
+    });
+}
+
+void Reactor::sendTo(std::vector<UserHandle> users, SharedFrame frame)
+{
+    post([this, users = std::move(users), frame = std::move(frame)]() {
+        const bool droppable = isFannedOutChat(frame);
+        std::vector<int> dropped;
+        for (const UserHandle user : users) {
+            auto userIt = m_clientsByUser.find(user);
+            if (userIt != m_clientsByUser.end() && !userIt->second->sendFrame(frame, droppable)) {
+                dropped.push_back(userIt->second->getSocket());
+            }
+        }
+
+        for (const int fd : dropped) {
+            closeClient(fd);
+        }
+    });
+}
+
+void Reactor::sendHistory(UserHandle user, std::shared_ptr<const HistoryLog::Batch> batch,
+                          std::function<void()> onDrained)
+{
+    post([this, user, batch = std::move(batch), onDrained = std::move(onDrained)]() mutable {
+        auto userIt = m_clientsByUser.find(user);
+        if (userIt != m_clientsByUser.end() && !userIt->second->sendHistory(std::move(batch), std::move(onDrained))) {
+            closeClient(userIt->second->getSocket());
+        }
+    });
+}
+
+int Reactor::nextTimeoutMs() const
+{
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    if (!m_stalledListeners.empty()) {
+        deadline = m_acceptRetryAt;
+    }
+
+    if (!m_pendingLogons.empty()) {
+        auto clientIt = m_clients.find(m_pendingLogons.front());
+        if (clientIt == m_clients.end()) {
+            return 0; // stale entry, clear it right away
+        }
+
+        const auto logonDeadline = clientIt->second->getAcceptedAt() + m_handshakeTimeout;
+        if (!deadline || logonDeadline < *deadline) {
+            deadline = logonDeadline;
+        }
+    }
+
+    if (!deadline) {
+        return -1;
+    }
+
+    const auto remaining = *deadline - std::chrono::steady_clock::now();
+    // Round up so we never wake just before the deadline
+    return std::max<int>(0, std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+}
+
+void Reactor::expirePendingLogons()
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    while (!m_pendingLogons.empty()) {
+        const int fd = m_pendingLogons.front();
+        auto clientIt = m_clients.find(fd);
+
+        // The socket logged on, closed, or now belongs to a newer connection
+        // that queued its own entry further back.
+        if (clientIt == m_clients.end()
+            || clientIt->second->getState() != ServerClient::ConnectionState::PreAuth) {
+            m_pendingLogons.pop_front();
+            continue;
+        }
+
+        if (clientIt->second->getAcceptedAt() + m_handshakeTimeout > now) {
+            break;
+        }
+
+        m_pendingLogons.pop_front();
+        clientIt->second->handleLogonTimeout();
+        closeClient(fd);
+    }
+}
+
+void Reactor::scheduleFlush(int fd)
+{
+    m_pendingFlushes.push_back(fd);
+
+    if (m_flushTimerFd > -1 && !m_flushWindowOpen) {
+        itimerspec window{};
+        window.it_value.tv_sec = m_flushDelay.count() / 1000000;
+        window.it_value.tv_nsec = (m_flushDelay.count() % 1000000) * 1000;
+        if (timerfd_settime(m_flushTimerFd, 0, &window, nullptr) == 0) {
+            m_flushWindowOpen = true;
+        }
+    }
+}
+
+void Reactor::flushPending()
+{
+    if (m_flushWindowOpen) {
+        return;
+    }
+
+    // Flushing can close connections, and their disconnects queue more frames
+    std::vector<int> pending;
+    pending.swap(m_pendingFlushes);
+    for (const int fd : pending) {
+        flushClient(fd);
+    }
+}
+
+void Reactor::onFlushTimer()
+{
+    uint64_t expirations = 0;
+    (void)!read(m_flushTimerFd, &expirations, sizeof(expirations));
+    m_flushWindowOpen = false;
+    flushPending();
+}
+
+void Reactor::runPendingTasks()
+{
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(m_tasksMutex);
+        tasks.swap(m_pendingTasks);
+    }
+
+    for (auto& task : tasks) {
+        task();
+    }
+}
+
+void Reactor::registerClient(std::unique_ptr<ServerClient> client)
+{
+    const int fd = client->getSocket();
+    if (fd <= -1 || !setNonBlocking(fd)) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: could not make client socket non-blocking.";
+        return;
+    }
+
+    if (!watchClient(client.get())) {
+        return;
+    }
+
+    if (client->getState() == ServerClient::ConnectionState::PreAuth) {
+        m_pendingLogons.push_back(fd);
+    }
+    m_clients[fd] = std::move(client);
+    m_clientCount = m_clients.size();
+}
+
+void Reactor::acceptConnection(int listenSocket, int clientSocket)
+{
+    auto listenerIt = m_listeners.find(listenSocket);
+    if (listenerIt == m_listeners.end()) {
+        close(clientSocket);
+        return;
+    }
+
+    if (m_shedConnections > 0) {
+        SIMPLEIM_LOG_WARNING << "Accepting connections again after refusing " << m_shedConnections
+                             << " for want of file descriptors.";
+        m_shedConnections = 0;
+    }
+
+    sockaddr_in clientAddr{};
+    socklen_t clientAddrSize = sizeof(clientAddr);
+    if (getpeername(clientSocket, (struct sockaddr *)&clientAddr, &clientAddrSize) == 0) {
+        SIMPLEIM_LOG_DEBUG << "Connection accepted from " << inet_ntoa(clientAddr.sin_addr) << ":" << ntohs(clientAddr.sin_port);
+    }
+    listenerIt->second(clientSocket);
+}
+
+bool Reactor::shedConnections(int listenSocket)
+{
+    if (m_spareFd == -1) {
+        return false;
+    }
+
+    close(m_spareFd);
+    const size_t shedBefore = m_shedConnections;
+    int clientSocket;
+    while ((clientSocket = accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC)) != -1 || errno == EINTR
+           || errno == ECONNABORTED) {
+        if (clientSocket != -1) {
+            close(clientSocket);
+            ++m_shedConnections;
+        }
+    }
+    const bool drained = errno == EWOULDBLOCK || errno == EAGAIN;
+    m_spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    if (shedBefore == 0 && m_shedConnections > 0) {
+        SIMPLEIM_LOG_WARNING << "Out of file descriptors: refusing new connections until some close.";
+    }
+    return drained;
+}
+
+void Reactor::stallListener(int listenSocket)
+{
+    if (std::find(m_stalledListeners.begin(), m_stalledListeners.end(), listenSocket) == m_stalledListeners.end()) {
+        m_stalledListeners.push_back(listenSocket);
+    }
+    m_acceptRetryAt = std::chrono::steady_clock::now() + kAcceptRetryDelay;
+}
+
+std::vector<int> Reactor::dueStalledListeners()
+{
+    if (m_stalledListeners.empty() || std::chrono::steady_clock::now() < m_acceptRetryAt) {
+        return {};
+    }
+    return std::exchange(m_stalledListeners, {});
+}
+
+ServerClient* Reactor::findClient(int fd) const
+{
+    auto clientIt = m_clients.find(fd);
+    return clientIt == m_clients.end() ? nullptr : clientIt->second.get();
+}
+
+void Reactor::trackLogon(ServerClient* client, bool wasPreAuth)
+{
+    // Index the user once its logon completes so routed sends can find it
+    if (wasPreAuth && client->getState() == ServerClient::ConnectionState::Authenticated) {
+        m_clientsByUser[client->getUserHandle()] = client;
+        m_recipientsStale = true;
+    }
+}
+
+void Reactor::closeClient(int fd)
+{
+    auto clientIt = m_clients.find(fd);
+    if (clientIt == m_clients.end()) {
+        return;
+    }
+
+    auto userIt = m_clientsByUser.find(clientIt->second->getUserHandle());
+    if (userIt != m_clientsByUser.end() && userIt->second == clientIt->second.get()) {
+        m_clientsByUser.erase(userIt);
+        m_recipientsStale = true;
+    }
+
+    std::unique_ptr<ServerClient> client = std::move(clientIt->second);
+    m_clients.erase(clientIt);
+    m_clientCount = m_clients.size();
+    releaseClient(std::move(client));
+}
+
+const std::vector<ServerClient*>& Reactor::recipients()
+{
+    if (m_recipientsStale) {
+        m_recipients.clear();
+        m_recipients.reserve(m_clientsByUser.size());
+        for (const auto& [user, client] : m_clientsByUser) {
+            m_recipients.push_back(client);
+        }
+        m_recipientsStale = false;
+    }
+    return m_recipients;
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "ServerClient.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class ClientManager;
+
+// Event loop owning a shard of connections. Every ServerClient handed to it is
+// driven on the reactor's single thread, so idle connections cost a socket and
+// a ServerClient rather than a thread. The I/O mechanism lives in subclasses:
+// EpollReactor reacts to readiness, IoUringReactor to completed operations.
+class Reactor
+{
+public:
+    // io_uring when built with SIMPLEIM_IO_URING and the kernel supports it,
+    // epoll otherwise. The newest numbered broadcasts are kept up to
+    // recentBroadcastBytes, for streams resumed here; see recentBroadcasts.
+    static std::unique_ptr<Reactor> create(ClientManager* manager,
+                                           std::chrono::milliseconds handshakeTimeout,
+                                           std::chrono::microseconds flushDelay,
+                                           size_t recentBroadcastBytes);
+
+    virtual ~Reactor();
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    void start();
+    void stop();
+
+    virtual const char* backendName() const = 0;
+
+    // Thread-safe. Ownership of the connection moves to the reactor thread.
+    void addClient(std::unique_ptr<ServerClient> client);
+
+    // Thread-safe. Runs the task on the reactor thread.
+    void post(std::function<void()> task);
+
+    // Thread-safe. The reactor takes ownership of the non-blocking listen socket
+    // and calls onAccept on its own thread for every accepted connection.
+    void addListener(int listenSocket, std::function<void(int)> onAccept);
+    void removeListener(int listenSocket);
+
+    // Thread-safe. Queues the frame on authenticated connections owned by this
+    // reactor on the reactor thread, so shards never write each other's sockets and
+    // messages to a user keep the order they were submitted in. Chat the
+    // manager numbered goes out in number order, however the posts race, and
+    // skips connections it was already resent to on resume.
+    void broadcast(SharedFrame frame, UserHandle excludeUser = kInvalidUserHandle, uint64_t number = 0);
+    void sendTo(UserHandle user, SharedFrame frame);
+    // One task for every listed user on this reactor, as a room message needs.
+    void sendTo(std::vector<UserHandle> users, SharedFrame frame);
+    // Thread-safe. Queues a batch of replayed history for the user; see
+    // ServerClient::sendHistory.
+    void sendHistory(UserHandle user, std::shared_ptr<const HistoryLog::Batch> batch,
+                     std::function<void()> onDrained);
+
+    // Reactor thread only. The number of the last numbered broadcast queued
+    // here; every connection still open has been offered all up to it.
+    uint64_t lastBroadcast() const { return m_lastBroadcast; }
+    // Reactor thread only. Adds the numbered broadcasts past after, up to
+    // lastBroadcast(), to frames, less those that left out excludeUser. False
+    // if some of them are no longer kept.
+    bool recentBroadcasts(uint64_t after, UserHandle excludeUser, std::vector<ChatStream::Frame>& frames) const;
+
+    size_t clientCount() const { return m_clientCount.load(std::memory_order_relaxed); }
+
+protected:
+    Reactor(ClientManager* manager, std::chrono::milliseconds handshakeTimeout,
+            std::chrono::microseconds flushDelay, size_t recentBroadcastBytes);
+
+    // Backend hooks, all called on the reactor thread: openBackend, run until
+    // m_terminate, then closeBackend. Subclasses must call stop() from their
+    // destructor, while the hooks still exist.
+    virtual bool openBackend() = 0;
+    virtual void closeBackend() = 0;
+    virtual void run() = 0;
+    virtual bool watchListener(int listenSocket) = 0;
+    virtual void unwatchListener(int listenSocket) = 0;
+    virtual bool watchClient(ServerClient* client) = 0;
+    // Takes a connection the reactor has dropped; the backend may keep it
+    // until the kernel no longer references its buffers.
+    virtual void releaseClient(std::unique_ptr<ServerClient> client) = 0;
+    // Writes everything queued on the connection in as few calls as it can.
+    virtual void flushClient(int fd) = 0;
+
+    // Shared bookkeeping for the backend loops.
+    void runPendingTasks();
+    int nextTimeoutMs() const;
+    void expirePendingLogons();
+    void acceptConnection(int listenSocket, int clientSocket);
+    // Out of descriptors: gives up the spare to accept and close every pending
+    // connection, so peers are refused rather than left queued. False when
+    // there was no spare or the backlog could not be drained.
+    bool shedConnections(int listenSocket);
+    // Accepting failed for a reason the spare can't help with. The listener is
+    // returned by dueStalledListeners once the retry delay has passed.
+    void stallListener(int listenSocket);
+    std::vector<int> dueStalledListeners();
+    bool isListener(int fd) const { return m_listeners.count(fd) > 0; }
+    ServerClient* findClient(int fd) const;
+    void trackLogon(ServerClient* client, bool wasPreAuth);
+    void closeClient(int fd);
+
+    // Write coalescing. Connections report newly queued frames through their
+    // write scheduler, and flushPending hands each of them to flushClient once
+    // per loop iteration, so frames queued in between leave in one write. With
+    // a flush delay the flush timer fires that long after the first frame and
+    // flushPending waits for it.
+    void scheduleFlush(int fd);
+    void flushPending();
+    void onFlushTimer();
+
+    ClientManager* m_manager;
+    int m_wakeFd;
+    // timerfd closing the flush delay window; -1 when there is no delay.
+    int m_flushTimerFd;
+    std::atomic<bool> m_terminate;
+
+private:
+    std::chrono::milliseconds m_handshakeTimeout;
+    std::chrono::microseconds m_flushDelay;
+    std::unique_ptr<std::thread> m_thread;
+
+    std::mutex m_tasksMutex;
+    std::vector<std::function<void()>> m_pendingTasks;
+
+    // Only touched on the reactor thread, keyed by socket fd.
+    std::unordered_map<int, std::unique_ptr<ServerClient>> m_clients;
+    std::unordered_map<UserHandle, ServerClient*> m_clientsByUser;
+    // Authenticated connections as a flat list for broadcasts to walk. Like
+    // the maps it is only touched on the reactor thread, so it needs no lock
+    // and is never shared. Logons and closes only mark it stale; the next
+    // broadcast rebuilds it once from m_clientsByUser, so a burst of them
+    // costs one rebuild.
+    std::vector<ServerClient*> m_recipients;
+    bool m_recipientsStale;
+    std::unordered_map<int, std::function<void(int)>> m_listeners;
+
+    // Held open so there is always a descriptor to give up when accept runs
+    // out of them; see shedConnections.
+    int m_spareFd;
+    size_t m_shedConnections;
+    std::vector<int> m_stalledListeners;
+    std::chrono::steady_clock::time_point m_acceptRetryAt;
+
+    // Numbered broadcasts: the last one queued, the newest of those up to it,
+    // numbered on from m_lastBroadcast - m_recentBroadcasts.size() + 1, and
+    // any posted ahead of one still on its way.
+    struct NumberedBroadcast
+    {
+        UserHandle excludeUser;
+        SharedFrame frame;
+    };
+    uint64_t m_lastBroadcast;
+    std::deque<NumberedBroadcast> m_recentBroadcasts;
+    size_t m_recentBroadcastBytes;
+    size_t m_maxRecentBroadcastBytes;
+    std::map<uint64_t, NumberedBroadcast> m_earlyBroadcasts;
+
+    // Sockets still in PreAuth, in accept order. All share one timeout, so the
+    // front always holds the earliest deadline.
+    std::deque<int> m_pendingLogons;
+    std::atomic<size_t> m_clientCount;
+
+    // Sockets with frames queued since their last flush, and whether the flush
+    // timer is armed for them.
+    std::vector<int> m_pendingFlushes;
+    bool m_flushWindowOpen;
+
+    void registerClient(std::unique_ptr<ServerClient> client);
+    void deliverBroadcast(const SharedFrame& frame, UserHandle excludeUser, uint64_t number);
+    const std::vector<ServerClient*>& recipients();
+};
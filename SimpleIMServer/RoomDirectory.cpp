@@ -0,0 +1,130 @@
+#include "RoomDirectory.h"
+
+#include <algorithm>
+#include <mutex>
+
+bool RoomDirectory::isValidName(std::string_view room)
+{
+    return !room.empty() && room.size() <= kMaxRoomNameLength
+        && room.find_first_of(",:") == std::string_view::npos;
+}
+
+bool RoomDirectory::join(std::string_view room, UserHandle user, size_t shard)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    auto roomIt = m_rooms.find(room);
+    if (roomIt == m_rooms.end()) {
+        roomIt = m_rooms.emplace(std::string(room), std::make_shared<const Members>()).first;
+    }
+
+    const Members& current = *roomIt->second;
+    auto memberIt = std::find_if(current.begin(), current.end(),
+                                 [user](const Member& member) { return member.user == user; });
+    if (memberIt != current.end()) {
+        return false;
+    }
+
+    // Readers holding the old snapshot keep it unchanged
+    auto next = std::make_shared<Members>();
+    next->reserve(current.size() + 1);
+    next->assign(current.begin(), current.end());
+    next->push_back(Member{user, shard});
+    roomIt->second = std::move(next);
+
+    m_roomsByUser[user].push_back(roomIt->first);
+    return true;
+}
+
+bool RoomDirectory::leave(std::string_view room, UserHandle user)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    if (!removeMember(room, user)) {
+        return false;
+    }
+
+    auto userIt = m_roomsByUser.find(user);
+    if (userIt != m_roomsByUser.end()) {
+        std::vector<std::string>& rooms = userIt->second;
+        rooms.erase(std::find(rooms.begin(), rooms.end(), room));
+        if (rooms.empty()) {
+            m_roomsByUser.erase(userIt);
+        }
+    }
+    return true;
+}
+
+void RoomDirectory::leaveAll(UserHandle user)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    auto userIt = m_roomsByUser.find(user);
+    if (userIt == m_roomsByUser.end()) {
+        return;
+    }
+
+    for (const std::string& room : userIt->second) {
+        removeMember(room, user);
+    }
+    m_roomsByUser.erase(userIt);
+}
+
+std::shared_ptr<const RoomDirectory::Members> RoomDirectory::members(std::string_view room) const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto roomIt = m_rooms.find(room);
+    return roomIt == m_rooms.end() ? nullptr : roomIt->second;
+}
+
+bool RoomDirectory::isMember(std::string_view room, UserHandle user) const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto userIt = m_roomsByUser.find(user);
+    if (userIt == m_roomsByUser.end()) {
+        return false;
+    }
+    const std::vector<std::string>& rooms = userIt->second;
+    return std::find(rooms.begin(), rooms.end(), room) != rooms.end();
+}
+
+std::vector<std::string> RoomDirectory::names() const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    std::vector<std::string> names;
+    names.reserve(m_rooms.size());
+    for (const auto& roomPair : m_rooms) {
+        names.push_back(roomPair.first);
+    }
+    return names;
+}
+
+size_t RoomDirectory::size() const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_rooms.size();
+}
+
+bool RoomDirectory::removeMember(std::string_view room, UserHandle user)
+{
+    auto roomIt = m_rooms.find(room);
+    if (roomIt == m_rooms.end()) {
+        return false;
+    }
+
+    const Members& current = *roomIt->second;
+    auto memberIt = std::find_if(current.begin(), current.end(),
+                                 [user](const Member& member) { return member.user == user; });
+    if (memberIt == current.end()) {
+        return false;
+    }
+
+    if (current.size() == 1) {
+        m_rooms.erase(roomIt);
+        return true;
+    }
+
+    auto next = std::make_shared<Members>();
+    next->reserve(current.size() - 1);
+    next->insert(next->end(), current.begin(), memberIt);
+    next->insert(next->end(), memberIt + 1, current.end());
+    roomIt->second = std::move(next);
+    return true;
+}
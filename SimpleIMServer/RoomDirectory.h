@@ -0,0 +1,54 @@
+#pragma once
+
+#include "UserDirectory.h"
+
+#include <cstddef>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Named chat rooms and who is in them. Each room's members are published as an
+// immutable snapshot, replaced on every join and leave, so a room message walks
+// only that room's members and holds no lock while it does. Rooms exist while
+// they have members. Thread-safe.
+class RoomDirectory
+{
+public:
+    struct Member
+    {
+        UserHandle user;
+        size_t shard; // reactor owning the member's connection
+    };
+    using Members = std::vector<Member>;
+
+    static constexpr size_t kMaxRoomNameLength = 64;
+
+    // Non-empty, at most kMaxRoomNameLength, and free of the ',' and ':' the
+    // room payloads are split on.
+    static bool isValidName(std::string_view room);
+
+    // False if the user is already in the room.
+    bool join(std::string_view room, UserHandle user, size_t shard);
+    // False if the user was not in the room.
+    bool leave(std::string_view room, UserHandle user);
+    void leaveAll(UserHandle user);
+
+    // Null if the room does not exist.
+    std::shared_ptr<const Members> members(std::string_view room) const;
+    bool isMember(std::string_view room, UserHandle user) const;
+
+    std::vector<std::string> names() const;
+    size_t size() const;
+
+private:
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<std::string, std::shared_ptr<const Members>, NameHash, std::equal_to<>> m_rooms;
+    // Reverse index, so a disconnect leaves its rooms without scanning them all.
+    std::unordered_map<UserHandle, std::vector<std::string>> m_roomsByUser;
+
+    // Caller holds the mutex exclusively.
+    bool removeMember(std::string_view room, UserHandle user);
+};
@@ -0,0 +1,734 @@
+#include "SearchIndex.h"
+
+#include <Log.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+// How often the indexer looks for newly synced history when it has caught up
+constexpr std::chrono::milliseconds kIndexInterval{100};
+// History records read per pass
+constexpr size_t kReadBatch = 4096;
+// Segments of a tier merged at once; a tier's segments hold this many times
+// the records of the one below
+constexpr size_t kMergeFactor = 4;
+constexpr size_t kMinWordLength = 2;
+constexpr size_t kMaxWordLength = 64;
+constexpr char kMagic[8] = {'S', 'I', 'M', 'I', 'D', 'X', '1', '\0'};
+
+// Host byte order, like the history.
+struct SegmentHeader
+{
+    char magic[8];
+    uint64_t firstSequence;
+    uint64_t lastSequence;
+    uint64_t records;
+    uint32_t termCount;
+    uint32_t checksum;  // FNV-1a of everything after the header
+};
+static_assert(sizeof(SegmentHeader) == 40);
+
+// Precedes each term's text and postings.
+struct TermHeader
+{
+    uint16_t length;
+    uint16_t reserved;
+    uint32_t count;
+    uint32_t postingsLength;
+};
+static_assert(sizeof(TermHeader) == 12);
+
+uint32_t checksum(const char* data, size_t length, uint32_t hash = 2166136261u)
+{
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool writeAll(int fd, const char* data, size_t length)
+{
+    while (length > 0) {
+        const ssize_t written = write(fd, data, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+void syncDirectory(const std::string& directory)
+{
+    const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+void appendVarint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+// Builds a segment term by term, in term order, and writes it out whole.
+class SegmentWriter
+{
+public:
+    explicit SegmentWriter(uint64_t firstSequence)
+        : m_firstSequence(firstSequence)
+        , m_termCount(0)
+    {}
+
+    void add(std::string_view term, const std::vector<uint64_t>& sequences)
+    {
+        const size_t headerOffset = m_body.size();
+        m_body.append(sizeof(TermHeader), '\0');
+        m_body.append(term);
+
+        const size_t postingsOffset = m_body.size();
+        uint64_t previous = m_firstSequence;
+        for (uint64_t sequence : sequences) {
+            appendVarint(m_body, sequence - previous);
+            previous = sequence;
+        }
+
+        TermHeader header{};
+        header.length = static_cast<uint16_t>(term.size());
+        header.count = static_cast<uint32_t>(sequences.size());
+        header.postingsLength = static_cast<uint32_t>(m_body.size() - postingsOffset);
+        std::memcpy(&m_body[headerOffset], &header, sizeof(header));
+        ++m_termCount;
+    }
+
+    // Through a temporary file, so a crash never leaves half a segment under
+    // the real name.
+    bool write(const std::string& directory, const std::string& path, uint64_t lastSequence, uint64_t records) const
+    {
+        SegmentHeader header{};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.firstSequence = m_firstSequence;
+        header.lastSequence = lastSequence;
+        header.records = records;
+        header.termCount = m_termCount;
+        header.checksum = checksum(m_body.data(), m_body.size());
+
+        const std::string temporaryPath = path + ".tmp";
+        const int fd = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            return false;
+        }
+        const bool written = writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header))
+            && writeAll(fd, m_body.data(), m_body.size()) && fdatasync(fd) == 0;
+        close(fd);
+        if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            unlink(temporaryPath.c_str());
+            return false;
+        }
+        syncDirectory(directory);
+        return true;
+    }
+
+private:
+    uint64_t m_firstSequence;
+    uint32_t m_termCount;
+    std::string m_body;
+};
+
+// Merges two ascending lists of distinct records and adds the newest of them
+// to results, newest first, until it holds limit.
+void takeNewest(const std::vector<uint64_t>& first, const std::vector<uint64_t>& second, size_t limit,
+                std::vector<uint64_t>& results)
+{
+    auto a = first.rbegin();
+    auto b = second.rbegin();
+    while (results.size() < limit && (a != first.rend() || b != second.rend())) {
+        if (b == second.rend() || (a != first.rend() && *a > *b)) {
+            results.push_back(*a++);
+        }
+        else {
+            results.push_back(*b++);
+        }
+    }
+}
+}
+
+// An immutable segment, mapped from its file.
+struct SearchIndex::Segment
+{
+    struct Term
+    {
+        std::string_view text;
+        std::string_view postings;
+        uint32_t count;
+    };
+
+    ~Segment()
+    {
+        if (data) {
+            munmap(const_cast<char*>(data), length);
+        }
+    }
+
+    const Term* find(std::string_view text) const
+    {
+        auto it = std::lower_bound(terms.begin(), terms.end(), text,
+                                   [](const Term& term, std::string_view value) { return term.text < value; });
+        return it != terms.end() && it->text == text ? &*it : nullptr;
+    }
+
+    void decode(const Term& term, std::vector<uint64_t>& out) const
+    {
+        out.resize(term.count);
+        const uint8_t* in = reinterpret_cast<const uint8_t*>(term.postings.data());
+        uint64_t sequence = firstSequence;
+        for (uint32_t i = 0; i < term.count; ++i) {
+            uint64_t delta = 0;
+            unsigned shift = 0;
+            uint8_t byte = 0;
+            do {
+                byte = *in++;
+                delta |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            sequence += delta;
+            out[i] = sequence;
+        }
+    }
+
+    std::string path;
+    uint64_t firstSequence = 0;
+    uint64_t lastSequence = 0;
+    uint64_t records = 0;
+    const char* data = nullptr;
+    size_t length = 0;
+    std::vector<Term> terms;
+};
+
+std::unique_ptr<SearchIndex> SearchIndex::open(const HistoryLog& history, const std::string& directory,
+                                               size_t segmentRecords)
+{
+    std::unique_ptr<SearchIndex> index(new SearchIndex(history, directory, std::max<size_t>(1, segmentRecords)));
+    if (!index->recover()) {
+        return nullptr;
+    }
+
+    index->m_indexer = std::thread([search = index.get()]() { search->run(); });
+    index->m_merger = std::thread([search = index.get()]() { search->runMerges(); });
+    SIMPLEIM_LOG_INFO << "Search index: " << index->segmentCount() << " segment(s) in '" << directory
+                      << "', indexed up to #" << index->indexedSequence() << ".";
+    return index;
+}
+
+SearchIndex::SearchIndex(const HistoryLog& history, const std::string& directory, size_t segmentRecords)
+    : m_history(history)
+    , m_directory(directory)
+    , m_segmentRecords(segmentRecords)
+    , m_indexedSequence(0)
+    , m_segments(std::make_shared<const Segments>())
+    , m_mergePending(false)
+    , m_stop(false)
+{}
+
+SearchIndex::~SearchIndex()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_stop = true;
+    }
+    m_indexWake.notify_one();
+    m_mergeWake.notify_one();
+    if (m_merger.joinable()) {
+        m_merger.join();
+    }
+    if (m_indexer.joinable()) {
+        m_indexer.join();
+    }
+    flush();
+}
+
+std::vector<uint64_t> SearchIndex::find(std::string_view query, std::string_view user, size_t limit) const
+{
+    std::vector<std::string> words;
+    tokenize(query, words);
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+
+    std::vector<uint64_t> results;
+    if (words.empty() || limit == 0) {
+        return results;
+    }
+
+    // The same words as filed for the direct messages user sent or received
+    std::vector<std::string> scoped;
+    if (!user.empty()) {
+        for (const std::string& word : words) {
+            scoped.push_back(std::string(user) + '\0' + word);
+        }
+    }
+
+    std::vector<uint64_t> broadcasts;
+    std::vector<uint64_t> directs;
+    std::shared_ptr<const Segments> segments;
+    {
+        // Together, so a segment being written out is seen once, in one place
+        std::lock_guard<std::mutex> bufferLock(m_bufferMutex);
+        {
+            std::lock_guard<std::mutex> lock(m_segmentsMutex);
+            segments = m_segments;
+        }
+        match(m_buffer.postings, words, broadcasts);
+        match(m_buffer.postings, scoped, directs);
+        takeNewest(broadcasts, directs, limit, results);
+    }
+
+    for (auto segment = segments->rbegin(); segment != segments->rend() && results.size() < limit; ++segment) {
+        match(**segment, words, broadcasts);
+        match(**segment, scoped, directs);
+        takeNewest(broadcasts, directs, limit, results);
+    }
+    return results;
+}
+
+size_t SearchIndex::segmentCount() const
+{
+    std::lock_guard<std::mutex> lock(m_segmentsMutex);
+    return m_segments->size();
+}
+
+void SearchIndex::tokenize(std::string_view text, std::vector<std::string>& words)
+{
+    words.clear();
+    std::string word;
+    for (size_t i = 0; i <= text.size(); ++i) {
+        const unsigned char c = i < text.size() ? static_cast<unsigned char>(text[i]) : ' ';
+        if (std::isalnum(c) || c >= 0x80) {
+            word += static_cast<char>(c < 0x80 ? std::tolower(c) : c);
+            continue;
+        }
+        if (word.size() >= kMinWordLength && word.size() <= kMaxWordLength) {
+            words.push_back(word);
+        }
+        word.clear();
+    }
+}
+
+void SearchIndex::match(const Postings& postings, const std::vector<std::string>& terms, std::vector<uint64_t>& out)
+{
+    out.clear();
+    std::vector<const std::vector<uint64_t>*> lists;
+    for (const std::string& term : terms) {
+        auto it = postings.find(term);
+        if (it == postings.end()) {
+            return;
+        }
+        lists.push_back(&it->second);
+    }
+    if (lists.empty()) {
+        return;
+    }
+
+    // Rarest first, so every step shrinks the smallest list there is
+    std::sort(lists.begin(), lists.end(), [](const auto* a, const auto* b) { return a->size() < b->size(); });
+    out = *lists.front();
+    std::vector<uint64_t> both;
+    for (size_t i = 1; i < lists.size() && !out.empty(); ++i) {
+        both.clear();
+        std::set_intersection(out.begin(), out.end(), lists[i]->begin(), lists[i]->end(), std::back_inserter(both));
+        out.swap(both);
+    }
+}
+
+void SearchIndex::match(const Segment& segment, const std::vector<std::string>& terms, std::vector<uint64_t>& out)
+{
+    out.clear();
+    std::vector<const Segment::Term*> found;
+    for (const std::string& term : terms) {
+        const Segment::Term* entry = segment.find(term);
+        if (!entry) {
+            return;
+        }
+        found.push_back(entry);
+    }
+    if (found.empty()) {
+        return;
+    }
+
+    std::sort(found.begin(), found.end(), [](const auto* a, const auto* b) { return a->count < b->count; });
+    segment.decode(*found.front(), out);
+    std::vector<uint64_t> list;
+    std::vector<uint64_t> both;
+    for (size_t i = 1; i < found.size() && !out.empty(); ++i) {
+        segment.decode(*found[i], list);
+        both.clear();
+        std::set_intersection(out.begin(), out.end(), list.begin(), list.end(), std::back_inserter(both));
+        out.swap(both);
+    }
+}
+
+bool SearchIndex::recover()
+{
+    std::error_code error;
+    std::filesystem::create_directories(m_directory, error);
+
+    Segments segments;
+    if (!error) {
+        for (const auto& file : std::filesystem::directory_iterator(m_directory, error)) {
+            const std::string path = file.path().string();
+            if (file.path().extension() == ".tmp") {
+                unlink(path.c_str()); // a segment whose write never finished
+            }
+            else if (file.path().extension() == ".seg") {
+                if (auto segment = loadSegment(path)) {
+                    segments.push_back(std::move(segment));
+                }
+                else {
+                    SIMPLEIM_LOG_WARNING << "Search index: dropping unreadable segment '" << path << "'.";
+                    unlink(path.c_str());
+                }
+            }
+        }
+    }
+    if (error) {
+        SIMPLEIM_LOG_ERROR << "Search index: cannot use '" << m_directory << "': " << error.message();
+        return false;
+    }
+
+    // A merge cut short by a crash leaves its inputs beside its output
+    std::sort(segments.begin(), segments.end(), [](const auto& a, const auto& b) {
+        return a->firstSequence != b->firstSequence ? a->firstSequence < b->firstSequence
+                                                    : a->lastSequence > b->lastSequence;
+    });
+    auto kept = std::make_shared<Segments>();
+    for (auto& segment : segments) {
+        if (!kept->empty() && segment->firstSequence <= kept->back()->lastSequence) {
+            unlink(segment->path.c_str());
+            continue;
+        }
+        kept->push_back(std::move(segment));
+    }
+
+    m_indexedSequence.store(kept->empty() ? 0 : kept->back()->lastSequence, std::memory_order_release);
+    m_segments = std::move(kept);
+    return true;
+}
+
+std::string SearchIndex::segmentPath(uint64_t firstSequence, uint64_t lastSequence) const
+{
+    char name[64];
+    std::snprintf(name, sizeof(name), "%020" PRIu64 "-%020" PRIu64 ".seg", firstSequence, lastSequence);
+    return m_directory + "/" + name;
+}
+
+std::shared_ptr<const SearchIndex::Segment> SearchIndex::loadSegment(const std::string& path) const
+{
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return nullptr;
+    }
+    struct stat info{};
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SegmentHeader)) {
+        close(fd);
+        return nullptr;
+    }
+
+    auto segment = std::make_shared<Segment>();
+    segment->path = path;
+    segment->length = static_cast<size_t>(info.st_size);
+    void* data = mmap(nullptr, segment->length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    segment->data = static_cast<const char*>(data);
+
+    SegmentHeader header{};
+    std::memcpy(&header, segment->data, sizeof(header));
+    const char* body = segment->data + sizeof(header);
+    const size_t bodyLength = segment->length - sizeof(header);
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || checksum(body, bodyLength) != header.checksum) {
+        return nullptr;
+    }
+    segment->firstSequence = header.firstSequence;
+    segment->lastSequence = header.lastSequence;
+    segment->records = header.records;
+
+    segment->terms.reserve(header.termCount);
+    size_t offset = 0;
+    for (uint32_t i = 0; i < header.termCount; ++i) {
+        TermHeader term{};
+        if (bodyLength - offset < sizeof(term)) {
+            return nullptr;
+        }
+        std::memcpy(&term, body + offset, sizeof(term));
+        offset += sizeof(term);
+        if (bodyLength - offset < static_cast<size_t>(term.length) + term.postingsLength) {
+            return nullptr;
+        }
+        segment->terms.push_back(Segment::Term{std::string_view(body + offset, term.length),
+                                               std::string_view(body + offset + term.length, term.postingsLength),
+                                               term.count});
+        offset += term.length + term.postingsLength;
+    }
+    return segment;
+}
+
+void SearchIndex::run()
+{
+    uint64_t next = m_indexedSequence.load(std::memory_order_relaxed) + 1;
+    std::unique_lock<std::mutex> lock(m_wakeMutex);
+    while (!m_stop) {
+        lock.unlock();
+        std::vector<HistoryLog::Entry> entries;
+        if (m_history.durableSequence() >= next) {
+            entries = m_history.read(next, kReadBatch);
+        }
+        if (!entries.empty()) {
+            {
+                std::lock_guard<std::mutex> bufferLock(m_bufferMutex);
+                for (const HistoryLog::Entry& entry : entries) {
+                    add(entry);
+                }
+            }
+            next = entries.back().sequence + 1;
+            m_indexedSequence.store(entries.back().sequence, std::memory_order_release);
+            if (m_buffer.records >= m_segmentRecords) {
+                flush();
+            }
+        }
+
+        lock.lock();
+        if (entries.empty()) {
+            m_indexWake.wait_for(lock, kIndexInterval, [this]() { return m_stop; });
+        }
+    }
+}
+
+void SearchIndex::add(const HistoryLog::Entry& entry)
+{
+    if (m_buffer.records == 0) {
+        m_buffer.firstSequence = entry.sequence;
+    }
+    m_buffer.lastSequence = entry.sequence;
+    ++m_buffer.records;
+
+    // Only the text; the frame's payload is "from: text"
+    std::string_view text(entry.frame);
+    text.remove_prefix(std::min(text.size(), MessageHeader::kWireSize));
+    if (text.size() >= entry.from.size() + 2 && text.substr(0, entry.from.size()) == entry.from) {
+        text.remove_prefix(entry.from.size() + 2);
+    }
+
+    std::vector<std::string> words;
+    tokenize(text, words);
+    auto file = [this, &entry](const std::string& term) {
+        std::vector<uint64_t>& sequences = m_buffer.postings[term];
+        if (sequences.empty() || sequences.back() != entry.sequence) {
+            sequences.push_back(entry.sequence);
+        }
+    };
+
+    for (const std::string& word : words) {
+        if (entry.kind == HistoryKind::Broadcast) {
+            file(word);
+            continue;
+        }
+        file(entry.from + '\0' + word);
+        if (entry.to != entry.from) {
+            file(entry.to + '\0' + word);
+        }
+    }
+}
+
+void SearchIndex::flush()
+{
+    if (m_buffer.records == 0) {
+        return;
+    }
+
+    // Only this thread changes the buffer, so it is read here without the lock
+    std::vector<const Postings::value_type*> terms;
+    terms.reserve(m_buffer.postings.size());
+    for (const auto& term : m_buffer.postings) {
+        terms.push_back(&term);
+    }
+    std::sort(terms.begin(), terms.end(), [](const auto* a, const auto* b) { return a->first < b->first; });
+
+    SegmentWriter writer(m_buffer.firstSequence);
+    for (const auto* term : terms) {
+        writer.add(term->first, term->second);
+    }
+    const std::string path = segmentPath(m_buffer.firstSequence, m_buffer.lastSequence);
+    std::shared_ptr<const Segment> segment;
+    if (writer.write(m_directory, path, m_buffer.lastSequence, m_buffer.records)) {
+        segment = loadSegment(path);
+    }
+    if (!segment) {
+        // Kept in memory, and written out with what follows
+        SIMPLEIM_LOG_ERROR << "Search index: cannot write '" << path << "'.";
+        return;
+    }
+
+    Buffer written;
+    {
+        std::lock_guard<std::mutex> bufferLock(m_bufferMutex);
+        std::lock_guard<std::mutex> lock(m_segmentsMutex);
+        auto segments = std::make_shared<Segments>(*m_segments);
+        segments->push_back(std::move(segment));
+        m_segments = std::move(segments);
+        std::swap(written, m_buffer);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_mergePending = true;
+    }
+    m_mergeWake.notify_one();
+}
+
+void SearchIndex::runMerges()
+{
+    std::unique_lock<std::mutex> lock(m_wakeMutex);
+    while (true) {
+        m_mergeWake.wait(lock, [this]() { return m_mergePending || m_stop; });
+        if (m_stop) {
+            break;
+        }
+
+        m_mergePending = false;
+        lock.unlock();
+        while (mergeOnce()) {
+            std::lock_guard<std::mutex> stopLock(m_wakeMutex);
+            if (m_stop) {
+                break;
+            }
+        }
+        lock.lock();
+    }
+}
+
+bool SearchIndex::mergeOnce()
+{
+    std::shared_ptr<const Segments> segments;
+    {
+        std::lock_guard<std::mutex> lock(m_segmentsMutex);
+        segments = m_segments;
+    }
+
+    // Sizes fall from the oldest segment to the newest. A small one left
+    // before a larger one, written out at a shutdown, joins its neighbour;
+    // otherwise the oldest run of one tier is merged.
+    size_t first = 0;
+    size_t count = 0;
+    for (size_t i = 0; i + 1 < segments->size() && count == 0; ++i) {
+        if (tierOf((*segments)[i]->records) < tierOf((*segments)[i + 1]->records)) {
+            first = i;
+            count = 2;
+        }
+    }
+    for (size_t i = 0; i + kMergeFactor <= segments->size() && count == 0; ++i) {
+        const size_t tier = tierOf((*segments)[i]->records);
+        size_t run = 1;
+        while (run < kMergeFactor && tierOf((*segments)[i + run]->records) == tier) {
+            ++run;
+        }
+        if (run == kMergeFactor) {
+            first = i;
+            count = kMergeFactor;
+        }
+    }
+    if (count == 0) {
+        return false;
+    }
+
+    const Segments inputs(segments->begin() + first, segments->begin() + first + count);
+    uint64_t records = 0;
+    std::vector<size_t> cursors(inputs.size(), 0);
+    for (const auto& input : inputs) {
+        records += input->records;
+    }
+
+    // Inputs cover consecutive ranges, so a term's lists join in order
+    SegmentWriter writer(inputs.front()->firstSequence);
+    std::vector<uint64_t> merged;
+    std::vector<uint64_t> list;
+    while (true) {
+        const Segment::Term* next = nullptr;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (cursors[i] < inputs[i]->terms.size()
+                && (!next || inputs[i]->terms[cursors[i]].text < next->text)) {
+                next = &inputs[i]->terms[cursors[i]];
+            }
+        }
+        if (!next) {
+            break;
+        }
+
+        const std::string_view text = next->text;
+        merged.clear();
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (cursors[i] < inputs[i]->terms.size() && inputs[i]->terms[cursors[i]].text == text) {
+                inputs[i]->decode(inputs[i]->terms[cursors[i]], list);
+                merged.insert(merged.end(), list.begin(), list.end());
+                ++cursors[i];
+            }
+        }
+        writer.add(text, merged);
+    }
+
+    const std::string path = segmentPath(inputs.front()->firstSequence, inputs.back()->lastSequence);
+    std::shared_ptr<const Segment> segment;
+    if (writer.write(m_directory, path, inputs.back()->lastSequence, records)) {
+        segment = loadSegment(path);
+    }
+    if (!segment) {
+        SIMPLEIM_LOG_ERROR << "Search index: cannot write '" << path << "'; segments left unmerged.";
+        return false;
+    }
+
+    {
+        // Only this thread removes segments, so the run is still where it was
+        std::lock_guard<std::mutex> lock(m_segmentsMutex);
+        auto replaced = std::make_shared<Segments>(m_segments->begin(), m_segments->begin() + first);
+        replaced->push_back(std::move(segment));
+        replaced->insert(replaced->end(), m_segments->begin() + first + count, m_segments->end());
+        m_segments = std::move(replaced);
+    }
+
+    // Searches still holding the old segments keep their mappings
+    for (const auto& input : inputs) {
+        unlink(input->path.c_str());
+    }
+    return true;
+}
+
+size_t SearchIndex::tierOf(uint64_t records) const
+{
+    size_t tier = 0;
+    for (uint64_t size = m_segmentRecords * kMergeFactor; records >= size; size *= kMergeFactor) {
+        ++tier;
+    }
+    return tier;
+}
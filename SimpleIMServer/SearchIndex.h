@@ -0,0 +1,107 @@
+#pragma once
+
+#include "HistoryLog.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Inverted index over the history, for finding the messages that mention all
+// of a few words. Words are runs of letters and digits, lowercased, at least
+// two bytes long; bytes past ASCII count as letters so UTF-8 words stay
+// whole. A direct message's words are only filed under its sender and its
+// recipient, so a search turns up only the direct messages its user was part of.
+//
+// An indexer thread tails the synced history into an in-memory buffer, which
+// is written out as an immutable segment once it holds enough records. A
+// segment is a sorted term dictionary with each term's sequence numbers stored
+// as delta-coded varints. A merge thread folds runs of similar-sized segments
+// into one, so a search visits a handful of segments however long the history
+// grows. On open the indexer resumes after the last record the segments in
+// the directory cover. Thread-safe.
+class SearchIndex
+{
+public:
+    // Null if the directory cannot be used.
+    static std::unique_ptr<SearchIndex> open(const HistoryLog& history, const std::string& directory,
+                                             size_t segmentRecords);
+
+    // Writes out what is still buffered, so a restart need not index it again.
+    ~SearchIndex();
+
+    SearchIndex(const SearchIndex&) = delete;
+    SearchIndex& operator=(const SearchIndex&) = delete;
+
+    // The newest records, at most limit of them, holding every word of the
+    // query and visible to user. Newest first.
+    std::vector<uint64_t> find(std::string_view query, std::string_view user, size_t limit) const;
+
+    // The last record searchable; 0 while there are none.
+    uint64_t indexedSequence() const { return m_indexedSequence.load(std::memory_order_acquire); }
+    size_t segmentCount() const;
+
+    // The words text is indexed and searched under, in order, repeats included.
+    static void tokenize(std::string_view text, std::vector<std::string>& words);
+
+private:
+    struct Segment;
+    using Segments = std::vector<std::shared_ptr<const Segment>>;
+    using Postings = std::unordered_map<std::string, std::vector<uint64_t>>;
+
+    // Records indexed since the last segment was written out.
+    struct Buffer
+    {
+        uint64_t firstSequence = 0;
+        uint64_t lastSequence = 0;
+        uint64_t records = 0;
+        Postings postings;
+    };
+
+    SearchIndex(const HistoryLog& history, const std::string& directory, size_t segmentRecords);
+
+    bool recover();
+    std::string segmentPath(uint64_t firstSequence, uint64_t lastSequence) const;
+    std::shared_ptr<const Segment> loadSegment(const std::string& path) const;
+
+    // Terms are the words of the query, or the same words filed under a user.
+    static void match(const Postings& postings, const std::vector<std::string>& terms, std::vector<uint64_t>& out);
+    static void match(const Segment& segment, const std::vector<std::string>& terms, std::vector<uint64_t>& out);
+
+    void run();
+    void add(const HistoryLog::Entry& entry);
+    void flush();
+
+    void runMerges();
+    bool mergeOnce();
+    size_t tierOf(uint64_t records) const;
+
+    const HistoryLog& m_history;
+    std::string m_directory;
+    size_t m_segmentRecords;
+    std::atomic<uint64_t> m_indexedSequence;
+
+    // Written by the indexer only; searches read it under the lock.
+    mutable std::mutex m_bufferMutex;
+    Buffer m_buffer;
+
+    // Replaced whole whenever a segment is added or a run merged.
+    mutable std::mutex m_segmentsMutex;
+    std::shared_ptr<const Segments> m_segments;
+
+    std::mutex m_wakeMutex;
+    std::condition_variable m_indexWake;
+    std::condition_variable m_mergeWake;
+    bool m_mergePending;
+    bool m_stop;
+
+    std::thread m_indexer;
+    std::thread m_merger;
+};
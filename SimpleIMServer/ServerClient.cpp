@@ -1,7 +1,11 @@
 #include "ServerClient.h"
 #include "ClientManager.h"
 
-#include <iostream>
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <optional>
+#include <Log.h>
 #include <sys/socket.h>
 #include <cstring>
 #include <vector>
@@ -11,316 +15,643 @@
 
 namespace {
 constexpr uint32_t kMaxPayloadLength = 1024 * 1024;
-
-bool isValidMessageType(MessageType type)
+constexpr uint32_t kMaxLogonPayloadLength = 256;
+constexpr size_t kReadChunkSize = 16 * 1024;
+constexpr size_t kMaxWriteChunks = IOV_MAX;
+// Past this much queued, batching saves little and the socket should get it now.
+constexpr size_t kMaxCoalescedBytes = 64 * 1024;
+// A history replay asks for its next batch once the queue is down to this.
+constexpr size_t kHistoryRefillBytes = 64 * 1024;
+
+// A peer that went away mid-send or mid-read is routine; only other failures
+// are errors.
+bool isPeerReset(int error)
 {
-    return type >= MessageType::UserLogon && type <= MessageType::ClientDisconnected;
+    return error == EPIPE || error == ECONNRESET;
 }
 
-bool recvAll(int socket, char* buffer, size_t length)
+void logSendFailure(const std::string& userId, int error)
 {
-    size_t totalReceived = 0;
-    while (totalReceived < length) {
-        const ssize_t bytesReceived = recv(socket, buffer + totalReceived, length - totalReceived, 0);
-        if (bytesReceived == 0) {
-            errno = 0; // peer performed an orderly shutdown
-            return false;
-        }
-
-        if (bytesReceived < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-
-            return false;
-        }
-
-        totalReceived += static_cast<size_t>(bytesReceived);
+    if (isPeerReset(error)) {
+        SIMPLEIM_LOG_DEBUG << "Peer reset with data pending for '" << userId << "'.";
+    }
+    else {
+        SIMPLEIM_LOG_ERROR << "Failed to send to '" << userId << "' (errno=" << error << ": " << std::strerror(error)
+                           << ")";
     }
-
-    return true;
 }
 
-bool sendAll(int socket, const char* buffer, size_t length)
+// ':' ends a name in direct messages and ',' separates names in presence, so
+// a name holding either could not be addressed or listed; nor could one
+// holding control characters be shown.
+bool isValidUsername(std::string_view username)
 {
-    size_t totalSent = 0;
-    while (totalSent < length) {
-        const ssize_t bytesSent = send(socket, buffer + totalSent, length - totalSent, 0);
-        if (bytesSent < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-
-            return false;
-        }
-
-        if (bytesSent == 0) {
-            return false;
-        }
-
-        totalSent += static_cast<size_t>(bytesSent);
-    }
-
-    return true;
+    return std::none_of(username.begin(), username.end(), [](char c) {
+        return c == ':' || c == ',' || static_cast<unsigned char>(c) < 0x20 || c == 0x7f;
+    });
 }
 
 }
 
 ServerClient::ServerClient(int socket,
-               std::function<void(std::string)> disconnectCallback)
+               std::function<void(UserHandle)> disconnectCallback,
+               size_t shard,
+               const OutboundQueueLimits& outboundLimits)
     : m_socket(socket)
     , m_userId("")
-    , m_terminate(false)
+    , m_userHandle(kInvalidUserHandle)
+    , m_shard(shard)
+    , m_acceptedAt(std::chrono::steady_clock::now())
     , m_state(ConnectionState::PreAuth)
     , m_clientDisconnected(disconnectCallback)
+    , m_decoder(kMaxLogonPayloadLength)
+    , m_frontOffset(0)
+    , m_outboundBytes(0)
+    , m_framesInFlight(0)
+    , m_outboundLimits(outboundLimits)
+    , m_resentBroadcasts(0)
 {}
 
 ServerClient::~ServerClient()
 {
-    m_terminate = true;
-    
-    // Close socket first to interrupt any blocking recv calls
     if (m_socket > -1) {
         close(m_socket);
         m_socket = -1;
     }
-    
-    // Then wait for thread to finish. If destruction occurs on the same client thread,
-    // detach to avoid self-join.
-    if (m_thread && m_thread->joinable()) {
-        if (m_thread->get_id() == std::this_thread::get_id()) {
-            m_thread->detach();
-        } else {
-            m_thread->join();
-        }
-    }
 }
 
-bool ServerClient::handleLogon(ClientManager* manager)
+bool ServerClient::handleLogon(ClientManager* manager, MessageType type, std::string_view username)
 {
-    if (m_state != ConnectionState::PreAuth) {
-        std::cerr << __PRETTY_FUNCTION__ << "Logon attempted outside pre-auth state." << std::endl;
-        sendMessage(MessageType::LoginFailure, "Already authenticated");
+    if(type != MessageType::UserLogon) {
+        SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Incorrect login message type.";
+        sendMessage(MessageType::LoginFailure, "Invalid message type");
+        handleSocketError();
         return false;
     }
 
-    std::optional<MessageHeader> header = readMessageHeader();
-    if(!header.has_value()) {
-        std::cerr << __PRETTY_FUNCTION__ << "Failed to read message header." << std::endl;
+    if(username.empty()) {
+        SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Empty username provided.";
+        sendMessage(MessageType::LoginFailure, "Username cannot be empty");
+        handleSocketError();
         return false;
     }
-
-    if(header->type != MessageType::UserLogon) {
-        std::cerr << __PRETTY_FUNCTION__ << "Incorrect login message type." << std::endl;
-        sendMessage(MessageType::LoginFailure, "Invalid message type");
+    if(username.size() > kMaxUsernameLength) {
+        SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Username of " << username.size() << " bytes is too long.";
+        sendMessage(MessageType::LoginFailure, "Username too long");
+        handleSocketError();
         return false;
     }
-
-    std::string username = readMessageData(header->length);
-    if(username.empty()) {
-        std::cerr << __PRETTY_FUNCTION__ << "Empty username provided." << std::endl;
-        sendMessage(MessageType::LoginFailure, "Username cannot be empty");
+    if(!isValidUsername(username)) {
+        SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Username holds characters the protocol cannot carry.";
+        sendMessage(MessageType::LoginFailure, "Username cannot contain ':', ',' or control characters");
+        handleSocketError();
         return false;
     }
 
-    // Check if username is already taken
-    if(!manager->isUsernameAvailable(username)) {
-        std::cout << __PRETTY_FUNCTION__ << "Username '" << username << "' already taken." << std::endl;
+    // Claim the username; fails if it is already taken
+    const UserHandle handle = manager->registerClient(username, m_shard);
+    if(handle == kInvalidUserHandle) {
+        SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Username '" << username << "' already taken.";
         sendMessage(MessageType::LoginFailure, "Username already taken");
+        handleSocketError();
         return false;
     }
 
     m_userId = username;
+    m_userHandle = handle;
     m_state = ConnectionState::Authenticated;
+
+    // Queues the announcement; it goes out with the next presence batch
+    manager->onClientLogon(m_userId);
     
     // Send login success
     sendMessage(MessageType::LoginSuccess, "Login successful");
     
-    // Send current list of connected clients
-    std::string userList = manager->serializeUserList();
-    sendMessage(MessageType::ConnectedClientsList, userList);
+    // Who is logged on as of the snapshot's sequence. Deltas reach us only
+    // once this returns, after the snapshot.
+    const auto snapshot = manager->presenceSnapshot();
+    for (const SharedFrame& page : snapshot->pages) {
+        sendFrame(page);
+    }
+
+    // Then what the user missed: the rest of the chat stream they resume, or
+    // else history, streamed from the history thread
+    if (openStream(manager, m_streamResume)) {
+        manager->replayHistory(m_userHandle, m_userId, m_historyAfter);
+    }
+
+    // And whatever direct messages waited for us, in one go
+    if (SharedFrame offline = manager->takeOfflineMessages(m_userId)) {
+        sendFrame(offline);
+    }
     
-    std::cout << __PRETTY_FUNCTION__ << "User '" << m_userId << "' logged in successfully." << std::endl;
+    SIMPLEIM_LOG_INFO << __PRETTY_FUNCTION__ << "User '" << m_userId << "' logged in successfully.";
+    return m_state != ConnectionState::Closing;
+}
+
+bool ServerClient::handleResumeRequest(MessageType type, std::string_view data)
+{
+    // "seq" for history, "stream:seq" for a chat stream
+    const char* end = data.data() + data.size();
+    uint64_t first = 0;
+    uint64_t second = 0;
+    auto result = std::from_chars(data.data(), end, first);
+    bool valid = result.ec == std::errc();
+    if (valid && type == MessageType::StreamResume) {
+        valid = result.ptr != end && *result.ptr == ':';
+        if (valid) {
+            result = std::from_chars(result.ptr + 1, end, second);
+            valid = result.ec == std::errc();
+        }
+    }
+    if (!valid || result.ptr != end) {
+        SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Malformed resume request.";
+        sendMessage(MessageType::LoginFailure, "Invalid resume request");
+        handleSocketError();
+        return false;
+    }
+
+    if (type == MessageType::StreamResume) {
+        m_streamResume = ChatStream::Position{first, second};
+    }
+    else {
+        m_historyAfter = first;
+    }
     return true;
 }
 
-void ServerClient::run(ClientManager* manager)
+bool ServerClient::openStream(ClientManager* manager, const std::optional<ChatStream::Position>& resume)
 {
-    if (!m_thread)
-    {
-        std::cout << __PRETTY_FUNCTION__ << "Client starting..." << std::endl;
-
-        m_thread.reset(new std::thread([this, manager]()->void {
-            const std::string userIdSnapshot = m_userId;
-            
-            while(!m_terminate && m_socket > -1) {
-
-                std::optional<MessageHeader> header = readMessageHeader();
-
-                if(header.has_value() && !m_terminate) {
-
-                    std::string messageData = readMessageData(header->length);
-
-                    if (!m_terminate) {
-                        switch(header->type)
-                        {
-                            case MessageType::UserLogon:
-                                std::cout << "User logon during active session ignored for user: " << m_userId << std::endl;
-                            break;
-                            case MessageType::UserLogoff:
-                                m_state = ConnectionState::Closing;
-                                handleSocketError();
-                                return;
-                            break;
-                            case MessageType::ChatMessageBroadcast:
-                                std::cout << "Received chat message from " << m_userId << ": " << messageData << std::endl;
-                                if (manager) {
-                                    manager->broadcastChatMessage(m_userId, messageData);
-                                }
-                            break;
-                            case MessageType::ChatMessageDM:
-                                std::cout << "Received direct message from " << m_userId << ": " << messageData << std::endl;
-                                if (manager) {
-                                    manager->handleDirectMessage(m_userId, messageData);
-                                }
-                            break;
-                        }
-                    }
-                }
-                else {
-                    // If we can't read a header, the client has likely disconnected
-                    return;
-                }
-            }
-            
-            std::cout << __PRETTY_FUNCTION__ << "Client thread ending for user: " << userIdSnapshot << std::endl;
-        }));
+    std::vector<ChatStream::Frame> missed;
+    std::shared_ptr<ChatStream> stream = manager->openStream(m_userHandle, m_shard, m_userId, resume, missed,
+                                                             m_resentBroadcasts);
+    if (!stream) {
+        return true;
     }
-    else
+
+    const bool resumed = resume && resume->stream == stream->id();
+    sendMessage(MessageType::StreamSync, std::to_string(stream->id()) + ":" + std::to_string(stream->nextSequence()));
     {
-        std::cerr << __PRETTY_FUNCTION__  << "Client thread already running. Run called twice!";
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        m_stream = std::move(stream);
+    }
+
+    if (!missed.empty()) {
+        std::vector<OutboundFrame> frames;
+        frames.reserve(missed.size());
+        for (ChatStream::Frame& frame : missed) {
+            frames.push_back(OutboundFrame{std::move(frame.owner), frame.bytes});
+        }
+        queueFrames(frames.data(), frames.size());
     }
+    return !resumed;
 }
 
-std::optional<MessageHeader> ServerClient::readMessageHeader()
+void ServerClient::closeStream()
 {
-    if (m_socket > -1 && !m_terminate)
-    {
-        char headerBuffer[5];
-        if (!recvAll(m_socket, headerBuffer, sizeof(headerBuffer))) {
-            if (!m_terminate && errno != 0) {
-                std::cerr << __PRETTY_FUNCTION__
-                          << "Error: Failed to receive complete header from client (errno="
-                          << errno << ": " << std::strerror(errno) << ")" << std::endl;
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    if (!m_stream) {
+        return;
+    }
+
+    for (const OutboundFrame& frame : m_outbound) {
+        m_stream->record(frame.owner, frame.bytes);
+    }
+    m_stream.reset();
+}
+
+void ServerClient::handleLogonTimeout()
+{
+    SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Dropping connection that did not log on in time.";
+    sendMessage(MessageType::LoginFailure, "Logon timed out");
+    handleSocketError();
+}
+
+bool ServerClient::onReadable(ClientManager* manager)
+{
+    char chunk[kReadChunkSize];
+
+    while (m_state != ConnectionState::Closing) {
+        const ssize_t bytesReceived = recv(m_socket, chunk, sizeof(chunk), MSG_DONTWAIT);
+
+        if (bytesReceived > 0) {
+            if (!onReceived(manager, chunk, static_cast<size_t>(bytesReceived))) {
+                return false;
             }
-            handleSocketError();
-            return std::nullopt;
+            continue;
         }
 
-        const MessageType type = static_cast<MessageType>(headerBuffer[0]);
-        uint32_t payloadLength = 0;
-        std::memcpy(&payloadLength, &headerBuffer[1], sizeof(uint32_t));
-        payloadLength = ntohl(payloadLength);
+        if (bytesReceived == 0) {
+            // peer performed an orderly shutdown
+            onReadFailed(0);
+            return false;
+        }
 
-        if (!isValidMessageType(type)) {
-            std::cerr << __PRETTY_FUNCTION__ << "Invalid message type: "
-                      << static_cast<int>(headerBuffer[0]) << std::endl;
-            handleSocketError();
-            return std::nullopt;
+        if (errno == EINTR) {
+            continue;
         }
 
-        if (payloadLength > kMaxPayloadLength) {
-            std::cerr << __PRETTY_FUNCTION__ << "Payload too large: " << payloadLength << std::endl;
-            handleSocketError();
-            return std::nullopt;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
         }
 
-        return MessageHeader(type, payloadLength);
+        onReadFailed(errno);
+        return false;
     }
-    else
+
+    return false;
+}
+
+bool ServerClient::onWritable()
+{
+    bool flushed = false;
+    int error = 0;
     {
-        std::cerr << __PRETTY_FUNCTION__ << "Invalid socket.";
-        return std::nullopt;
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        flushed = flushWriteBuffer();
+        error = errno;
+    }
+
+    if (!flushed) {
+        logSendFailure(m_userId, error);
+        handleSocketError();
+        return false;
     }
+
+    notifyHistoryDrained();
+    return m_state != ConnectionState::Closing;
 }
 
-std::string ServerClient::readMessageData(uint32_t dataLen)
+bool ServerClient::onReceived(ClientManager* manager, const char* data, size_t length)
 {
-    if (dataLen == 0) {
-        return std::string();
+    if (m_state == ConnectionState::Closing) {
+        return false;
     }
 
-    if (dataLen > kMaxPayloadLength) {
-        std::cerr << __PRETTY_FUNCTION__ << "Payload too large: " << dataLen << std::endl;
-        handleSocketError();
-        return std::string();
+    // Frames are dispatched straight from the caller's memory; only a trailing
+    // partial frame is copied.
+    m_decoder.feed(data, length);
+    return processFrames(manager);
+}
+
+void ServerClient::onReadFailed(int error)
+{
+    if (isPeerReset(error)) {
+        SIMPLEIM_LOG_DEBUG << __PRETTY_FUNCTION__ << "Peer reset the connection of '" << m_userId << "'.";
     }
+    else if (error != 0) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Error: Failed to receive from client (errno="
+                           << error << ": " << std::strerror(error) << ")";
+    }
+    handleSocketError();
+}
 
-    if (m_socket > -1) {
-        std::vector<char> payloadBuffer(dataLen);
-        if (!recvAll(m_socket, payloadBuffer.data(), dataLen)) {
-            if (!m_terminate) {
-                std::cerr << __PRETTY_FUNCTION__ << "Error: Failed to receive complete payload from client" << std::endl;
-            }
-            handleSocketError();
-            return std::string();
+bool ServerClient::processFrames(ClientManager* manager)
+{
+    Frame frame;
+
+    while (true) {
+        // Unauthenticated peers only get to send a username-sized frame
+        m_decoder.setMaxPayloadLength(
+            m_state == ConnectionState::PreAuth ? kMaxLogonPayloadLength : kMaxPayloadLength);
+
+        switch (m_decoder.next(frame))
+        {
+            case FrameDecoder::Result::Frame:
+                if (!dispatchMessage(manager, frame.type, frame.payload)) {
+                    return false;
+                }
+            break;
+            case FrameDecoder::Result::Incomplete:
+                return true; // wait for the rest of the frame
+            case FrameDecoder::Result::InvalidType:
+                SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Invalid message type received.";
+                handleSocketError();
+                return false;
+            case FrameDecoder::Result::PayloadTooLarge:
+                SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Payload too large.";
+                handleSocketError();
+                return false;
         }
+    }
+}
 
-        return std::string(payloadBuffer.begin(), payloadBuffer.end());
+bool ServerClient::dispatchMessage(ClientManager* manager, MessageType type, std::string_view data)
+{
+    if (m_state == ConnectionState::PreAuth) {
+        if (type == MessageType::HistoryResume || type == MessageType::StreamResume) {
+            return handleResumeRequest(type, data);
+        }
+        return handleLogon(manager, type, data);
     }
 
-    std::cerr << __PRETTY_FUNCTION__ << "Invalid socket.";
-    return std::string();
+    switch(type)
+    {
+        case MessageType::UserLogon:
+            SIMPLEIM_LOG_WARNING << "User logon during active session ignored for user: " << m_userId;
+        break;
+        case MessageType::UserLogoff:
+            handleSocketError();
+            return false;
+        case MessageType::ChatMessageBroadcast:
+            SIMPLEIM_LOG_DEBUG << "Received chat message from " << m_userId << ": " << data;
+            if (manager) {
+                manager->broadcastChatMessage(m_userId, data);
+            }
+        break;
+        case MessageType::ChatMessageDM:
+            SIMPLEIM_LOG_DEBUG << "Received direct message from " << m_userId << ": " << data;
+            if (manager) {
+                manager->handleDirectMessage(m_userHandle, m_userId, data);
+            }
+        break;
+        case MessageType::RoomJoin:
+            if (manager) {
+                manager->joinRoom(m_userHandle, data);
+            }
+        break;
+        case MessageType::RoomLeave:
+            if (manager) {
+                manager->leaveRoom(m_userHandle, data);
+            }
+        break;
+        case MessageType::RoomList:
+            if (manager) {
+                manager->listRooms(m_userHandle);
+            }
+        break;
+        case MessageType::RoomMessage:
+            SIMPLEIM_LOG_DEBUG << "Received room message from " << m_userId << ": " << data;
+            if (manager) {
+                manager->handleRoomMessage(m_userHandle, m_userId, data);
+            }
+        break;
+        case MessageType::SearchRequest:
+            if (manager) {
+                manager->search(m_userHandle, m_userId, data);
+            }
+        break;
+        case MessageType::StreamAck: {
+            uint64_t sequence = 0;
+            const auto result = std::from_chars(data.data(), data.data() + data.size(), sequence);
+            std::lock_guard<std::mutex> lock(m_writeMutex);
+            if (result.ec == std::errc() && m_stream) {
+                m_stream->acknowledge(sequence);
+            }
+        }
+        break;
+        default:
+            SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Unexpected message type from client: "
+                                 << static_cast<int>(type);
+        break;
+    }
+
+    return m_state != ConnectionState::Closing;
 }
 
 void ServerClient::handleSocketError()
 {
-    m_state = ConnectionState::Closing;
-    m_terminate = true;
+    // Only the first caller (reactor or a sending thread) reports the disconnect
+    if (m_state.exchange(ConnectionState::Closing) == ConnectionState::Closing) {
+        return;
+    }
 
-    if (m_socket > -1) {
-        close(m_socket);
-        m_socket = -1;
+    // The socket itself is closed by the destructor once the reactor drops us;
+    // shutting it down here makes the reactor see a hangup if another thread failed.
+    // A reactor that schedules our writes flushes them first and shuts down itself.
+    if (m_socket > -1 && !m_writeScheduler) {
+        shutdown(m_socket, SHUT_RDWR);
     }
 
-    // Only call disconnect callback once
+    closeStream();
+
     if(m_clientDisconnected) {
         auto callback = m_clientDisconnected;
         m_clientDisconnected = nullptr;  // Prevent multiple calls
-        callback(m_userId);
+        callback(m_userHandle);
     }
 }
 
 bool ServerClient::sendMessage(MessageType type, const std::string& data)
 {
-    if (m_socket <= -1) {
-        std::cerr << __PRETTY_FUNCTION__ << "Invalid socket." << std::endl;
+    return sendFrame(Message::encode_shared(type, data));
+}
+
+bool ServerClient::sendFrame(SharedFrame frame, bool droppable)
+{
+    const std::string_view bytes(*frame);
+    OutboundFrame outbound{std::move(frame), bytes, droppable};
+    return queueFrames(&outbound, 1);
+}
+
+bool ServerClient::sendHistory(std::shared_ptr<const HistoryLog::Batch> batch, std::function<void()> onDrained)
+{
+    std::vector<OutboundFrame> frames;
+    frames.reserve(batch->frames.size());
+    for (const std::string_view frame : batch->frames) {
+        frames.push_back(OutboundFrame{batch, frame});
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        m_historyDrained = std::move(onDrained);
+    }
+    if (!queueFrames(frames.data(), frames.size())) {
         return false;
     }
 
-    // Create header
-    MessageHeader header(type, static_cast<uint32_t>(data.length()));
-    
-    // Send header
-    char headerBuffer[5];
-    headerBuffer[0] = static_cast<uint8_t>(type);
-    const uint32_t networkLength = htonl(header.length);
-    std::memcpy(&headerBuffer[1], &networkLength, sizeof(uint32_t));
-    
-    if (!sendAll(m_socket, headerBuffer, sizeof(headerBuffer))) {
-        std::cerr << __PRETTY_FUNCTION__ << "Failed to send header" << std::endl;
+    // The socket may have taken the whole batch already, leaving no write
+    // to complete and ask for the next
+    notifyHistoryDrained();
+    return true;
+}
+
+bool ServerClient::queueFrames(OutboundFrame* frames, size_t count)
+{
+    if (m_socket <= -1 || m_state == ConnectionState::Closing) {
+        SIMPLEIM_LOG_ERROR << __PRETTY_FUNCTION__ << "Invalid socket.";
+        return false;
+    }
+
+    bool flushed = true;
+    bool withinLimits = true;
+    bool schedule = false;
+    int error = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        schedule = m_outbound.empty();
+        for (size_t i = 0; i < count; ++i) {
+            m_outboundBytes += frames[i].bytes.size();
+            m_outbound.push_back(std::move(frames[i]));
+        }
+        if (!m_writeScheduler) {
+            flushed = flushWriteBuffer();
+        }
+        else if (m_framesInFlight == 0
+                 && (m_outbound.size() >= kMaxWriteChunks || m_outboundBytes >= kMaxCoalescedBytes)) {
+            // A full write's worth goes out now instead of waiting for the
+            // reactor's flush
+            flushed = flushWriteBuffer();
+        }
+        error = errno;
+
+        // Only what the socket would not take counts against the watermark
+        if (flushed && m_outboundBytes > m_outboundLimits.highWatermark) {
+            withinLimits = applySlowConsumerPolicy();
+        }
+    }
+
+    if (!flushed) {
+        logSendFailure(m_userId, error);
         handleSocketError();
         return false;
     }
+
+    if (!withinLimits) {
+        handleSocketError();
+        return false;
+    }
+
+    if (schedule && m_writeScheduler) {
+        m_writeScheduler();
+    }
     
-    // Send data if any
-    if (!data.empty()) {
-        if (!sendAll(m_socket, data.data(), data.length())) {
-            std::cerr << __PRETTY_FUNCTION__ << "Failed to send data" << std::endl;
-            handleSocketError();
-            return false;
+    return true;
+}
+
+void ServerClient::notifyHistoryDrained()
+{
+    std::function<void()> drained;
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        if (!m_historyDrained || m_outboundBytes > kHistoryRefillBytes) {
+            return;
         }
+        drained = std::move(m_historyDrained);
+        m_historyDrained = nullptr;
     }
-    
+    drained();
+}
+
+bool ServerClient::applySlowConsumerPolicy()
+{
+    if (m_outboundLimits.policy == SlowConsumerPolicy::Disconnect) {
+        SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Disconnecting slow consumer '" << m_userId << "' with "
+                             << m_outboundBytes.load() << " bytes queued.";
+        return false;
+    }
+
+    // Shed droppable chat from the oldest end down to the low watermark, leaving frames a
+    // send has already started on intact.
+    const size_t firstDroppable = std::max<size_t>(m_framesInFlight, m_frontOffset > 0 ? 1 : 0);
+    std::deque<OutboundFrame> kept;
+    size_t dropped = 0;
+
+    for (size_t i = 0; i < m_outbound.size(); ++i) {
+        OutboundFrame& frame = m_outbound[i];
+        if (i >= firstDroppable && m_outboundBytes > m_outboundLimits.lowWatermark && frame.droppable) {
+            m_outboundBytes -= frame.bytes.size();
+            ++dropped;
+            continue;
+        }
+        kept.push_back(std::move(frame));
+    }
+    m_outbound.swap(kept);
+
+    SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Dropped " << dropped << " queued chat frames for slow consumer '"
+                         << m_userId << "'.";
+
+    if (m_outboundBytes > m_outboundLimits.highWatermark) {
+        SIMPLEIM_LOG_WARNING << __PRETTY_FUNCTION__ << "Disconnecting slow consumer '" << m_userId
+                             << "', nothing left to drop.";
+        return false;
+    }
+
+    return true;
+}
+
+bool ServerClient::prepareWrite(std::vector<iovec>& chunks)
+{
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    chunks.resize(std::min(m_outbound.size(), kMaxWriteChunks));
+    m_framesInFlight = fillWriteChunks(chunks.data(), chunks.size());
+    return m_framesInFlight > 0;
+}
+
+bool ServerClient::completeWrite(ssize_t result)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        m_framesInFlight = 0;
+    }
+
+    if (result < 0) {
+        logSendFailure(m_userId, static_cast<int>(-result));
+        handleSocketError();
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        consumeWritten(static_cast<size_t>(result));
+    }
+    notifyHistoryDrained();
     return true;
 }
+
+size_t ServerClient::fillWriteChunks(iovec* chunks, size_t maxChunks)
+{
+    const size_t count = std::min(m_outbound.size(), maxChunks);
+    for (size_t i = 0; i < count; ++i) {
+        const std::string_view frame = m_outbound[i].bytes;
+        const size_t offset = i == 0 ? m_frontOffset : 0;
+        chunks[i].iov_base = const_cast<char*>(frame.data()) + offset;
+        chunks[i].iov_len = frame.size() - offset;
+    }
+    return count;
+}
+
+void ServerClient::consumeWritten(size_t bytes)
+{
+    while (bytes > 0 && !m_outbound.empty()) {
+        const size_t remaining = m_outbound.front().bytes.size() - m_frontOffset;
+        if (bytes < remaining) {
+            m_frontOffset += bytes;
+            m_outboundBytes -= bytes;
+            return;
+        }
+
+        bytes -= remaining;
+        m_outboundBytes -= remaining;
+        if (m_stream) {
+            m_stream->record(m_outbound.front().owner, m_outbound.front().bytes);
+        }
+        m_outbound.pop_front();
+        m_frontOffset = 0;
+    }
+}
+
+bool ServerClient::flushWriteBuffer()
+{
+    iovec chunks[kMaxWriteChunks];
+    msghdr message{};
+    message.msg_iov = chunks;
+
+    // Everything queued goes out in one sendmsg unless the socket takes less
+    while ((message.msg_iovlen = fillWriteChunks(chunks, kMaxWriteChunks)) > 0) {
+        const ssize_t bytesSent = sendmsg(m_socket, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (bytesSent > 0) {
+            consumeWritten(static_cast<size_t>(bytesSent));
+            continue;
+        }
+
+        if (bytesSent < 0 && errno == EINTR) {
+            continue;
+        }
+
+        // Socket buffer is full; the reactor resumes on the next EPOLLOUT edge.
+        return bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+    return true;
+}
\ No newline at end of file
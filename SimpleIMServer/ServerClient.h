@@ -1,17 +1,28 @@
 #pragma once
 
 #include <string>
-#include <thread>
-#include <memory>
+#include <string_view>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
 #include <optional>
+#include <vector>
 #include <functional>
+#include <sys/uio.h>
 
+#include <FrameDecoder.h>
 #include <Message.h>
 
+#include "ChatStream.h"
+#include "HistoryLog.h"
+#include "ServerConfig.h"
+#include "UserDirectory.h"
+
 // Forward declaration
 class ClientManager;
 
-class ServerClient 
+class ServerClient
 {
 public:
     enum class ConnectionState
@@ -21,31 +32,128 @@ public:
         Closing
     };
 
-    explicit ServerClient(int socket, 
-                    std::function<void(std::string)> disconnectCallback);
+    explicit ServerClient(int socket,
+                    std::function<void(UserHandle)> disconnectCallback,
+                    size_t shard = 0,
+                    const OutboundQueueLimits& outboundLimits = OutboundQueueLimits());
     ~ServerClient();
 
     ServerClient(const ServerClient&) = delete;
     ServerClient& operator=(const ServerClient&) = delete;
-    
-    bool handleLogon(ClientManager* manager);
-    void run(ClientManager* manager);
-    
+
+    // Readiness handlers driven by the EpollReactor. Both drain the socket until
+    // it would block and return false once the connection should be dropped.
+    // In PreAuth only the UserLogon is read, after any resume requests
+    // sent ahead of it.
+    bool onReadable(ClientManager* manager);
+    bool onWritable();
+
+    // Completion handlers for reactors that do the I/O themselves (io_uring).
+    // onReceived takes bytes already read from the socket; onReadFailed takes
+    // the errno of a failed read, or 0 for an orderly shutdown by the peer.
+    bool onReceived(ClientManager* manager, const char* data, size_t length);
+    void onReadFailed(int error);
+
+    // With a write scheduler set, sendMessage only queues the frame, calling
+    // the scheduler when the queue was empty; a queue that already held frames
+    // has a flush or a send pending. The reactor then writes the queue itself
+    // (onWritable, or prepareWrite and completeWrite around its own send) and
+    // shuts the socket down once the connection closes.
+    void setWriteScheduler(std::function<void()> scheduler) { m_writeScheduler = std::move(scheduler); }
+
+    // Fills chunks with the queued frames, up to IOV_MAX of them, for a single
+    // vectored send. They stay valid until completeWrite, whatever is queued
+    // in the meantime.
+    bool prepareWrite(std::vector<iovec>& chunks);
+    bool completeWrite(ssize_t result);
+
     bool sendMessage(MessageType type, const std::string& data = "");
+    // Queues an already encoded frame, letting a broadcast share one frame
+    // between all of its recipients. Never blocks: a queue past its high
+    // watermark is handled by the slow consumer policy, and false means the
+    // connection was dropped. Only droppable frames may be shed by that
+    // policy: chat fanned out to a crowd, not replies or direct messages.
+    bool sendFrame(SharedFrame frame, bool droppable = false);
+    // Queues replayed history, straight from the mapped segments. onDrained
+    // runs on the reactor thread once most of the queue has gone out, to fetch
+    // the next batch; it is dropped with the connection.
+    bool sendHistory(std::shared_ptr<const HistoryLog::Batch> batch, std::function<void()> onDrained);
+    size_t outboundBytes() const { return m_outboundBytes.load(std::memory_order_relaxed); }
     const std::string& getUserId() const { return m_userId; }
+    UserHandle getUserHandle() const { return m_userHandle; }
+    int getSocket() const { return m_socket; }
+    ConnectionState getState() const { return m_state; }
+    std::chrono::steady_clock::time_point getAcceptedAt() const { return m_acceptedAt; }
+    // Broadcasts numbered up to this went out again in the stream this
+    // connection resumed; see ClientManager::openStream.
+    uint64_t resentBroadcasts() const { return m_resentBroadcasts; }
+
+    // Drops a connection that never completed its logon.
+    void handleLogonTimeout();
 
 private:
     int m_socket;
     std::string m_userId;
+    // Assigned at logon; what the server routes by from then on.
+    UserHandle m_userHandle;
+    size_t m_shard;
+    std::chrono::steady_clock::time_point m_acceptedAt;
+
+    std::atomic<ConnectionState> m_state;
+
+    std::function<void(UserHandle)> m_clientDisconnected;
 
-    bool m_terminate;
-    ConnectionState m_state;
-    std::unique_ptr<std::thread> m_thread;
+    // Splits received bytes into frames; holds a frame split across reads.
+    FrameDecoder m_decoder;
+
+    // A queued frame and what keeps its bytes alive: the encoded frame itself,
+    // or the history batch whose mapped segment it lies in.
+    struct OutboundFrame
+    {
+        std::shared_ptr<const void> owner;
+        std::string_view bytes;
+        bool droppable = false;
+    };
 
-    std::function<void(std::string)> m_clientDisconnected;
+    // Frames the socket has not fully accepted yet, oldest first, and how much
+    // of the front one went out already. Frames are immutable, so a pending
+    // send can point straight into them while more are queued.
+    std::mutex m_writeMutex;
+    std::deque<OutboundFrame> m_outbound;
+    size_t m_frontOffset;
+    std::atomic<size_t> m_outboundBytes;
+    // Front frames a reactor-submitted send still points into; never shed.
+    size_t m_framesInFlight;
+    OutboundQueueLimits m_outboundLimits;
+    std::function<void()> m_writeScheduler;
+    std::function<void()> m_historyDrained;
+    // Numbers chat frames as they leave the queue, so frames shed under
+    // backpressure never take a number; null when the server keeps no streams.
+    std::shared_ptr<ChatStream> m_stream;
+    uint64_t m_resentBroadcasts;
+    // Asked for ahead of the UserLogon: the history after this record, and
+    // the rest of this chat stream.
+    std::optional<uint64_t> m_historyAfter;
+    std::optional<ChatStream::Position> m_streamResume;
 
-    std::optional<MessageHeader> readMessageHeader();
-    std::string readMessageData(uint32_t dataLen);
+    bool handleLogon(ClientManager* manager, MessageType type, std::string_view username);
+    // Takes a resume request sent ahead of the UserLogon. False once the
+    // connection is dropped for a malformed one.
+    bool handleResumeRequest(MessageType type, std::string_view data);
+    // Sends StreamSync and then the frames the client missed, and numbers
+    // chat frames from then on. Returns whether history still needs replaying.
+    bool openStream(ClientManager* manager, const std::optional<ChatStream::Position>& resume);
+    // Numbers the chat frames still queued, as the client may yet get some of
+    // them, and stops numbering; the manager parks the stream from here.
+    void closeStream();
+    bool processFrames(ClientManager* manager);
+    bool queueFrames(OutboundFrame* frames, size_t count);
+    void notifyHistoryDrained();
+    size_t fillWriteChunks(iovec* chunks, size_t maxChunks);
+    void consumeWritten(size_t bytes);
+    bool applySlowConsumerPolicy();
+    bool dispatchMessage(ClientManager* manager, MessageType type, std::string_view data);
+    bool flushWriteBuffer();
 
     void handleSocketError();
 
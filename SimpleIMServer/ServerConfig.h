@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// What to do with a connection whose outbound queue passes its high watermark.
+enum class SlowConsumerPolicy
+{
+    DropOldestChat, // shed queued chat frames, oldest first; presence and replies are kept
+    Disconnect
+};
+
+struct OutboundQueueLimits
+{
+    // Bytes queued for one connection before the slow consumer policy applies.
+    size_t highWatermark = 4 * 1024 * 1024;
+
+    // DropOldestChat sheds down to here so it does not trigger on every new frame.
+    size_t lowWatermark = 1024 * 1024;
+
+    SlowConsumerPolicy policy = SlowConsumerPolicy::DropOldestChat;
+};
+
+struct HistoryConfig
+{
+    // Where the segment files live; empty keeps no history.
+    std::string directory;
+
+    // A segment is sealed and the next one started before it would grow past this.
+    size_t segmentBytes = 64 * 1024 * 1024;
+
+    // Records replayed to a user logging on without naming where to resume.
+    size_t replayCount = 100;
+
+    // Records the search index gathers in memory before writing them out as
+    // a segment; 0 keeps no index.
+    size_t searchSegmentRecords = 64 * 1024;
+
+    // Matches returned for one search, the newest.
+    size_t searchResults = 20;
+};
+
+struct OfflineConfig
+{
+    // Where direct messages to users who are not logged on wait for them;
+    // empty turns such messages away.
+    std::string directory;
+
+    // One user's queue takes no more messages past this.
+    size_t maxBytesPerUser = 256 * 1024;
+
+    // One sender gets no more messages queued past this, over all recipients,
+    // so made-up names cannot fill the store.
+    size_t maxBytesPerSender = 1024 * 1024;
+
+    // Nor does the store as a whole past this.
+    size_t maxTotalBytes = 64 * 1024 * 1024;
+};
+
+struct ResumeConfig
+{
+    // How long a dropped user's chat stream waits for them to log on again and
+    // resume it; 0 keeps no streams.
+    std::chrono::seconds window{0};
+
+    // Sent chat frames each stream holds for resending, by size. Acknowledged
+    // frames go straight away, the oldest of the rest once past this.
+    size_t retainedBytes = 1024 * 1024;
+};
+
+struct ServerConfig
+{
+    uint16_t port = 8989;
+
+    // Reactor threads, each with its own SO_REUSEPORT listener and connection set.
+    size_t reactorCount = std::max(1u, std::thread::hardware_concurrency());
+
+    // Connections that have not completed their UserLogon by then are dropped.
+    std::chrono::milliseconds handshakeTimeout{5000};
+
+    OutboundQueueLimits outboundLimits;
+
+    // How long a reactor holds newly queued frames so more can join them in the
+    // same write. 0 writes at the end of each event loop iteration.
+    std::chrono::microseconds flushDelay{0};
+
+    // Presence changes are gathered this long and announced as one batch, so a
+    // reconnect storm costs each client a frame per interval rather than one
+    // per user. 0 announces every change as it happens.
+    std::chrono::milliseconds presenceInterval{50};
+
+    HistoryConfig history;
+    OfflineConfig offline;
+    ResumeConfig resume;
+};
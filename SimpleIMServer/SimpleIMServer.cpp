@@ -1,10 +1,17 @@
 #include "IncomingConnHandler.h"
+#include "ServerConfig.h"
 
 #include <atomic>
+#include <charconv>
 #include <chrono>
 #include <csignal>
+#include <cstdint>
 #include <iostream>
+#include <Log.h>
+#include <limits>
+#include <string>
 #include <thread>
+#include <sys/resource.h>
 
 namespace {
 std::atomic<bool> g_running{true};
@@ -12,15 +19,179 @@ std::atomic<bool> g_running{true};
 void stopServer(int) {
     g_running = false;
 }
+
+// Each connection holds a descriptor, so lift the soft limit as far as allowed.
+void raiseFileDescriptorLimit() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            SIMPLEIM_LOG_WARNING << "Could not raise open file limit.";
+        }
+    }
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --port <port>        Listen port (default 8989)\n"
+              << "  --reactors <count>   Reactor threads (default: one per core)\n"
+              << "  --handshake-timeout-ms <ms>\n"
+              << "                       Drop connections that have not logged on (default 5000)\n"
+              << "  --outbound-high-watermark <bytes>\n"
+              << "                       Queued bytes per connection before the slow consumer\n"
+              << "                       policy applies (default 4194304)\n"
+              << "  --outbound-low-watermark <bytes>\n"
+              << "                       Level drop-oldest-chat sheds down to (default 1048576)\n"
+              << "  --slow-consumer <drop-oldest-chat|disconnect>\n"
+              << "                       Slow consumer policy (default drop-oldest-chat)\n"
+              << "  --flush-delay-us <us>  Hold queued frames this long to coalesce writes (default 0)\n"
+              << "  --presence-interval-ms <ms>\n"
+              << "                       Batch joins and leaves over this window (default 50)\n"
+              << "  --history-dir <path>  Keep chat and direct message history here (default: none)\n"
+              << "  --history-segment-bytes <bytes>\n"
+              << "                       Size at which a history segment is sealed (default 67108864)\n"
+              << "  --history-replay <count>\n"
+              << "                       Records replayed to a user logging on (default 100)\n"
+              << "  --search-segment-records <count>\n"
+              << "                       Records per search index segment; 0 keeps no index (default 65536)\n"
+              << "  --search-results <count>\n"
+              << "                       Matches returned for one search (default 20)\n"
+              << "  --offline-dir <path>  Hold direct messages to absent users here (default: none)\n"
+              << "  --offline-max-bytes <bytes>\n"
+              << "                       Messages held for one user (default 262144)\n"
+              << "  --offline-max-sender-bytes <bytes>\n"
+              << "                       Messages one sender may have held, over all users (default 1048576)\n"
+              << "  --offline-max-total-bytes <bytes>\n"
+              << "                       Messages held for everyone (default 67108864)\n"
+              << "  --resume-window-s <s>  Let a dropped user resume their chat stream this long;\n"
+              << "                       0 keeps no streams (default 0)\n"
+              << "  --resume-bytes <bytes>\n"
+              << "                       Sent chat held per stream for resending (default 1048576)\n";
+}
+
+// No timer or window is meant to be longer than a day.
+constexpr std::chrono::hours kMaxDuration{24};
+constexpr uint64_t kMaxSize = std::numeric_limits<size_t>::max();
+
+// Accepts only a plain decimal number that uses up the whole argument and
+// lies within [min, max]; signs, trailing text and overflow are rejected.
+bool parseNumber(const std::string& argument, uint64_t min, uint64_t max, uint64_t& value) {
+    const char* end = argument.data() + argument.size();
+    uint64_t parsed = 0;
+    const auto [last, error] = std::from_chars(argument.data(), end, parsed);
+    if (argument.empty() || error != std::errc() || last != end || parsed < min || parsed > max) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+bool parseArguments(int argc, char *argv[], ServerConfig& config) {
+    constexpr uint64_t maxMilliseconds = std::chrono::milliseconds(kMaxDuration).count();
+    constexpr uint64_t maxMicroseconds = std::chrono::microseconds(kMaxDuration).count();
+    constexpr uint64_t maxSeconds = std::chrono::seconds(kMaxDuration).count();
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string option = argv[i];
+        if (option == "--help" || option == "-h" || i + 1 >= argc) {
+            return false;
+        }
+
+        const std::string argument = argv[++i];
+        uint64_t value = 0;
+        const auto number = [&](uint64_t min, uint64_t max) {
+            return parseNumber(argument, min, max, value);
+        };
+        if (option == "--port" && number(1, 65535)) {
+            config.port = static_cast<uint16_t>(value);
+        }
+        else if (option == "--reactors" && number(1, 1024)) {
+            config.reactorCount = value;
+        }
+        else if (option == "--handshake-timeout-ms" && number(1, maxMilliseconds)) {
+            config.handshakeTimeout = std::chrono::milliseconds(value);
+        }
+        else if (option == "--outbound-high-watermark" && number(1, kMaxSize)) {
+            config.outboundLimits.highWatermark = value;
+        }
+        else if (option == "--outbound-low-watermark" && number(0, kMaxSize)) {
+            config.outboundLimits.lowWatermark = value;
+        }
+        else if (option == "--flush-delay-us" && number(0, maxMicroseconds)) {
+            config.flushDelay = std::chrono::microseconds(value);
+        }
+        else if (option == "--presence-interval-ms" && number(0, maxMilliseconds)) {
+            config.presenceInterval = std::chrono::milliseconds(value);
+        }
+        else if (option == "--history-dir" && !argument.empty()) {
+            config.history.directory = argument;
+        }
+        else if (option == "--history-segment-bytes" && number(1, kMaxSize)) {
+            config.history.segmentBytes = value;
+        }
+        else if (option == "--history-replay" && number(0, kMaxSize)) {
+            config.history.replayCount = value;
+        }
+        else if (option == "--search-segment-records" && number(0, kMaxSize)) {
+            config.history.searchSegmentRecords = value;
+        }
+        else if (option == "--search-results" && number(1, kMaxSize)) {
+            config.history.searchResults = value;
+        }
+        else if (option == "--offline-dir" && !argument.empty()) {
+            config.offline.directory = argument;
+        }
+        else if (option == "--offline-max-bytes" && number(1, kMaxSize)) {
+            config.offline.maxBytesPerUser = value;
+        }
+        else if (option == "--offline-max-sender-bytes" && number(1, kMaxSize)) {
+            config.offline.maxBytesPerSender = value;
+        }
+        else if (option == "--offline-max-total-bytes" && number(1, kMaxSize)) {
+            config.offline.maxTotalBytes = value;
+        }
+        else if (option == "--resume-window-s" && number(0, maxSeconds)) {
+            config.resume.window = std::chrono::seconds(value);
+        }
+        else if (option == "--resume-bytes" && number(1, kMaxSize)) {
+            config.resume.retainedBytes = value;
+        }
+        else if (option == "--slow-consumer" && argument == "drop-oldest-chat") {
+            config.outboundLimits.policy = SlowConsumerPolicy::DropOldestChat;
+        }
+        else if (option == "--slow-consumer" && argument == "disconnect") {
+            config.outboundLimits.policy = SlowConsumerPolicy::Disconnect;
+        }
+        else {
+            std::cerr << "Invalid option: " << option << " " << argv[i] << std::endl;
+            return false;
+        }
+    }
+
+    if (config.outboundLimits.lowWatermark > config.outboundLimits.highWatermark) {
+        std::cerr << "The outbound low watermark must not exceed the high watermark." << std::endl;
+        return false;
+    }
+
+    return true;
+}
 } // namespace
 
 int main(int argc, char *argv[]) {
     std::signal(SIGINT, stopServer);
     std::signal(SIGTERM, stopServer);
+    std::signal(SIGPIPE, SIG_IGN);
+    raiseFileDescriptorLimit();
+
+    ServerConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        printUsage(argv[0]);
+        return 1;
+    }
 
-    std::cout << "Starting SimpleIM Server" << std::endl;
+    SIMPLEIM_LOG_INFO << "Starting SimpleIM Server";
 
-    IncomingConnHandler connectionHandler;
+    IncomingConnHandler connectionHandler(config);
     connectionHandler.start();
 
     while (g_running) {
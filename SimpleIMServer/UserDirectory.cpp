@@ -0,0 +1,134 @@
+#include "UserDirectory.h"
+
+#include <mutex>
+
+UserDirectory::UserDirectory(size_t shardCount)
+    : m_shardMask(0)
+{
+    size_t count = 1;
+    while (count < shardCount && count <= kShardMask) {
+        count <<= 1;
+    }
+    m_shards.reset(new Shard[count]);
+    m_shardMask = count - 1;
+}
+
+UserHandle UserDirectory::claim(std::string_view name, size_t shard)
+{
+    Shard& nameShard = shardFor(name);
+    std::unique_lock<std::shared_mutex> lock(nameShard.mutex);
+    if (nameShard.byName.find(name) != nameShard.byName.end()) {
+        return kInvalidUserHandle;
+    }
+
+    uint32_t index = 0;
+    if (!nameShard.freeSlots.empty()) {
+        index = nameShard.freeSlots.back();
+        nameShard.freeSlots.pop_back();
+    }
+    else if (nameShard.entries.size() <= kIndexMask) {
+        index = static_cast<uint32_t>(nameShard.entries.size());
+        nameShard.entries.emplace_back();
+    }
+    else {
+        return kInvalidUserHandle; // every slot in this shard is in use
+    }
+
+    Entry& entry = nameShard.entries[index];
+    entry.name.assign(name);
+    entry.shard = shard;
+    entry.live = true;
+
+    const UserHandle handle = makeHandle(static_cast<uint32_t>(&nameShard - m_shards.get()), index, entry.generation);
+    nameShard.byName.emplace(entry.name, handle);
+    return handle;
+}
+
+std::string UserDirectory::release(UserHandle handle)
+{
+    if (shardIndexOf(handle) > m_shardMask) {
+        return std::string();
+    }
+
+    Shard& shard = m_shards[shardIndexOf(handle)];
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    if (!entryFor(shard, handle)) {
+        return std::string();
+    }
+
+    Entry& entry = shard.entries[indexOf(handle)];
+    shard.byName.erase(entry.name);
+    entry.live = false;
+    ++entry.generation;
+    shard.freeSlots.push_back(indexOf(handle));
+    return std::move(entry.name);
+}
+
+UserHandle UserDirectory::find(std::string_view name) const
+{
+    const Shard& shard = shardFor(name);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.byName.find(name);
+    return it == shard.byName.end() ? kInvalidUserHandle : it->second;
+}
+
+bool UserDirectory::shardOf(UserHandle handle, size_t& shard) const
+{
+    if (shardIndexOf(handle) > m_shardMask) {
+        return false;
+    }
+
+    const Shard& handleShard = m_shards[shardIndexOf(handle)];
+    std::shared_lock<std::shared_mutex> lock(handleShard.mutex);
+    const Entry* entry = entryFor(handleShard, handle);
+    if (!entry) {
+        return false;
+    }
+    shard = entry->shard;
+    return true;
+}
+
+std::vector<std::string> UserDirectory::names() const
+{
+    std::vector<std::string> names;
+    for (size_t i = 0; i <= m_shardMask; ++i) {
+        std::shared_lock<std::shared_mutex> lock(m_shards[i].mutex);
+        names.reserve(names.size() + m_shards[i].byName.size());
+        for (const auto& namePair : m_shards[i].byName) {
+            names.push_back(namePair.first);
+        }
+    }
+    return names;
+}
+
+size_t UserDirectory::size() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i <= m_shardMask; ++i) {
+        std::shared_lock<std::shared_mutex> lock(m_shards[i].mutex);
+        count += m_shards[i].byName.size();
+    }
+    return count;
+}
+
+UserDirectory::Shard& UserDirectory::shardFor(std::string_view name) const
+{
+    // The maps bucket on the low bits of the same hash; shard on the high ones
+    const size_t hash = NameHash()(name);
+    return m_shards[(hash >> (sizeof(size_t) * 8 - kShardBits)) & m_shardMask];
+}
+
+const UserDirectory::Entry* UserDirectory::entryFor(const Shard& shard, UserHandle handle) const
+{
+    const uint32_t index = indexOf(handle);
+    if (index == 0 || index >= shard.entries.size()) {
+        return nullptr;
+    }
+
+    const Entry& entry = shard.entries[index];
+    const uint32_t shardIndex = static_cast<uint32_t>(&shard - m_shards.get());
+    if (!entry.live || makeHandle(shardIndex, index, entry.generation) != handle) {
+        return nullptr;
+    }
+    return &entry;
+}
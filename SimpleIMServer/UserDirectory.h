@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Compact id a user gets at logon. From the low bits up it holds the slot
+// index, the registry shard and a count of how often the slot was reused, so a
+// handle kept past its user's logoff never reaches whoever holds the slot next.
+using UserHandle = uint32_t;
+constexpr UserHandle kInvalidUserHandle = 0;
+
+// Longest name a user may log on with, in bytes. Short enough that a name
+// in hex still makes a legal file name for its offline queue.
+constexpr size_t kMaxUsernameLength = 100;
+
+// Lets a name-keyed map be searched with a string_view, without building a key.
+struct NameHash
+{
+    using is_transparent = void;
+    size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+};
+
+// Interning table for logged-on usernames. Routing works on handles; a name is
+// only hashed when a client addresses another user by it, as a DM target.
+// Names are spread over shards by hash, each on its own cache line with its
+// own lock, so lookups from different reactors rarely meet. Thread-safe.
+class UserDirectory
+{
+public:
+    static constexpr size_t kDefaultShardCount = 16;
+
+    // The shard count is rounded up to a power of two, at most 16.
+    explicit UserDirectory(size_t shardCount = kDefaultShardCount);
+
+    // Claims the name for a connection owned by the given reactor shard.
+    // Returns kInvalidUserHandle if the name is taken.
+    UserHandle claim(std::string_view name, size_t shard);
+
+    // Frees the handle and hands back its name; empty if it was not live.
+    std::string release(UserHandle handle);
+
+    UserHandle find(std::string_view name) const;
+    bool shardOf(UserHandle handle, size_t& shard) const;
+
+    std::vector<std::string> names() const;
+    size_t size() const;
+    size_t shardCount() const { return m_shardMask + 1; }
+
+private:
+    static constexpr uint32_t kIndexBits = 20;
+    static constexpr uint32_t kShardBits = 4;
+    static constexpr uint32_t kIndexMask = (1u << kIndexBits) - 1;
+    static constexpr uint32_t kShardMask = (1u << kShardBits) - 1;
+    static constexpr size_t kCacheLineSize = 64;
+
+    struct Entry
+    {
+        std::string name;
+        size_t shard = 0;
+        uint8_t generation = 0;
+        bool live = false;
+    };
+
+    struct alignas(kCacheLineSize) Shard
+    {
+        mutable std::shared_mutex mutex;
+        // Slot 0 stays unused so that no live handle is ever 0.
+        std::vector<Entry> entries = std::vector<Entry>(1);
+        std::vector<uint32_t> freeSlots;
+        std::unordered_map<std::string, UserHandle, NameHash, std::equal_to<>> byName;
+    };
+
+    std::unique_ptr<Shard[]> m_shards;
+    size_t m_shardMask;
+
+    Shard& shardFor(std::string_view name) const;
+
+    static uint32_t indexOf(UserHandle handle) { return handle & kIndexMask; }
+    static uint32_t shardIndexOf(UserHandle handle) { return (handle >> kIndexBits) & kShardMask; }
+    static UserHandle makeHandle(uint32_t shard, uint32_t index, uint8_t generation)
+    {
+        return (static_cast<UserHandle>(generation) << (kIndexBits + kShardBits)) | (shard << kIndexBits) | index;
+    }
+
+    // Caller holds the shard's mutex.
+    const Entry* entryFor(const Shard& shard, UserHandle handle) const;
+};
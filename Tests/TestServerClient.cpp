@@ -1,21 +1,71 @@
 #include <gtest/gtest.h>
 
+#include "ChatStream.h"
 #include "ClientManager.h"
+#include "FrameDecoder.h"
+#include "HistoryLog.h"
+#include "Log.h"
 #include "Message.h"
+#include "OfflineStore.h"
+#include "Presence.h"
+#include "RoomDirectory.h"
+#include "SearchIndex.h"
 #include "ServerClient.h"
+#include "SimpleIMClient.h"
+#include "UserDirectory.h"
 
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <functional>
 #include <optional>
 #include <vector>
 #include <cstring>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
+#include <new>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <arpa/inet.h>
 
+#include "MessageQueue.h"
+#include "MpscMessageQueue.h"
+
+namespace {
+// Counts every global operator new, so tests can assert a path allocates nothing.
+std::atomic<size_t> g_allocations(0);
+}
+
+// Out of line so the compiler never pairs an inlined malloc with a free.
+[[gnu::noinline]] void* operator new(size_t size)
+{
+    ++g_allocations;
+    if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void* memory, size_t) noexcept
+{
+    std::free(memory);
+}
+
 class TestServerClient : public ::testing::Test
 {
 protected:
@@ -94,9 +144,126 @@ protected:
         return true;
     }
 
+    // Sends one frame on any socket, not only the fixture's own.
+    bool sendTo(int fd, MessageType type, const std::string& payload)
+    {
+        const std::vector<uint8_t> bytes = buildRawMessage(type, payload);
+        return send(fd, bytes.data(), bytes.size(), 0) == static_cast<ssize_t>(bytes.size());
+    }
+
+    // The next frame's type and payload; empty on timeout.
+    std::optional<std::pair<MessageType, std::string>> readFrame(int fd)
+    {
+        char headerBuffer[5];
+        if (recv(fd, headerBuffer, sizeof(headerBuffer), MSG_WAITALL) != 5) {
+            return std::nullopt;
+        }
+        uint32_t length = 0;
+        std::memcpy(&length, &headerBuffer[1], sizeof(length));
+        std::string payload(ntohl(length), '\0');
+        if (!payload.empty()
+            && recv(fd, payload.data(), payload.size(), MSG_WAITALL) != static_cast<ssize_t>(payload.size())) {
+            return std::nullopt;
+        }
+        return std::make_pair(static_cast<MessageType>(headerBuffer[0]), std::move(payload));
+    }
+
+    // The payload of the next frame of the given type, noting the types of
+    // any skipped on the way when asked; empty on timeout.
+    std::optional<std::string> readUntil(int fd, MessageType type, std::vector<MessageType>* skipped = nullptr)
+    {
+        while (std::optional<std::pair<MessageType, std::string>> frame = readFrame(fd)) {
+            if (frame->first == type) {
+                return std::move(frame->second);
+            }
+            if (skipped) {
+                skipped->push_back(frame->first);
+            }
+        }
+        return std::nullopt;
+    }
+
+    // A non-blocking listen socket on an ephemeral loopback port, as a
+    // reactor takes them; -1 on failure. address gets the port picked.
+    int listenOnLoopback(sockaddr_in& address)
+    {
+        const int listenSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenSocket == -1) {
+            return -1;
+        }
+
+        address = sockaddr_in{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addressSize = sizeof(address);
+        if (bind(listenSocket, reinterpret_cast<sockaddr*>(&address), addressSize) != 0
+            || listen(listenSocket, SOMAXCONN) != 0
+            || getsockname(listenSocket, reinterpret_cast<sockaddr*>(&address), &addressSize) != 0) {
+            close(listenSocket);
+            return -1;
+        }
+        return listenSocket;
+    }
+
     int m_sockets[2] = {-1, -1};
 };
 
+// A SimpleIMClient and what it reported through its callbacks, gathered from
+// its network thread for a test to wait on.
+class TestClient
+{
+public:
+    explicit TestClient(const sockaddr_in& server)
+    {
+        client.setServerAddress("127.0.0.1", ntohs(server.sin_port));
+        client.setConnectedUsersListCallback([this](const std::string& users) { add(m_events, "users:" + users); });
+        client.setUserConnectedCallback([this](const std::string& user) { add(m_events, "+" + user); });
+        client.setUserDisconnectedCallback([this](const std::string& user) { add(m_events, "-" + user); });
+        client.setChatMessageCallback([this](const std::string& user, const std::string& message) {
+            add(m_chat, user + ": " + message);
+        });
+    }
+
+    // Whether the presence event or chat line came, waiting up to two seconds.
+    bool waitFor(const std::string& event)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_changed.wait_for(lock, std::chrono::seconds(2), [this, &event]() {
+            return std::find(m_events.begin(), m_events.end(), event) != m_events.end()
+                || std::find(m_chat.begin(), m_chat.end(), event) != m_chat.end();
+        });
+    }
+
+    std::vector<std::string> events()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_events;
+    }
+
+    std::vector<std::string> chat()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_chat;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::vector<std::string> m_events;
+    std::vector<std::string> m_chat;
+
+    void add(std::vector<std::string>& to, std::string event)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        to.push_back(std::move(event));
+        m_changed.notify_all();
+    }
+
+public:
+    // Last, so its network thread is stopped before the rest goes
+    SimpleIMClient client;
+};
+
 
 TEST(TestMessage, ToBytesUsesNetworkByteOrderLength)
 {
@@ -110,44 +277,625 @@ TEST(TestMessage, ToBytesUsesNetworkByteOrderLength)
     EXPECT_EQ(ntohl(length), 5U);
 }
 
+TEST(TestMessage, FromBytesRoundTripsTheWireFormat)
+{
+    const std::vector<uint8_t> bytes = Message(MessageType::ChatMessageDM, "bob:hi").to_bytes();
+    EXPECT_EQ(Message::from_bytes(bytes).to_bytes(), bytes);
+
+    // A truncated frame is rejected instead of read past its end
+    const std::vector<uint8_t> truncated(bytes.begin(), bytes.end() - 1);
+    EXPECT_EQ(Message::from_bytes(truncated).to_bytes().size(), MessageHeader::kWireSize);
+}
+
+TEST(TestMessage, ShortMessagesQueueAndEncodeWithoutAllocating)
+{
+    MessageQueue queue;
+    const std::string line(150, 'x');
+    const std::string target = "bob";
+    char buffer[512];
+    Message popped;
+
+    const size_t allocationsBefore = g_allocations.load();
+    queue.push(Message(MessageType::ChatMessageBroadcast, line));
+    queue.emplace(MessageType::ChatMessageDM, std::initializer_list<std::string_view>{target, ":", line});
+    size_t encoded = 0;
+    while (queue.tryPop(popped, std::chrono::milliseconds(0))) {
+        encoded += popped.encode_into(buffer + encoded, sizeof(buffer) - encoded);
+    }
+    EXPECT_EQ(g_allocations.load(), allocationsBefore);
+
+    EXPECT_EQ(encoded, 2 * MessageHeader::kWireSize + line.size() + target.size() + 1 + line.size());
+    EXPECT_EQ(popped.data(), target + ":" + line);
+    EXPECT_EQ(popped.encode_into(buffer, popped.encoded_size() - 1), 0U);
+
+    // Long payloads keep the buffer of the string they were moved from
+    std::string longText(4 * Message::kInlineCapacity, 'y');
+    const char* longData = longText.data();
+    Message longMessage(MessageType::ChatMessageBroadcast, std::move(longText));
+    EXPECT_EQ(longMessage.data().data(), longData);
+    Message movedMessage(std::move(longMessage));
+    EXPECT_EQ(movedMessage.data().data(), longData);
+    EXPECT_TRUE(longMessage.data().empty());
+}
+
+TEST(TestFrameDecoder, YieldsEveryFrameFromOneChunkInPlace)
+{
+    std::vector<uint8_t> stream;
+    for (const std::string text : {"one", "", "three"}) {
+        const std::vector<uint8_t> bytes = Message(MessageType::ChatMessageBroadcast, text).to_bytes();
+        stream.insert(stream.end(), bytes.begin(), bytes.end());
+    }
+    const char* data = reinterpret_cast<const char*>(stream.data());
+
+    FrameDecoder decoder;
+    decoder.feed(data, stream.size());
+
+    Frame frame{};
+    std::vector<std::string> payloads;
+    while (decoder.next(frame) == FrameDecoder::Result::Frame) {
+        EXPECT_EQ(frame.type, MessageType::ChatMessageBroadcast);
+        // Views into the fed bytes rather than copies
+        EXPECT_GE(frame.payload.data(), data);
+        EXPECT_LE(frame.payload.data() + frame.payload.size(), data + stream.size());
+        payloads.emplace_back(frame.payload);
+    }
+    EXPECT_EQ(payloads, (std::vector<std::string>{"one", "", "three"}));
+    EXPECT_EQ(decoder.buffered(), 0U);
+}
+
+TEST(TestFrameDecoder, ReassemblesFramesSplitAcrossChunks)
+{
+    std::vector<uint8_t> stream = Message(MessageType::UserLogon, "alice").to_bytes();
+    const std::vector<uint8_t> second = Message(MessageType::ChatMessageBroadcast, "hello there").to_bytes();
+    stream.insert(stream.end(), second.begin(), second.end());
+
+    // Byte at a time through the caller's memory, then through prepare/commit
+    FrameDecoder decoder;
+    std::vector<std::string> payloads;
+    Frame frame{};
+    for (size_t i = 0; i < stream.size(); ++i) {
+        if (i % 2 == 0) {
+            decoder.feed(reinterpret_cast<const char*>(&stream[i]), 1);
+        }
+        else {
+            *decoder.prepare(1) = static_cast<char>(stream[i]);
+            decoder.commit(1);
+        }
+
+        FrameDecoder::Result result;
+        while ((result = decoder.next(frame)) == FrameDecoder::Result::Frame) {
+            payloads.emplace_back(frame.payload);
+        }
+        ASSERT_EQ(result, FrameDecoder::Result::Incomplete);
+    }
+    EXPECT_EQ(payloads, (std::vector<std::string>{"alice", "hello there"}));
+
+    // Malformed headers are reported before waiting on their payload
+    FrameDecoder limited(4);
+    const std::vector<uint8_t> oversized = Message(MessageType::UserLogon, "alice").to_bytes();
+    limited.feed(reinterpret_cast<const char*>(oversized.data()), MessageHeader::kWireSize);
+    EXPECT_EQ(limited.next(frame), FrameDecoder::Result::PayloadTooLarge);
+
+    FrameDecoder invalid;
+    const char badType[MessageHeader::kWireSize] = {static_cast<char>(200), 0, 0, 0, 0};
+    invalid.feed(badType, sizeof(badType));
+    EXPECT_EQ(invalid.next(frame), FrameDecoder::Result::InvalidType);
+}
+
+TEST(TestUserDirectory, HandlesRouteUntilReleasedAndAreNeverReusedAsIs)
+{
+    UserDirectory users;
+    const UserHandle alice = users.claim("alice", 1);
+    ASSERT_NE(alice, kInvalidUserHandle);
+    EXPECT_EQ(users.claim("alice", 0), kInvalidUserHandle);
+    EXPECT_EQ(users.find(std::string_view("alice:hello").substr(0, 5)), alice);
+
+    size_t shard = 0;
+    ASSERT_TRUE(users.shardOf(alice, shard));
+    EXPECT_EQ(shard, 1U);
+
+    EXPECT_EQ(users.release(alice), "alice");
+    EXPECT_EQ(users.release(alice), "");
+    EXPECT_EQ(users.find("alice"), kInvalidUserHandle);
+
+    // The slot comes back under a new handle; the old one stays dead
+    const UserHandle bob = users.claim("bob", 0);
+    ASSERT_NE(bob, kInvalidUserHandle);
+    EXPECT_NE(bob, alice);
+    EXPECT_FALSE(users.shardOf(alice, shard));
+    EXPECT_EQ(users.names(), std::vector<std::string>{"bob"});
+}
+
+TEST(TestPresence, SnapshotIsPagedCachedAndNumberedWithItsDeltas)
+{
+    Presence presence(9);
+    presence.join("alice");
+    presence.join("bob");
+    presence.join("carol");
+    EXPECT_EQ(presence.snapshot()->sequence, 0U);
+
+    const std::vector<SharedFrame> deltas = presence.flush();
+    ASSERT_EQ(deltas.size(), 3U);
+    EXPECT_EQ(*deltas[0], *Message::encode_shared(MessageType::PresenceDelta, "1:+alice"));
+    EXPECT_EQ(*deltas[2], *Message::encode_shared(MessageType::PresenceDelta, "3:+carol"));
+
+    // Shared until membership changes
+    const std::shared_ptr<const Presence::Snapshot> snapshot = presence.snapshot();
+    EXPECT_EQ(presence.snapshot(), snapshot);
+    EXPECT_EQ(snapshot->sequence, 3U);
+    ASSERT_EQ(snapshot->pages.size(), 2U);
+    EXPECT_EQ(*snapshot->pages[0], *Message::encode_shared(MessageType::PresenceSnapshot, "3:0:2:alice,bob"));
+    EXPECT_EQ(*snapshot->pages[1], *Message::encode_shared(MessageType::PresenceSnapshot, "3:1:2:carol"));
+
+    presence.leave("alice");
+    ASSERT_EQ(presence.flush().size(), 1U);
+    const std::shared_ptr<const Presence::Snapshot> next = presence.snapshot();
+    EXPECT_NE(next, snapshot);
+    EXPECT_EQ(next->sequence, 4U);
+    ASSERT_EQ(next->pages.size(), 1U);
+    EXPECT_EQ(*next->pages[0], *Message::encode_shared(MessageType::PresenceSnapshot, "4:0:1:carol,bob"));
+    EXPECT_EQ(presence.size(), 2U);
+}
+
+TEST(TestPresence, ChangesWithinABatchCoalesceAndCancel)
+{
+    Presence presence;
+    presence.join("alice");
+    presence.join("bob");
+    presence.leave("alice");
+    presence.join("carol");
+
+    // alice came and went unseen; the rest share one frame
+    const std::vector<SharedFrame> deltas = presence.flush();
+    ASSERT_EQ(deltas.size(), 1U);
+    EXPECT_EQ(*deltas[0], *Message::encode_shared(MessageType::PresenceDelta, "1:+bob,+carol"));
+    EXPECT_TRUE(presence.flush().empty());
+
+    // A reconnect inside the window announces nothing
+    const std::shared_ptr<const Presence::Snapshot> snapshot = presence.snapshot();
+    presence.leave("bob");
+    presence.join("bob");
+    EXPECT_TRUE(presence.flush().empty());
+    EXPECT_EQ(presence.snapshot(), snapshot);
+    EXPECT_EQ(presence.sequence(), 2U);
+}
+
+TEST(TestRoomDirectory, MembersAreSnapshotsAndEmptyRoomsGoAway)
+{
+    RoomDirectory rooms;
+    EXPECT_FALSE(RoomDirectory::isValidName(""));
+    EXPECT_FALSE(RoomDirectory::isValidName("a:b"));
+    EXPECT_FALSE(RoomDirectory::isValidName(std::string(RoomDirectory::kMaxRoomNameLength + 1, 'r')));
+
+    EXPECT_TRUE(rooms.join("team", 1, 0));
+    EXPECT_FALSE(rooms.join("team", 1, 0));
+    EXPECT_TRUE(rooms.join("team", 2, 1));
+    EXPECT_TRUE(rooms.join("other", 1, 0));
+
+    // A holder keeps the members it read while the room changes
+    const std::shared_ptr<const RoomDirectory::Members> before = rooms.members("team");
+    ASSERT_TRUE(before);
+    EXPECT_TRUE(rooms.leave("team", 2));
+    EXPECT_FALSE(rooms.leave("team", 2));
+    EXPECT_EQ(before->size(), 2U);
+    ASSERT_EQ(rooms.members("team")->size(), 1U);
+    EXPECT_EQ(rooms.members("team")->front().user, 1U);
+    EXPECT_FALSE(rooms.isMember("team", 2));
+
+    rooms.leaveAll(1);
+    EXPECT_EQ(rooms.members("team"), nullptr);
+    EXPECT_EQ(rooms.size(), 0U);
+}
+
+TEST(TestHistoryLog, RecordsAreNumberedAcrossSegmentsAndSurviveReopen)
+{
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("simpleim-history-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+    HistoryConfig config;
+    config.directory = directory.string();
+    config.segmentBytes = 4096;
+
+    {
+        std::unique_ptr<HistoryLog> history = HistoryLog::open(config);
+        ASSERT_TRUE(history);
+        for (int i = 0; i < 200; ++i) {
+            history->append(HistoryKind::Broadcast, "alice", {},
+                            Message::encode_shared(MessageType::ChatMessageBroadcast, {"alice: line ", std::to_string(i)}));
+        }
+        history->append(HistoryKind::Direct, "alice", "bob",
+                        Message::encode_shared(MessageType::ChatMessageBroadcast, "alice: psst"));
+    }
+
+    // Closing synced everything; reopening carries on from it
+    std::unique_ptr<HistoryLog> history = HistoryLog::open(config);
+    ASSERT_TRUE(history);
+    EXPECT_EQ(history->durableSequence(), 201U);
+    EXPECT_GT(history->segmentCount(), 1U);
+
+    const std::vector<HistoryLog::Entry> all = history->read(1, 1000);
+    ASSERT_EQ(all.size(), 201U);
+    for (size_t i = 0; i < all.size(); ++i) {
+        EXPECT_EQ(all[i].sequence, i + 1);
+    }
+    EXPECT_EQ(all[7].frame, *Message::encode_shared(MessageType::ChatMessageBroadcast, "alice: line 7"));
+    EXPECT_EQ(all[200].kind, HistoryKind::Direct);
+    EXPECT_EQ(all[200].to, "bob");
+
+    // Starts mid-segment, by way of the sparse index, and runs into the next
+    const std::vector<HistoryLog::Entry> page = history->read(150, 40);
+    ASSERT_EQ(page.size(), 40U);
+    EXPECT_EQ(page.front().sequence, 150U);
+    EXPECT_EQ(page.back().sequence, 189U);
+
+    history->append(HistoryKind::Broadcast, "bob", {}, Message::encode_shared(MessageType::ChatMessageBroadcast, "bob: hi"));
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (history->durableSequence() < 202 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(history->read(202, 10).size(), 1U);
+    EXPECT_EQ(history->read(202, 10).front().from, "bob");
+
+    history.reset();
+    std::filesystem::remove_all(directory);
+}
+
+TEST(TestHistoryLog, TornTailIsCutOnReopen)
+{
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("simpleim-history-torn-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+    HistoryConfig config;
+    config.directory = directory.string();
+
+    {
+        std::unique_ptr<HistoryLog> history = HistoryLog::open(config);
+        ASSERT_TRUE(history);
+        for (int i = 0; i < 10; ++i) {
+            history->append(HistoryKind::Broadcast, "alice", {},
+                            Message::encode_shared(MessageType::ChatMessageBroadcast, "alice: hello"));
+        }
+    }
+
+    // Half a record, as a crash mid-write would leave it
+    const std::filesystem::path segment = directory / "00000000000000000001.log";
+    const auto intact = std::filesystem::file_size(segment);
+    {
+        std::ofstream tail(segment, std::ios::binary | std::ios::app);
+        tail << std::string(20, '\x7f');
+    }
+
+    std::unique_ptr<HistoryLog> history = HistoryLog::open(config);
+    ASSERT_TRUE(history);
+    EXPECT_EQ(history->durableSequence(), 10U);
+    EXPECT_EQ(std::filesystem::file_size(segment), intact);
+    EXPECT_EQ(history->read(1, 100).size(), 10U);
+
+    history.reset();
+    std::filesystem::remove_all(directory);
+}
+
+TEST(TestSearchIndex, FindsNewestMatchesAcrossMergesAndReopens)
+{
+    std::vector<std::string> words;
+    SearchIndex::tokenize("The OUTAGE, again: x 42 caf\xc3\xa9", words);
+    EXPECT_EQ(words, (std::vector<std::string>{"the", "outage", "again", "42", "caf\xc3\xa9"}));
+
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("simpleim-search-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+    HistoryConfig config;
+    config.directory = directory.string();
+    std::unique_ptr<HistoryLog> history = HistoryLog::open(config);
+    ASSERT_TRUE(history);
+
+    // Every tenth line mentions the outage, and bob is told about it privately
+    for (int i = 1; i <= 200; ++i) {
+        const std::string text = i % 10 == 0 ? "the outage is over " + std::to_string(i) : "status " + std::to_string(i);
+        history->append(HistoryKind::Broadcast, "alice", {},
+                        Message::encode_shared(MessageType::ChatMessageBroadcast, {"alice: ", text}));
+    }
+    history->append(HistoryKind::Direct, "alice", "bob",
+                    Message::encode_shared(MessageType::ChatMessageBroadcast, "alice: outage details"));
+
+    const std::string indexDirectory = (directory / "index").string();
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    {
+        // Eight records a segment, so the 201 are written out and merged many times over
+        std::unique_ptr<SearchIndex> index = SearchIndex::open(*history, indexDirectory, 8);
+        ASSERT_TRUE(index);
+        while ((index->indexedSequence() < 201 || index->segmentCount() > 8)
+               && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ASSERT_EQ(index->indexedSequence(), 201U);
+        EXPECT_LE(index->segmentCount(), 8U);
+
+        EXPECT_EQ(index->find("Outage", "carol", 3), (std::vector<uint64_t>{200, 190, 180}));
+        EXPECT_EQ(index->find("outage", "bob", 2), (std::vector<uint64_t>{201, 200}));
+        EXPECT_EQ(index->find("OVER outage 50", "carol", 10), (std::vector<uint64_t>{50}));
+        EXPECT_TRUE(index->find("outage missing", "carol", 10).empty());
+        EXPECT_EQ(index->find("outage", "alice", 100).size(), 21U);
+    }
+
+    // The segments carry on where they left off
+    std::unique_ptr<SearchIndex> index = SearchIndex::open(*history, indexDirectory, 8);
+    ASSERT_TRUE(index);
+    EXPECT_EQ(index->indexedSequence(), 201U);
+    EXPECT_EQ(index->find("outage", "bob", 2), (std::vector<uint64_t>{201, 200}));
+
+    index.reset();
+    history.reset();
+    std::filesystem::remove_all(directory);
+}
+
+TEST(TestOfflineStore, SendersHaveAQuotaAndUnreadableQueuesAreKept)
+{
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("simpleim-offline-store-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+
+    OfflineConfig config;
+    config.directory = directory.string();
+    config.maxBytesPerSender = 40;
+    std::unique_ptr<OfflineStore> store = OfflineStore::open(config);
+    ASSERT_NE(store, nullptr);
+
+    // Records of 8 + 5 + 5 bytes: mallory's third made-up name is one too many
+    EXPECT_EQ(store->store("ghost1", "mally", "boo!!"), OfflineStore::Result::Stored);
+    EXPECT_EQ(store->store("ghost2", "mally", "boo!!"), OfflineStore::Result::Stored);
+    EXPECT_EQ(store->store("ghost3", "mally", "boo!!"), OfflineStore::Result::SenderFull);
+    EXPECT_EQ(store->store("ghost3", "alice", "hello"), OfflineStore::Result::Stored);
+    EXPECT_EQ(store->totalBytes(), 3 * 18U);
+
+    // A delivered message no longer counts against its sender
+    ASSERT_NE(store->take("ghost1"), nullptr);
+    EXPECT_EQ(store->store("ghost3", "mally", "boo!!"), OfflineStore::Result::Stored);
+
+    // A queue that cannot be read stays where it is, still counted
+    const std::filesystem::path unreadable = directory / "66726f646f.queue"; // "frodo"
+    std::filesystem::create_directory(unreadable);
+    const uint64_t totalBytes = store->totalBytes();
+    EXPECT_EQ(store->take("frodo"), nullptr);
+    EXPECT_TRUE(std::filesystem::exists(unreadable));
+    EXPECT_EQ(store->totalBytes(), totalBytes);
+
+    store.reset();
+    std::filesystem::remove_all(directory);
+}
+
+TEST(TestOfflineStore, TornRecordIsCutOffBeforeTheNextAppend)
+{
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("simpleim-offline-torn-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+
+    OfflineConfig config;
+    config.directory = directory.string();
+    std::unique_ptr<OfflineStore> store = OfflineStore::open(config);
+    ASSERT_NE(store, nullptr);
+    EXPECT_EQ(store->store("frodo", "sam", "first"), OfflineStore::Result::Stored);
+    store.reset();
+
+    // A crash part way through the second record: its header and one byte of the sender
+    const std::filesystem::path queue = directory / "66726f646f.queue"; // "frodo"
+    const uint64_t wholeBytes = std::filesystem::file_size(queue);
+    {
+        const char torn[] = {3, 0, 0, 0, 6, 0, 0, 0, 's'};
+        std::ofstream file(queue, std::ios::binary | std::ios::app);
+        file.write(torn, sizeof(torn));
+    }
+
+    store = OfflineStore::open(config);
+    ASSERT_NE(store, nullptr);
+    EXPECT_EQ(std::filesystem::file_size(queue), wholeBytes);
+    EXPECT_EQ(store->totalBytes(), wholeBytes);
+    EXPECT_EQ(store->store("frodo", "sam", "second"), OfflineStore::Result::Stored);
+
+    const SharedFrame frames = store->take("frodo");
+    ASSERT_NE(frames, nullptr);
+    std::vector<std::string> messages;
+    FrameDecoder decoder;
+    decoder.feed(frames->data(), frames->size());
+    Frame frame{};
+    while (decoder.next(frame) == FrameDecoder::Result::Frame) {
+        messages.emplace_back(frame.payload);
+    }
+    EXPECT_EQ(messages, (std::vector<std::string>{"sam: first", "sam: second"}));
+
+    // No name is too long to queue for; longer ones cannot log on to read it
+    EXPECT_EQ(store->store(std::string(kMaxUsernameLength, 'n'), "sam", "hi"), OfflineStore::Result::Stored);
+    EXPECT_EQ(store->store(std::string(kMaxUsernameLength + 1, 'n'), "sam", "hi"), OfflineStore::Result::Failed);
+
+    store.reset();
+    std::filesystem::remove_all(directory);
+}
+
+TEST(TestChatStream, NumbersChatFramesAndResumesAfterWhatWasReceived)
+{
+    auto chat = [](const std::string& text) { return Message::encode_shared(MessageType::ChatMessageBroadcast, text); };
+    const SharedFrame three = chat("bob: three");
+    const auto now = std::chrono::steady_clock::now();
+
+    // Only chat is numbered, however many frames share a buffer
+    ChatStream stream(7, 1024);
+    auto buffer = std::make_shared<std::string>(*Message::encode_shared(MessageType::PresenceDelta, "1:+bob"));
+    *buffer += *chat("bob: one");
+    *buffer += *chat("bob: two");
+    *buffer += *Message::encode_shared(MessageType::SearchEnd, "0");
+    stream.record(buffer, *buffer);
+    stream.record(three, *three);
+    EXPECT_EQ(stream.nextSequence(), 4U);
+
+    // Not while its connection is up
+    std::vector<ChatStream::Frame> missed;
+    EXPECT_FALSE(stream.resume(1, now, missed));
+
+    stream.acknowledge(1);
+    stream.park(now + std::chrono::seconds(60));
+    EXPECT_FALSE(stream.resume(0, now, missed)); // frame 1 was let go
+    EXPECT_FALSE(stream.resume(4, now, missed)); // ahead of the stream
+    ASSERT_TRUE(stream.resume(1, now, missed));
+    ASSERT_EQ(missed.size(), 2U);
+    EXPECT_EQ(missed[0].bytes, *chat("bob: two"));
+    EXPECT_EQ(missed[1].bytes, *three);
+    EXPECT_EQ(stream.nextSequence(), 2U);
+
+    // It keeps the newest frames that fit, and only until its window ends
+    ChatStream small(8, 2 * three->size());
+    for (int i = 0; i < 3; ++i) {
+        small.record(three, *three);
+    }
+    small.park(now + std::chrono::seconds(60));
+    EXPECT_TRUE(small.expired(now + std::chrono::seconds(60)));
+    EXPECT_FALSE(small.resume(1, now + std::chrono::seconds(60), missed));
+    EXPECT_FALSE(small.resume(0, now, missed));
+    ASSERT_TRUE(small.resume(1, now, missed));
+    EXPECT_EQ(missed.size(), 2U);
+}
+
+TEST(TestLog, DisabledLevelsDoNotEvaluateTheirArguments)
+{
+    int evaluated = 0;
+    auto expensive = [&evaluated]() { ++evaluated; return "formatted"; };
+
+    SIMPLEIM_LOG_DEBUG << expensive();
+    EXPECT_EQ(evaluated, Log::compiledIn(Log::Level::Debug) ? 1 : 0);
+
+    Log::setLevel(Log::Level::Error);
+    SIMPLEIM_LOG_INFO << expensive();
+    SIMPLEIM_LOG_WARNING << expensive();
+    Log::setLevel(Log::kCompiledLevel);
+    EXPECT_LE(evaluated, 1);
+}
+
+TEST(TestLog, RateLimiterHoldsBackABurstAndCountsIt)
+{
+    Log::RateLimiter limiter;
+    int allowed = 0;
+    for (int i = 0; i < 100; ++i) {
+        allowed += limiter.allow() ? 1 : 0;
+    }
+
+    // A second boundary inside the loop can open one more budget
+    EXPECT_GE(allowed, static_cast<int>(Log::RateLimiter::kLinesPerSecond));
+    EXPECT_LE(allowed, static_cast<int>(2 * Log::RateLimiter::kLinesPerSecond));
+    EXPECT_EQ(limiter.takeSuppressed(), static_cast<uint64_t>(100 - allowed));
+    EXPECT_EQ(limiter.takeSuppressed(), 0U);
+}
+
+TEST(TestMpscMessageQueue, KeepsEachProducersOrderAndRefusesWhenFull)
+{
+    constexpr int kProducers = 4;
+    constexpr int kPerProducer = 5000;
+    MpscMessageQueue queue(64);
+    EXPECT_EQ(queue.capacity(), 64U);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&queue, p]() {
+            for (int i = 0; i < kPerProducer; ++i) {
+                const std::string payload = std::to_string(p) + ":" + std::to_string(i);
+                while (!queue.push(Message(MessageType::ChatMessageBroadcast, payload))) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    std::vector<int> nextExpected(kProducers, 0);
+    Message message;
+    for (int received = 0; received < kProducers * kPerProducer;) {
+        if (!queue.tryPop(message)) {
+            std::this_thread::yield();
+            continue;
+        }
+        const std::string payload(message.data());
+        const size_t colon = payload.find(':');
+        const int producer = std::stoi(payload.substr(0, colon));
+        ASSERT_EQ(std::stoi(payload.substr(colon + 1)), nextExpected[producer]++);
+        ++received;
+    }
+    for (std::thread& producer : producers) {
+        producer.join();
+    }
+    EXPECT_TRUE(queue.empty());
+
+    for (size_t i = 0; i < queue.capacity(); ++i) {
+        ASSERT_TRUE(queue.push(Message(MessageType::ChatMessageBroadcast, "x")));
+    }
+    EXPECT_FALSE(queue.push(Message(MessageType::ChatMessageBroadcast, "overflow")));
+}
+
+TEST(TestMpscMessageQueue, PushWakesAWaitingConsumerOnly)
+{
+    MpscMessageQueue queue;
+    pollfd wake{queue.wakeFd(), POLLIN, 0};
+
+    // Nobody is waiting, so a push costs no signal
+    ASSERT_TRUE(queue.push(Message(MessageType::ChatMessageBroadcast, "busy")));
+    EXPECT_EQ(poll(&wake, 1, 0), 0);
+    EXPECT_FALSE(queue.prepareWait());
+
+    Message message;
+    ASSERT_TRUE(queue.tryPop(message));
+    ASSERT_TRUE(queue.prepareWait());
+
+    std::thread producer([&queue]() {
+        queue.push(Message(MessageType::ChatMessageBroadcast, "wake"));
+    });
+    EXPECT_EQ(poll(&wake, 1, 1000), 1);
+    producer.join();
+
+    queue.consumeWakeup();
+    ASSERT_TRUE(queue.tryPop(message));
+    EXPECT_EQ(message.data(), "wake");
+}
+
 TEST_F(TestServerClient, HandleLogonReadsSplitHeaderAndPayload)
 {
     bool disconnectedCalled = false;
-    std::string disconnectedUserId;
+    UserHandle disconnectedUser = kInvalidUserHandle;
 
     ServerClient client(
         m_sockets[0],
-        [&](std::string userId) {
+        [&](UserHandle user) {
             disconnectedCalled = true;
-            disconnectedUserId = userId;
+            disconnectedUser = user;
         });
 
     ClientManager manager;
 
     std::vector<uint8_t> bytes = buildRawMessage(MessageType::UserLogon, "alice");
 
+    // Each partial read leaves the connection waiting in PreAuth
     ASSERT_EQ(send(m_sockets[1], bytes.data(), 2, 0), 2);
+    ASSERT_TRUE(client.onReadable(&manager));
     ASSERT_EQ(send(m_sockets[1], bytes.data() + 2, 3, 0), 3);
+    ASSERT_TRUE(client.onReadable(&manager));
     ASSERT_EQ(send(m_sockets[1], bytes.data() + 5, 2, 0), 2);
+    ASSERT_TRUE(client.onReadable(&manager));
+    EXPECT_EQ(client.getState(), ServerClient::ConnectionState::PreAuth);
     ASSERT_EQ(send(m_sockets[1], bytes.data() + 7, bytes.size() - 7, 0),
               static_cast<ssize_t>(bytes.size() - 7));
 
-    ASSERT_TRUE(client.handleLogon(&manager));
+    ASSERT_TRUE(client.onReadable(&manager));
+    EXPECT_EQ(client.getState(), ServerClient::ConnectionState::Authenticated);
     EXPECT_EQ(client.getUserId(), "alice");
     EXPECT_FALSE(disconnectedCalled);
-    EXPECT_TRUE(disconnectedUserId.empty());
+    EXPECT_EQ(disconnectedUser, kInvalidUserHandle);
 }
 
 TEST_F(TestServerClient, HandleLogonFailsWhenPayloadDisconnectsMidMessage)
 {
     bool disconnectedCalled = false;
-    std::string disconnectedUserId;
+    UserHandle disconnectedUser = kInvalidUserHandle;
 
     ServerClient client(
         m_sockets[0],
-        [&](std::string userId) {
+        [&](UserHandle user) {
             disconnectedCalled = true;
-            disconnectedUserId = userId;
+            disconnectedUser = user;
         });
 
     ClientManager manager;
@@ -160,19 +908,19 @@ TEST_F(TestServerClient, HandleLogonFailsWhenPayloadDisconnectsMidMessage)
     close(m_sockets[1]);
     m_sockets[1] = -1;
 
-    EXPECT_FALSE(client.handleLogon(&manager));
+    EXPECT_FALSE(client.onReadable(&manager));
     EXPECT_TRUE(disconnectedCalled);
-    EXPECT_TRUE(disconnectedUserId.empty());
+    EXPECT_EQ(disconnectedUser, kInvalidUserHandle);
 }
 
 TEST_F(TestServerClient, HandleLogonSendsExpectedSuccessMessages)
 {
-    ServerClient client(m_sockets[0], [](const std::string&) {});
+    ServerClient client(m_sockets[0], [](UserHandle) {});
     ClientManager manager;
 
     ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogon, "alice")));
 
-    ASSERT_TRUE(client.handleLogon(&manager));
+    ASSERT_TRUE(client.onReadable(&manager));
 
     std::optional<MessageHeader> firstHeader = recvHeader();
     ASSERT_TRUE(firstHeader.has_value());
@@ -185,20 +933,23 @@ TEST_F(TestServerClient, HandleLogonSendsExpectedSuccessMessages)
 
     std::optional<MessageHeader> secondHeader = recvHeader();
     ASSERT_TRUE(secondHeader.has_value());
-    EXPECT_EQ(secondHeader->type, MessageType::ConnectedClientsList);
-    EXPECT_EQ(secondHeader->length, 0U);
+    EXPECT_EQ(secondHeader->type, MessageType::PresenceSnapshot);
+    std::vector<char> secondPayload(secondHeader->length);
+    ASSERT_TRUE(recvPayload(secondPayload));
+    // alice's own join waits for the next presence batch
+    EXPECT_EQ(std::string(secondPayload.begin(), secondPayload.end()), "0:0:1:");
 }
 
-TEST_F(TestServerClient, RunIgnoresRelogonAfterAuthentication)
+TEST_F(TestServerClient, OnReadableIgnoresRelogonAfterAuthentication)
 {
-    ServerClient client(m_sockets[0], [](const std::string&) {});
+    ServerClient client(m_sockets[0], [](UserHandle) {});
     ClientManager manager;
 
     ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogon, "alice")));
-    ASSERT_TRUE(client.handleLogon(&manager));
+    ASSERT_TRUE(client.onReadable(&manager));
     EXPECT_EQ(client.getUserId(), "alice");
 
-    // Drain handleLogon responses from socket.
+    // Drain logon responses from socket.
     std::optional<MessageHeader> firstHeader = recvHeader();
     ASSERT_TRUE(firstHeader.has_value());
     std::vector<char> firstPayload(firstHeader->length);
@@ -207,32 +958,30 @@ TEST_F(TestServerClient, RunIgnoresRelogonAfterAuthentication)
     std::optional<MessageHeader> secondHeader = recvHeader();
     ASSERT_TRUE(secondHeader.has_value());
 
-    client.run(&manager);
-
     ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogon, "mallory")));
     ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogoff, "")));
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(client.onReadable(&manager));
     EXPECT_EQ(client.getUserId(), "alice");
 }
 
 TEST_F(TestServerClient, UserLogoffTriggersDisconnectCallbackExactlyOnce)
 {
     std::atomic<int> callbackCount(0);
-    std::string disconnectedUserId;
+    UserHandle disconnectedUser = kInvalidUserHandle;
 
     ServerClient client(
         m_sockets[0],
-        [&](std::string userId) {
+        [&](UserHandle user) {
             ++callbackCount;
-            disconnectedUserId = userId;
+            disconnectedUser = user;
         });
     ClientManager manager;
 
     ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogon, "alice")));
-    ASSERT_TRUE(client.handleLogon(&manager));
+    ASSERT_TRUE(client.onReadable(&manager));
 
-    // Drain handleLogon responses from socket.
+    // Drain logon responses from socket.
     std::optional<MessageHeader> firstHeader = recvHeader();
     ASSERT_TRUE(firstHeader.has_value());
     std::vector<char> firstPayload(firstHeader->length);
@@ -241,22 +990,23 @@ TEST_F(TestServerClient, UserLogoffTriggersDisconnectCallbackExactlyOnce)
     std::optional<MessageHeader> secondHeader = recvHeader();
     ASSERT_TRUE(secondHeader.has_value());
 
-    client.run(&manager);
     ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogoff, "")));
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(client.onReadable(&manager));
+    EXPECT_FALSE(client.onReadable(&manager));
     EXPECT_EQ(callbackCount.load(), 1);
-    EXPECT_EQ(disconnectedUserId, "alice");
+    EXPECT_NE(disconnectedUser, kInvalidUserHandle);
+    EXPECT_EQ(disconnectedUser, client.getUserHandle());
 }
 
 TEST_F(TestServerClient, HandleLogonRejectsInvalidMessageType)
 {
-    ServerClient client(m_sockets[0], [](const std::string&) {});
+    ServerClient client(m_sockets[0], [](UserHandle) {});
     ClientManager manager;
 
     ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::ChatMessageBroadcast, "alice")));
 
-    EXPECT_FALSE(client.handleLogon(&manager));
+    EXPECT_FALSE(client.onReadable(&manager));
 
     std::optional<MessageHeader> responseHeader = recvHeader();
     ASSERT_TRUE(responseHeader.has_value());
@@ -266,12 +1016,12 @@ TEST_F(TestServerClient, HandleLogonRejectsInvalidMessageType)
 
 TEST_F(TestServerClient, HandleLogonRejectsZeroLengthUsername)
 {
-    ServerClient client(m_sockets[0], [](const std::string&) {});
+    ServerClient client(m_sockets[0], [](UserHandle) {});
     ClientManager manager;
 
     ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogon, "")));
 
-    EXPECT_FALSE(client.handleLogon(&manager));
+    EXPECT_FALSE(client.onReadable(&manager));
 
     std::optional<MessageHeader> responseHeader = recvHeader();
     ASSERT_TRUE(responseHeader.has_value());
@@ -279,13 +1029,33 @@ TEST_F(TestServerClient, HandleLogonRejectsZeroLengthUsername)
     EXPECT_EQ(responseHeader->length, strlen("Username cannot be empty"));
 }
 
+TEST_F(TestServerClient, HandleLogonRejectsNamesTheProtocolCannotCarry)
+{
+    ClientManager manager;
+
+    // Each is refused as sent rather than logged on under some other name
+    for (const std::string& name : {std::string("bob:42"), std::string("bob,carol"), std::string("bob\n"),
+                                    std::string(kMaxUsernameLength + 1, 'b')}) {
+        int sockets[2] = {-1, -1};
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+        ServerClient client(sockets[0], [](UserHandle) {});
+        const std::vector<uint8_t> logon = buildRawMessage(MessageType::UserLogon, name);
+        ASSERT_EQ(send(sockets[1], logon.data(), logon.size(), 0), static_cast<ssize_t>(logon.size()));
+
+        EXPECT_FALSE(client.onReadable(&manager)) << name;
+        char header[5] = {};
+        EXPECT_EQ(recv(sockets[1], header, sizeof(header), MSG_DONTWAIT), 5) << name;
+        EXPECT_EQ(static_cast<MessageType>(header[0]), MessageType::LoginFailure) << name;
+        EXPECT_TRUE(manager.isUsernameAvailable("bob"));
+        close(sockets[1]);
+    }
+}
+
 TEST_F(TestServerClient, IntegrationClientDisconnectRemovesUserWithoutCrash)
 {
     ClientManager manager;
 
-    std::thread acceptThread([&]() {
-        manager.addConnectedClient(m_sockets[0]);
-    });
+    manager.addConnectedClient(m_sockets[0]);
 
     ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogon, "alice")));
 
@@ -297,15 +1067,1205 @@ TEST_F(TestServerClient, IntegrationClientDisconnectRemovesUserWithoutCrash)
 
     std::optional<MessageHeader> listHeader = recvHeader();
     ASSERT_TRUE(listHeader.has_value());
-    ASSERT_EQ(listHeader->type, MessageType::ConnectedClientsList);
+    ASSERT_EQ(listHeader->type, MessageType::PresenceSnapshot);
     std::vector<char> listPayload(listHeader->length);
     ASSERT_TRUE(recvPayload(listPayload));
 
-    acceptThread.join();
-
     close(m_sockets[1]);
     m_sockets[1] = -1;
 
     std::this_thread::sleep_for(std::chrono::milliseconds(50));
     EXPECT_TRUE(manager.getConnectedUsernames().empty());
 }
+
+TEST_F(TestServerClient, OnReadableDispatchesEveryFrameFromOneRead)
+{
+    std::atomic<int> callbackCount(0);
+
+    ServerClient client(m_sockets[0], [&](UserHandle) { ++callbackCount; });
+    ClientManager manager;
+
+    ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogon, "alice")));
+    ASSERT_TRUE(client.onReadable(&manager));
+
+    // Several frames arriving back to back are all handled by one readiness event,
+    // and a partial trailing frame waits for the rest of its bytes.
+    std::vector<uint8_t> burst;
+    for (int i = 0; i < 3; ++i) {
+        std::vector<uint8_t> frame = buildRawMessage(MessageType::UserLogon, "mallory");
+        burst.insert(burst.end(), frame.begin(), frame.end());
+    }
+    std::vector<uint8_t> logoff = buildRawMessage(MessageType::UserLogoff, "");
+    burst.insert(burst.end(), logoff.begin(), logoff.begin() + 2);
+    ASSERT_TRUE(sendRaw(burst));
+
+    EXPECT_TRUE(client.onReadable(&manager));
+    EXPECT_EQ(client.getState(), ServerClient::ConnectionState::Authenticated);
+    EXPECT_EQ(callbackCount.load(), 0);
+
+    ASSERT_TRUE(sendRaw(std::vector<uint8_t>(logoff.begin() + 2, logoff.end())));
+    EXPECT_FALSE(client.onReadable(&manager));
+    EXPECT_EQ(client.getState(), ServerClient::ConnectionState::Closing);
+    EXPECT_EQ(callbackCount.load(), 1);
+}
+
+TEST_F(TestServerClient, ScheduledWritesWaitForTheReactorToSendThem)
+{
+    ServerClient client(m_sockets[0], nullptr);
+    int scheduled = 0;
+    client.setWriteScheduler([&]() { ++scheduled; });
+
+    ASSERT_TRUE(client.sendMessage(MessageType::ChatMessageBroadcast, "first"));
+    EXPECT_EQ(scheduled, 1);
+
+    // The reactor owns the send, so nothing reaches the socket by itself
+    char probe = 0;
+    EXPECT_EQ(recv(m_sockets[1], &probe, 1, MSG_DONTWAIT), -1);
+
+    std::vector<iovec> chunks;
+    ASSERT_TRUE(client.prepareWrite(chunks));
+    ASSERT_EQ(chunks.size(), 1u);
+    const char* inFlight = static_cast<const char*>(chunks[0].iov_base);
+    const size_t inFlightLength = chunks[0].iov_len;
+
+    // Frames queued while a send is in flight leave its bytes where they are,
+    // and the send's completion picks them up without another schedule
+    ASSERT_TRUE(client.sendMessage(MessageType::ChatMessageBroadcast, "second"));
+    EXPECT_EQ(scheduled, 1);
+    ASSERT_EQ(send(m_sockets[0], inFlight, inFlightLength, 0), static_cast<ssize_t>(inFlightLength));
+    ASSERT_TRUE(client.completeWrite(static_cast<ssize_t>(inFlightLength)));
+
+    ASSERT_TRUE(client.prepareWrite(chunks));
+    ASSERT_EQ(chunks.size(), 1u);
+    ASSERT_EQ(send(m_sockets[0], chunks[0].iov_base, chunks[0].iov_len, 0), static_cast<ssize_t>(chunks[0].iov_len));
+    ASSERT_TRUE(client.completeWrite(static_cast<ssize_t>(chunks[0].iov_len)));
+    EXPECT_FALSE(client.prepareWrite(chunks));
+
+    for (const std::string expected : {"first", "second"}) {
+        std::optional<MessageHeader> header = recvHeader();
+        ASSERT_TRUE(header.has_value());
+        EXPECT_EQ(header->type, MessageType::ChatMessageBroadcast);
+        std::vector<char> payload(header->length);
+        ASSERT_TRUE(recvPayload(payload));
+        EXPECT_EQ(std::string(payload.begin(), payload.end()), expected);
+    }
+
+    // A failed send closes the connection
+    ASSERT_TRUE(client.sendMessage(MessageType::ChatMessageBroadcast, "third"));
+    EXPECT_EQ(scheduled, 2);
+    ASSERT_TRUE(client.prepareWrite(chunks));
+    EXPECT_FALSE(client.completeWrite(-EPIPE));
+    EXPECT_EQ(client.getState(), ServerClient::ConnectionState::Closing);
+}
+
+TEST_F(TestServerClient, BroadcastFrameIsSharedNotCopiedPerRecipient)
+{
+    int otherSockets[2] = {-1, -1};
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, otherSockets), 0);
+
+    ServerClient first(m_sockets[0], nullptr);
+    ServerClient second(otherSockets[0], nullptr);
+    first.setWriteScheduler([]() {});
+    second.setWriteScheduler([]() {});
+
+    SharedFrame frame = Message::encode_shared(MessageType::ChatMessageBroadcast, "alice: hi all");
+    ASSERT_EQ(frame->size(), 5 + std::string("alice: hi all").size());
+    ASSERT_TRUE(first.sendFrame(frame));
+    ASSERT_TRUE(second.sendFrame(frame));
+    EXPECT_EQ(frame.use_count(), 3);
+
+    // Both queues point at the one encoded buffer
+    std::vector<iovec> firstChunks;
+    std::vector<iovec> secondChunks;
+    ASSERT_TRUE(first.prepareWrite(firstChunks));
+    ASSERT_TRUE(second.prepareWrite(secondChunks));
+    EXPECT_EQ(firstChunks[0].iov_base, frame->data());
+    EXPECT_EQ(secondChunks[0].iov_base, frame->data());
+    EXPECT_EQ(firstChunks[0].iov_len, frame->size());
+
+    // Partial sends resume inside the frame, and the queue lets go once it is out
+    ASSERT_TRUE(first.completeWrite(3));
+    ASSERT_TRUE(first.prepareWrite(firstChunks));
+    EXPECT_EQ(firstChunks[0].iov_base, frame->data() + 3);
+    ASSERT_TRUE(first.completeWrite(static_cast<ssize_t>(firstChunks[0].iov_len)));
+    EXPECT_FALSE(first.prepareWrite(firstChunks));
+    EXPECT_EQ(frame.use_count(), 2);
+
+    close(otherSockets[1]);
+}
+
+TEST_F(TestServerClient, QueuedFramesLeaveInOneVectoredWrite)
+{
+    ServerClient client(m_sockets[0], nullptr);
+    int scheduled = 0;
+    client.setWriteScheduler([&]() { ++scheduled; });
+
+    // Only the first frame of a burst asks the reactor for a flush
+    const std::vector<std::string> burst = {"one", "two", "three"};
+    for (const std::string& text : burst) {
+        ASSERT_TRUE(client.sendMessage(MessageType::ChatMessageBroadcast, text));
+    }
+    EXPECT_EQ(scheduled, 1);
+
+    std::vector<iovec> chunks;
+    ASSERT_TRUE(client.prepareWrite(chunks));
+    EXPECT_EQ(chunks.size(), burst.size());
+    ASSERT_TRUE(client.completeWrite(0));
+
+    // The reactor's flush writes the whole burst with one sendmsg
+    ASSERT_TRUE(client.onWritable());
+    EXPECT_EQ(client.outboundBytes(), 0u);
+
+    char received[64];
+    EXPECT_EQ(recv(m_sockets[1], received, sizeof(received), 0), static_cast<ssize_t>(3 * 5 + 3 + 3 + 5));
+}
+
+TEST_F(TestServerClient, SlowConsumerShedsOldestChatDownToLowWatermark)
+{
+    OutboundQueueLimits limits;
+    limits.highWatermark = 137;
+    limits.lowWatermark = 87;
+    limits.policy = SlowConsumerPolicy::DropOldestChat;
+
+    std::atomic<int> callbackCount(0);
+    ServerClient client(m_sockets[0], [&](UserHandle) { ++callbackCount; }, 0, limits);
+    client.setWriteScheduler([]() {});
+    const auto sendChat = [&client](char fill) {
+        return client.sendFrame(Message::encode_shared(MessageType::ChatMessageBroadcast, std::string(15, fill)), true);
+    };
+
+    // A send already in flight keeps its frame whatever happens to the rest
+    ASSERT_TRUE(sendChat('a'));
+    std::vector<iovec> chunks;
+    ASSERT_TRUE(client.prepareWrite(chunks));
+
+    // Replies look like chat on the wire but are never shed
+    ASSERT_TRUE(client.sendMessage(MessageType::PresenceDelta, "bob"));
+    ASSERT_TRUE(client.sendMessage(MessageType::ChatMessageBroadcast, "System: sent"));
+    for (char fill = 'b'; fill <= 'e'; ++fill) {
+        ASSERT_TRUE(sendChat(fill));
+    }
+    EXPECT_EQ(client.outboundBytes(), 20u + 8u + 17u + 4 * 20u);
+
+    // Crossing the high watermark sheds b, c and d but keeps presence, the reply and e
+    ASSERT_TRUE(sendChat('f'));
+    EXPECT_EQ(client.outboundBytes(), 20u + 8u + 17u + 2 * 20u);
+    EXPECT_EQ(client.getState(), ServerClient::ConnectionState::PreAuth);
+    EXPECT_EQ(callbackCount.load(), 0);
+
+    ASSERT_TRUE(client.completeWrite(static_cast<ssize_t>(chunks[0].iov_len)));
+    std::vector<std::string> remaining;
+    ASSERT_TRUE(client.prepareWrite(chunks));
+    size_t written = 0;
+    for (const iovec& chunk : chunks) {
+        remaining.emplace_back(static_cast<const char*>(chunk.iov_base) + 5, chunk.iov_len - 5);
+        written += chunk.iov_len;
+    }
+    ASSERT_TRUE(client.completeWrite(static_cast<ssize_t>(written)));
+    EXPECT_FALSE(client.prepareWrite(chunks));
+    EXPECT_EQ(remaining, (std::vector<std::string>{"bob", "System: sent", std::string(15, 'e'), std::string(15, 'f')}));
+    EXPECT_EQ(client.outboundBytes(), 0u);
+}
+
+TEST_F(TestServerClient, SlowConsumerIsDisconnectedPastHighWatermark)
+{
+    OutboundQueueLimits limits;
+    limits.highWatermark = 50;
+    limits.lowWatermark = 10;
+    limits.policy = SlowConsumerPolicy::Disconnect;
+
+    std::atomic<int> callbackCount(0);
+    ServerClient client(m_sockets[0], [&](UserHandle) { ++callbackCount; }, 0, limits);
+    client.setWriteScheduler([]() {});
+
+    ASSERT_TRUE(client.sendMessage(MessageType::ChatMessageBroadcast, std::string(40, 'x')));
+    EXPECT_FALSE(client.sendMessage(MessageType::ChatMessageBroadcast, std::string(40, 'y')));
+    EXPECT_EQ(client.getState(), ServerClient::ConnectionState::Closing);
+    EXPECT_EQ(callbackCount.load(), 1);
+}
+
+TEST_F(TestServerClient, IntegrationDirectMessageCrossesReactorShards)
+{
+    ServerConfig config;
+    config.reactorCount = 2;
+    config.presenceInterval = std::chrono::milliseconds(0);
+    ClientManager manager(config);
+
+    int bobSockets[2] = {-1, -1};
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, bobSockets), 0);
+    timeval timeout{1, 0};
+    ASSERT_EQ(setsockopt(bobSockets[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)), 0);
+
+    ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogon, "alice")));
+    manager.addConnectedClient(m_sockets[0], 0);
+
+    // alice: LoginSuccess, PresenceSnapshot, her own join (which her snapshot
+    // already counted), then bob's
+    std::vector<uint8_t> bobLogon = buildRawMessage(MessageType::UserLogon, "bob");
+    const std::vector<std::pair<MessageType, std::string>> aliceExpected = {
+        {MessageType::LoginSuccess, "Login successful"}, {MessageType::PresenceSnapshot, "1:0:1:alice"},
+        {MessageType::PresenceDelta, "1:+alice"}, {MessageType::PresenceDelta, "2:+bob"}};
+    for (const auto& expected : aliceExpected) {
+        if (expected.second == "2:+bob") {
+            ASSERT_EQ(send(bobSockets[1], bobLogon.data(), bobLogon.size(), 0), static_cast<ssize_t>(bobLogon.size()));
+            manager.addConnectedClient(bobSockets[0], 1);
+        }
+
+        std::optional<MessageHeader> header = recvHeader();
+        ASSERT_TRUE(header.has_value());
+        EXPECT_EQ(header->type, expected.first);
+        std::vector<char> payload(header->length);
+        ASSERT_TRUE(recvPayload(payload));
+        EXPECT_EQ(std::string(payload.begin(), payload.end()), expected.second);
+    }
+
+    ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::ChatMessageDM, "bob:hi bob")));
+
+    // bob: LoginSuccess, PresenceSnapshot, then his own join and the DM routed
+    // from the other shard. alice may see the join, and reply, before bob's
+    // reactor has queued it for him, so those two come in either order.
+    std::vector<std::pair<MessageType, std::string>> bobFrames;
+    for (int i = 0; i < 4; ++i) {
+        char headerBuffer[5];
+        ASSERT_EQ(recv(bobSockets[1], headerBuffer, sizeof(headerBuffer), MSG_WAITALL), 5);
+        uint32_t length = 0;
+        std::memcpy(&length, &headerBuffer[1], sizeof(length));
+        std::string payload(ntohl(length), '\0');
+        if (!payload.empty()) {
+            ASSERT_EQ(recv(bobSockets[1], payload.data(), payload.size(), MSG_WAITALL), static_cast<ssize_t>(payload.size()));
+        }
+        bobFrames.emplace_back(static_cast<MessageType>(headerBuffer[0]), payload);
+    }
+
+    EXPECT_EQ(bobFrames[1].second, "2:0:1:alice,bob");
+    if (bobFrames[2].first == MessageType::ChatMessageBroadcast) {
+        std::swap(bobFrames[2], bobFrames[3]);
+    }
+    EXPECT_EQ(bobFrames[2].first, MessageType::PresenceDelta);
+    EXPECT_EQ(bobFrames[2].second, "2:+bob");
+    EXPECT_EQ(bobFrames[3].first, MessageType::ChatMessageBroadcast);
+    EXPECT_EQ(bobFrames[3].second, "alice: hi bob");
+
+    close(bobSockets[1]);
+}
+
+TEST_F(TestServerClient, IntegrationRoomMessagesReachOnlyMembers)
+{
+    ServerConfig config;
+    config.reactorCount = 2;
+    ClientManager manager(config);
+
+    // alice on the fixture's socket; bob on the other shard, carol on alice's
+    int bobSockets[2] = {-1, -1};
+    int carolSockets[2] = {-1, -1};
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, bobSockets), 0);
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, carolSockets), 0);
+    timeval timeout{1, 0};
+    ASSERT_EQ(setsockopt(bobSockets[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)), 0);
+
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::UserLogon, "alice"));
+    ASSERT_TRUE(sendTo(bobSockets[1], MessageType::UserLogon, "bob"));
+    ASSERT_TRUE(sendTo(carolSockets[1], MessageType::UserLogon, "carol"));
+    manager.addConnectedClient(m_sockets[0], 0);
+    manager.addConnectedClient(bobSockets[0], 1);
+    manager.addConnectedClient(carolSockets[0], 0);
+
+    for (int fd : {m_sockets[1], bobSockets[1]}) {
+        ASSERT_TRUE(readUntil(fd, MessageType::LoginSuccess).has_value());
+        ASSERT_TRUE(sendTo(fd, MessageType::RoomJoin, "team"));
+        EXPECT_EQ(readUntil(fd, MessageType::RoomJoin), "team");
+    }
+
+    ASSERT_TRUE(sendTo(bobSockets[1], MessageType::RoomList, ""));
+    EXPECT_EQ(readUntil(bobSockets[1], MessageType::RoomList), "team");
+
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::RoomMessage, "team:hi team"));
+    EXPECT_EQ(readUntil(bobSockets[1], MessageType::RoomMessage), "team:alice: hi team");
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::RoomMessage), "team:alice: hi team");
+
+    // carol shares alice's reactor, so by now anything sent her way has arrived
+    char buffer[4096];
+    ssize_t received = 0;
+    while ((received = recv(carolSockets[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        for (ssize_t offset = 0; offset + 5 <= received; ) {
+            EXPECT_NE(static_cast<MessageType>(buffer[offset]), MessageType::RoomMessage);
+            uint32_t length = 0;
+            std::memcpy(&length, &buffer[offset + 1], sizeof(length));
+            offset += 5 + ntohl(length);
+        }
+    }
+
+    // Non-members cannot post to the room
+    ASSERT_TRUE(sendTo(carolSockets[1], MessageType::RoomMessage, "team:let me in"));
+    timeval carolTimeout{1, 0};
+    ASSERT_EQ(setsockopt(carolSockets[1], SOL_SOCKET, SO_RCVTIMEO, &carolTimeout, sizeof(carolTimeout)), 0);
+    EXPECT_EQ(readUntil(carolSockets[1], MessageType::ChatMessageBroadcast), "System: You are not in room 'team'");
+
+    close(bobSockets[1]);
+    close(carolSockets[1]);
+}
+
+TEST_F(TestServerClient, IntegrationHistoryIsReplayedOnLogonAndResumes)
+{
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("simpleim-replay-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+
+    ServerConfig config;
+    config.reactorCount = 1;
+    config.presenceInterval = std::chrono::milliseconds(0);
+    config.history.directory = directory.string();
+    config.history.replayCount = 3;
+    auto manager = std::make_unique<ClientManager>(config);
+    ASSERT_NE(manager->history(), nullptr);
+
+    // The chat lines up to HistoryEnd, and HistoryEnd's sequence
+    auto readReplay = [this](int fd, std::vector<std::string>& lines) -> std::optional<std::string> {
+        while (std::optional<std::pair<MessageType, std::string>> frame = readFrame(fd)) {
+            if (frame->first == MessageType::HistoryEnd) {
+                return frame->second;
+            }
+            if (frame->first == MessageType::ChatMessageBroadcast) {
+                lines.push_back(frame->second);
+            }
+        }
+        return std::nullopt;
+    };
+
+    auto logOn = [&](const std::string& name, std::vector<std::string>& lines,
+                     std::optional<uint64_t> historyAfter = std::nullopt) -> std::pair<int, std::optional<std::string>> {
+        int sockets[2] = {-1, -1};
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+            return {-1, std::nullopt};
+        }
+        timeval timeout{1, 0};
+        setsockopt(sockets[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (historyAfter) {
+            sendTo(sockets[1], MessageType::HistoryResume, std::to_string(*historyAfter));
+        }
+        sendTo(sockets[1], MessageType::UserLogon, name);
+        manager->addConnectedClient(sockets[0]);
+        return {sockets[1], readReplay(sockets[1], lines)};
+    };
+
+    // Nothing kept yet: the replay is just its end
+    std::vector<std::string> lines;
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::UserLogon, "alice"));
+    manager->addConnectedClient(m_sockets[0]);
+    EXPECT_EQ(readReplay(m_sockets[1], lines), "0");
+    auto [carol, carolEnd] = logOn("carol", lines);
+    EXPECT_EQ(carolEnd, "0");
+    EXPECT_TRUE(lines.empty());
+
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_TRUE(sendTo(m_sockets[1], MessageType::ChatMessageBroadcast, "m" + std::to_string(i)));
+    }
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::ChatMessageDM, "carol:secret"));
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (manager->history()->durableSequence() < 6 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(manager->history()->durableSequence(), 6U);
+
+    // The last three records, less carol's direct message
+    auto [bob, bobEnd] = logOn("bob", lines);
+    EXPECT_EQ(bobEnd, "6");
+    EXPECT_EQ(lines, (std::vector<std::string>{"alice: m3", "alice: m4"}));
+
+    // carol comes back for everything after record 2, her message included
+    close(carol);
+    while (!manager->isUsernameAvailable("carol") && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    lines.clear();
+    auto [carolAgain, carolAgainEnd] = logOn("carol", lines, 2);
+    EXPECT_EQ(carolAgainEnd, "6");
+    EXPECT_EQ(lines, (std::vector<std::string>{"alice: m2", "alice: m3", "alice: m4", "alice: secret"}));
+
+    manager.reset();
+    close(bob);
+    close(carolAgain);
+    std::filesystem::remove_all(directory);
+}
+
+TEST_F(TestServerClient, IntegrationReplayWaitsForRecordsStillBeingSynced)
+{
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("simpleim-pending-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+
+    ServerConfig config;
+    config.reactorCount = 1;
+    config.history.directory = directory.string();
+    config.history.replayCount = 10000;
+    auto manager = std::make_unique<ClientManager>(config);
+    ASSERT_NE(manager->history(), nullptr);
+
+    // Several group commits' worth, sent just before alice logs on, so the
+    // writer is still syncing them when her replay is set up
+    constexpr int kMessages = 2000;
+    auto message = [](int i) { return "m" + std::to_string(i) + std::string(2000, '.'); };
+    for (int i = 0; i < kMessages; ++i) {
+        manager->broadcastChatMessage("bob", message(i));
+    }
+    ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogon, "alice")));
+    manager->addConnectedClient(m_sockets[0]);
+
+    std::vector<std::string> lines;
+    std::optional<std::string> end;
+    while (!end) {
+        char headerBuffer[5];
+        ASSERT_EQ(recv(m_sockets[1], headerBuffer, sizeof(headerBuffer), MSG_WAITALL), 5);
+        uint32_t length = 0;
+        std::memcpy(&length, &headerBuffer[1], sizeof(length));
+        std::string payload(ntohl(length), '\0');
+        ASSERT_EQ(recv(m_sockets[1], payload.data(), payload.size(), MSG_WAITALL), static_cast<ssize_t>(payload.size()));
+        const MessageType type = static_cast<MessageType>(headerBuffer[0]);
+        if (type == MessageType::HistoryEnd) {
+            end = payload;
+        }
+        else if (type == MessageType::ChatMessageBroadcast) {
+            lines.push_back(payload);
+        }
+    }
+
+    // None of them is lost to the window between append and sync
+    EXPECT_EQ(end, std::to_string(kMessages));
+    ASSERT_EQ(lines.size(), static_cast<size_t>(kMessages));
+    for (int i = 0; i < kMessages; ++i) {
+        EXPECT_EQ(lines[i], "bob: " + message(i)) << "line " << i;
+    }
+
+    manager.reset();
+    std::filesystem::remove_all(directory);
+}
+
+TEST_F(TestServerClient, IntegrationDirectMessagesWaitForOfflineUsers)
+{
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("simpleim-offline-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+
+    ServerConfig config;
+    config.reactorCount = 1;
+    config.presenceInterval = std::chrono::milliseconds(0);
+    config.offline.directory = directory.string();
+    config.offline.maxBytesPerUser = 64;
+    config.offline.maxBytesPerSender = 64;
+    auto manager = std::make_unique<ClientManager>(config);
+
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::UserLogon, "alice"));
+    manager->addConnectedClient(m_sockets[0]);
+    ASSERT_TRUE(readUntil(m_sockets[1], MessageType::LoginSuccess).has_value());
+
+    const std::string queued = "System: 'bob' is offline; the message will be delivered when they log on";
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::ChatMessageDM, "bob:one"));
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::ChatMessageBroadcast), queued);
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::ChatMessageDM, "bob:two"));
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::ChatMessageBroadcast), queued);
+
+    // Past bob's limit; carol's queue is separate
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::ChatMessageDM, "bob:" + std::string(40, 'x')));
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::ChatMessageBroadcast),
+              "System: Too many messages are waiting for 'bob'; not sent");
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::ChatMessageDM, "carol:hi"));
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::ChatMessageBroadcast),
+              "System: 'carol' is offline; the message will be delivered when they log on");
+
+    // alice has 47 bytes waiting in all; a made-up name takes her past her own limit
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::ChatMessageDM, "ghost:" + std::string(10, 'x')));
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::ChatMessageBroadcast),
+              "System: You have too many messages waiting for offline users; not sent");
+
+    int bobSockets[2] = {-1, -1};
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, bobSockets), 0);
+    timeval timeout{1, 0};
+    ASSERT_EQ(setsockopt(bobSockets[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)), 0);
+    ASSERT_TRUE(sendTo(bobSockets[1], MessageType::UserLogon, "bob"));
+    manager->addConnectedClient(bobSockets[0]);
+    ASSERT_TRUE(readUntil(bobSockets[1], MessageType::LoginSuccess).has_value());
+    EXPECT_EQ(readUntil(bobSockets[1], MessageType::ChatMessageBroadcast), "alice: one");
+    EXPECT_EQ(readUntil(bobSockets[1], MessageType::ChatMessageBroadcast), "alice: two");
+
+    // Delivered once: the next one goes to bob live
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::ChatMessageDM, "bob:three"));
+    EXPECT_EQ(readUntil(bobSockets[1], MessageType::ChatMessageBroadcast), "alice: three");
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::ChatMessageBroadcast), "System: Message sent to bob");
+
+    // Only carol's queue is left
+    size_t queues = 0;
+    for (const auto& file : std::filesystem::directory_iterator(directory)) {
+        queues += file.path().extension() == ".queue" ? 1 : 0;
+    }
+    EXPECT_EQ(queues, 1U);
+
+    manager.reset();
+    close(bobSockets[1]);
+    std::filesystem::remove_all(directory);
+}
+
+TEST_F(TestServerClient, IntegrationSearchFindsHistoryTheUserMaySee)
+{
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("simpleim-search-server-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+
+    ServerConfig config;
+    config.reactorCount = 1;
+    config.presenceInterval = std::chrono::milliseconds(0);
+    config.history.directory = directory.string();
+    auto manager = std::make_unique<ClientManager>(config);
+    ASSERT_NE(manager->searchIndex(), nullptr);
+
+    int bobSockets[2] = {-1, -1};
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, bobSockets), 0);
+    timeval timeout{1, 0};
+    ASSERT_EQ(setsockopt(bobSockets[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)), 0);
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::UserLogon, "alice"));
+    ASSERT_TRUE(sendTo(bobSockets[1], MessageType::UserLogon, "bob"));
+    manager->addConnectedClient(m_sockets[0]);
+    manager->addConnectedClient(bobSockets[0]);
+    ASSERT_TRUE(readUntil(m_sockets[1], MessageType::LoginSuccess).has_value());
+    ASSERT_TRUE(readUntil(bobSockets[1], MessageType::LoginSuccess).has_value());
+
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::ChatMessageBroadcast, "the outage started"));
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::ChatMessageBroadcast, "lunch?"));
+    ASSERT_TRUE(sendTo(bobSockets[1], MessageType::ChatMessageDM, "alice:outage is on me"));
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (manager->searchIndex()->indexedSequence() < 3 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(manager->searchIndex()->indexedSequence(), 3U);
+
+    // alice was sent the direct message, so she finds it too, first
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::SearchRequest, "OUTAGE"));
+    const std::optional<std::string> newest = readUntil(m_sockets[1], MessageType::SearchResult);
+    ASSERT_TRUE(newest.has_value());
+    EXPECT_EQ(newest->substr(newest->find(':') + 1), "bob: outage is on me");
+    const std::optional<std::string> oldest = readUntil(m_sockets[1], MessageType::SearchResult);
+    ASSERT_TRUE(oldest.has_value());
+    EXPECT_EQ(oldest->substr(oldest->find(':') + 1), "alice: the outage started");
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::SearchEnd), "2");
+
+    manager.reset();
+    close(bobSockets[1]);
+    std::filesystem::remove_all(directory);
+}
+
+TEST_F(TestServerClient, IntegrationDroppedUserResumesWithOnlyWhatTheyMissed)
+{
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("simpleim-resume-" + std::to_string(getpid()));
+    std::filesystem::remove_all(directory);
+
+    ServerConfig config;
+    config.reactorCount = 1;
+    config.presenceInterval = std::chrono::milliseconds(0);
+    config.history.directory = directory.string();
+    config.resume.window = std::chrono::seconds(60);
+    auto manager = std::make_unique<ClientManager>(config);
+
+    auto connect = [&](const std::string& name, const std::string& resume = "") {
+        int sockets[2] = {-1, -1};
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+            return -1;
+        }
+        timeval timeout{1, 0};
+        setsockopt(sockets[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (!resume.empty()) {
+            sendTo(sockets[1], MessageType::StreamResume, resume);
+        }
+        sendTo(sockets[1], MessageType::UserLogon, name);
+        manager->addConnectedClient(sockets[0]);
+        return sockets[1];
+    };
+
+    // Once bob hears alice has gone, her stream is parked
+    auto waitForLeave = [&](int fd) {
+        std::optional<std::string> delta;
+        while ((delta = readUntil(fd, MessageType::PresenceDelta)) && !delta->ends_with("-alice")) {}
+        return delta.has_value();
+    };
+
+    const int bob = connect("bob");
+    ASSERT_TRUE(readUntil(bob, MessageType::StreamSync).has_value());
+    int alice = connect("alice");
+    const std::optional<std::string> sync = readUntil(alice, MessageType::StreamSync);
+    ASSERT_TRUE(sync.has_value());
+    const std::string stream = sync->substr(0, sync->find(':'));
+    EXPECT_EQ(sync->substr(sync->find(':') + 1), "1");
+
+    for (const char* text : {"one", "two", "three"}) {
+        ASSERT_TRUE(sendTo(bob, MessageType::ChatMessageBroadcast, text));
+    }
+    EXPECT_EQ(readUntil(alice, MessageType::ChatMessageBroadcast), "bob: one");
+    EXPECT_EQ(readUntil(alice, MessageType::ChatMessageBroadcast), "bob: two");
+    EXPECT_EQ(readUntil(alice, MessageType::ChatMessageBroadcast), "bob: three");
+    ASSERT_TRUE(sendTo(alice, MessageType::StreamAck, "1"));
+
+    // alice drops having really got two of them, and bob goes on without her
+    close(alice);
+    ASSERT_TRUE(waitForLeave(bob));
+    ASSERT_TRUE(sendTo(bob, MessageType::ChatMessageBroadcast, "four"));
+    EXPECT_EQ(readUntil(bob, MessageType::ChatMessageBroadcast), "bob: four");
+
+    // She gets the two she missed and carries on live, without a history replay
+    std::vector<MessageType> skipped;
+    alice = connect("alice", stream + ":2");
+    EXPECT_EQ(readUntil(alice, MessageType::StreamSync, &skipped), stream + ":3");
+    EXPECT_EQ(readUntil(alice, MessageType::ChatMessageBroadcast, &skipped), "bob: three");
+    EXPECT_EQ(readUntil(alice, MessageType::ChatMessageBroadcast, &skipped), "bob: four");
+    ASSERT_TRUE(sendTo(bob, MessageType::ChatMessageBroadcast, "five"));
+    EXPECT_EQ(readUntil(alice, MessageType::ChatMessageBroadcast, &skipped), "bob: five");
+    EXPECT_EQ(std::count(skipped.begin(), skipped.end(), MessageType::HistoryEnd), 0);
+
+    // The stream no longer holds frame 1, so asking for it starts afresh
+    close(alice);
+    ASSERT_TRUE(waitForLeave(bob));
+    alice = connect("alice", stream + ":0");
+    const std::optional<std::string> fresh = readUntil(alice, MessageType::StreamSync);
+    ASSERT_TRUE(fresh.has_value());
+    EXPECT_NE(fresh->substr(0, fresh->find(':')), stream);
+    EXPECT_EQ(fresh->substr(fresh->find(':') + 1), "1");
+    EXPECT_TRUE(readUntil(alice, MessageType::HistoryEnd).has_value());
+
+    // What once read as a resume position is refused as a name, not cut off it
+    const int dave = connect("dave@" + stream + ":1");
+    EXPECT_TRUE(readUntil(dave, MessageType::LoginFailure).has_value());
+    EXPECT_TRUE(manager->isUsernameAvailable("dave"));
+    close(dave);
+
+    manager.reset();
+    close(alice);
+    close(bob);
+    std::filesystem::remove_all(directory);
+}
+
+TEST_F(TestServerClient, IntegrationNumberedBroadcastsGoOutInNumberOrder)
+{
+    ServerConfig config;
+    config.reactorCount = 1;
+    config.presenceInterval = std::chrono::milliseconds(0);
+    config.resume.window = std::chrono::seconds(60);
+    ClientManager manager(config);
+
+    ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogon, "alice")));
+    manager.addConnectedClient(m_sockets[0]);
+    ASSERT_TRUE(readUntil(m_sockets[1], MessageType::LoginSuccess).has_value());
+
+    // Two senders took 1 and 2, and the second posted first
+    auto chat = [](const std::string& text) { return Message::encode_shared(MessageType::ChatMessageBroadcast, text); };
+    manager.reactor(0).broadcast(chat("bob: two"), kInvalidUserHandle, 2);
+    manager.reactor(0).broadcast(chat("carol: one"), kInvalidUserHandle, 1);
+    manager.reactor(0).broadcast(chat("bob: three"), kInvalidUserHandle, 3);
+
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::ChatMessageBroadcast), "carol: one");
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::ChatMessageBroadcast), "bob: two");
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::ChatMessageBroadcast), "bob: three");
+}
+
+TEST_F(TestServerClient, IntegrationResumeOnAnotherReactorMissesAndRepeatsNothing)
+{
+    ServerConfig config;
+    config.reactorCount = 2;
+    config.presenceInterval = std::chrono::milliseconds(0);
+    config.resume.window = std::chrono::seconds(60);
+    auto manager = std::make_unique<ClientManager>(config);
+
+    auto connect = [&](const std::string& name, size_t shard, const std::string& resume = "") {
+        int sockets[2] = {-1, -1};
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+            return -1;
+        }
+        timeval timeout{1, 0};
+        setsockopt(sockets[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (!resume.empty()) {
+            sendTo(sockets[1], MessageType::StreamResume, resume);
+        }
+        sendTo(sockets[1], MessageType::UserLogon, name);
+        manager->addConnectedClient(sockets[0], shard);
+        return sockets[1];
+    };
+
+    const int bob = connect("bob", 0);
+    const int carol = connect("carol", 0);
+    ASSERT_TRUE(readUntil(bob, MessageType::LoginSuccess).has_value());
+    ASSERT_TRUE(readUntil(carol, MessageType::LoginSuccess).has_value());
+    int alice = connect("alice", 1);
+    const std::optional<std::string> sync = readUntil(alice, MessageType::StreamSync);
+    ASSERT_TRUE(sync.has_value());
+    const std::string stream = sync->substr(0, sync->find(':'));
+
+    // bob chats without pause, throwing away what he is sent, until told
+    std::atomic<bool> stop(false);
+    std::thread chatter([&]() {
+        char discard[4096];
+        for (int i = 0; !stop.load(); ++i) {
+            sendTo(bob, MessageType::ChatMessageBroadcast, std::to_string(i));
+            while (recv(bob, discard, sizeof(discard), MSG_DONTWAIT) > 0) {}
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        sendTo(bob, MessageType::ChatMessageBroadcast, "end");
+    });
+
+    std::vector<std::string> received;
+    auto readChat = [&](size_t count) {
+        for (std::optional<std::string> chat; received.size() < count;) {
+            if (!(chat = readUntil(alice, MessageType::ChatMessageBroadcast))) {
+                return false;
+            }
+            received.push_back(*chat);
+        }
+        return true;
+    };
+    bool resumed = readChat(200);
+
+    // alice drops mid-conversation, and resumes on bob's reactor while her
+    // old one lags behind it
+    std::optional<std::string> resync;
+    if (resumed) {
+        close(alice);
+        std::optional<std::string> delta;
+        while ((delta = readUntil(carol, MessageType::PresenceDelta)) && !delta->ends_with("-alice")) {}
+        manager->reactor(1).post([]() { std::this_thread::sleep_for(std::chrono::milliseconds(300)); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        alice = connect("alice", 0, stream + ":" + std::to_string(received.size()));
+        resync = readUntil(alice, MessageType::StreamSync);
+        resumed = delta.has_value() && readChat(600);
+    }
+    stop = true;
+    while (resumed && received.back() != "bob: end") {
+        resumed = readChat(received.size() + 1);
+    }
+    chatter.join();
+    ASSERT_TRUE(resumed);
+    EXPECT_EQ(resync, stream + ":201");
+
+    // Every message once, in the order bob sent them
+    received.pop_back();
+    for (size_t i = 0; i < received.size(); ++i) {
+        ASSERT_EQ(received[i], "bob: " + std::to_string(i));
+    }
+
+    manager.reset();
+    close(alice);
+    close(bob);
+    close(carol);
+}
+
+TEST_F(TestServerClient, IntegrationClientResumesItsStreamAfterTheConnectionDrops)
+{
+    ServerConfig config;
+    config.reactorCount = 2;
+    config.presenceInterval = std::chrono::milliseconds(0);
+    config.resume.window = std::chrono::seconds(60);
+
+    // The server's end of each connection, in accept order, to cut one off
+    std::mutex acceptedMutex;
+    std::vector<int> accepted;
+    auto manager = std::make_unique<ClientManager>(config);
+    sockaddr_in address{};
+    const int listenSocket = listenOnLoopback(address);
+    ASSERT_NE(listenSocket, -1);
+    manager->reactor(0).addListener(listenSocket, [&](int clientSocket) {
+        {
+            std::lock_guard<std::mutex> lock(acceptedMutex);
+            accepted.push_back(clientSocket);
+        }
+        manager->addConnectedClient(clientSocket);
+    });
+
+    TestClient bob(address);
+    TestClient alice(address);
+    bob.client.logon("bob");
+    ASSERT_TRUE(bob.waitFor("users:"));
+    alice.client.logon("alice");
+    ASSERT_TRUE(alice.waitFor("users:bob"));
+    ASSERT_TRUE(bob.waitFor("+alice"));
+
+    bob.client.sendChatMessage("one");
+    bob.client.sendChatMessage("two");
+    ASSERT_TRUE(alice.waitFor("bob: two"));
+    const uint64_t stream = alice.client.streamId();
+    EXPECT_NE(stream, 0U);
+
+    // alice's connection drops under her, and bob goes on without her
+    {
+        std::lock_guard<std::mutex> lock(acceptedMutex);
+        ASSERT_EQ(accepted.size(), 2U);
+        ASSERT_EQ(shutdown(accepted[1], SHUT_RDWR), 0);
+    }
+    ASSERT_TRUE(bob.waitFor("-alice"));
+    bob.client.sendChatMessage("three");
+    bob.client.sendChatMessage("four");
+    ASSERT_TRUE(bob.waitFor("bob: four"));
+    for (int i = 0; i < 200 && alice.client.connected(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_FALSE(alice.client.connected());
+
+    // Logging on again picks the stream up where it broke off, then carries on live
+    alice.client.logon("alice");
+    ASSERT_TRUE(alice.waitFor("bob: four"));
+    bob.client.sendChatMessage("five");
+    ASSERT_TRUE(alice.waitFor("bob: five"));
+    EXPECT_EQ(alice.chat(), (std::vector<std::string>{"bob: one", "bob: two", "bob: three", "bob: four", "bob: five"}));
+    EXPECT_EQ(alice.client.streamId(), stream);
+    EXPECT_EQ(alice.client.streamSequence(), 5U);
+    EXPECT_EQ(alice.client.logonState(), SimpleIMClient::LogonState::Accepted);
+
+    alice.client.disconnectFromServer();
+    bob.client.disconnectFromServer();
+    manager.reset();
+}
+
+TEST_F(TestServerClient, IntegrationClientFollowsPresenceFromAPagedSnapshot)
+{
+    ServerConfig config;
+    config.reactorCount = 2;
+    config.presenceInterval = std::chrono::milliseconds(0);
+    auto manager = std::make_unique<ClientManager>(config);
+    sockaddr_in address{};
+    const int listenSocket = listenOnLoopback(address);
+    ASSERT_NE(listenSocket, -1);
+    manager->reactor(0).addListener(listenSocket, [&manager](int clientSocket) {
+        manager->addConnectedClient(clientSocket);
+    });
+
+    // A crowd whose names fill more than one snapshot page, logged on in order
+    constexpr size_t kCrowd = 200;
+    std::vector<std::string> crowd;
+    std::vector<int> crowdSockets;
+    std::string crowdList;
+    for (size_t i = 0; i < kCrowd; ++i) {
+        std::string name = "crowd" + std::to_string(i);
+        name.resize(100, '_');
+        int sockets[2] = {-1, -1};
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+        timeval timeout{1, 0};
+        setsockopt(sockets[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        const std::vector<uint8_t> logon = buildRawMessage(MessageType::UserLogon, name);
+        ASSERT_EQ(send(sockets[1], logon.data(), logon.size(), 0), static_cast<ssize_t>(logon.size()));
+        manager->addConnectedClient(sockets[0]);
+        char header[5];
+        ASSERT_EQ(recv(sockets[1], header, sizeof(header), MSG_WAITALL), 5);
+        ASSERT_EQ(static_cast<MessageType>(header[0]), MessageType::LoginSuccess);
+        crowdList += (crowdList.empty() ? "" : ",") + name;
+        crowd.push_back(std::move(name));
+        crowdSockets.push_back(sockets[1]);
+    }
+    ASSERT_GT(crowdList.size(), Presence::kDefaultPageBytes);
+
+    TestClient alice(address);
+    TestClient bob(address);
+    alice.client.logon("alice");
+    ASSERT_TRUE(alice.waitFor("users:" + crowdList));
+    bob.client.logon("bob");
+    ASSERT_TRUE(bob.waitFor("users:" + crowdList + ",alice"));
+    ASSERT_TRUE(alice.waitFor("+bob"));
+
+    // Half the crowd leaves, then bob
+    for (size_t i = 0; i < kCrowd; i += 2) {
+        close(crowdSockets[i]);
+        crowdSockets[i] = -1;
+    }
+    for (size_t i = 0; i < kCrowd; i += 2) {
+        ASSERT_TRUE(alice.waitFor("-" + crowd[i])) << crowd[i];
+    }
+    bob.client.disconnectFromServer();
+    ASSERT_TRUE(alice.waitFor("-bob"));
+
+    // Each change once, and nothing about herself
+    std::vector<std::string> events = alice.events();
+    EXPECT_EQ(events.size(), 1 + 1 + kCrowd / 2 + 1);
+    std::sort(events.begin(), events.end());
+    EXPECT_EQ(std::adjacent_find(events.begin(), events.end()), events.end());
+    EXPECT_EQ(std::count(events.begin(), events.end(), "+alice"), 0);
+
+    alice.client.disconnectFromServer();
+    manager.reset();
+    for (const int socket : crowdSockets) {
+        if (socket != -1) {
+            close(socket);
+        }
+    }
+}
+
+TEST_F(TestServerClient, IntegrationClientSendsAsSoonAsAMessageIsQueued)
+{
+    ServerConfig config;
+    config.reactorCount = 1;
+    auto manager = std::make_unique<ClientManager>(config);
+    sockaddr_in address{};
+    const int listenSocket = listenOnLoopback(address);
+    ASSERT_NE(listenSocket, -1);
+    manager->reactor(0).addListener(listenSocket, [&manager](int clientSocket) {
+        manager->addConnectedClient(clientSocket);
+    });
+
+    TestClient alice(address);
+    TestClient bob(address);
+    alice.client.logon("alice");
+    ASSERT_TRUE(alice.waitFor("users:"));
+    bob.client.logon("bob");
+    ASSERT_TRUE(alice.waitFor("+bob"));
+
+    // One at a time from an idle client: each goes out when queued, not
+    // when a poll next comes round
+    constexpr int kPings = 50;
+    const auto started = std::chrono::steady_clock::now();
+    for (int i = 0; i < kPings; ++i) {
+        alice.client.sendChatMessage("ping" + std::to_string(i));
+        ASSERT_TRUE(bob.waitFor("alice: ping" + std::to_string(i)));
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(1));
+
+    // A burst leaves in as few writes as the socket allows, still in order
+    constexpr int kBurst = 1000;
+    for (int i = 0; i < kBurst; ++i) {
+        alice.client.sendChatMessage("burst" + std::to_string(i));
+    }
+    ASSERT_TRUE(bob.waitFor("alice: burst" + std::to_string(kBurst - 1)));
+    const std::vector<std::string> chat = bob.chat();
+    ASSERT_EQ(chat.size(), static_cast<size_t>(kPings + kBurst));
+    for (int i = 0; i < kBurst; ++i) {
+        ASSERT_EQ(chat[kPings + i], "alice: burst" + std::to_string(i));
+    }
+
+    alice.client.disconnectFromServer();
+    bob.client.disconnectFromServer();
+    manager.reset();
+}
+
+TEST_F(TestServerClient, IntegrationLogonStormIsAnnouncedInBatches)
+{
+    ServerConfig config;
+    config.reactorCount = 1;
+    config.presenceInterval = std::chrono::milliseconds(500);
+    ClientManager manager(config);
+
+    ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogon, "alice")));
+    manager.addConnectedClient(m_sockets[0]);
+
+    // Everyone logs on inside one window, one of them leaving again
+    constexpr int kUsers = 20;
+    std::vector<int> peers;
+    for (int i = 0; i < kUsers; ++i) {
+        int sockets[2] = {-1, -1};
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+        const std::vector<uint8_t> logon = buildRawMessage(MessageType::UserLogon, "user" + std::to_string(i));
+        ASSERT_EQ(send(sockets[1], logon.data(), logon.size(), 0), static_cast<ssize_t>(logon.size()));
+        manager.addConnectedClient(sockets[0]);
+        peers.push_back(sockets[1]);
+    }
+    const auto loggedOn = [&manager]() { return manager.getConnectedUsernames().size(); };
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (loggedOn() != kUsers + 1 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(loggedOn(), static_cast<size_t>(kUsers + 1));
+    close(peers.back());
+    peers.pop_back();
+
+    // alice gets her snapshot, then the whole storm as one delta
+    std::vector<std::pair<MessageType, std::string>> frames;
+    while (frames.empty() || frames.back().first != MessageType::PresenceDelta) {
+        std::optional<MessageHeader> header = recvHeader();
+        ASSERT_TRUE(header.has_value());
+        std::vector<char> payload(header->length);
+        ASSERT_TRUE(recvPayload(payload));
+        frames.emplace_back(header->type, std::string(payload.begin(), payload.end()));
+    }
+
+    ASSERT_EQ(frames.size(), 3U);
+    EXPECT_EQ(frames[1].first, MessageType::PresenceSnapshot);
+    std::string expected = "1:+alice";
+    for (int i = 0; i < kUsers - 1; ++i) {
+        expected += ",+user" + std::to_string(i);
+    }
+    EXPECT_EQ(frames[2].second, expected);
+
+    for (int fd : peers) {
+        close(fd);
+    }
+}
+
+TEST_F(TestServerClient, IntegrationBroadcastsFollowLogonsAndLeaves)
+{
+    ServerConfig config;
+    config.reactorCount = 1;
+    // Unbatched, so every leave is announced rather than cancelling its join
+    config.presenceInterval = std::chrono::milliseconds(0);
+    ClientManager manager(config);
+
+    // A storm of logons ahead of alice's first message
+    constexpr size_t kPeers = 16;
+    std::vector<std::array<int, 2>> peers(kPeers);
+    for (size_t i = 0; i < kPeers; ++i) {
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, peers[i].data()), 0);
+        timeval timeout{1, 0};
+        ASSERT_EQ(setsockopt(peers[i][1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)), 0);
+        ASSERT_TRUE(sendTo(peers[i][1], MessageType::UserLogon, "user" + std::to_string(i)));
+        manager.addConnectedClient(peers[i][0]);
+    }
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::UserLogon, "alice"));
+    manager.addConnectedClient(m_sockets[0]);
+    for (const auto& peer : peers) {
+        ASSERT_TRUE(readUntil(peer[1], MessageType::LoginSuccess).has_value());
+    }
+    ASSERT_TRUE(readUntil(m_sockets[1], MessageType::LoginSuccess).has_value());
+
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::ChatMessageBroadcast, "hello"));
+    for (const auto& peer : peers) {
+        EXPECT_EQ(readUntil(peer[1], MessageType::ChatMessageBroadcast), "alice: hello");
+    }
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::ChatMessageBroadcast), "alice: hello");
+
+    // Half of them leave; the rest still hear alice and the leavers cost nothing
+    for (size_t i = 0; i < kPeers; i += 2) {
+        close(peers[i][1]);
+        peers[i][1] = -1;
+    }
+    size_t leaves = 0;
+    while (leaves < kPeers / 2) {
+        const std::optional<std::string> delta = readUntil(m_sockets[1], MessageType::PresenceDelta);
+        ASSERT_TRUE(delta.has_value());
+        for (size_t at = delta->find("-user"); at != std::string::npos; at = delta->find("-user", at + 1)) {
+            ++leaves;
+        }
+    }
+    ASSERT_TRUE(sendTo(m_sockets[1], MessageType::ChatMessageBroadcast, "still here?"));
+    for (size_t i = 1; i < kPeers; i += 2) {
+        EXPECT_EQ(readUntil(peers[i][1], MessageType::ChatMessageBroadcast), "alice: still here?");
+    }
+    EXPECT_EQ(readUntil(m_sockets[1], MessageType::ChatMessageBroadcast), "alice: still here?");
+
+    for (const auto& peer : peers) {
+        if (peer[1] != -1) {
+            close(peer[1]);
+        }
+    }
+}
+
+TEST_F(TestServerClient, IntegrationStalledLogonTimesOutWithoutBlockingOthers)
+{
+    ServerConfig config;
+    config.reactorCount = 1;
+    config.handshakeTimeout = std::chrono::milliseconds(100);
+    ClientManager manager(config);
+
+    // A peer that connects and never sends its UserLogon
+    int stalledSockets[2] = {-1, -1};
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, stalledSockets), 0);
+    timeval timeout{1, 0};
+    ASSERT_EQ(setsockopt(stalledSockets[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)), 0);
+    manager.addConnectedClient(stalledSockets[0]);
+
+    // Logons behind it on the same reactor still complete straight away
+    const auto start = std::chrono::steady_clock::now();
+    manager.addConnectedClient(m_sockets[0]);
+    ASSERT_TRUE(sendRaw(buildRawMessage(MessageType::UserLogon, "alice")));
+
+    std::optional<MessageHeader> loginHeader = recvHeader();
+    ASSERT_TRUE(loginHeader.has_value());
+    EXPECT_EQ(loginHeader->type, MessageType::LoginSuccess);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, config.handshakeTimeout);
+
+    // The stalled peer is told why and then disconnected
+    char headerBuffer[5];
+    ASSERT_EQ(recv(stalledSockets[1], headerBuffer, sizeof(headerBuffer), MSG_WAITALL), 5);
+    EXPECT_EQ(static_cast<MessageType>(headerBuffer[0]), MessageType::LoginFailure);
+    uint32_t length = 0;
+    std::memcpy(&length, &headerBuffer[1], sizeof(length));
+    std::string reason(ntohl(length), '\0');
+    ASSERT_EQ(recv(stalledSockets[1], reason.data(), reason.size(), MSG_WAITALL), static_cast<ssize_t>(reason.size()));
+    EXPECT_EQ(reason, "Logon timed out");
+    EXPECT_EQ(recv(stalledSockets[1], headerBuffer, sizeof(headerBuffer), 0), 0);
+
+    EXPECT_EQ(manager.getConnectedUsernames(), std::vector<std::string>{"alice"});
+    close(stalledSockets[1]);
+}
+
+TEST_F(TestServerClient, IntegrationListenerRefusesConnectionsWhileOutOfDescriptors)
+{
+    ServerConfig config;
+    config.reactorCount = 1;
+    ClientManager manager(config);
+    if (std::string(manager.reactor(0).backendName()) != "epoll") {
+        GTEST_SKIP() << "io_uring accepts are not held to a limit lowered after the ring is set up";
+    }
+
+    sockaddr_in address{};
+    const int listenSocket = listenOnLoopback(address);
+    ASSERT_NE(listenSocket, -1);
+
+    // Sockets for every peer up front: the test shares the server's descriptor table
+    constexpr size_t kPeers = 8;
+    constexpr size_t kAcceptable = 2;
+    int peers[kPeers];
+    for (int& peer : peers) {
+        peer = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        ASSERT_NE(peer, -1);
+        timeval timeout{1, 0};
+        ASSERT_EQ(setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)), 0);
+    }
+
+    // Listening, with the reactor's own descriptors opened, before the limit drops
+    manager.reactor(0).addListener(listenSocket, [&manager](int clientSocket) {
+        manager.addConnectedClient(clientSocket, 0);
+    });
+    std::promise<void> listening;
+    manager.reactor(0).post([&listening]() { listening.set_value(); });
+    ASSERT_EQ(listening.get_future().wait_for(std::chrono::seconds(1)), std::future_status::ready);
+
+    // Leave room for exactly kAcceptable more descriptors
+    const int lowestFree = dup(peers[0]);
+    ASSERT_NE(lowestFree, -1);
+    close(lowestFree);
+    rlimit original{};
+    ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &original), 0);
+    rlimit lowered = original;
+    lowered.rlim_cur = static_cast<rlim_t>(lowestFree) + kAcceptable;
+    ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &lowered), 0);
+    struct RestoreLimit {
+        rlimit limit;
+        ~RestoreLimit() { setrlimit(RLIMIT_NOFILE, &limit); }
+    } restore{original};
+
+    for (int peer : peers) {
+        ASSERT_EQ(connect(peer, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+    }
+
+    // Peers past the limit are closed at once rather than left in the backlog
+    char byte = 0;
+    for (size_t i = kAcceptable; i < kPeers; ++i) {
+        EXPECT_EQ(recv(peers[i], &byte, 1, 0), 0) << "peer " << i;
+    }
+
+    // and those accepted before it still log on
+    for (size_t i = 0; i < kAcceptable; ++i) {
+        Message logon(MessageType::UserLogon, "user" + std::to_string(i));
+        const std::vector<uint8_t> bytes = logon.to_bytes();
+        ASSERT_EQ(send(peers[i], bytes.data(), bytes.size(), 0), static_cast<ssize_t>(bytes.size()));
+        char header[5];
+        ASSERT_EQ(recv(peers[i], header, sizeof(header), MSG_WAITALL), 5);
+        EXPECT_EQ(static_cast<MessageType>(header[0]), MessageType::LoginSuccess);
+    }
+
+    // Once descriptors free up the listener accepts again
+    for (int peer : peers) {
+        close(peer);
+    }
+    setrlimit(RLIMIT_NOFILE, &original);
+    const int latePeer = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT_NE(latePeer, -1);
+    timeval timeout{1, 0};
+    ASSERT_EQ(setsockopt(latePeer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)), 0);
+    ASSERT_EQ(connect(latePeer, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+    const std::vector<uint8_t> bytes = Message(MessageType::UserLogon, "late").to_bytes();
+    ASSERT_EQ(send(latePeer, bytes.data(), bytes.size(), 0), static_cast<ssize_t>(bytes.size()));
+    char header[5];
+    ASSERT_EQ(recv(latePeer, header, sizeof(header), MSG_WAITALL), 5);
+    EXPECT_EQ(static_cast<MessageType>(header[0]), MessageType::LoginSuccess);
+    close(latePeer);
+}